@@ -0,0 +1,195 @@
+/*
+ * Wakeups per accepted connection with many epoll sets on one listener
+ *
+ * Every worker thread has an epoll set of its own with the same
+ * listening socket in it, as a pre-forked server would.  A client then
+ * makes connections one at a time; the workers accept until EAGAIN.
+ *
+ * A worker woken for a connection another one has taken already usually
+ * goes back to sleep inside epoll_wait(), so the wakeups are counted as
+ * the voluntary context switches of the workers during the run.  How
+ * often epoll_wait() returned, and how often for nothing, is printed
+ * as well.
+ *
+ * Without EPOLLEXCLUSIVE every connection wakes every idle worker; with
+ * it there should be about one wakeup per connection.
+ *
+ * Compile by:
+ *
+ * gcc -O2 -o exclusive-wakeup-bench exclusive-wakeup-bench.c -lpthread
+ *
+ * Usage: exclusive-wakeup-bench [-w workers] [-c connections] [-n]
+ *	-n: add the listener without EPOLLEXCLUSIVE, for comparison
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1 << 28)
+#endif
+
+struct worker {
+	pthread_t thread;
+	unsigned long switches;
+	unsigned long wakeups;
+	unsigned long empty;
+} __attribute__((aligned(64)));
+
+static int listen_fd;
+static int stop_pipe[2];
+static int exclusive = 1;
+static volatile unsigned long total_accepted;
+static pthread_barrier_t ready;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void *worker_fn(void *arg)
+{
+	struct worker *w = arg;
+	struct epoll_event ev;
+	struct rusage start, end;
+	int epfd, fd, n;
+
+	epfd = epoll_create(1);
+	if (epfd < 0)
+		die("epoll_create");
+	ev.events = EPOLLIN | (exclusive ? EPOLLEXCLUSIVE : 0);
+	ev.data.fd = listen_fd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, listen_fd, &ev) < 0)
+		die("epoll_ctl");
+	ev.events = EPOLLIN;
+	ev.data.fd = stop_pipe[0];
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, stop_pipe[0], &ev) < 0)
+		die("epoll_ctl");
+	pthread_barrier_wait(&ready);
+	getrusage(RUSAGE_THREAD, &start);
+
+	for (;;) {
+		n = epoll_wait(epfd, &ev, 1, -1);
+		if (n <= 0)
+			continue;
+		if (ev.data.fd == stop_pipe[0])
+			break;
+		w->wakeups++;
+		n = 0;
+		while ((fd = accept(listen_fd, NULL, NULL)) >= 0) {
+			close(fd);
+			n++;
+		}
+		if (!n)
+			w->empty++;
+		__sync_fetch_and_add(&total_accepted, n);
+	}
+	getrusage(RUSAGE_THREAD, &end);
+	/* Not counting the wakeup to stop */
+	w->switches = end.ru_nvcsw - start.ru_nvcsw - 1;
+	close(epfd);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	unsigned long switches = 0, wakeups = 0, empty = 0;
+	int nr_workers = 64, nr_conns = 10000;
+	struct worker *workers;
+	struct timeval start, end;
+	double secs;
+	int c, i, fd;
+
+	while ((c = getopt(argc, argv, "w:c:n")) != -1) {
+		switch (c) {
+		case 'w':
+			nr_workers = atoi(optarg);
+			break;
+		case 'c':
+			nr_conns = atoi(optarg);
+			break;
+		case 'n':
+			exclusive = 0;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-w workers] "
+				"[-c connections] [-n]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nr_workers < 1 || nr_conns < 1)
+		return 1;
+
+	listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (listen_fd < 0)
+		die("socket");
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    listen(listen_fd, 1024) < 0 ||
+	    getsockname(listen_fd, (struct sockaddr *)&addr, &len) < 0)
+		die("listen");
+	fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+	if (pipe(stop_pipe) < 0)
+		die("pipe");
+
+	workers = calloc(nr_workers, sizeof(*workers));
+	if (!workers)
+		die("calloc");
+	pthread_barrier_init(&ready, NULL, nr_workers + 1);
+	for (i = 0; i < nr_workers; i++)
+		if (pthread_create(&workers[i].thread, NULL, worker_fn,
+				   &workers[i]))
+			die("pthread_create");
+	pthread_barrier_wait(&ready);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr_conns; i++) {
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0)
+			die("socket");
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+			die("connect");
+		close(fd);
+	}
+	while (total_accepted < nr_conns)
+		usleep(1000);
+	gettimeofday(&end, NULL);
+
+	if (write(stop_pipe[1], "", 1) != 1)
+		die("write");
+	for (i = 0; i < nr_workers; i++) {
+		pthread_join(workers[i].thread, NULL);
+		switches += workers[i].switches;
+		wakeups += workers[i].wakeups;
+		empty += workers[i].empty;
+	}
+
+	secs = (end.tv_sec - start.tv_sec) +
+		(end.tv_usec - start.tv_usec) / 1000000.0;
+	printf("%d workers, %s, %d connections in %.2fs\n", nr_workers,
+		exclusive ? "EPOLLEXCLUSIVE" : "shared wakeups", nr_conns, secs);
+	printf("wakeups: %lu, %.2f per connection\n", switches,
+		(double)switches / nr_conns);
+	printf("epoll_wait returns: %lu, %.2f per connection, %lu (%.1f%%) "
+		"found nothing to accept\n", wakeups,
+		(double)wakeups / nr_conns, empty,
+		wakeups ? 100.0 * empty / wakeups : 0.0);
+	return 0;
+}
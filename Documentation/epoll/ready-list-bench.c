@@ -0,0 +1,195 @@
+/*
+ * epoll ready list throughput: events/s versus fds and cpus
+ *
+ * All the fds are eventfds in a single epoll set, edge triggered.
+ * Producer threads, one per cpu by default, keep writing to their
+ * share of the fds, so that every write goes through ep_poll_callback()
+ * on the cpu of its producer, all of them on the same ready list.  The
+ * consumer threads harvest the events with epoll_wait().
+ *
+ * Printed are the events harvested per second, the average batch that
+ * one epoll_wait() returned, and the writes per second, which is the
+ * rate of ready list insertions attempted.  Run it for a range of fd
+ * and producer counts to see how the ready list scales, e.g.:
+ *
+ *	for p in 1 2 4 8 16; do ./ready-list-bench -f 100000 -p $p; done
+ *
+ * Compile by:
+ *
+ * gcc -O2 -o ready-list-bench ready-list-bench.c -lpthread
+ *
+ * Usage: ready-list-bench [-f fds] [-p producers] [-c consumers]
+ *			   [-b maxevents] [-t seconds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+struct thread {
+	pthread_t thread;
+	int first, last;	/* Producer's share of the fds */
+	unsigned long count;	/* Writes or harvested events */
+	unsigned long calls;	/* epoll_wait() calls that returned events */
+} __attribute__((aligned(64)));
+
+static int epfd;
+static int *fds;
+static int maxevents = 64;
+static volatile int stop;
+static pthread_barrier_t ready;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void *producer_fn(void *arg)
+{
+	struct thread *t = arg;
+	uint64_t one = 1;
+	int i;
+
+	pthread_barrier_wait(&ready);
+	while (!stop) {
+		for (i = t->first; i < t->last; i++)
+			if (write(fds[i], &one, sizeof(one)) == sizeof(one))
+				t->count++;
+	}
+	return NULL;
+}
+
+static void *consumer_fn(void *arg)
+{
+	struct thread *t = arg;
+	struct epoll_event *events;
+	int n;
+
+	events = calloc(maxevents, sizeof(*events));
+	if (!events)
+		die("calloc");
+	pthread_barrier_wait(&ready);
+	while (!stop) {
+		n = epoll_wait(epfd, events, maxevents, 100);
+		if (n <= 0)
+			continue;
+		t->count += n;
+		t->calls++;
+	}
+	free(events);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	int nr_fds = 1000, nr_consumers = 1, seconds = 5;
+	int nr_producers = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned long events = 0, calls = 0, writes = 0;
+	struct thread *producers, *consumers;
+	struct epoll_event ev;
+	struct rlimit rlim;
+	struct timeval start, end;
+	double secs;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "f:p:c:b:t:")) != -1) {
+		switch (c) {
+		case 'f':
+			nr_fds = atoi(optarg);
+			break;
+		case 'p':
+			nr_producers = atoi(optarg);
+			break;
+		case 'c':
+			nr_consumers = atoi(optarg);
+			break;
+		case 'b':
+			maxevents = atoi(optarg);
+			break;
+		case 't':
+			seconds = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-f fds] [-p producers] "
+				"[-c consumers] [-b maxevents] [-t seconds]\n",
+				argv[0]);
+			return 1;
+		}
+	}
+	if (nr_fds < 1 || nr_producers < 1 || nr_consumers < 1 ||
+	    maxevents < 1 || seconds < 1)
+		return 1;
+	if (nr_producers > nr_fds)
+		nr_producers = nr_fds;
+
+	rlim.rlim_cur = rlim.rlim_max = nr_fds + 64;
+	if (setrlimit(RLIMIT_NOFILE, &rlim) < 0)
+		perror("setrlimit");
+
+	epfd = epoll_create(nr_fds);
+	if (epfd < 0)
+		die("epoll_create");
+	fds = calloc(nr_fds, sizeof(*fds));
+	if (!fds)
+		die("calloc");
+	for (i = 0; i < nr_fds; i++) {
+		fds[i] = eventfd(0, 0);
+		if (fds[i] < 0)
+			die("eventfd");
+		ev.events = EPOLLIN | EPOLLET;
+		ev.data.u32 = i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev) < 0)
+			die("epoll_ctl");
+	}
+
+	producers = calloc(nr_producers, sizeof(*producers));
+	consumers = calloc(nr_consumers, sizeof(*consumers));
+	if (!producers || !consumers)
+		die("calloc");
+	pthread_barrier_init(&ready, NULL, nr_producers + nr_consumers + 1);
+	for (i = 0; i < nr_consumers; i++)
+		if (pthread_create(&consumers[i].thread, NULL, consumer_fn,
+				   &consumers[i]))
+			die("pthread_create");
+	for (i = 0; i < nr_producers; i++) {
+		producers[i].first = (long)nr_fds * i / nr_producers;
+		producers[i].last = (long)nr_fds * (i + 1) / nr_producers;
+		if (pthread_create(&producers[i].thread, NULL, producer_fn,
+				   &producers[i]))
+			die("pthread_create");
+	}
+
+	pthread_barrier_wait(&ready);
+	gettimeofday(&start, NULL);
+	sleep(seconds);
+	stop = 1;
+	gettimeofday(&end, NULL);
+
+	for (i = 0; i < nr_producers; i++) {
+		pthread_join(producers[i].thread, NULL);
+		writes += producers[i].count;
+	}
+	for (i = 0; i < nr_consumers; i++) {
+		pthread_join(consumers[i].thread, NULL);
+		events += consumers[i].count;
+		calls += consumers[i].calls;
+	}
+
+	secs = (end.tv_sec - start.tv_sec) +
+		(end.tv_usec - start.tv_usec) / 1000000.0;
+	printf("%d fds, %d producers, %d consumers, maxevents %d\n",
+		nr_fds, nr_producers, nr_consumers, maxevents);
+	printf("events: %.0f/s, %.1f per epoll_wait; writes: %.0f/s\n",
+		events / secs, calls ? (double)events / calls : 0.0,
+		writes / secs);
+	return 0;
+}
@@ -0,0 +1,233 @@
+/*
+ * fault-bench: page faults from many threads against mmap/munmap
+ *
+ * Every thread faults in its own region one page at a time, drops the
+ * ptes with madvise(MADV_DONTNEED) and starts over, while another
+ * thread keeps mapping, touching and unmapping a page, taking mmap_sem
+ * for writing each time.  Faults which have to take mmap_sem queue up
+ * behind that thread and bounce the rwsem between the cpus; those done
+ * speculatively (see handle_speculative_fault()) do neither.
+ *
+ * The regions are anonymous memory, written to, or with -f a shared
+ * mapping of a file, read from once it is in the page cache: these are
+ * the two kinds of fault that can be handled without mmap_sem.  The
+ * faults per second are printed, and how many of them were speculative
+ * according to /proc/vmstat.
+ *
+ * Compile by:
+ *
+ * gcc -O2 -o fault-bench fault-bench.c -lpthread
+ *
+ * Usage: fault-bench [-t threads] [-s MB per thread] [-d seconds]
+ *		      [-f file] [-n]
+ *	-f: fault on a file of threads * MB, created if needed
+ *	-n: no mmap/munmap thread, for comparison
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+struct thread {
+	pthread_t thread;
+	char *region;
+	unsigned long faults;
+} __attribute__((aligned(64)));
+
+static unsigned long region_size = 64UL << 20;
+static int file_backed;
+static long page_size;
+static volatile int stop;
+static pthread_barrier_t ready;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(1);
+}
+
+static void *fault_fn(void *arg)
+{
+	struct thread *t = arg;
+	volatile char *p = t->region;
+	unsigned long off;
+	char sum = 0;
+
+	pthread_barrier_wait(&ready);
+	while (!stop) {
+		for (off = 0; off < region_size && !stop; off += page_size) {
+			if (file_backed)
+				sum += p[off];
+			else
+				p[off] = 1;
+			t->faults++;
+		}
+		if (madvise(t->region, region_size, MADV_DONTNEED))
+			die("madvise");
+	}
+	return (void *)(long)sum;
+}
+
+static unsigned long mmap_ops;
+
+static void *mmap_fn(void *arg)
+{
+	char *p;
+
+	pthread_barrier_wait(&ready);
+	while (!stop) {
+		p = mmap(NULL, page_size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			die("mmap");
+		*p = 1;
+		munmap(p, page_size);
+		mmap_ops++;
+	}
+	return NULL;
+}
+
+static unsigned long speculative_faults(void)
+{
+	unsigned long val = 0;
+	char name[64];
+	FILE *f;
+
+	f = fopen("/proc/vmstat", "r");
+	if (!f)
+		return 0;
+	while (fscanf(f, "%63s %lu", name, &val) == 2)
+		if (!strcmp(name, "pgfault_speculative"))
+			break;
+	if (strcmp(name, "pgfault_speculative"))
+		val = 0;
+	fclose(f);
+	return val;
+}
+
+/* Make the file big enough and get it into the page cache */
+static int open_file(const char *path, unsigned long size)
+{
+	char buf[65536];
+	unsigned long done;
+	int fd;
+
+	fd = open(path, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+		die(path);
+	memset(buf, 1, sizeof(buf));
+	for (done = 0; done < size; done += sizeof(buf))
+		if (pread(fd, buf, sizeof(buf), done) != sizeof(buf) &&
+		    pwrite(fd, buf, sizeof(buf), done) != sizeof(buf))
+			die("pwrite");
+	return fd;
+}
+
+int main(int argc, char *argv[])
+{
+	int nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	int seconds = 5, antagonist = 1, fd = -1;
+	const char *path = NULL;
+	unsigned long faults = 0, spec;
+	struct thread *threads;
+	pthread_t mmap_thread;
+	struct timeval start, end;
+	double secs;
+	int c, i;
+
+	while ((c = getopt(argc, argv, "t:s:d:f:n")) != -1) {
+		switch (c) {
+		case 't':
+			nr_threads = atoi(optarg);
+			break;
+		case 's':
+			region_size = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'd':
+			seconds = atoi(optarg);
+			break;
+		case 'f':
+			path = optarg;
+			file_backed = 1;
+			break;
+		case 'n':
+			antagonist = 0;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-t threads] "
+				"[-s MB per thread] [-d seconds] [-f file] "
+				"[-n]\n", argv[0]);
+			return 1;
+		}
+	}
+	if (nr_threads < 1 || !region_size || seconds < 1)
+		return 1;
+	page_size = sysconf(_SC_PAGESIZE);
+
+	if (file_backed)
+		fd = open_file(path, region_size * nr_threads);
+
+	threads = calloc(nr_threads, sizeof(*threads));
+	if (!threads)
+		die("calloc");
+	for (i = 0; i < nr_threads; i++) {
+		if (file_backed)
+			threads[i].region = mmap(NULL, region_size, PROT_READ,
+						 MAP_SHARED, fd,
+						 region_size * i);
+		else
+			threads[i].region = mmap(NULL, region_size,
+						 PROT_READ | PROT_WRITE,
+						 MAP_PRIVATE | MAP_ANONYMOUS,
+						 -1, 0);
+		if (threads[i].region == MAP_FAILED)
+			die("mmap");
+		/*
+		 * The anon_vma is set up by the first fault: do it here, so
+		 * that the measured faults can all go the speculative way.
+		 */
+		if (!file_backed)
+			threads[i].region[0] = 1;
+	}
+
+	pthread_barrier_init(&ready, NULL, nr_threads + antagonist + 1);
+	for (i = 0; i < nr_threads; i++)
+		if (pthread_create(&threads[i].thread, NULL, fault_fn,
+				   &threads[i]))
+			die("pthread_create");
+	if (antagonist && pthread_create(&mmap_thread, NULL, mmap_fn, NULL))
+		die("pthread_create");
+
+	spec = speculative_faults();
+	pthread_barrier_wait(&ready);
+	gettimeofday(&start, NULL);
+	sleep(seconds);
+	stop = 1;
+	gettimeofday(&end, NULL);
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(threads[i].thread, NULL);
+		faults += threads[i].faults;
+	}
+	if (antagonist)
+		pthread_join(mmap_thread, NULL);
+	spec = speculative_faults() - spec;
+
+	secs = (end.tv_sec - start.tv_sec) +
+		(end.tv_usec - start.tv_usec) / 1000000.0;
+	printf("%d threads, %s faults, %s\n", nr_threads,
+		file_backed ? "file read" : "anonymous write",
+		antagonist ? "with mmap/munmap" : "no mmap/munmap");
+	printf("faults: %.0f/s, %.0f/s per thread, %.1f%% speculative\n",
+		faults / secs, faults / secs / nr_threads,
+		faults ? 100.0 * spec / faults : 0.0);
+	if (antagonist)
+		printf("mmap/munmap: %.0f/s\n", mmap_ops / secs);
+	return 0;
+}
@@ -0,0 +1,185 @@
+/*
+ * fork-share-ptes-test: memory must come back after a shared pte table
+ *
+ * With /proc/sys/vm/fork_share_ptes set, a process maps and touches
+ * some anonymous memory and forks; neither process faults on it after
+ * the fork, so the pte tables stay shared until they exit.  This is
+ * done with the child exiting first, which leaves the parent as the
+ * last mm holding the read-only tables, and then with the parent
+ * exiting first.  Afterwards MemFree and SwapFree in /proc/meminfo
+ * must be back where they were, give or take some slack for the
+ * per-cpu page lists.
+ *
+ * It has to be run as root, as it sets fork_share_ptes for the test
+ * and restores it afterwards.
+ *
+ * Compile by:
+ *
+ * gcc -O2 -o fork-share-ptes-test fork-share-ptes-test.c
+ *
+ * Usage: fork-share-ptes-test [-s MB] [-i iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define SYSCTL "/proc/sys/vm/fork_share_ptes"
+
+static unsigned long size = 64UL << 20;
+
+static void die(const char *what)
+{
+	perror(what);
+	exit(2);
+}
+
+static int read_sysctl(void)
+{
+	FILE *f = fopen(SYSCTL, "r");
+	int val;
+
+	if (!f)
+		die(SYSCTL);
+	if (fscanf(f, "%d", &val) != 1)
+		val = 0;
+	fclose(f);
+	return val;
+}
+
+static void write_sysctl(int val)
+{
+	FILE *f = fopen(SYSCTL, "w");
+
+	if (!f)
+		die(SYSCTL);
+	fprintf(f, "%d\n", val);
+	fclose(f);
+}
+
+/* MemFree + SwapFree, in kB */
+static long free_kb(void)
+{
+	char line[128];
+	long val, sum = 0;
+	FILE *f;
+
+	sync();
+	usleep(100000);
+	f = fopen("/proc/meminfo", "r");
+	if (!f)
+		die("/proc/meminfo");
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "MemFree: %ld kB", &val) == 1 ||
+		    sscanf(line, "SwapFree: %ld kB", &val) == 1)
+			sum += val;
+	fclose(f);
+	return sum;
+}
+
+static void wait_for(pid_t pid)
+{
+	int status;
+
+	if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+	    WEXITSTATUS(status))
+		die("waitpid");
+}
+
+/*
+ * Runs in a process of its own, so that its exit is what gets
+ * measured: map, touch, fork, and let the child or us exit first.
+ */
+static void share_and_exit(int child_first)
+{
+	int pipefd[2];
+	pid_t pid;
+	char *p;
+	unsigned long off;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		die("mmap");
+	for (off = 0; off < size; off += getpagesize())
+		p[off] = 1;
+	if (pipe(pipefd) < 0)
+		die("pipe");
+
+	pid = fork();
+	if (pid < 0)
+		die("fork");
+	if (!pid) {
+		char c;
+
+		/* Outlive the parent: read() returns when it is gone */
+		close(pipefd[1]);
+		if (!child_first && read(pipefd[0], &c, 1) < 0)
+			_exit(1);
+		_exit(0);
+	}
+	if (child_first)
+		wait_for(pid);
+	_exit(0);
+}
+
+static int run(int child_first, int iterations)
+{
+	long before, after, slack = size >> 12;
+	pid_t pid;
+	int i;
+
+	before = free_kb();
+	for (i = 0; i < iterations; i++) {
+		pid = fork();
+		if (pid < 0)
+			die("fork");
+		if (!pid)
+			share_and_exit(child_first);
+		wait_for(pid);
+	}
+	/* An orphaned child exits when its pipe closes; give it time */
+	if (!child_first)
+		sleep(1);
+	after = free_kb();
+	printf("%s first: %ld kB lost after %d x %lu MB\n",
+		child_first ? "child" : "parent", before - after,
+		iterations, size >> 20);
+	return before - after > slack;
+}
+
+int main(int argc, char *argv[])
+{
+	int iterations = 4, old, failed;
+	int c;
+
+	while ((c = getopt(argc, argv, "s:i:")) != -1) {
+		switch (c) {
+		case 's':
+			size = strtoul(optarg, NULL, 0) << 20;
+			break;
+		case 'i':
+			iterations = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-s MB] [-i iterations]\n",
+				argv[0]);
+			return 2;
+		}
+	}
+	if (!size || iterations < 1)
+		return 2;
+
+	old = read_sysctl();
+	write_sysctl(1);
+	failed = run(1, iterations);
+	failed |= run(0, iterations);
+	write_sysctl(old);
+
+	printf("%s\n", failed ? "FAIL" : "PASS");
+	return failed;
+}
@@ -90,6 +90,7 @@ ia64_elf32_init (struct pt_regs *regs)
 	vma = kmem_cache_zalloc(vm_area_cachep, GFP_KERNEL);
 	if (vma) {
 		vma->vm_mm = current->mm;
+		INIT_LIST_HEAD(&vma->anon_vma_chain);
 		vma->vm_start = IA32_GDT_OFFSET;
 		vma->vm_end = vma->vm_start + PAGE_SIZE;
 		vma->vm_page_prot = PAGE_SHARED;
@@ -115,6 +116,7 @@ ia64_elf32_init (struct pt_regs *regs)
 	vma = kmem_cache_zalloc(vm_area_cachep, GFP_KERNEL);
 	if (vma) {
 		vma->vm_mm = current->mm;
+		INIT_LIST_HEAD(&vma->anon_vma_chain);
 		vma->vm_start = IA32_GATE_OFFSET;
 		vma->vm_end = vma->vm_start + PAGE_SIZE;
 		vma->vm_page_prot = PAGE_COPY_EXEC;
@@ -139,6 +141,7 @@ ia64_elf32_init (struct pt_regs *regs)
 	vma = kmem_cache_zalloc(vm_area_cachep, GFP_KERNEL);
 	if (vma) {
 		vma->vm_mm = current->mm;
+		INIT_LIST_HEAD(&vma->anon_vma_chain);
 		vma->vm_start = IA32_LDT_OFFSET;
 		vma->vm_end = vma->vm_start + PAGE_ALIGN(IA32_LDT_ENTRIES*IA32_LDT_ENTRY_SIZE);
 		vma->vm_page_prot = PAGE_SHARED;
@@ -118,6 +118,7 @@ ia64_init_addr_space (void)
 	vma = kmem_cache_zalloc(vm_area_cachep, GFP_KERNEL);
 	if (vma) {
 		vma->vm_mm = current->mm;
+		INIT_LIST_HEAD(&vma->anon_vma_chain);
 		vma->vm_start = current->thread.rbs_bot & PAGE_MASK;
 		vma->vm_end = vma->vm_start + PAGE_SIZE;
 		vma->vm_flags = VM_DATA_DEFAULT_FLAGS|VM_GROWSUP|VM_ACCOUNT;
@@ -136,6 +137,7 @@ ia64_init_addr_space (void)
 		vma = kmem_cache_zalloc(vm_area_cachep, GFP_KERNEL);
 		if (vma) {
 			vma->vm_mm = current->mm;
+			INIT_LIST_HEAD(&vma->anon_vma_chain);
 			vma->vm_end = PAGE_SIZE;
 			vma->vm_page_prot = __pgprot(pgprot_val(PAGE_READONLY) | _PAGE_MA_NAT);
 			vma->vm_flags = VM_READ | VM_MAYREAD | VM_IO | VM_RESERVED;
@@ -182,4 +182,35 @@ static inline unsigned long __cmpxchg_local(volatile void *ptr,
 	cmpxchg_local((ptr), (o), (n));					\
 })
 
+/*
+ * Compare and exchange the two adjacent words at ptr, which must be
+ * 16 byte aligned.  Like cmpxchg_local() this is only atomic against
+ * the local cpu.  Returns 1 if the exchange happened.
+ *
+ * CMPXCHG16B is missing on some early 64 bit cpus, so callers have to
+ * check system_has_cmpxchg_double() first.
+ */
+#define __HAVE_ARCH_CMPXCHG_DOUBLE 1
+#define system_has_cmpxchg_double()	cpu_has_cx16
+
+struct __cmpxchg_double {
+	unsigned long w[2];
+};
+
+static inline int cmpxchg_double_local(volatile void *ptr,
+				       unsigned long o1, unsigned long o2,
+				       unsigned long n1, unsigned long n2)
+{
+	char ret;
+
+	asm volatile("cmpxchg16b %1\n\t"
+		     "sete %0"
+		     : "=qm" (ret),
+		       "+m" (*(volatile struct __cmpxchg_double *)ptr),
+		       "+a" (o1), "+d" (o2)
+		     : "b" (n1), "c" (n2)
+		     : "memory");
+	return ret;
+}
+
 #endif /* _ASM_X86_CMPXCHG_64_H */
@@ -166,9 +166,11 @@ static inline int pud_bad(pud_t pud)
 	return (pud_val(pud) & ~(PTE_PFN_MASK | _PAGE_USER)) != _KERNPG_TABLE;
 }
 
+/* A pte table shared by fork is mapped read-only, see pmd_ptes_shared() */
 static inline int pmd_bad(pmd_t pmd)
 {
-	return (pmd_val(pmd) & ~(PTE_PFN_MASK | _PAGE_USER)) != _KERNPG_TABLE;
+	return (pmd_val(pmd) & ~(PTE_PFN_MASK | _PAGE_USER | _PAGE_RW)) !=
+		(_KERNPG_TABLE & ~_PAGE_RW);
 }
 
 #define pte_none(x)	(!pte_val((x)))
@@ -225,6 +227,71 @@ static inline int pud_large(pud_t pte)
 #define pfn_pmd(nr, prot) (__pmd(((nr) << PAGE_SHIFT) | pgprot_val((prot))))
 #define pmd_pfn(x)  ((pmd_val((x)) & __PHYSICAL_MASK) >> PAGE_SHIFT)
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * A transparent huge pmd maps HPAGE_PMD_NR independent anonymous pages
+ * with one PSE entry.  The software bit keeps it apart from hugetlbfs
+ * and kernel large mappings, which never go through the split paths.
+ */
+static inline int pmd_trans_huge(pmd_t pmd)
+{
+	return (pmd_val(pmd) & (_PAGE_PRESENT | _PAGE_PSE | _PAGE_TRANS_HUGE)) ==
+		(_PAGE_PRESENT | _PAGE_PSE | _PAGE_TRANS_HUGE);
+}
+
+/* Turn the pte for the first subpage into the pmd mapping all of them */
+static inline pmd_t pte_mktranshuge(pte_t pte)
+{
+	return __pmd(pte_val(pte) | _PAGE_PSE | _PAGE_TRANS_HUGE);
+}
+
+/* The pte mapping subpage @index of a transparent huge pmd */
+static inline pte_t pmd_trans_huge_pte(pmd_t pmd, unsigned long index)
+{
+	return __pte((pmd_val(pmd) & ~(_PAGE_PSE | _PAGE_TRANS_HUGE)) +
+		     (index << PAGE_SHIFT));
+}
+
+#define pmd_trans_huge_page(pmd)	\
+	(pfn_to_page((pmd_val((pmd)) & PTE_PFN_MASK) >> PAGE_SHIFT))
+
+static inline int pmdp_trans_huge_test_and_clear_young(pmd_t *pmdp)
+{
+	if (!(pmd_val(*pmdp) & _PAGE_ACCESSED))
+		return 0;
+	return test_and_clear_bit(_PAGE_BIT_ACCESSED,
+				  (unsigned long *)&pmdp->pmd);
+}
+
+static inline void pmdp_trans_huge_set_wrprotect(pmd_t *pmdp)
+{
+	clear_bit(_PAGE_BIT_RW, (unsigned long *)&pmdp->pmd);
+}
+#endif
+
+#ifdef CONFIG_FORK_SHARE_PTES
+/*
+ * A pte table that fork left shared between parent and child is mapped
+ * without _PAGE_RW at the pmd level, whatever its ptes say, so that any
+ * write through it faults and can unshare it.
+ */
+static inline int pmd_ptes_shared(pmd_t pmd)
+{
+	return (pmd_val(pmd) & (_PAGE_PRESENT | _PAGE_PSE | _PAGE_RW)) ==
+		_PAGE_PRESENT;
+}
+
+static inline pmd_t pmd_wrprotect(pmd_t pmd)
+{
+	return __pmd(pmd_val(pmd) & ~_PAGE_RW);
+}
+
+static inline pmd_t pmd_mkwrite(pmd_t pmd)
+{
+	return __pmd(pmd_val(pmd) | _PAGE_RW);
+}
+#endif
+
 #define pte_to_pgoff(pte) ((pte_val((pte)) & PHYSICAL_PAGE_MASK) >> PAGE_SHIFT)
 #define pgoff_to_pte(off) ((pte_t) { .pte = ((off) << PAGE_SHIFT) |	\
 					    _PAGE_FILE })
@@ -140,14 +140,32 @@ static void __init setup_cpu_pda_map(void)
  */
 void __init setup_per_cpu_areas(void)
 {
-	ssize_t size, old_size;
-	char *ptr;
+	ssize_t size;
 	int cpu;
+#ifndef CONFIG_HAVE_DYNAMIC_PER_CPU_AREA
+	ssize_t old_size;
+	char *ptr;
 	unsigned long align = 1;
+#endif
 
 	/* Setup cpu_pda map */
 	setup_cpu_pda_map();
 
+#ifdef CONFIG_HAVE_DYNAMIC_PER_CPU_AREA
+	/*
+	 * The units of the first percpu chunk are the per cpu areas; the
+	 * room left in them goes to modules and dynamic percpu data.
+	 */
+	size = pcpu_embed_first_chunk(__per_cpu_end - __per_cpu_start,
+				      PERCPU_MODULE_RESERVE +
+				      PERCPU_DYNAMIC_RESERVE);
+	printk(KERN_INFO "PERCPU: Allocated %zd bytes of per cpu data\n",
+			  size * num_possible_cpus());
+
+	for_each_possible_cpu(cpu)
+		per_cpu_offset(cpu) = (char *)pcpu_base_addr + cpu * size -
+					__per_cpu_start;
+#else
 	/* Copy section for each CPU (we discard the original) */
 	old_size = PERCPU_ENOUGH_ROOM;
 	align = max_t(unsigned long, PAGE_SIZE, align);
@@ -182,6 +200,7 @@ void __init setup_per_cpu_areas(void)
 		per_cpu_offset(cpu) = ptr - __per_cpu_start;
 		memcpy(ptr, __per_cpu_start, __per_cpu_end - __per_cpu_start);
 	}
+#endif
 
 	printk(KERN_DEBUG "NR_CPUS: %d, nr_cpu_ids: %d, nr_node_ids %d\n",
 		NR_CPUS, nr_cpu_ids, nr_node_ids);
@@ -669,6 +669,20 @@ void __kprobes do_page_fault(struct pt_regs *regs, unsigned long error_code)
 	if (unlikely(in_atomic() || !mm))
 		goto bad_area_nosemaphore;
 
+	/*
+	 * Not-present faults from user mode may be resolved without
+	 * mmap_sem; anything the speculative path can't handle, or which
+	 * raced with a change to the mapping, is retried below.
+	 */
+	if ((error_code & (PF_USER | PF_PROT | PF_RSVD)) == PF_USER
+#ifdef CONFIG_X86_32
+	    && !v8086_mode(regs)
+#endif
+	    && !handle_speculative_fault(mm, address, error_code & PF_WRITE)) {
+		tsk->min_flt++;
+		return;
+	}
+
 again:
 	/*
 	 * When running in the kernel we expect faults to occur only to
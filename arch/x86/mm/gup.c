@@ -74,8 +74,12 @@ static noinline int gup_pte_range(pmd_t pmd, unsigned long addr,
 	pte_t *ptep;
 
 	mask = _PAGE_PRESENT|_PAGE_USER;
-	if (write)
+	if (write) {
+		/* the ptes may be writable, but not so a shared table */
+		if (pmd_ptes_shared(pmd))
+			return 0;
 		mask |= _PAGE_RW;
+	}
 
 	ptep = pte_offset_map(&pmd, addr);
 	do {
@@ -137,6 +141,38 @@ static noinline int gup_huge_pmd(pmd_t pmd, unsigned long addr,
 	return 1;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * The pages behind a transparent huge pmd are not a compound page, each
+ * one carries its own reference count.  They cannot be freed under us:
+ * splitting leaves them mapped, and unmapping flushes the TLB, which
+ * waits for us to reenable interrupts.
+ */
+static noinline int gup_trans_huge_pmd(pmd_t pmd, unsigned long addr,
+		unsigned long end, int write, struct page **pages, int *nr)
+{
+	unsigned long mask;
+	struct page *page;
+
+	mask = _PAGE_PRESENT|_PAGE_USER;
+	if (write)
+		mask |= _PAGE_RW;
+	if ((pmd_val(pmd) & mask) != mask)
+		return 0;
+
+	page = pmd_trans_huge_page(pmd) + ((addr & ~PMD_MASK) >> PAGE_SHIFT);
+	do {
+		VM_BUG_ON(page_count(page) == 0);
+		get_page(page);
+		pages[*nr] = page;
+		(*nr)++;
+		page++;
+	} while (addr += PAGE_SIZE, addr != end);
+
+	return 1;
+}
+#endif
+
 static int gup_pmd_range(pud_t pud, unsigned long addr, unsigned long end,
 		int write, struct page **pages, int *nr)
 {
@@ -150,6 +186,14 @@ static int gup_pmd_range(pud_t pud, unsigned long addr, unsigned long end,
 		next = pmd_addr_end(addr, end);
 		if (pmd_none(pmd))
 			return 0;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		if (pmd_trans_huge(pmd)) {
+			if (!gup_trans_huge_pmd(pmd, addr, next, write,
+						pages, nr))
+				return 0;
+			continue;
+		}
+#endif
 		if (unlikely(pmd_large(pmd))) {
 			if (!gup_huge_pmd(pmd, addr, next, write, pages, nr))
 				return 0;
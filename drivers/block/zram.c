@@ -0,0 +1,631 @@
+/*
+ * Compressed RAM block device driver.
+ *
+ * Like brd, this keeps the contents of its devices in RAM, but each page
+ * is stored LZO-compressed, and pages that are all zeroes are not stored
+ * at all.  It is meant to be used as swap, or for small scratch
+ * filesystems, on machines where RAM is scarcer than CPU time.
+ *
+ * As swap, a device gets told through ->swap_slot_free_notify when a
+ * swap slot is freed, and drops its copy of the page right away, rather
+ * than holding on to it until the slot is written again.  Discard
+ * requests from filesystems free storage in the same way.
+ */
+
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/blkdev.h>
+#include <linux/bio.h>
+#include <linux/genhd.h>
+#include <linux/highmem.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/swap.h>
+#include <linux/lzo.h>
+#include <linux/buffer_head.h> /* invalidate_bh_lrus() */
+
+#define SECTOR_SHIFT		9
+#define PAGE_SECTORS_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
+#define PAGE_SECTORS		(1 << PAGE_SECTORS_SHIFT)
+
+/*
+ * Pages that do not compress to less than this are stored as they are:
+ * the compressed copy would save too little to be worth decompressing.
+ */
+#define ZRAM_MAX_COMPR_SIZE	(PAGE_SIZE / 4 * 3)
+
+/* zram_slot flags */
+#define ZRAM_ZERO		(1 << 0)	/* all zeroes, nothing stored */
+#define ZRAM_UNCOMPRESSED	(1 << 1)	/* ->data is a struct page */
+
+/*
+ * One zram_slot per page of the device.  ->data is NULL for a page never
+ * written (or freed since), which reads back as zeroes too.
+ */
+struct zram_slot {
+	void		*data;
+	unsigned short	size;		/* compressed size in bytes */
+	unsigned short	flags;
+};
+
+struct zram_stats {
+	u64	num_reads;
+	u64	num_writes;
+	u64	failed_writes;
+	u64	notify_free;
+	u64	discards;
+	u64	pages_zero;		/* zero-filled pages, not stored */
+	u64	pages_stored;		/* pages stored, compressed or not */
+	u64	pages_expand;		/* pages stored uncompressed */
+	u64	compr_size;		/* their total (compressed) size */
+	u64	mem_used;		/* memory allocated to hold them */
+};
+
+struct zram_device {
+	int			zram_number;
+	struct request_queue	*zram_queue;
+	struct gendisk		*zram_disk;
+
+	/*
+	 * zram_lock protects the slots, the stats and zram_rbuffer.  Reads
+	 * decompress under it; it is also taken from swap_entry_free(),
+	 * which holds swap_lock.
+	 */
+	spinlock_t		zram_lock;
+	struct zram_slot	*zram_slots;
+	unsigned long		zram_nr_pages;
+	struct zram_stats	stats;
+	void			*zram_rbuffer;	/* for partial page reads */
+
+	/* zram_mutex serializes writers over the buffers below */
+	struct mutex		zram_mutex;
+	void			*zram_wrkmem;	/* LZO work memory */
+	void			*zram_cbuffer;	/* compressed output */
+	void			*zram_wbuffer;	/* for partial page writes */
+};
+
+static int zram_major;
+static struct zram_device **zram_devices;
+
+/*
+ * Free whatever slot index holds.  Called with zram_lock held.
+ */
+static void zram_free_slot(struct zram_device *zram, unsigned long index)
+{
+	struct zram_slot *slot = &zram->zram_slots[index];
+
+	if (slot->flags & ZRAM_ZERO) {
+		zram->stats.pages_zero--;
+	} else if (slot->data) {
+		if (slot->flags & ZRAM_UNCOMPRESSED) {
+			__free_page(slot->data);
+			zram->stats.pages_expand--;
+			zram->stats.mem_used -= PAGE_SIZE;
+		} else {
+			zram->stats.mem_used -= ksize(slot->data);
+			kfree(slot->data);
+		}
+		zram->stats.pages_stored--;
+		zram->stats.compr_size -= slot->size;
+	}
+	slot->data = NULL;
+	slot->size = 0;
+	slot->flags = 0;
+}
+
+static void zram_free_slots(struct zram_device *zram)
+{
+	unsigned long index;
+
+	spin_lock(&zram->zram_lock);
+	for (index = 0; index < zram->zram_nr_pages; index++)
+		zram_free_slot(zram, index);
+	spin_unlock(&zram->zram_lock);
+}
+
+/*
+ * Fill the PAGE_SIZE buffer dst with page index of the device.  Called
+ * with zram_lock held.
+ */
+static void zram_read_slot(struct zram_device *zram, unsigned long index,
+			   void *dst)
+{
+	struct zram_slot *slot = &zram->zram_slots[index];
+	size_t dlen = PAGE_SIZE;
+	void *src;
+	int ret;
+
+	if (!slot->data) {
+		memset(dst, 0, PAGE_SIZE);
+		return;
+	}
+
+	if (slot->flags & ZRAM_UNCOMPRESSED) {
+		src = kmap_atomic(slot->data, KM_USER1);
+		memcpy(dst, src, PAGE_SIZE);
+		kunmap_atomic(src, KM_USER1);
+		return;
+	}
+
+	ret = lzo1x_decompress_safe(slot->data, slot->size, dst, &dlen);
+	BUG_ON(ret != LZO_E_OK || dlen != PAGE_SIZE);
+}
+
+static int zram_page_zero_filled(void *ptr)
+{
+	unsigned long *p = ptr;
+	unsigned int i;
+
+	for (i = 0; i < PAGE_SIZE / sizeof(*p); i++)
+		if (p[i])
+			return 0;
+	return 1;
+}
+
+static void zram_read_bvec(struct zram_device *zram, struct bio_vec *bvec,
+			   unsigned long index, unsigned int offset)
+{
+	void *mem;
+
+	mem = kmap_atomic(bvec->bv_page, KM_USER0);
+	spin_lock(&zram->zram_lock);
+	zram->stats.num_reads++;
+	if (bvec->bv_len == PAGE_SIZE) {
+		zram_read_slot(zram, index, mem + bvec->bv_offset);
+	} else {
+		zram_read_slot(zram, index, zram->zram_rbuffer);
+		memcpy(mem + bvec->bv_offset, zram->zram_rbuffer + offset,
+		       bvec->bv_len);
+	}
+	spin_unlock(&zram->zram_lock);
+	flush_dcache_page(bvec->bv_page);
+	kunmap_atomic(mem, KM_USER0);
+}
+
+/*
+ * Store page index of the device from the PAGE_SIZE of data at offset in
+ * page, which must stay unchanged meanwhile.  Called under zram_mutex.
+ */
+static int zram_write_slot(struct zram_device *zram, unsigned long index,
+			   struct page *page, unsigned int offset)
+{
+	struct zram_slot new = { .data = NULL };
+	size_t clen;
+	void *src, *dst;
+	int ret;
+
+	src = kmap_atomic(page, KM_USER0);
+	if (zram_page_zero_filled(src + offset)) {
+		kunmap_atomic(src, KM_USER0);
+		new.flags = ZRAM_ZERO;
+		goto install;
+	}
+	ret = lzo1x_1_compress(src + offset, PAGE_SIZE, zram->zram_cbuffer,
+			       &clen, zram->zram_wrkmem);
+	kunmap_atomic(src, KM_USER0);
+	if (ret != LZO_E_OK)
+		return -EIO;
+
+	if (clen > ZRAM_MAX_COMPR_SIZE) {
+		new.data = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
+		if (!new.data)
+			return -ENOMEM;
+		new.size = PAGE_SIZE;
+		new.flags = ZRAM_UNCOMPRESSED;
+		src = kmap_atomic(page, KM_USER0);
+		dst = kmap_atomic(new.data, KM_USER1);
+		memcpy(dst, src + offset, PAGE_SIZE);
+		kunmap_atomic(dst, KM_USER1);
+		kunmap_atomic(src, KM_USER0);
+	} else {
+		new.data = kmalloc(clen, GFP_NOIO);
+		if (!new.data)
+			return -ENOMEM;
+		new.size = clen;
+		memcpy(new.data, zram->zram_cbuffer, clen);
+	}
+
+install:
+	spin_lock(&zram->zram_lock);
+	zram_free_slot(zram, index);
+	zram->zram_slots[index] = new;
+	if (new.flags & ZRAM_ZERO) {
+		zram->stats.pages_zero++;
+	} else {
+		zram->stats.pages_stored++;
+		zram->stats.compr_size += new.size;
+		if (new.flags & ZRAM_UNCOMPRESSED) {
+			zram->stats.pages_expand++;
+			zram->stats.mem_used += PAGE_SIZE;
+		} else
+			zram->stats.mem_used += ksize(new.data);
+	}
+	spin_unlock(&zram->zram_lock);
+	return 0;
+}
+
+static int zram_write_bvec(struct zram_device *zram, struct bio_vec *bvec,
+			   unsigned long index, unsigned int offset)
+{
+	struct page *page = bvec->bv_page;
+	unsigned int page_offset = bvec->bv_offset;
+	void *mem;
+	int err;
+
+	mutex_lock(&zram->zram_mutex);
+	if (bvec->bv_len != PAGE_SIZE) {
+		/* Merge the new data into the rest of the old page */
+		mem = kmap_atomic(bvec->bv_page, KM_USER0);
+		spin_lock(&zram->zram_lock);
+		zram_read_slot(zram, index, zram->zram_wbuffer);
+		spin_unlock(&zram->zram_lock);
+		memcpy(zram->zram_wbuffer + offset, mem + bvec->bv_offset,
+		       bvec->bv_len);
+		kunmap_atomic(mem, KM_USER0);
+		page = virt_to_page(zram->zram_wbuffer);
+		page_offset = 0;
+	}
+	err = zram_write_slot(zram, index, page, page_offset);
+
+	spin_lock(&zram->zram_lock);
+	zram->stats.num_writes++;
+	if (err)
+		zram->stats.failed_writes++;
+	spin_unlock(&zram->zram_lock);
+	mutex_unlock(&zram->zram_mutex);
+	return err;
+}
+
+/*
+ * Free the pages lying wholly inside a discarded range.
+ */
+static void zram_discard(struct zram_device *zram, sector_t sector,
+			 unsigned int size)
+{
+	unsigned long index, end;
+
+	index = (sector + PAGE_SECTORS - 1) >> PAGE_SECTORS_SHIFT;
+	end = (sector + (size >> SECTOR_SHIFT)) >> PAGE_SECTORS_SHIFT;
+
+	spin_lock(&zram->zram_lock);
+	zram->stats.discards++;
+	for (; index < end; index++)
+		zram_free_slot(zram, index);
+	spin_unlock(&zram->zram_lock);
+}
+
+static int zram_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct block_device *bdev = bio->bi_bdev;
+	struct zram_device *zram = bdev->bd_disk->private_data;
+	struct bio_vec *bvec;
+	sector_t sector;
+	int i, rw;
+	int err = -EIO;
+
+	sector = bio->bi_sector;
+	if (sector + (bio->bi_size >> SECTOR_SHIFT) >
+						get_capacity(bdev->bd_disk))
+		goto out;
+
+	if (bio_discard(bio)) {
+		zram_discard(zram, sector, bio->bi_size);
+		err = 0;
+		goto out;
+	}
+
+	rw = bio_rw(bio);
+	if (rw == READA)
+		rw = READ;
+
+	err = 0;
+	bio_for_each_segment(bvec, bio, i) {
+		unsigned long index = sector >> PAGE_SECTORS_SHIFT;
+		unsigned int offset = (sector & (PAGE_SECTORS-1)) << SECTOR_SHIFT;
+
+		/* Each segment must lie within one page of the device */
+		if (offset + bvec->bv_len > PAGE_SIZE) {
+			err = -EIO;
+			break;
+		}
+		if (rw == READ)
+			zram_read_bvec(zram, bvec, index, offset);
+		else
+			err = zram_write_bvec(zram, bvec, index, offset);
+		if (err)
+			break;
+		sector += bvec->bv_len >> SECTOR_SHIFT;
+	}
+
+out:
+	bio_endio(bio, err);
+
+	return 0;
+}
+
+/*
+ * Discards are handled by zram_make_request(), but the block layer only
+ * passes them on to queues that have this set.
+ */
+static int zram_prepare_discard(struct request_queue *q, struct request *req)
+{
+	return 0;
+}
+
+/*
+ * Called from swap_entry_free(), with swap_lock held, when swap slot index
+ * of a zram device in use as swap is freed.
+ */
+static void zram_swap_slot_free_notify(struct block_device *bdev,
+				       unsigned long index)
+{
+	struct zram_device *zram = bdev->bd_disk->private_data;
+
+	spin_lock(&zram->zram_lock);
+	zram_free_slot(zram, index);
+	zram->stats.notify_free++;
+	spin_unlock(&zram->zram_lock);
+}
+
+static int zram_ioctl(struct block_device *bdev, fmode_t mode,
+			unsigned int cmd, unsigned long arg)
+{
+	int error;
+	struct zram_device *zram = bdev->bd_disk->private_data;
+
+	if (cmd != BLKFLSBUF)
+		return -ENOTTY;
+
+	/*
+	 * As with brd, BLKFLSBUF frees the device's whole contents.
+	 */
+	mutex_lock(&bdev->bd_mutex);
+	error = -EBUSY;
+	if (bdev->bd_openers <= 1) {
+		invalidate_bh_lrus();
+		truncate_inode_pages(bdev->bd_inode->i_mapping, 0);
+		zram_free_slots(zram);
+		error = 0;
+	}
+	mutex_unlock(&bdev->bd_mutex);
+
+	return error;
+}
+
+static struct block_device_operations zram_fops = {
+	.owner =		THIS_MODULE,
+	.locked_ioctl =		zram_ioctl,
+	.swap_slot_free_notify = zram_swap_slot_free_notify,
+};
+
+/*
+ * Statistics, in /sys/block/zram<N>/
+ */
+static ssize_t zram_show_stat(struct device *dev, char *buf, size_t offset)
+{
+	struct zram_device *zram = dev_to_disk(dev)->private_data;
+	u64 val;
+
+	spin_lock(&zram->zram_lock);
+	val = *(u64 *)((void *)&zram->stats + offset);
+	spin_unlock(&zram->zram_lock);
+	return sprintf(buf, "%llu\n", (unsigned long long)val);
+}
+
+#define ZRAM_STAT_ATTR(_name, _field)					\
+static ssize_t _name##_show(struct device *dev,				\
+			    struct device_attribute *attr, char *buf)	\
+{									\
+	return zram_show_stat(dev, buf,					\
+			      offsetof(struct zram_stats, _field));	\
+}									\
+static DEVICE_ATTR(_name, S_IRUGO, _name##_show, NULL)
+
+ZRAM_STAT_ATTR(num_reads, num_reads);
+ZRAM_STAT_ATTR(num_writes, num_writes);
+ZRAM_STAT_ATTR(failed_writes, failed_writes);
+ZRAM_STAT_ATTR(notify_free, notify_free);
+ZRAM_STAT_ATTR(discards, discards);
+ZRAM_STAT_ATTR(zero_pages, pages_zero);
+ZRAM_STAT_ATTR(stored_pages, pages_stored);
+ZRAM_STAT_ATTR(uncompressed_pages, pages_expand);
+ZRAM_STAT_ATTR(compr_data_size, compr_size);
+ZRAM_STAT_ATTR(mem_used_total, mem_used);
+
+static ssize_t orig_data_size_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	struct zram_device *zram = dev_to_disk(dev)->private_data;
+	u64 val;
+
+	spin_lock(&zram->zram_lock);
+	val = zram->stats.pages_stored << PAGE_SHIFT;
+	spin_unlock(&zram->zram_lock);
+	return sprintf(buf, "%llu\n", (unsigned long long)val);
+}
+static DEVICE_ATTR(orig_data_size, S_IRUGO, orig_data_size_show, NULL);
+
+static struct attribute *zram_attrs[] = {
+	&dev_attr_num_reads.attr,
+	&dev_attr_num_writes.attr,
+	&dev_attr_failed_writes.attr,
+	&dev_attr_notify_free.attr,
+	&dev_attr_discards.attr,
+	&dev_attr_zero_pages.attr,
+	&dev_attr_stored_pages.attr,
+	&dev_attr_uncompressed_pages.attr,
+	&dev_attr_orig_data_size.attr,
+	&dev_attr_compr_data_size.attr,
+	&dev_attr_mem_used_total.attr,
+	NULL,
+};
+
+static struct attribute_group zram_attr_group = {
+	.attrs = zram_attrs,
+};
+
+/*
+ * And now the modules code and kernel interface.
+ */
+static int num_devices = 1;
+static unsigned long zram_size;
+module_param(num_devices, int, 0);
+MODULE_PARM_DESC(num_devices, "Number of zram devices");
+module_param(zram_size, ulong, 0);
+MODULE_PARM_DESC(zram_size, "Size of each zram device in kbytes "
+		 "(default: a quarter of RAM)");
+MODULE_LICENSE("GPL");
+
+static void zram_free(struct zram_device *zram)
+{
+	if (zram->zram_slots) {
+		zram_free_slots(zram);
+		vfree(zram->zram_slots);
+	}
+	kfree(zram->zram_wrkmem);
+	free_pages((unsigned long)zram->zram_cbuffer, 1);
+	free_page((unsigned long)zram->zram_rbuffer);
+	free_page((unsigned long)zram->zram_wbuffer);
+	kfree(zram);
+}
+
+static struct zram_device *zram_alloc(int i, unsigned long nr_pages)
+{
+	struct zram_device *zram;
+	struct gendisk *disk;
+
+	zram = kzalloc(sizeof(*zram), GFP_KERNEL);
+	if (!zram)
+		goto out;
+	zram->zram_number	= i;
+	spin_lock_init(&zram->zram_lock);
+	mutex_init(&zram->zram_mutex);
+
+	zram->zram_nr_pages = nr_pages;
+	zram->zram_slots = vmalloc(nr_pages * sizeof(struct zram_slot));
+	zram->zram_wrkmem = kmalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+	/* lzo can overrun its output a little on incompressible data */
+	zram->zram_cbuffer = (void *)__get_free_pages(GFP_KERNEL, 1);
+	zram->zram_rbuffer = (void *)__get_free_page(GFP_KERNEL);
+	zram->zram_wbuffer = (void *)__get_free_page(GFP_KERNEL);
+	if (!zram->zram_slots || !zram->zram_wrkmem || !zram->zram_cbuffer ||
+	    !zram->zram_rbuffer || !zram->zram_wbuffer)
+		goto out_free_dev;
+	memset(zram->zram_slots, 0, nr_pages * sizeof(struct zram_slot));
+
+	zram->zram_queue = blk_alloc_queue(GFP_KERNEL);
+	if (!zram->zram_queue)
+		goto out_free_dev;
+	blk_queue_make_request(zram->zram_queue, zram_make_request);
+	blk_queue_max_sectors(zram->zram_queue, 1024);
+	blk_queue_hardsect_size(zram->zram_queue, PAGE_SIZE);
+	blk_queue_bounce_limit(zram->zram_queue, BLK_BOUNCE_ANY);
+	blk_queue_set_discard(zram->zram_queue, zram_prepare_discard);
+
+	disk = zram->zram_disk = alloc_disk(1);
+	if (!disk)
+		goto out_free_queue;
+	disk->major		= zram_major;
+	disk->first_minor	= i;
+	disk->fops		= &zram_fops;
+	disk->private_data	= zram;
+	disk->queue		= zram->zram_queue;
+	sprintf(disk->disk_name, "zram%d", i);
+	set_capacity(disk, nr_pages << PAGE_SECTORS_SHIFT);
+
+	return zram;
+
+out_free_queue:
+	blk_cleanup_queue(zram->zram_queue);
+out_free_dev:
+	zram_free(zram);
+out:
+	return NULL;
+}
+
+static void zram_del_one(struct zram_device *zram)
+{
+	sysfs_remove_group(&disk_to_dev(zram->zram_disk)->kobj,
+			   &zram_attr_group);
+	del_gendisk(zram->zram_disk);
+	put_disk(zram->zram_disk);
+	blk_cleanup_queue(zram->zram_queue);
+	zram_free(zram);
+}
+
+static int __init zram_init(void)
+{
+	unsigned long nr_pages;
+	int i;
+
+	if (num_devices < 1 || num_devices > 1 << MINORBITS)
+		return -EINVAL;
+
+	if (zram_size)
+		nr_pages = zram_size >> (PAGE_SHIFT - 10);
+	else
+		nr_pages = totalram_pages / 4;
+	if (!nr_pages)
+		return -EINVAL;
+
+	zram_devices = kcalloc(num_devices, sizeof(*zram_devices), GFP_KERNEL);
+	if (!zram_devices)
+		return -ENOMEM;
+
+	zram_major = register_blkdev(0, "zram");
+	if (zram_major < 0) {
+		kfree(zram_devices);
+		return -EIO;
+	}
+
+	for (i = 0; i < num_devices; i++) {
+		zram_devices[i] = zram_alloc(i, nr_pages);
+		if (!zram_devices[i])
+			goto out_free;
+	}
+
+	/* point of no return */
+
+	for (i = 0; i < num_devices; i++) {
+		struct gendisk *disk = zram_devices[i]->zram_disk;
+
+		add_disk(disk);
+		if (sysfs_create_group(&disk_to_dev(disk)->kobj,
+				       &zram_attr_group))
+			printk(KERN_WARNING "zram: %s: cannot create "
+			       "statistics in sysfs\n", disk->disk_name);
+	}
+
+	printk(KERN_INFO "zram: %d device(s) of %luk\n",
+	       num_devices, nr_pages << (PAGE_SHIFT - 10));
+	return 0;
+
+out_free:
+	while (--i >= 0) {
+		put_disk(zram_devices[i]->zram_disk);
+		blk_cleanup_queue(zram_devices[i]->zram_queue);
+		zram_free(zram_devices[i]);
+	}
+	unregister_blkdev(zram_major, "zram");
+	kfree(zram_devices);
+
+	return -ENOMEM;
+}
+
+static void __exit zram_exit(void)
+{
+	int i;
+
+	for (i = 0; i < num_devices; i++)
+		zram_del_one(zram_devices[i]);
+
+	unregister_blkdev(zram_major, "zram");
+	kfree(zram_devices);
+}
+
+module_init(zram_init);
+module_exit(zram_exit);
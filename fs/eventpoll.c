@@ -45,16 +45,21 @@
  *
  * 1) epmutex (mutex)
  * 2) ep->mtx (mutex)
- * 3) ep->lock (spinlock)
+ * 3) ep->lock (rwlock)
  *
  * The acquire order is the one listed above, from 1 to 3.
- * We need a spinlock (ep->lock) because we manipulate objects
+ * We need a spinning lock (ep->lock) because we manipulate objects
  * from inside the poll callback, that might be triggered from
  * a wake_up() that in turn might be called from IRQ context.
  * So we can't sleep inside the poll callback and hence we need
- * a spinlock. During the event transfer loop (from kernel to
- * user space) we could end up sleeping due a copy_to_user(), so
- * we need a lock that will allow us to sleep. This lock is a
+ * a spinning lock. The poll callback only takes ep->lock for reading,
+ * and adds items to the ready list (or to ep->ovflist) with atomic
+ * operations, so that many CPUs can report events on the same epoll
+ * set concurrently. Everybody else that walks or modifies the ready
+ * list takes ep->lock for writing.
+ * During the event transfer loop (from kernel to user space) we
+ * could end up sleeping due a copy_to_user(), so we need a lock
+ * that will allow us to sleep. This lock is a
  * mutex (ep->mtx). It is acquired during the event transfer loop,
  * during epoll_ctl(EPOLL_CTL_DEL) and during eventpoll_release_file().
  * Then we also need a global mutex to serialize eventpoll_release_file()
@@ -90,7 +95,14 @@
 #endif /* #if DEBUG_EPI != 0 */
 
 /* Epoll private bits inside the event mask */
-#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET)
+#define EP_PRIVATE_BITS (EPOLLONESHOT | EPOLLET | EPOLLEXCLUSIVE)
+
+/* Event bits that can be combined with EPOLLEXCLUSIVE */
+#define EP_EXCLUSIVE_OK_BITS (POLLIN | POLLOUT | POLLRDNORM | POLLWRNORM | \
+			      POLLERR | POLLHUP | EPOLLET | EPOLLEXCLUSIVE)
+
+/* Number of events copied to userspace with a single copy */
+#define EP_SEND_BATCH 16
 
 /* Maximum number of poll wake up nests we are allowing */
 #define EP_MAX_POLLWAKE_NESTS 4
@@ -173,8 +185,11 @@ struct epitem {
  * interface.
  */
 struct eventpoll {
-	/* Protect the this structure access */
-	spinlock_t lock;
+	/*
+	 * Protect the this structure access. Taken for reading by the poll
+	 * callback, and for writing by the ready list consumers.
+	 */
+	rwlock_t lock;
 
 	/*
 	 * This mutex is used to ensure that files are not removed
@@ -184,7 +199,10 @@ struct eventpoll {
 	 */
 	struct mutex mtx;
 
-	/* Wait queue used by sys_epoll_wait() */
+	/*
+	 * Wait queue used by sys_epoll_wait(). Its entries are added and
+	 * removed with ep->lock held for writing.
+	 */
 	wait_queue_head_t wq;
 
 	/* Wait queue used by file->poll() */
@@ -424,10 +442,10 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 
 	rb_erase(&epi->rbn, &ep->rbr);
 
-	spin_lock_irqsave(&ep->lock, flags);
+	write_lock_irqsave(&ep->lock, flags);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
+	write_unlock_irqrestore(&ep->lock, flags);
 
 	/* At this point it is safe to free the eventpoll item */
 	kmem_cache_free(epi_cache, epi);
@@ -506,10 +524,10 @@ static unsigned int ep_eventpoll_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &ep->poll_wait, wait);
 
 	/* Check our condition */
-	spin_lock_irqsave(&ep->lock, flags);
+	read_lock_irqsave(&ep->lock, flags);
 	if (!list_empty(&ep->rdllist))
 		pollflags = POLLIN | POLLRDNORM;
-	spin_unlock_irqrestore(&ep->lock, flags);
+	read_unlock_irqrestore(&ep->lock, flags);
 
 	return pollflags;
 }
@@ -575,7 +593,7 @@ static int ep_alloc(struct eventpoll **pep)
 	if (unlikely(!ep))
 		goto free_uid;
 
-	spin_lock_init(&ep->lock);
+	rwlock_init(&ep->lock);
 	mutex_init(&ep->mtx);
 	init_waitqueue_head(&ep->wq);
 	init_waitqueue_head(&ep->poll_wait);
@@ -627,6 +645,59 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
 	return epir;
 }
 
+/*
+ * Adds a new entry to the tail of the list in a lockless way, i.e.
+ * multiple CPUs are allowed to call this function concurrently, as long
+ * as they hold "ep->lock" for reading and nobody else touches the list.
+ * Returns zero if the entry has just been added to the list by another
+ * CPU, since an item can sit only once inside the ready list.
+ */
+static inline int list_add_tail_lockless(struct list_head *new,
+					 struct list_head *head)
+{
+	struct list_head *prev;
+
+	/*
+	 * This is a simple 'new->next = head' operation, but cmpxchg() is
+	 * used in order to detect that the same element has just been added
+	 * to the list from another CPU: the winner observes new->next == new.
+	 */
+	if (cmpxchg(&new->next, new, head) != new)
+		return 0;
+
+	/*
+	 * The ->next of the new element must be set to head before the tail
+	 * pointer is swapped, and xchg() implies a full memory barrier. Only
+	 * then the old tail is linked to the new element.
+	 */
+	prev = xchg(&head->prev, new);
+	prev->next = new;
+	new->prev = prev;
+
+	return 1;
+}
+
+/*
+ * Chains an item to "ep->ovflist" in a lockless way, with the same rules
+ * of list_add_tail_lockless(). Returns zero if the item is already chained.
+ */
+static inline int ep_chain_ovflist_lockless(struct eventpoll *ep,
+					    struct epitem *epi)
+{
+	/* Fast preliminary check */
+	if (epi->next != EP_UNACTIVE_PTR)
+		return 0;
+
+	/* Check that the same item has not just been chained by another CPU */
+	if (cmpxchg(&epi->next, EP_UNACTIVE_PTR, NULL) != EP_UNACTIVE_PTR)
+		return 0;
+
+	/* Atomically exchange the head of the chain */
+	epi->next = xchg(&ep->ovflist, epi);
+
+	return 1;
+}
+
 /*
  * This is the callback that is passed to the wait queue wakeup
  * machanism. It is called by the stored file descriptors when they
@@ -634,7 +705,7 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
  */
 static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
-	int pwake = 0;
+	int pwake = 0, ewake = 0;
 	unsigned long flags;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
@@ -642,7 +713,12 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	DNPRINTK(3, (KERN_INFO "[%p] eventpoll: poll_callback(%p) epi=%p ep=%p\n",
 		     current, epi->ffd.file, epi, ep));
 
-	spin_lock_irqsave(&ep->lock, flags);
+	/*
+	 * Only the read side of the lock is taken here, so concurrent
+	 * callbacks on the same eventpoll do not serialize on each other.
+	 * The ready list and the ovflist are updated with atomic operations.
+	 */
+	read_lock_irqsave(&ep->lock, flags);
 
 	/*
 	 * If the event mask does not contain any poll(2) event, we consider the
@@ -659,38 +735,45 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * semantics). All the events that happens during that period of time are
 	 * chained in ep->ovflist and requeued later on.
 	 */
-	if (unlikely(ep->ovflist != EP_UNACTIVE_PTR)) {
-		if (epi->next == EP_UNACTIVE_PTR) {
-			epi->next = ep->ovflist;
-			ep->ovflist = epi;
-		}
+	if (unlikely(ACCESS_ONCE(ep->ovflist) != EP_UNACTIVE_PTR)) {
+		ep_chain_ovflist_lockless(ep, epi);
 		goto out_unlock;
 	}
 
 	/* If this file is already in the ready list we exit soon */
-	if (ep_is_linked(&epi->rdllink))
-		goto is_linked;
-
-	list_add_tail(&epi->rdllink, &ep->rdllist);
+	if (!ep_is_linked(&epi->rdllink))
+		list_add_tail_lockless(&epi->rdllink, &ep->rdllist);
 
-is_linked:
 	/*
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
-	 * wait list.
+	 * wait list. We do not own ep->wq.lock here, since ep->lock is only
+	 * held for reading, so use the locking variant of wake_up().
 	 */
-	if (waitqueue_active(&ep->wq))
-		wake_up_locked(&ep->wq);
+	if (waitqueue_active(&ep->wq)) {
+		wake_up(&ep->wq);
+		ewake = 1;
+	}
 	if (waitqueue_active(&ep->poll_wait))
 		pwake++;
 
 out_unlock:
-	spin_unlock_irqrestore(&ep->lock, flags);
+	read_unlock_irqrestore(&ep->lock, flags);
 
 	/* We have to call this outside the lock */
 	if (pwake)
 		ep_poll_safewake(&psw, &ep->poll_wait);
 
-	return 1;
+	/*
+	 * Our wait queue entry is an exclusive one when EPOLLEXCLUSIVE is set,
+	 * and the return value tells the wakeup code if this entry consumed
+	 * the wakeup. If nobody is sleeping inside epoll_wait() on this
+	 * eventpoll, let the wakeup move on to the next exclusive waiter,
+	 * so that the event is not stuck on a busy epoll set.
+	 */
+	if (!(epi->event.events & EPOLLEXCLUSIVE))
+		ewake = 1;
+
+	return ewake;
 }
 
 /*
@@ -707,7 +790,10 @@ static void ep_ptable_queue_proc(struct file *file, wait_queue_head_t *whead,
 		init_waitqueue_func_entry(&pwq->wait, ep_poll_callback);
 		pwq->whead = whead;
 		pwq->base = epi;
-		add_wait_queue(whead, &pwq->wait);
+		if (epi->event.events & EPOLLEXCLUSIVE)
+			add_wait_queue_exclusive(whead, &pwq->wait);
+		else
+			add_wait_queue(whead, &pwq->wait);
 		list_add_tail(&pwq->llink, &epi->pwqlist);
 		epi->nwait++;
 	} else {
@@ -796,7 +882,7 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	ep_rbtree_insert(ep, epi);
 
 	/* We have to drop the new item inside our item list to keep track of it */
-	spin_lock_irqsave(&ep->lock, flags);
+	write_lock_irqsave(&ep->lock, flags);
 
 	/* If the file is already "ready" we drop it inside the ready list */
 	if ((revents & event->events) && !ep_is_linked(&epi->rdllink)) {
@@ -809,7 +895,7 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 			pwake++;
 	}
 
-	spin_unlock_irqrestore(&ep->lock, flags);
+	write_unlock_irqrestore(&ep->lock, flags);
 
 	atomic_inc(&ep->user->epoll_watches);
 
@@ -831,10 +917,10 @@ error_unregister:
 	 * list, since that is used/cleaned only inside a section bound by "mtx".
 	 * And ep_insert() is called with "mtx" held.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
+	write_lock_irqsave(&ep->lock, flags);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
+	write_unlock_irqrestore(&ep->lock, flags);
 
 	kmem_cache_free(epi_cache, epi);
 
@@ -865,7 +951,7 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	 */
 	revents = epi->ffd.file->f_op->poll(epi->ffd.file, NULL);
 
-	spin_lock_irqsave(&ep->lock, flags);
+	write_lock_irqsave(&ep->lock, flags);
 
 	/* Copy the data member from inside the lock */
 	epi->event.data = event->data;
@@ -885,7 +971,7 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 				pwake++;
 		}
 	}
-	spin_unlock_irqrestore(&ep->lock, flags);
+	write_unlock_irqrestore(&ep->lock, flags);
 
 	/* We have to call this outside the lock */
 	if (pwake)
@@ -894,14 +980,51 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	return 0;
 }
 
+/*
+ * Copies a batch of harvested events to userspace with a single copy, and
+ * then updates the items that generated them. If the copy fails, the items
+ * are put back at the head of "txlist", so that their events are not lost.
+ * Must be called with "mtx" held.
+ */
+static int ep_send_batch(struct eventpoll *ep, struct epoll_event __user *uevent,
+			 struct epoll_event *evbuf, struct epitem **evepi,
+			 int nbatch, struct list_head *txlist)
+{
+	int i;
+	struct epitem *epi;
+
+	if (__copy_to_user(uevent, evbuf, nbatch * sizeof(struct epoll_event))) {
+		for (i = nbatch - 1; i >= 0; i--)
+			list_add(&evepi[i]->rdllink, txlist);
+		return -EFAULT;
+	}
+
+	for (i = 0; i < nbatch; i++) {
+		epi = evepi[i];
+		/*
+		 * At this point, noone can insert into ep->rdllist besides
+		 * us. The epoll_ctl() callers are locked out by us holding
+		 * "mtx" and the poll callback will queue them in ep->ovflist.
+		 */
+		if (epi->event.events & EPOLLONESHOT)
+			epi->event.events &= EP_PRIVATE_BITS;
+		else if (!(epi->event.events & EPOLLET))
+			list_add_tail(&epi->rdllink, &ep->rdllist);
+	}
+
+	return 0;
+}
+
 static int ep_send_events(struct eventpoll *ep, struct epoll_event __user *events,
 			  int maxevents)
 {
-	int eventcnt, error = -EFAULT, pwake = 0;
+	int eventcnt, nbatch = 0, error = -EFAULT, pwake = 0;
 	unsigned int revents;
 	unsigned long flags;
 	struct epitem *epi, *nepi;
 	struct list_head txlist;
+	struct epoll_event evbuf[EP_SEND_BATCH];
+	struct epitem *evepi[EP_SEND_BATCH];
 
 	INIT_LIST_HEAD(&txlist);
 
@@ -918,18 +1041,18 @@ static int ep_send_events(struct eventpoll *ep, struct epoll_event __user *event
 	 * have the poll callback to queue directly on ep->rdllist,
 	 * because we are doing it in the loop below, in a lockless way.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
+	write_lock_irqsave(&ep->lock, flags);
 	list_splice(&ep->rdllist, &txlist);
 	INIT_LIST_HEAD(&ep->rdllist);
 	ep->ovflist = NULL;
-	spin_unlock_irqrestore(&ep->lock, flags);
+	write_unlock_irqrestore(&ep->lock, flags);
 
 	/*
 	 * We can loop without lock because this is a task private list.
 	 * We just splice'd out the ep->rdllist in ep_collect_ready_items().
 	 * Items cannot vanish during the loop because we are holding "mtx".
 	 */
-	for (eventcnt = 0; !list_empty(&txlist) && eventcnt < maxevents;) {
+	for (eventcnt = 0; !list_empty(&txlist) && eventcnt + nbatch < maxevents;) {
 		epi = list_first_entry(&txlist, struct epitem, rdllink);
 
 		list_del_init(&epi->rdllink);
@@ -944,34 +1067,34 @@ static int ep_send_events(struct eventpoll *ep, struct epoll_event __user *event
 
 		/*
 		 * Is the event mask intersect the caller-requested one,
-		 * deliver the event to userspace. Again, we are holding
-		 * "mtx", so no operations coming from userspace can change
-		 * the item.
+		 * queue the event in the batch that will be delivered to
+		 * userspace. Again, we are holding "mtx", so no operations
+		 * coming from userspace can change the item.
 		 */
 		if (revents) {
-			if (__put_user(revents,
-				       &events[eventcnt].events) ||
-			    __put_user(epi->event.data,
-				       &events[eventcnt].data))
-				goto errxit;
-			if (epi->event.events & EPOLLONESHOT)
-				epi->event.events &= EP_PRIVATE_BITS;
-			eventcnt++;
+			evbuf[nbatch].events = revents;
+			evbuf[nbatch].data = epi->event.data;
+			evepi[nbatch++] = epi;
+			if (nbatch == EP_SEND_BATCH) {
+				if (ep_send_batch(ep, &events[eventcnt], evbuf,
+						  evepi, nbatch, &txlist))
+					goto errxit;
+				eventcnt += nbatch;
+				nbatch = 0;
+			}
 		}
-		/*
-		 * At this point, noone can insert into ep->rdllist besides
-		 * us. The epoll_ctl() callers are locked out by us holding
-		 * "mtx" and the poll callback will queue them in ep->ovflist.
-		 */
-		if (!(epi->event.events & EPOLLET) &&
-		    (revents & epi->event.events))
-			list_add_tail(&epi->rdllink, &ep->rdllist);
+	}
+	if (nbatch) {
+		if (ep_send_batch(ep, &events[eventcnt], evbuf, evepi, nbatch,
+				  &txlist))
+			goto errxit;
+		eventcnt += nbatch;
 	}
 	error = 0;
 
 errxit:
 
-	spin_lock_irqsave(&ep->lock, flags);
+	write_lock_irqsave(&ep->lock, flags);
 	/*
 	 * During the time we spent in the loop above, some other events
 	 * might have been queued by the poll callback. We re-insert them
@@ -1011,7 +1134,7 @@ errxit:
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
-	spin_unlock_irqrestore(&ep->lock, flags);
+	write_unlock_irqrestore(&ep->lock, flags);
 
 	mutex_unlock(&ep->mtx);
 
@@ -1039,7 +1162,7 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		MAX_SCHEDULE_TIMEOUT : (timeout * HZ + 999) / 1000;
 
 retry:
-	spin_lock_irqsave(&ep->lock, flags);
+	write_lock_irqsave(&ep->lock, flags);
 
 	res = 0;
 	if (list_empty(&ep->rdllist)) {
@@ -1066,9 +1189,9 @@ retry:
 				break;
 			}
 
-			spin_unlock_irqrestore(&ep->lock, flags);
+			write_unlock_irqrestore(&ep->lock, flags);
 			jtimeout = schedule_timeout(jtimeout);
-			spin_lock_irqsave(&ep->lock, flags);
+			write_lock_irqsave(&ep->lock, flags);
 		}
 		__remove_wait_queue(&ep->wq, &wait);
 
@@ -1078,7 +1201,7 @@ retry:
 	/* Is it worth to try to dig for events ? */
 	eavail = !list_empty(&ep->rdllist);
 
-	spin_unlock_irqrestore(&ep->lock, flags);
+	write_unlock_irqrestore(&ep->lock, flags);
 
 	/*
 	 * Try to transfer events to user space. In case we get 0 events and
@@ -1189,6 +1312,19 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 	if (file == tfile || !is_file_epoll(file))
 		goto error_tgt_fput;
 
+	/*
+	 * EPOLLEXCLUSIVE only makes sense at insertion time, with a restricted
+	 * set of events, and cannot be used when the target is itself an
+	 * eventpoll file (nested wakeups go through ep_poll_safewake()).
+	 */
+	if (ep_op_has_event(op) && (epds.events & EPOLLEXCLUSIVE)) {
+		if (op == EPOLL_CTL_MOD)
+			goto error_tgt_fput;
+		if (is_file_epoll(tfile) ||
+		    (epds.events & ~EP_EXCLUSIVE_OK_BITS))
+			goto error_tgt_fput;
+	}
+
 	/*
 	 * At this point it is safe to assume that the "private_data" contains
 	 * our own data structure.
@@ -1222,6 +1358,9 @@ SYSCALL_DEFINE4(epoll_ctl, int, epfd, int, op, int, fd,
 		break;
 	case EPOLL_CTL_MOD:
 		if (epi) {
+			/* The wait queue mode of an item cannot be changed */
+			if (epi->event.events & EPOLLEXCLUSIVE)
+				break;
 			epds.events |= POLLERR | POLLHUP;
 			error = ep_modify(ep, epi, &epds);
 		} else
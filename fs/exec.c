@@ -242,6 +242,7 @@ static int __bprm_mm_init(struct linux_binprm *bprm)
 
 	down_write(&mm->mmap_sem);
 	vma->vm_mm = mm;
+	INIT_LIST_HEAD(&vma->anon_vma_chain);
 
 	/*
 	 * Place the stack at the largest stack address the architecture
@@ -531,7 +532,8 @@ static int shift_arg_pages(struct vm_area_struct *vma, unsigned long shift)
 	/*
 	 * cover the whole range: [new_start, old_end)
 	 */
-	vma_adjust(vma, new_start, old_end, vma->vm_pgoff, NULL);
+	if (vma_adjust(vma, new_start, old_end, vma->vm_pgoff, NULL))
+		return -ENOMEM;
 
 	/*
 	 * move the page tables downwards, on failure we rely on
@@ -23,25 +23,28 @@
 #include <linux/blkdev.h>
 #include <linux/backing-dev.h>
 #include <linux/buffer_head.h>
+#include <linux/slab.h>
+#include <linux/completion.h>
 #include "internal.h"
 
+/*
+ * There used to be a pool of pdflush threads; every backing device has its
+ * own flusher thread now.  The sysctl stays for the sake of old tools.
+ */
+int nr_pdflush_threads;
 
-/**
- * writeback_acquire - attempt to get exclusive writeback access to a device
- * @bdi: the device's backing_dev_info structure
- *
- * It is a waste of resources to have more than one pdflush thread blocked on
- * a single request queue.  Exclusion at the request_queue level is obtained
- * via a flag in the request_queue's backing_dev_info.state.
- *
- * Non-request_queue-backed address_spaces will share default_backing_dev_info,
- * unless they implement their own.  Which is somewhat inefficient, as this
- * may prevent concurrent writeback against multiple devices.
+/*
+ * A unit of writeback work queued to a bdi's flusher thread.  It is
+ * always allocated by whoever queues it and freed by whoever runs it.
  */
-static int writeback_acquire(struct backing_dev_info *bdi)
-{
-	return !test_and_set_bit(BDI_pdflush, &bdi->state);
-}
+struct bdi_work {
+	struct list_head list;
+	long nr_pages;
+	enum writeback_sync_modes sync_mode;
+	unsigned int for_background:1;
+	atomic_t *pending;		/* if !NULL, someone waits on... */
+	struct completion *done;	/* ...this, once pending drops to 0 */
+};
 
 /**
  * writeback_in_progress - determine whether there is writeback in progress
@@ -51,17 +54,73 @@ static int writeback_acquire(struct backing_dev_info *bdi)
  */
 int writeback_in_progress(struct backing_dev_info *bdi)
 {
-	return test_bit(BDI_pdflush, &bdi->state);
+	return test_bit(BDI_writeback_running, &bdi->state);
+}
+
+/*
+ * Queue background writeback to @bdi.  Called with bdi_lock held.
+ */
+static void __bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages)
+{
+	struct bdi_work *work;
+
+	/*
+	 * No point in piling up background work, one pass goes on until
+	 * we are below the background threshold anyway.
+	 */
+	list_for_each_entry(work, &bdi->work_list, list) {
+		if (work->for_background)
+			return;
+	}
+
+	work = kmalloc(sizeof(*work), GFP_ATOMIC);
+	if (work) {
+		work->nr_pages = nr_pages;
+		work->sync_mode = WB_SYNC_NONE;
+		work->for_background = 1;
+		work->pending = NULL;
+		work->done = NULL;
+		list_add_tail(&work->list, &bdi->work_list);
+	}
+	/* Without the work, the periodic writeback will get to it */
+	bdi_kick_flusher(bdi);
 }
 
 /**
- * writeback_release - relinquish exclusive writeback access against a device.
- * @bdi: the device's backing_dev_info structure
+ * bdi_start_writeback - start background writeback against a device
+ * @bdi: the backing device to write back
+ * @nr_pages: write back at least this many pages, or only until dirty
+ *	memory is below the background threshold if zero
+ *
+ * This only queues the work to the device's flusher thread, it does not
+ * wait for any of it.  Callable from atomic context.
  */
-static void writeback_release(struct backing_dev_info *bdi)
+void bdi_start_writeback(struct backing_dev_info *bdi, long nr_pages)
 {
-	BUG_ON(!writeback_in_progress(bdi));
-	clear_bit(BDI_pdflush, &bdi->state);
+	spin_lock_bh(&bdi_lock);
+	__bdi_start_writeback(bdi, nr_pages);
+	spin_unlock_bh(&bdi_lock);
+}
+
+/*
+ * Start writeback of `nr_pages' pages on all the devices that have dirty
+ * inodes.  If `nr_pages' is zero, write back the whole world.
+ */
+void wakeup_flusher_threads(long nr_pages)
+{
+	struct backing_dev_info *bdi;
+
+	if (nr_pages == 0)
+		nr_pages = global_page_state(NR_FILE_DIRTY) +
+				global_page_state(NR_UNSTABLE_NFS);
+
+	spin_lock_bh(&bdi_lock);
+	list_for_each_entry(bdi, &bdi_list, bdi_list) {
+		if (bdi_cap_writeback_dirty(bdi) &&
+		    test_bit(BDI_dirty, &bdi->state))
+			__bdi_start_writeback(bdi, nr_pages);
+	}
+	spin_unlock_bh(&bdi_lock);
 }
 
 /**
@@ -168,8 +227,14 @@ void __mark_inode_dirty(struct inode *inode, int flags)
 		 * reposition it (that would break s_dirty time-ordering).
 		 */
 		if (!was_dirty) {
+			struct backing_dev_info *bdi;
+
+			bdi = inode->i_mapping->backing_dev_info;
 			inode->dirtied_when = jiffies;
 			list_move(&inode->i_list, &sb->s_dirty);
+			/* Let the device's flusher thread know */
+			if (!test_bit(BDI_dirty, &bdi->state))
+				set_bit(BDI_dirty, &bdi->state);
 		}
 	}
 out:
@@ -424,9 +489,6 @@ __writeback_single_inode(struct inode *inode, struct writeback_control *wbc)
  * If older_than_this is non-NULL, then only write out inodes which
  * had their first dirtying at a time earlier than *older_than_this.
  *
- * If we're a pdlfush thread, then implement pdflush collision avoidance
- * against the entire list.
- *
  * If `bdi' is non-zero then we're being asked to writeback a specific queue.
  * This function assumes that the blockdev superblock's inodes are backed by
  * a variety of queues, so all inodes are searched.  For other superblocks,
@@ -510,18 +572,10 @@ void generic_sync_sb_inodes(struct super_block *sb,
 		if (time_after(inode->dirtied_when, start))
 			break;
 
-		/* Is another pdflush already flushing this queue? */
-        //已经有另外的pdflush在处理这个super_block中的结点了
-		if (current_is_pdflush() && !writeback_acquire(bdi))
-			break;
-
 		BUG_ON(inode->i_state & I_FREEING);
 		__iget(inode);
 		pages_skipped = wbc->pages_skipped;
 		__writeback_single_inode(inode, wbc);
-        //处理完了,清除设备的BDI_pdflush 标志
-		if (current_is_pdflush())
-			writeback_release(bdi);
 		if (wbc->pages_skipped != pages_skipped) {
 			/*
 			 * writeback is not making progress due to locked
@@ -646,6 +700,189 @@ restart:
 	spin_unlock(&sb_lock);
 }
 
+/*
+ * Write back the inodes against `bdi' on all superblocks.  Background
+ * writeback goes on until dirty memory is below the background threshold
+ * and at least `nr_pages' pages have been written, kupdate writeback only
+ * writes inodes which have been dirty for longer than dirty_expire_interval.
+ * Returns the number of pages written.
+ */
+static long wb_writeback(struct backing_dev_info *bdi, long nr_pages,
+			 enum writeback_sync_modes sync_mode,
+			 int for_background, int for_kupdate)
+{
+	struct writeback_control wbc = {
+		.bdi		= bdi,
+		.sync_mode	= sync_mode,
+		.older_than_this = NULL,
+		.for_kupdate	= for_kupdate,
+		.range_cyclic	= 1,
+	};
+	unsigned long wb_start = jiffies;
+	unsigned long oldest_jif;
+	long wrote = 0;
+
+	if (for_kupdate) {
+		oldest_jif = jiffies - dirty_expire_interval;
+		wbc.older_than_this = &oldest_jif;
+	}
+
+	/* Only writeback on behalf of sync() may block on the queue */
+	if (for_background || for_kupdate)
+		wbc.nonblocking = 1;
+	else {
+		wbc.range_cyclic = 0;
+		wbc.range_start = 0;
+		wbc.range_end = LLONG_MAX;
+	}
+
+	for (;;) {
+		if (for_background) {
+			long background_thresh;
+			long dirty_thresh;
+
+			get_dirty_limits(&background_thresh, &dirty_thresh,
+					 NULL, NULL);
+			if (global_page_state(NR_FILE_DIRTY) +
+			    global_page_state(NR_UNSTABLE_NFS) <
+					background_thresh && nr_pages <= 0)
+				break;
+		} else if (nr_pages <= 0)
+			break;
+
+		wbc.more_io = 0;
+		wbc.encountered_congestion = 0;
+		wbc.nr_to_write = MAX_WRITEBACK_PAGES;
+		wbc.pages_skipped = 0;
+		writeback_inodes(&wbc);
+		nr_pages -= MAX_WRITEBACK_PAGES - wbc.nr_to_write;
+		wrote += MAX_WRITEBACK_PAGES - wbc.nr_to_write;
+
+		/* Keep the bandwidth estimate current for the throttlers */
+		bdi_update_bandwidth(bdi, 0, 0, 0, 0, 0, wb_start);
+
+		if (wbc.nr_to_write > 0 || wbc.pages_skipped > 0) {
+			/* Wrote less than expected */
+			if (wbc.encountered_congestion || wbc.more_io)
+				congestion_wait(WRITE, HZ/10);
+			else
+				break;	/* All the (old) data is written */
+		}
+	}
+
+	return wrote;
+}
+
+/*
+ * Periodic writeback of "old" data.
+ *
+ * Define "old": the first time one of an inode's pages is dirtied, we mark the
+ * dirtying-time in the inode's address_space.  So this periodic writeback code
+ * just walks the superblock inode lists, writing back any inodes against this
+ * device which are older than a specific point in time.
+ *
+ * Try to run once per dirty_writeback_interval.  older_than_this takes
+ * precedence over nr_to_write.  So we'll only write back all dirty pages if
+ * they are all attached to "old" mappings.
+ */
+static long wb_check_old_data_flush(struct backing_dev_info *bdi)
+{
+	long nr_pages;
+
+	if (!dirty_writeback_interval)
+		return 0;
+	if (time_before(jiffies,
+			bdi->wb_last_old_flush + dirty_writeback_interval))
+		return 0;
+
+	bdi->wb_last_old_flush = jiffies;
+	nr_pages = global_page_state(NR_FILE_DIRTY) +
+			global_page_state(NR_UNSTABLE_NFS) +
+			(inodes_stat.nr_inodes - inodes_stat.nr_unused);
+
+	return wb_writeback(bdi, nr_pages, WB_SYNC_NONE, 0, 1);
+}
+
+/**
+ * wb_do_writeback - run the writeback work of a device
+ * @bdi: the device's backing_dev_info structure
+ *
+ * Runs the work queued to @bdi, then the periodic writeback if it is due.
+ * Called by the device's flusher thread, or in its stead if there is none.
+ * Returns the number of pages written.
+ */
+long wb_do_writeback(struct backing_dev_info *bdi)
+{
+	struct bdi_work *work;
+	long wrote = 0;
+
+	set_bit(BDI_writeback_running, &bdi->state);
+
+	for (;;) {
+		spin_lock_bh(&bdi_lock);
+		if (list_empty(&bdi->work_list)) {
+			spin_unlock_bh(&bdi_lock);
+			break;
+		}
+		work = list_entry(bdi->work_list.next, struct bdi_work, list);
+		list_del(&work->list);
+		spin_unlock_bh(&bdi_lock);
+
+		wrote += wb_writeback(bdi, work->nr_pages, work->sync_mode,
+				      work->for_background, 0);
+
+		if (work->pending && atomic_dec_and_test(work->pending))
+			complete(work->done);
+		kfree(work);
+	}
+
+	wrote += wb_check_old_data_flush(bdi);
+
+	clear_bit(BDI_writeback_running, &bdi->state);
+	return wrote;
+}
+
+static int inode_list_has_bdi(struct list_head *head,
+			      struct backing_dev_info *bdi)
+{
+	struct inode *inode;
+
+	list_for_each_entry(inode, head, i_list)
+		if (inode->i_mapping->backing_dev_info == bdi)
+			return 1;
+	return 0;
+}
+
+/**
+ * bdi_has_dirty_inodes - are there dirty inodes against a device
+ * @bdi: the device's backing_dev_info structure
+ *
+ * Clears BDI_dirty if there are none, so that the device's flusher thread
+ * can go away until __mark_inode_dirty() sets it again.
+ */
+int bdi_has_dirty_inodes(struct backing_dev_info *bdi)
+{
+	struct super_block *sb;
+	int ret = 0;
+
+	spin_lock(&sb_lock);
+	spin_lock(&inode_lock);
+	list_for_each_entry(sb, &super_blocks, s_list) {
+		if (inode_list_has_bdi(&sb->s_dirty, bdi) ||
+		    inode_list_has_bdi(&sb->s_io, bdi) ||
+		    inode_list_has_bdi(&sb->s_more_io, bdi)) {
+			ret = 1;
+			break;
+		}
+	}
+	if (!ret)
+		clear_bit(BDI_dirty, &bdi->state);
+	spin_unlock(&inode_lock);
+	spin_unlock(&sb_lock);
+
+	return ret;
+}
+
 /*
  * writeback and wait upon the filesystem's dirty inodes.  The caller will
  * do this in two passes - one to write, and one to wait.
@@ -717,9 +954,56 @@ restart:
 	spin_unlock(&sb_lock);
 }
 
+/*
+ * Hand the non-waiting pass of sync to the flusher threads of all the
+ * devices with dirty inodes, so that they are written in parallel, and
+ * wait for them to finish.  Returns 0 if some work could not be queued.
+ */
+static int bdi_sync_writeback(void)
+{
+	struct backing_dev_info *bdi;
+	struct bdi_work *work;
+	DECLARE_COMPLETION_ONSTACK(done);
+	atomic_t pending = ATOMIC_INIT(1);
+	long nr_pages;
+	int ret = 1;
+
+	nr_pages = global_page_state(NR_FILE_DIRTY) +
+			global_page_state(NR_UNSTABLE_NFS) +
+			(inodes_stat.nr_inodes - inodes_stat.nr_unused);
+
+	spin_lock_bh(&bdi_lock);
+	list_for_each_entry(bdi, &bdi_list, bdi_list) {
+		if (!bdi_cap_writeback_dirty(bdi) ||
+		    !test_bit(BDI_dirty, &bdi->state))
+			continue;
+
+		work = kmalloc(sizeof(*work), GFP_ATOMIC);
+		if (!work) {
+			ret = 0;
+			break;
+		}
+		work->nr_pages = nr_pages;
+		work->sync_mode = WB_SYNC_NONE;
+		work->for_background = 0;
+		work->pending = &pending;
+		work->done = &done;
+		atomic_inc(&pending);
+		list_add_tail(&work->list, &bdi->work_list);
+		bdi_kick_flusher(bdi);
+	}
+	spin_unlock_bh(&bdi_lock);
+
+	if (!atomic_dec_and_test(&pending))
+		wait_for_completion(&done);
+
+	return ret;
+}
+
 void sync_inodes(int wait)
 {
-	__sync_inodes(0);
+	if (!bdi_sync_writeback())
+		__sync_inodes(0);
 
 	if (wait)
 		__sync_inodes(1);
@@ -225,6 +225,7 @@ void inode_init_once(struct inode *inode)
 	spin_lock_init(&inode->i_data.i_mmap_lock);
 	INIT_LIST_HEAD(&inode->i_data.private_list);
 	spin_lock_init(&inode->i_data.private_lock);
+	INIT_LIST_HEAD(&inode->i_data.shadow_list);
 	INIT_RAW_PRIO_TREE_ROOT(&inode->i_data.i_mmap);
 	INIT_LIST_HEAD(&inode->i_data.i_mmap_nonlinear);
 	i_size_ordered_init(inode);
@@ -278,6 +279,8 @@ void clear_inode(struct inode *inode)
 	invalidate_inode_buffers(inode);
        
 	BUG_ON(inode->i_data.nrpages);
+	BUG_ON(inode->i_data.nrshadows);
+	workingset_forget_mapping(&inode->i_data);
 	BUG_ON(!(inode->i_state & I_FREEING));
 	BUG_ON(inode->i_state & I_CLEAR);
 	//如果有其他进程操作此inode,就等待其完成
@@ -316,7 +319,7 @@ static void dispose_list(struct list_head *head)
 		//remove the inode from inode_in_use
 		list_del(&inode->i_list);
 
-		if (inode->i_data.nrpages)
+		if (inode->i_data.nrpages || inode->i_data.nrshadows)
 			//清除inode->i_data数据
 			truncate_inode_pages(&inode->i_data, 0);
 		clear_inode(inode);
@@ -1184,7 +1187,7 @@ static void generic_forget_inode(struct inode *inode)
 	inode->i_state |= I_FREEING;
 	inodes_stat.nr_inodes--;
 	spin_unlock(&inode_lock);
-	if (inode->i_data.nrpages)
+	if (inode->i_data.nrpages || inode->i_data.nrshadows)
 		truncate_inode_pages(&inode->i_data, 0);
 	clear_inode(inode);
 	wake_up_inode(inode);
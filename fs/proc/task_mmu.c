@@ -317,56 +317,85 @@ struct mem_size_stats {
 	u64 pss;
 };
 
-static int smaps_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
-			   struct mm_walk *walk)
+static void smaps_pte_entry(pte_t ptent, unsigned long addr,
+			    struct mem_size_stats *mss)
 {
-	struct mem_size_stats *mss = walk->private;
-	struct vm_area_struct *vma = mss->vma;
-	pte_t *pte, ptent;
-	spinlock_t *ptl;
 	struct page *page;
 	int mapcount;
 
-	pte = pte_offset_map_lock(vma->vm_mm, pmd, addr, &ptl);
-	for (; addr != end; pte++, addr += PAGE_SIZE) {
-		ptent = *pte;
-
-		if (is_swap_pte(ptent)) {
-			mss->swap += PAGE_SIZE;
-			continue;
-		}
+	if (is_swap_pte(ptent)) {
+		mss->swap += PAGE_SIZE;
+		return;
+	}
 
-		if (!pte_present(ptent))
-			continue;
+	if (!pte_present(ptent))
+		return;
+
+	mss->resident += PAGE_SIZE;
+
+	page = vm_normal_page(mss->vma, addr, ptent);
+	if (!page)
+		return;
+
+	/* Accumulate the size in pages that have been accessed. */
+	if (pte_young(ptent) || PageReferenced(page))
+		mss->referenced += PAGE_SIZE;
+	mapcount = page_mapcount(page);
+	if (mapcount >= 2) {
+		if (pte_dirty(ptent))
+			mss->shared_dirty += PAGE_SIZE;
+		else
+			mss->shared_clean += PAGE_SIZE;
+		mss->pss += (PAGE_SIZE << PSS_SHIFT) / mapcount;
+	} else {
+		if (pte_dirty(ptent))
+			mss->private_dirty += PAGE_SIZE;
+		else
+			mss->private_clean += PAGE_SIZE;
+		mss->pss += (PAGE_SIZE << PSS_SHIFT);
+	}
+}
 
-		mss->resident += PAGE_SIZE;
+static int smaps_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
+			   struct mm_walk *walk)
+{
+	struct mem_size_stats *mss = walk->private;
+	pte_t *pte;
+	spinlock_t *ptl;
 
-		page = vm_normal_page(vma, addr, ptent);
-		if (!page)
-			continue;
+	pte = pte_offset_map_lock(mss->vma->vm_mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE)
+		smaps_pte_entry(*pte, addr, mss);
+	pte_unmap_unlock(pte - 1, ptl);
+	cond_resched();
+	return 0;
+}
 
-		/* Accumulate the size in pages that have been accessed. */
-		if (pte_young(ptent) || PageReferenced(page))
-			mss->referenced += PAGE_SIZE;
-		mapcount = page_mapcount(page);
-		if (mapcount >= 2) {
-			if (pte_dirty(ptent))
-				mss->shared_dirty += PAGE_SIZE;
-			else
-				mss->shared_clean += PAGE_SIZE;
-			mss->pss += (PAGE_SIZE << PSS_SHIFT) / mapcount;
-		} else {
-			if (pte_dirty(ptent))
-				mss->private_dirty += PAGE_SIZE;
-			else
-				mss->private_clean += PAGE_SIZE;
-			mss->pss += (PAGE_SIZE << PSS_SHIFT);
-		}
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * A huge pmd is accounted as the ptes it stands for, without splitting
+ * it.  If it was split before we got the lock, walk the ptes after all.
+ */
+static int smaps_huge_pmd(pmd_t *pmd, unsigned long addr, unsigned long end,
+			  struct mm_walk *walk)
+{
+	struct mem_size_stats *mss = walk->private;
+	unsigned long index = (addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT;
+
+	spin_lock(&walk->mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd))) {
+		spin_unlock(&walk->mm->page_table_lock);
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
+			return 0;
+		return smaps_pte_range(pmd, addr, end, walk);
 	}
-	pte_unmap_unlock(pte - 1, ptl);
+	for (; addr != end; addr += PAGE_SIZE, index++)
+		smaps_pte_entry(pmd_trans_huge_pte(*pmd, index), addr, mss);
+	spin_unlock(&walk->mm->page_table_lock);
 	cond_resched();
 	return 0;
 }
+#endif
 
 static int show_smap(struct seq_file *m, void *v)
 {
@@ -376,6 +405,9 @@ static int show_smap(struct seq_file *m, void *v)
 	struct mem_size_stats mss;
 	struct mm_walk smaps_walk = {
 		.pmd_entry = smaps_pte_range,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		.huge_pmd_entry = smaps_huge_pmd,
+#endif
 		.mm = vma->vm_mm,
 		.private = &mss,
 	};
@@ -458,6 +490,31 @@ static int clear_refs_pte_range(pmd_t *pmd, unsigned long addr,
 	return 0;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+static int clear_refs_huge_pmd(pmd_t *pmd, unsigned long addr,
+			       unsigned long end, struct mm_walk *walk)
+{
+	unsigned long index = (addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT;
+	struct page *page;
+
+	spin_lock(&walk->mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd))) {
+		spin_unlock(&walk->mm->page_table_lock);
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
+			return 0;
+		return clear_refs_pte_range(pmd, addr, end, walk);
+	}
+	/* One accessed bit for the whole pmd, even if only part is asked */
+	pmdp_trans_huge_test_and_clear_young(pmd);
+	page = pmd_trans_huge_page(*pmd) + index;
+	for (; addr != end; addr += PAGE_SIZE)
+		ClearPageReferenced(page++);
+	spin_unlock(&walk->mm->page_table_lock);
+	cond_resched();
+	return 0;
+}
+#endif
+
 static ssize_t clear_refs_write(struct file *file, const char __user *buf,
 				size_t count, loff_t *ppos)
 {
@@ -482,6 +539,9 @@ static ssize_t clear_refs_write(struct file *file, const char __user *buf,
 	if (mm) {
 		struct mm_walk clear_refs_walk = {
 			.pmd_entry = clear_refs_pte_range,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+			.huge_pmd_entry = clear_refs_huge_pmd,
+#endif
 			.mm = mm,
 		};
 		down_read(&mm->mmap_sem);
@@ -606,6 +666,38 @@ static int pagemap_pte_range(pmd_t *pmd, unsigned long addr, unsigned long end,
 	return err;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/*
+ * Report the pages of a huge pmd from a snapshot of it, like the ptes
+ * above are read without a lock; the pmd may have been split or zapped
+ * since we looked, then do what the generic walk would have done.
+ */
+static int pagemap_huge_pmd(pmd_t *pmd, unsigned long addr, unsigned long end,
+			    struct mm_walk *walk)
+{
+	struct pagemapread *pm = walk->private;
+	unsigned long index = (addr & ~HPAGE_PMD_MASK) >> PAGE_SHIFT;
+	pmd_t entry = *pmd;
+	int err = 0;
+
+	if (unlikely(!pmd_trans_huge(entry))) {
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
+			return pagemap_pte_hole(addr, end, walk);
+		return pagemap_pte_range(pmd, addr, end, walk);
+	}
+	for (; addr != end; addr += PAGE_SIZE, index++) {
+		err = add_to_pagemap(addr, pte_to_pagemap_entry(
+				pmd_trans_huge_pte(entry, index)), pm);
+		if (err)
+			return err;
+	}
+
+	cond_resched();
+
+	return err;
+}
+#endif
+
 /*
  * /proc/pid/pagemap - an array mapping virtual pages to pfns
  *
@@ -693,6 +785,9 @@ static ssize_t pagemap_read(struct file *file, char __user *buf,
 	pm.end = (u64 *)(buf + count);
 
 	pagemap_walk.pmd_entry = pagemap_pte_range;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	pagemap_walk.huge_pmd_entry = pagemap_huge_pmd;
+#endif
 	pagemap_walk.pte_hole = pagemap_pte_hole;
 	pagemap_walk.mm = mm;
 	pagemap_walk.private = &pm;
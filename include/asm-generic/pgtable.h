@@ -196,6 +196,35 @@ static inline int pmd_none_or_clear_bad(pmd_t *pmd)
 	return 0;
 }
 
+#ifndef CONFIG_TRANSPARENT_HUGEPAGE
+#define pmd_trans_huge(pmd)	0
+#endif
+
+#ifndef CONFIG_FORK_SHARE_PTES
+#define pmd_ptes_shared(pmd)	0
+#endif
+
+/*
+ * A page fault may fill an empty pmd with a transparent huge pmd at any
+ * time unless mmap_sem is held for writing, and pmd_bad() is true for
+ * those.  Walkers holding mmap_sem only for reading split what they find
+ * and then use this, which reads the pmd once and treats a huge pmd that
+ * appeared meanwhile like an empty one.
+ */
+static inline int pmd_none_or_trans_huge_or_clear_bad(pmd_t *pmd)
+{
+	pmd_t pmdval = *pmd;
+
+	barrier();
+	if (pmd_none(pmdval) || pmd_trans_huge(pmdval))
+		return 1;
+	if (unlikely(pmd_bad(pmdval))) {
+		pmd_clear_bad(pmd);
+		return 1;
+	}
+	return 0;
+}
+
 static inline pte_t __ptep_modify_prot_start(struct mm_struct *mm,
 					     unsigned long addr,
 					     pte_t *ptep)
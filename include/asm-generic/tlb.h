@@ -33,6 +33,23 @@
   #define tlb_fast_mode(tlb) 1
 #endif
 
+/*
+ * Once pages[] is full, further pages are gathered into whole pages
+ * allocated on the fly, so that a large unmap does not have to stop and
+ * flush the TLB every FREE_PTE_NR pages.  If no page can be had, we fall
+ * back to flushing early.  The batches are bounded so that the eventual
+ * freeing does not hold off the CPU for too long.
+ */
+struct mmu_gather_batch {
+	struct mmu_gather_batch	*next;
+	unsigned int		nr;
+	struct page		*pages[0];
+};
+
+#define MAX_GATHER_BATCH	\
+	((PAGE_SIZE - sizeof(struct mmu_gather_batch)) / sizeof(void *))
+#define MAX_GATHER_BATCH_COUNT	(10000UL / MAX_GATHER_BATCH)
+
 /* struct mmu_gather is an opaque type used by the mm code for passing around
  * any data needed by arch specific code for tlb_remove_page.
  */
@@ -41,6 +58,9 @@ struct mmu_gather {
 	unsigned int		nr;	/* set to ~0U means fast mode */
 	unsigned int		need_flush;/* Really unmapped some ptes? */
 	unsigned int		fullmm; /* non-zero means full mm flush */
+	unsigned int		batch_count;
+	struct mmu_gather_batch	*batches;
+	struct mmu_gather_batch	*active;
 	struct page *		pages[FREE_PTE_NR];
 };
 
@@ -62,6 +82,9 @@ tlb_gather_mmu(struct mm_struct *mm, unsigned int full_mm_flush)
 
 	tlb->fullmm = full_mm_flush;
 
+	tlb->batches = tlb->active = NULL;
+	tlb->batch_count = 0;
+
 	return tlb;
 }
 
@@ -73,8 +96,16 @@ tlb_flush_mmu(struct mmu_gather *tlb, unsigned long start, unsigned long end)
 	tlb->need_flush = 0;
 	tlb_flush(tlb);
 	if (!tlb_fast_mode(tlb)) {
+		struct mmu_gather_batch *batch;
+
 		free_pages_and_swap_cache(tlb->pages, tlb->nr);
 		tlb->nr = 0;
+		for (batch = tlb->batches; batch && batch->nr;
+		     batch = batch->next) {
+			free_pages_and_swap_cache(batch->pages, batch->nr);
+			batch->nr = 0;
+		}
+		tlb->active = tlb->batches;
 	}
 }
 
@@ -85,14 +116,54 @@ tlb_flush_mmu(struct mmu_gather *tlb, unsigned long start, unsigned long end)
 static inline void
 tlb_finish_mmu(struct mmu_gather *tlb, unsigned long start, unsigned long end)
 {
+	struct mmu_gather_batch *batch, *next;
+
 	tlb_flush_mmu(tlb, start, end);
 
+	for (batch = tlb->batches; batch; batch = next) {
+		next = batch->next;
+		free_page((unsigned long)batch);
+	}
+	tlb->batches = tlb->active = NULL;
+
 	/* keep the page table cache within bounds */
 	check_pgt_cache();
 
 	put_cpu_var(mmu_gathers);
 }
 
+/*
+ * Add a page to the active gather batch, moving on to the next batch or
+ * allocating a new one when it is full.  Returns 0 if there is no room.
+ */
+static inline int tlb_batch_add(struct mmu_gather *tlb, struct page *page)
+{
+	struct mmu_gather_batch *batch = tlb->active;
+
+	if (batch && batch->nr == MAX_GATHER_BATCH) {
+		batch = batch->next;
+		if (batch)
+			tlb->active = batch;
+	}
+	if (!batch) {
+		if (tlb->batch_count == MAX_GATHER_BATCH_COUNT)
+			return 0;
+		batch = (void *)__get_free_page(GFP_NOWAIT | __GFP_NOWARN);
+		if (!batch)
+			return 0;
+		tlb->batch_count++;
+		batch->next = NULL;
+		batch->nr = 0;
+		if (tlb->active)
+			tlb->active->next = batch;
+		else
+			tlb->batches = batch;
+		tlb->active = batch;
+	}
+	batch->pages[batch->nr++] = page;
+	return 1;
+}
+
 /* tlb_remove_page
  *	Must perform the equivalent to __free_pte(pte_get_and_clear(ptep)), while
  *	handling the additional races in SMP caused by other CPUs caching valid
@@ -105,9 +176,14 @@ static inline void tlb_remove_page(struct mmu_gather *tlb, struct page *page)
 		free_page_and_swap_cache(page);
 		return;
 	}
+	if (tlb->nr < FREE_PTE_NR) {
+		tlb->pages[tlb->nr++] = page;
+		return;
+	}
+	if (tlb_batch_add(tlb, page))
+		return;
+	tlb_flush_mmu(tlb, 0, 0);
 	tlb->pages[tlb->nr++] = page;
-	if (tlb->nr >= FREE_PTE_NR)
-		tlb_flush_mmu(tlb, 0, 0);
 }
 
 /**
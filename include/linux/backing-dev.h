@@ -13,17 +13,22 @@
 #include <linux/proportions.h>
 #include <linux/kernel.h>
 #include <linux/fs.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
 #include <asm/atomic.h>
 
 struct page;
 struct device;
 struct dentry;
+struct task_struct;
 
 /*
  * Bits in backing_dev_info.state
  */
 enum bdi_state {
-	BDI_pdflush,		/* A pdflush thread is working this device */
+	BDI_writeback_running,	/* The flusher thread is writing this device */
+	BDI_dirty,		/* Inodes against this device may be dirty */
+	BDI_pending,		/* The flusher thread is being created/reaped */
 	BDI_write_congested,	/* The write queue is getting full */
 	BDI_read_congested,	/* The read queue is getting full */
 	BDI_unused,		/* Available bits start here */
@@ -34,6 +39,8 @@ typedef int (congested_fn)(void *, int);
 enum bdi_stat_item {
 	BDI_RECLAIMABLE,
 	BDI_WRITEBACK,
+	BDI_DIRTIED,
+	BDI_WRITTEN,
 	NR_BDI_STAT_ITEMS
 };
 
@@ -53,11 +60,33 @@ struct backing_dev_info {
 	struct prop_local_percpu completions;
 	int dirty_exceeded;
 
+	spinlock_t bw_lock;		/* protects the estimations below */
+	unsigned long bw_time_stamp;	/* last time write bw is updated */
+	unsigned long dirtied_stamp;	/* BDI_DIRTIED at bw_time_stamp */
+	unsigned long written_stamp;	/* BDI_WRITTEN at bw_time_stamp */
+	unsigned long write_bandwidth;	/* the estimated write bandwidth */
+	unsigned long avg_write_bandwidth; /* further smoothed write bw */
+
+	/*
+	 * The base dirty throttle rate, re-calculated on every 200ms.
+	 * All the bdi tasks' dirty rate will be curbed under it.
+	 * @balanced_dirty_ratelimit tracks the estimated balanced rate,
+	 * which @dirty_ratelimit is stepped towards.
+	 */
+	unsigned long dirty_ratelimit;
+	unsigned long balanced_dirty_ratelimit;
+
 	unsigned int min_ratio;
 	unsigned int max_ratio, max_prop_frac;
 
 	struct device *dev;
 
+	struct list_head bdi_list;	/* on the global bdi_list */
+	struct list_head work_list;	/* queued writeback work, bdi_lock */
+	struct task_struct *wb_task;	/* flusher thread, or NULL */
+	unsigned long wb_last_active;	/* jiffies the flusher last wrote */
+	unsigned long wb_last_old_flush; /* jiffies of last kupdate pass */
+
 #ifdef CONFIG_DEBUG_FS
 	struct dentry *debug_dir;
 	struct dentry *debug_stats;
@@ -71,6 +100,12 @@ int bdi_register(struct backing_dev_info *bdi, struct device *parent,
 		const char *fmt, ...);
 int bdi_register_dev(struct backing_dev_info *bdi, dev_t dev);
 void bdi_unregister(struct backing_dev_info *bdi);
+long wb_do_writeback(struct backing_dev_info *bdi);
+void bdi_kick_flusher(struct backing_dev_info *bdi);
+void bdi_wakeup_flushers(void);
+
+extern spinlock_t bdi_lock;
+extern struct list_head bdi_list;
 
 static inline void __add_bdi_stat(struct backing_dev_info *bdi,
 		enum bdi_stat_item item, s64 amount)
@@ -0,0 +1,85 @@
+#ifndef _LINUX_COMPACTION_H
+#define _LINUX_COMPACTION_H
+
+/*
+ * Memory compaction: assemble free high-order blocks by migrating the
+ * movable pages that sit in the way, instead of reclaiming them.
+ */
+
+/* Return values for try_to_compact_pages() and compact_zone() */
+#define COMPACT_SKIPPED		0	/* compaction was not attempted */
+#define COMPACT_CONTINUE	1	/* keep going, no block of the order yet */
+#define COMPACT_PARTIAL		2	/* a block of the order is now free */
+#define COMPACT_COMPLETE	3	/* the whole zone has been scanned */
+
+/*
+ * Below this fragmentation index an allocation failure is put down to a
+ * lack of memory rather than to fragmentation, and left to reclaim.
+ */
+#define COMPACT_FRAGINDEX_THRESHOLD	500
+
+/* Highest value of compact_defer_shift: skip at most 64 attempts */
+#define COMPACT_MAX_DEFER_SHIFT		6
+
+#ifdef CONFIG_COMPACTION
+extern int sysctl_compact_memory;
+extern int sysctl_compaction_handler(struct ctl_table *table, int write,
+			struct file *file, void __user *buffer, size_t *length,
+			loff_t *ppos);
+extern int sysctl_compact_node;
+extern int sysctl_compact_node_handler(struct ctl_table *table, int write,
+			struct file *file, void __user *buffer, size_t *length,
+			loff_t *ppos);
+
+extern int fragmentation_index(struct zone *zone, unsigned int order);
+extern unsigned long try_to_compact_pages(struct zonelist *zonelist,
+			int order, gfp_t gfp_mask, nodemask_t *nodemask);
+
+/* Do not skip compaction more than 64 times */
+static inline void defer_compaction(struct zone *zone)
+{
+	zone->compact_considered = 0;
+	if (zone->compact_defer_shift < COMPACT_MAX_DEFER_SHIFT)
+		zone->compact_defer_shift++;
+}
+
+/* Returns true if compaction should be skipped this time */
+static inline int compaction_deferred(struct zone *zone)
+{
+	unsigned long defer_limit = 1UL << zone->compact_defer_shift;
+
+	/* Avoid possible overflow */
+	if (++zone->compact_considered > defer_limit)
+		zone->compact_considered = defer_limit;
+
+	return zone->compact_considered < defer_limit;
+}
+
+static inline void compaction_succeeded(struct zone *zone)
+{
+	zone->compact_considered = 0;
+	zone->compact_defer_shift = 0;
+}
+
+#else
+static inline unsigned long try_to_compact_pages(struct zonelist *zonelist,
+			int order, gfp_t gfp_mask, nodemask_t *nodemask)
+{
+	return COMPACT_SKIPPED;
+}
+
+static inline void defer_compaction(struct zone *zone)
+{
+}
+
+static inline int compaction_deferred(struct zone *zone)
+{
+	return 1;
+}
+
+static inline void compaction_succeeded(struct zone *zone)
+{
+}
+#endif /* CONFIG_COMPACTION */
+
+#endif /* _LINUX_COMPACTION_H */
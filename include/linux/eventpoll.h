@@ -26,6 +26,14 @@
 #define EPOLL_CTL_DEL 2
 #define EPOLL_CTL_MOD 3
 
+/*
+ * Request an exclusive wakeup mode for the target file descriptor.
+ * When several epoll file descriptors are attached to the same target
+ * and all of them use this flag, only one of them is woken up for
+ * each event, instead of all of them.
+ */
+#define EPOLLEXCLUSIVE (1 << 28)
+
 /* Set the One Shot behaviour for the target file descriptor */
 #define EPOLLONESHOT (1 << 30)
 
@@ -0,0 +1,113 @@
+#ifndef _LINUX_HUGE_MM_H
+#define _LINUX_HUGE_MM_H
+
+/*
+ * Transparent huge pages: private anonymous memory mapped a pmd at a
+ * time.  The HPAGE_PMD_NR pages behind a huge pmd are ordinary order-0
+ * pages that happen to be physically contiguous, so everything below the
+ * page tables (rmap, LRU, swap, migration) handles them as usual.  Code
+ * that wants to look at the ptes of such a range calls split_huge_pmd()
+ * first, which replaces the huge pmd by a pte table mapping the same
+ * pages and can never fail.  Fork copies a huge pmd as it is, and the
+ * page table walkers that only look at a range can be given a
+ * ->huge_pmd_entry to do so without splitting it.
+ */
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+
+#define HPAGE_PMD_SHIFT	PMD_SHIFT
+#define HPAGE_PMD_SIZE	(1UL << HPAGE_PMD_SHIFT)
+#define HPAGE_PMD_MASK	(~(HPAGE_PMD_SIZE - 1))
+#define HPAGE_PMD_ORDER	(HPAGE_PMD_SHIFT - PAGE_SHIFT)
+#define HPAGE_PMD_NR	(1 << HPAGE_PMD_ORDER)
+
+enum transparent_hugepage_flag {
+	TRANSPARENT_HUGEPAGE_FLAG,		/* "always" */
+	TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,	/* "madvise" */
+};
+
+extern unsigned long transparent_hugepage_flags;
+
+/*
+ * Only private anonymous vmas are eligible: the pages must be ours to
+ * copy and free, and nothing but the page tables may know their layout.
+ */
+static inline int transparent_hugepage_enabled(struct vm_area_struct *vma)
+{
+	if (vma->vm_file || vma->vm_ops)
+		return 0;
+	if (vma->vm_flags & VM_NOHUGEPAGE)
+		return 0;
+	if (test_bit(TRANSPARENT_HUGEPAGE_FLAG, &transparent_hugepage_flags))
+		return 1;
+	return test_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			&transparent_hugepage_flags) &&
+		(vma->vm_flags & VM_HUGEPAGE);
+}
+
+struct mmu_gather;
+
+extern int do_huge_anonymous_page(struct mm_struct *mm,
+				  struct vm_area_struct *vma,
+				  unsigned long address, pmd_t *pmd,
+				  int write_access);
+extern int do_huge_pmd_fault(struct mm_struct *mm, struct vm_area_struct *vma,
+			     unsigned long address, pmd_t *pmd,
+			     int write_access);
+extern struct page *follow_trans_huge_pmd(struct mm_struct *mm,
+					  unsigned long address, pmd_t *pmd,
+					  unsigned int flags);
+extern int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
+			pmd_t *pmd);
+extern int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+			 pmd_t *dst_pmd, pmd_t *src_pmd, unsigned long addr,
+			 struct vm_area_struct *vma);
+extern void __split_huge_pmd(struct mm_struct *mm, pmd_t *pmd,
+			     unsigned long address);
+extern int page_referenced_trans_huge(struct page *page,
+				      struct mm_struct *mm,
+				      unsigned long address);
+
+static inline void split_huge_pmd(struct mm_struct *mm, pmd_t *pmd,
+				  unsigned long address)
+{
+	if (unlikely(pmd_trans_huge(*pmd)))
+		__split_huge_pmd(mm, pmd, address);
+}
+
+extern int hugepage_madvise(struct vm_area_struct *vma,
+			    unsigned long *vm_flags, int advice);
+extern int khugepaged_fork(struct mm_struct *mm, struct mm_struct *oldmm);
+
+#else /* !CONFIG_TRANSPARENT_HUGEPAGE */
+
+#define HPAGE_PMD_SIZE	({ BUG(); 0; })
+
+#define transparent_hugepage_enabled(vma)	0
+#define split_huge_pmd(mm, pmd, address)	do { } while (0)
+
+#define do_huge_anonymous_page(mm, vma, address, pmd, write_access) \
+	VM_FAULT_FALLBACK
+#define do_huge_pmd_fault(mm, vma, address, pmd, write_access) \
+	VM_FAULT_FALLBACK
+#define follow_trans_huge_pmd(mm, address, pmd, flags)	NULL
+#define zap_huge_pmd(tlb, vma, pmd)			0
+#define copy_huge_pmd(dst_mm, src_mm, dst_pmd, src_pmd, addr, vma) 1
+#define page_referenced_trans_huge(page, mm, address)	(-1)
+
+static inline int hugepage_madvise(struct vm_area_struct *vma,
+				   unsigned long *vm_flags, int advice)
+{
+	BUG();
+	return 0;
+}
+
+static inline int khugepaged_fork(struct mm_struct *mm,
+				  struct mm_struct *oldmm)
+{
+	return 0;
+}
+
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+#endif /* _LINUX_HUGE_MM_H */
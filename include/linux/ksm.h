@@ -0,0 +1,119 @@
+#ifndef __LINUX_KSM_H
+#define __LINUX_KSM_H
+/*
+ * Memory merging support.
+ *
+ * This code enables dynamic sharing of identical pages found in different
+ * memory areas, even if they are not shared by fork().
+ */
+
+#include <linux/bitops.h>
+#include <linux/mm.h>
+#include <linux/pagemap.h>
+#include <linux/rmap.h>
+#include <linux/sched.h>
+
+struct stable_node;
+struct mem_cgroup;
+
+#ifdef CONFIG_KSM
+int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
+		unsigned long end, int advice, unsigned long *vm_flags);
+int __ksm_enter(struct mm_struct *mm);
+
+static inline int ksm_fork(struct mm_struct *mm, struct mm_struct *oldmm)
+{
+	if (test_bit(MMF_VM_MERGEABLE, &oldmm->flags))
+		return __ksm_enter(mm);
+	return 0;
+}
+
+/*
+ * A KSM page is one of those write-protected "shared pages" or "merged
+ * pages" which KSM maps into multiple mms, wherever identical anonymous
+ * page content is found in VM_MERGEABLE vmas.  It's a PageAnon page,
+ * pointing to a struct stable_node instead of to an anon_vma.
+ */
+static inline int PageKsm(struct page *page)
+{
+	return ((unsigned long)page->mapping & PAGE_MAPPING_FLAGS) ==
+				(PAGE_MAPPING_ANON | PAGE_MAPPING_KSM);
+}
+
+static inline struct stable_node *page_stable_node(struct page *page)
+{
+	return PageKsm(page) ? (struct stable_node *)
+		((unsigned long)page->mapping - PAGE_MAPPING_FLAGS) : NULL;
+}
+
+static inline void set_page_stable_node(struct page *page,
+					struct stable_node *stable_node)
+{
+	page->mapping = (void *)((unsigned long)stable_node +
+				 PAGE_MAPPING_ANON + PAGE_MAPPING_KSM);
+}
+
+/*
+ * Reverse mapping of KSM pages, for mm/rmap.c: the page must be locked.
+ */
+int page_referenced_ksm(struct page *page, struct mem_cgroup *mem_cont);
+int try_to_unmap_ksm(struct page *page, int unlock, int migration);
+
+/*
+ * A KSM page swapped out and freed comes back as an ordinary anon page
+ * of whichever vma faulted it first: any other mm still holding that
+ * swap entry must map a copy, or rmap would not find its pte.
+ */
+struct page *ksm_does_need_to_copy(struct page *page,
+			struct vm_area_struct *vma, unsigned long address);
+
+static inline struct page *ksm_might_need_to_copy(struct page *page,
+			struct vm_area_struct *vma, unsigned long address)
+{
+	struct anon_vma *anon_vma = page_anon_vma(page);
+
+	if (!anon_vma ||
+	    (anon_vma->root == vma->anon_vma->root &&
+	     page->index == linear_page_index(vma, address)))
+		return page;
+	return ksm_does_need_to_copy(page, vma, address);
+}
+
+#else  /* !CONFIG_KSM */
+
+static inline int ksm_madvise(struct vm_area_struct *vma, unsigned long start,
+		unsigned long end, int advice, unsigned long *vm_flags)
+{
+	return 0;
+}
+
+static inline int ksm_fork(struct mm_struct *mm, struct mm_struct *oldmm)
+{
+	return 0;
+}
+
+static inline int PageKsm(struct page *page)
+{
+	return 0;
+}
+
+static inline int page_referenced_ksm(struct page *page,
+				      struct mem_cgroup *mem_cont)
+{
+	return 0;
+}
+
+static inline int try_to_unmap_ksm(struct page *page, int unlock,
+				   int migration)
+{
+	return 0;
+}
+
+static inline struct page *ksm_might_need_to_copy(struct page *page,
+			struct vm_area_struct *vma, unsigned long address)
+{
+	return page;
+}
+#endif /* !CONFIG_KSM */
+
+#endif /* __LINUX_KSM_H */
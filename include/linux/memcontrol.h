@@ -69,6 +69,9 @@ extern void mem_cgroup_record_reclaim_priority(struct mem_cgroup *mem,
 extern long mem_cgroup_calc_reclaim(struct mem_cgroup *mem, struct zone *zone,
 					int priority, enum lru_list lru);
 
+extern unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone,
+					int order, gfp_t gfp_mask, int priority);
+
 
 #else /* CONFIG_CGROUP_MEM_RES_CTLR */
 static inline int mem_cgroup_charge(struct page *page,
@@ -152,6 +155,12 @@ static inline long mem_cgroup_calc_reclaim(struct mem_cgroup *mem,
 {
 	return 0;
 }
+
+static inline unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone,
+					int order, gfp_t gfp_mask, int priority)
+{
+	return 0;
+}
 #endif /* CONFIG_CGROUP_MEM_CONT */
 
 #endif /* _LINUX_MEMCONTROL_H */
@@ -107,13 +107,19 @@ extern unsigned int kobjsize(const void *objp);
 #define VM_NORESERVE	0x00200000	/* should the VM suppress accounting */
 #define VM_HUGETLB	0x00400000	/* Huge TLB Page VM */
 #define VM_NONLINEAR	0x00800000	/* Is non-linear (remap_file_pages) */
+#ifdef CONFIG_MMU
+#define VM_HUGEPAGE	0x01000000	/* MADV_HUGEPAGE marked this vma */
+#else
 #define VM_MAPPED_COPY	0x01000000	/* T if mapped copy of data (nommu mmap) */
+#endif
 #define VM_INSERTPAGE	0x02000000	/* The vma has had "vm_insert_page()" done on it */
 #define VM_ALWAYSDUMP	0x04000000	/* Always include in core dumps */
 
 #define VM_CAN_NONLINEAR 0x08000000	/* Has ->fault & does nonlinear pages */
 #define VM_MIXEDMAP	0x10000000	/* Can contain "struct page" and pure PFN pages */
 #define VM_SAO		0x20000000	/* Strong Access Ordering (powerpc) */
+#define VM_NOHUGEPAGE	0x40000000	/* MADV_NOHUGEPAGE marked this vma */
+#define VM_MERGEABLE	0x80000000	/* KSM may merge identical pages */
 
 #ifndef VM_STACK_DEFAULT_FLAGS		/* arch can override this */
 #define VM_STACK_DEFAULT_FLAGS VM_DATA_DEFAULT_FLAGS
@@ -620,11 +626,18 @@ void page_address_init(void);
  * page->mapping points to its anon_vma, not to a struct address_space;
  * with the PAGE_MAPPING_ANON bit set to distinguish it.
  *
+ * On an anonymous page in a VM_MERGEABLE area, if CONFIG_KSM is enabled,
+ * the PAGE_MAPPING_KSM bit may be set along with the PAGE_MAPPING_ANON bit;
+ * and then page->mapping points, not to an anon_vma, but to a private
+ * structure which KSM associates with that merged page.  See ksm.h.
+ *
  * Please note that, confusingly, "page_mapping" refers to the inode
  * address_space which maps the page from disk; whereas "page_mapped"
  * refers to user virtual address space into which the page is mapped.
  */
 #define PAGE_MAPPING_ANON	1
+#define PAGE_MAPPING_KSM	2
+#define PAGE_MAPPING_FLAGS	(PAGE_MAPPING_ANON | PAGE_MAPPING_KSM)
 
 extern struct address_space swapper_space;
 static inline struct address_space *page_mapping(struct page *page)
@@ -696,6 +709,7 @@ static inline int page_mapped(struct page *page)
 
 #define VM_FAULT_NOPAGE	0x0100	/* ->fault installed the pte, not return page */
 #define VM_FAULT_LOCKED	0x0200	/* ->fault locked the returned page */
+#define VM_FAULT_FALLBACK 0x0400	/* huge page fault failed, use small pages */
 
 #define VM_FAULT_ERROR	(VM_FAULT_OOM | VM_FAULT_SIGBUS)
 
@@ -768,6 +782,7 @@ struct mm_walk {
 	int (*pmd_entry)(pmd_t *, unsigned long, unsigned long, struct mm_walk *);
 	int (*pte_entry)(pte_t *, unsigned long, unsigned long, struct mm_walk *);
 	int (*pte_hole)(unsigned long, unsigned long, struct mm_walk *);
+	int (*huge_pmd_entry)(pmd_t *, unsigned long, unsigned long, struct mm_walk *);
 	struct mm_struct *mm;
 	void *private;
 };
@@ -778,6 +793,38 @@ void free_pgd_range(struct mmu_gather *tlb, unsigned long addr,
 		unsigned long end, unsigned long floor, unsigned long ceiling);
 int copy_page_range(struct mm_struct *dst, struct mm_struct *src,
 			struct vm_area_struct *vma);
+#ifdef CONFIG_FORK_SHARE_PTES
+extern int sysctl_fork_share_ptes;
+extern int __unshare_pte_table(struct vm_area_struct *vma, pmd_t *pmd,
+			       unsigned long address);
+extern int unshare_pte_range(struct vm_area_struct *vma, unsigned long addr,
+			     unsigned long end);
+
+/*
+ * Before changing a pte in a table which fork left shared with another
+ * mm, the mm has to get its own copy.  Called with mmap_sem held; fails
+ * only with -ENOMEM.
+ */
+static inline int unshare_pte_table(struct vm_area_struct *vma, pmd_t *pmd,
+				    unsigned long address)
+{
+	if (likely(!pmd_ptes_shared(*pmd)))
+		return 0;
+	return __unshare_pte_table(vma, pmd, address);
+}
+#else
+static inline int unshare_pte_table(struct vm_area_struct *vma, pmd_t *pmd,
+				    unsigned long address)
+{
+	return 0;
+}
+
+static inline int unshare_pte_range(struct vm_area_struct *vma,
+				    unsigned long addr, unsigned long end)
+{
+	return 0;
+}
+#endif
 void unmap_mapping_range(struct address_space *mapping,
 		loff_t const holebegin, loff_t const holelen, int even_cows);
 int generic_access_phys(struct vm_area_struct *vma, unsigned long addr,
@@ -806,6 +853,41 @@ static inline int handle_mm_fault(struct mm_struct *mm,
 }
 #endif
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+extern int handle_speculative_fault(struct mm_struct *mm,
+			unsigned long address, int write_access);
+
+/*
+ * Changes to a vma's layout, flags, protection or policy are bracketed
+ * by these, under mmap_sem held for write (or for read and the anon_vma
+ * lock, when a stack expands), so a speculative fault can tell that the
+ * vma changed under it.
+ */
+static inline void vm_write_begin(struct vm_area_struct *vma)
+{
+	write_seqcount_begin(&vma->vm_sequence);
+}
+
+static inline void vm_write_end(struct vm_area_struct *vma)
+{
+	write_seqcount_end(&vma->vm_sequence);
+}
+#else
+static inline int handle_speculative_fault(struct mm_struct *mm,
+			unsigned long address, int write_access)
+{
+	return -EAGAIN;
+}
+
+static inline void vm_write_begin(struct vm_area_struct *vma)
+{
+}
+
+static inline void vm_write_end(struct vm_area_struct *vma)
+{
+}
+#endif
+
 extern int make_pages_present(unsigned long addr, unsigned long end);
 extern int access_process_vm(struct task_struct *tsk, unsigned long addr, void *buf, int len, int write);
 
@@ -832,6 +914,10 @@ extern unsigned long do_mremap(unsigned long addr,
 extern int mprotect_fixup(struct vm_area_struct *vma,
 			  struct vm_area_struct **pprev, unsigned long start,
 			  unsigned long end, unsigned long newflags);
+#ifdef CONFIG_NUMA_BALANCING
+extern unsigned long change_prot_numa(struct vm_area_struct *vma,
+				      unsigned long start, unsigned long end);
+#endif
 
 /*
  * get_user_pages_fast provides equivalent functionality to get_user_pages,
@@ -1067,7 +1153,7 @@ static inline void vma_nonlinear_insert(struct vm_area_struct *vma,
 
 /* mmap.c */
 extern int __vm_enough_memory(struct mm_struct *mm, long pages, int cap_sys_admin);
-extern void vma_adjust(struct vm_area_struct *vma, unsigned long start,
+extern int vma_adjust(struct vm_area_struct *vma, unsigned long start,
 	unsigned long end, pgoff_t pgoff, struct vm_area_struct *insert);
 extern struct vm_area_struct *vma_merge(struct mm_struct *,
 	struct vm_area_struct *prev, unsigned long addr, unsigned long end,
@@ -1177,6 +1263,10 @@ extern int expand_stack_downwards(struct vm_area_struct *vma,
 
 /* Look up the first VMA which satisfies  addr < vm_end,  NULL if none. */
 extern struct vm_area_struct * find_vma(struct mm_struct * mm, unsigned long addr);
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+extern struct vm_area_struct *find_vma_speculative(struct mm_struct *mm,
+					unsigned long addr, unsigned *seq);
+#endif
 extern struct vm_area_struct * find_vma_prev(struct mm_struct * mm, unsigned long addr,
 					     struct vm_area_struct **pprev);
 
@@ -1285,5 +1375,7 @@ int vmemmap_populate_basepages(struct page *start_page,
 int vmemmap_populate(struct page *start_page, unsigned long pages, int node);
 void vmemmap_populate_print_last(void);
 
+#include <linux/huge_mm.h>
+
 #endif /* __KERNEL__ */
 #endif /* _LINUX_MM_H */
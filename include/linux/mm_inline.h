@@ -23,9 +23,220 @@ static inline int page_is_file_cache(struct page *page)
 	return LRU_FILE;
 }
 
+#ifdef CONFIG_LRU_GEN
+extern int lru_gen_enabled_flag;
+
+static inline int lru_gen_enabled(void)
+{
+	return lru_gen_enabled_flag;
+}
+
+/*
+ * Which generation @page is on, or -1 if it is not on a multi-gen LRU
+ * list.  The generation is only set while the page is on one, and only
+ * changed under zone->lru_lock.
+ */
+static inline int page_lru_gen(struct page *page)
+{
+	return (int)((page->flags & __PG_LRU_GEN) >> PG_lru_gen) - 1;
+}
+
+static inline void set_page_lru_gen(struct page *page, int gen)
+{
+	unsigned long old, new;
+
+	do {
+		old = page->flags;
+		new = (old & ~(unsigned long)__PG_LRU_GEN) |
+			((unsigned long)(gen + 1) << PG_lru_gen);
+	} while (cmpxchg(&page->flags, old, new) != old);
+}
+
+static inline int lru_gen_is_active(struct zone *zone, int gen)
+{
+	unsigned long max_seq = zone->lrugen.max_seq;
+
+	return gen == max_seq % MAX_NR_GENS ||
+		gen == (max_seq - 1) % MAX_NR_GENS;
+}
+
+/* The classic LRU list whose statistics generation @gen is counted in. */
+static inline enum lru_list lru_gen_lru(struct zone *zone, int gen, int file)
+{
+	enum lru_list l = LRU_BASE + file * LRU_FILE;
+
+	if (lru_gen_is_active(zone, gen))
+		l += LRU_ACTIVE;
+	return l;
+}
+
+static inline void
+lru_gen_update_size(struct zone *zone, struct page *page, int gen, int delta)
+{
+	int file = !!page_is_file_cache(page);
+
+	zone->lrugen.nr_pages[gen][file] += delta;
+	__mod_zone_page_state(zone, NR_LRU_BASE + lru_gen_lru(zone, gen, file),
+			      delta);
+}
+
+/*
+ * Put @page, which add_page_to_lru_list() was asked to put on @l, on the
+ * youngest generation if @l is an active list and on the oldest otherwise.
+ * Returns 0, leaving the page to the classic lists, if the multi-gen LRU
+ * is disabled or the page is unevictable.
+ */
+static inline int
+lru_gen_add_page(struct zone *zone, struct page *page, enum lru_list l)
+{
+	struct lru_gen *lrugen = &zone->lrugen;
+	int file = is_file_lru(l);
+	int gen;
+
+	if (!lru_gen_enabled() || is_unevictable_lru(l))
+		return 0;
+
+	if (is_active_lru(l)) {
+		ClearPageActive(page);
+		gen = lrugen->max_seq % MAX_NR_GENS;
+	} else
+		gen = lrugen->min_seq[file] % MAX_NR_GENS;
+
+	set_page_lru_gen(page, gen);
+	lru_gen_update_size(zone, page, gen, 1);
+	list_add(&page->lru, &lrugen->lists[gen][file]);
+	return 1;
+}
+
+/*
+ * Take @page off its generation, if it is on one.  A page still in one of
+ * the youngest generations leaves with PageActive set when @set_active,
+ * as if it had been on an active list.
+ */
+static inline int
+lru_gen_del_page(struct zone *zone, struct page *page, int set_active)
+{
+	int gen = page_lru_gen(page);
+
+	if (gen < 0)
+		return 0;
+
+	list_del(&page->lru);
+	lru_gen_update_size(zone, page, gen, -1);
+	if (set_active && lru_gen_is_active(zone, gen))
+		SetPageActive(page);
+	set_page_lru_gen(page, -1);
+	return 1;
+}
+
+/*
+ * __isolate_lru_page() took @page off the LRU.  Its callers move it off
+ * the list and fix up the vmstat counts themselves, from PageActive, so
+ * only the generation needs dropping here.
+ */
+static inline void lru_gen_isolate_page(struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	int gen = page_lru_gen(page);
+
+	if (gen < 0)
+		return;
+
+	if (lru_gen_is_active(zone, gen))
+		SetPageActive(page);
+	zone->lrugen.nr_pages[gen][!!page_is_file_cache(page)]--;
+	set_page_lru_gen(page, -1);
+}
+
+/*
+ * Move @page to generation @gen, at the head of its list: where the page
+ * will be found last by reclaim.
+ */
+static inline void lru_gen_move_page(struct zone *zone, struct page *page,
+				     int gen)
+{
+	int file = !!page_is_file_cache(page);
+
+	lru_gen_update_size(zone, page, page_lru_gen(page), -1);
+	set_page_lru_gen(page, gen);
+	lru_gen_update_size(zone, page, gen, 1);
+	list_move(&page->lru, &zone->lrugen.lists[gen][file]);
+}
+
+/*
+ * Whether @page is on the youngest generation already, so that there is
+ * nothing for activate_page() to do.  Racy, for use without the lru_lock.
+ */
+static inline int lru_gen_page_youngest(struct page *page)
+{
+	int gen = page_lru_gen(page);
+
+	return gen >= 0 && gen == page_zone(page)->lrugen.max_seq % MAX_NR_GENS;
+}
+
+/*
+ * rotate_reclaimable_page() for a page on a generation: move it to the
+ * tail of the oldest one, unless it has been used since it was written.
+ */
+static inline int lru_gen_rotate_page(struct zone *zone, struct page *page)
+{
+	int gen = page_lru_gen(page);
+	int file;
+
+	if (gen < 0)
+		return 0;
+
+	if (!lru_gen_is_active(zone, gen)) {
+		file = !!page_is_file_cache(page);
+		gen = zone->lrugen.min_seq[file] % MAX_NR_GENS;
+		lru_gen_move_page(zone, page, gen);
+		list_move_tail(&page->lru, &zone->lrugen.lists[gen][file]);
+	}
+	return 1;
+}
+#else /* !CONFIG_LRU_GEN */
+static inline int lru_gen_enabled(void)
+{
+	return 0;
+}
+
+static inline int page_lru_gen(struct page *page)
+{
+	return -1;
+}
+
+static inline int
+lru_gen_add_page(struct zone *zone, struct page *page, enum lru_list l)
+{
+	return 0;
+}
+
+static inline int
+lru_gen_del_page(struct zone *zone, struct page *page, int set_active)
+{
+	return 0;
+}
+
+static inline void lru_gen_isolate_page(struct page *page)
+{
+}
+
+static inline int lru_gen_page_youngest(struct page *page)
+{
+	return 0;
+}
+
+static inline int lru_gen_rotate_page(struct zone *zone, struct page *page)
+{
+	return 0;
+}
+#endif /* CONFIG_LRU_GEN */
+
 static inline void
 add_page_to_lru_list(struct zone *zone, struct page *page, enum lru_list l)
 {
+	if (lru_gen_add_page(zone, page, l))
+		return;
 	list_add(&page->lru, &zone->lru[l].list);
 	__inc_zone_state(zone, NR_LRU_BASE + l);
 }
@@ -33,6 +244,8 @@ add_page_to_lru_list(struct zone *zone, struct page *page, enum lru_list l)
 static inline void
 del_page_from_lru_list(struct zone *zone, struct page *page, enum lru_list l)
 {
+	if (lru_gen_del_page(zone, page, 1))
+		return;
 	list_del(&page->lru);
 	__dec_zone_state(zone, NR_LRU_BASE + l);
 }
@@ -42,6 +255,8 @@ del_page_from_lru(struct zone *zone, struct page *page)
 {
 	enum lru_list l = LRU_BASE;
 
+	if (lru_gen_del_page(zone, page, 0))
+		return;
 	list_del(&page->lru);
 	if (PageUnevictable(page)) {
 		__ClearPageUnevictable(page);
@@ -69,6 +284,11 @@ static inline enum lru_list page_lru(struct page *page)
 
 	if (PageUnevictable(page))
 		lru = LRU_UNEVICTABLE;
+#ifdef CONFIG_LRU_GEN
+	else if (page_lru_gen(page) >= 0)
+		lru = lru_gen_lru(page_zone(page), page_lru_gen(page),
+				  !!page_is_file_cache(page));
+#endif
 	else {
 		if (PageActive(page))
 			lru += LRU_ACTIVE;
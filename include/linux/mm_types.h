@@ -9,8 +9,11 @@
 #include <linux/prio_tree.h>
 #include <linux/rbtree.h>
 #include <linux/rwsem.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
 #include <linux/completion.h>
 #include <linux/cpumask.h>
+#include <linux/workqueue.h>
 #include <asm/page.h>
 #include <asm/mmu.h>
 
@@ -138,7 +141,8 @@ struct vm_area_struct {
 	 * can only be in the i_mmap tree.  An anonymous MAP_PRIVATE, stack
 	 * or brk vma (with NULL file) can only be in an anon_vma list.
 	 */
-	struct list_head anon_vma_node;	/* Serialized by anon_vma->lock */
+	struct list_head anon_vma_chain; /* Serialized by mmap_sem &
+					  * page_table_lock */
 	struct anon_vma *anon_vma;	/* Serialized by page_table_lock */
 
 	/* Function pointers to deal with this struct. */
@@ -157,6 +161,15 @@ struct vm_area_struct {
 #ifdef CONFIG_NUMA
 	struct mempolicy *vm_policy;	/* NUMA policy for the VMA */
 #endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	/*
+	 * Bumped around changes to the fields above that a fault depends
+	 * on, and left odd once the vma is unlinked; the vma itself is
+	 * freed by RCU.  See handle_speculative_fault().
+	 */
+	seqcount_t vm_sequence;
+	struct rcu_head vm_rcu;
+#endif
 };
 
 struct core_thread {
@@ -229,6 +242,23 @@ struct mm_struct {
 
 	unsigned long flags; /* Must use atomic bitops to access the bits */
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	/* pte tables set aside for splitting huge pmds, see mm/huge_memory.c */
+	struct list_head pmd_huge_pte;
+#endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	seqcount_t mm_rb_seq;		/* mm_rb is being changed */
+	seqcount_t mm_remap_seq;	/* mremap is moving page tables */
+#endif
+#ifdef CONFIG_LRU_GEN
+	struct list_head lru_gen_list;	/* kswapd ages the page tables of these */
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	unsigned long numa_next_scan;	/* jiffies of the next hinting scan */
+	unsigned long numa_scan_offset;	/* where the next scan starts */
+	int numa_scan_seq;		/* completed passes over the mm */
+#endif
+
 	struct core_state *core_state; /* coredumping support */
 
 	/* aio bits */
@@ -256,6 +286,7 @@ struct mm_struct {
 #ifdef CONFIG_MMU_NOTIFIER
 	struct mmu_notifier_mm *mmu_notifier_mm;
 #endif
+	struct work_struct async_put_work;	/* see mmput() */
 };
 
 #endif /* _LINUX_MM_TYPES_H */
@@ -107,6 +107,8 @@ enum zone_stat_item {
 	NR_VMSCAN_WRITE,
 	/* Second 128 byte cacheline */
 	NR_WRITEBACK_TEMP,	/* Writeback using temporary buffers */
+	WORKINGSET_REFAULT,	/* evicted file pages read back in */
+	WORKINGSET_ACTIVATE,	/* ... and found to be in the working set */
 #ifdef CONFIG_NUMA
 	NUMA_HIT,		/* allocated in intended node */
 	NUMA_MISS,		/* allocated in non intended node */
@@ -166,6 +168,28 @@ static inline int is_unevictable_lru(enum lru_list l)
 #endif
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * With the multi-generational LRU, evictable pages are not on the active
+ * and inactive lists but on one of up to MAX_NR_GENS generations of their
+ * type (anon in [0], file in [1]).  Sequence numbers run from min_seq[type],
+ * the oldest generation and the one reclaim evicts from, to max_seq, the
+ * youngest, shared by both types; a generation's lists are indexed by its
+ * sequence number modulo MAX_NR_GENS.  The youngest MIN_NR_GENS generations
+ * are accounted as active pages and never evicted: reclaim has to age the
+ * zone, starting a new generation, before it can take from them.
+ */
+#define MIN_NR_GENS	2
+#define MAX_NR_GENS	4
+
+struct lru_gen {
+	unsigned long max_seq;
+	unsigned long min_seq[2];
+	struct list_head lists[MAX_NR_GENS][2];
+	unsigned long nr_pages[MAX_NR_GENS][2];
+};
+#endif
+
 struct per_cpu_pages {
 	int count;		/* number of pages in the list */
 	int high;		/* high watermark, emptying needed */
@@ -323,6 +347,9 @@ struct zone {
 		struct list_head list;
 		unsigned long nr_scan;
 	} lru[NR_LRU_LISTS];
+#ifdef CONFIG_LRU_GEN
+	struct lru_gen		lrugen;
+#endif
 
 	/*
 	 * The pageout code in vmscan.c keeps track of how many of the
@@ -335,6 +362,13 @@ struct zone {
 	unsigned long		recent_rotated[2];
 	unsigned long		recent_scanned[2];
 
+	/*
+	 * Clock of evictions and activations of file pages, from which
+	 * the refault distance of evicted pages is measured: see
+	 * mm/workingset.c.
+	 */
+	atomic_long_t		inactive_age;
+
     /*
      * specify how many pages were unsuccessflly scanned since the last time 
      * a page was swapped out 
@@ -370,6 +404,15 @@ struct zone {
 	 */
 	unsigned int inactive_ratio;
 
+#ifdef CONFIG_COMPACTION
+	/*
+	 * After a failed direct compaction, the next 1 << compact_defer_shift
+	 * attempts on this zone are skipped.  See compaction_deferred().
+	 */
+	unsigned int		compact_considered;
+	unsigned int		compact_defer_shift;
+#endif
+
 
 	ZONE_PADDING(_pad2_)
 	/* Rarely used or read-mostly fields */
@@ -100,6 +100,10 @@ enum pageflags {
 #endif
 #ifdef CONFIG_IA64_UNCACHED_ALLOCATOR
 	PG_uncached,		/* Page has been mapped as uncached */
+#endif
+#ifdef CONFIG_LRU_GEN
+	PG_lru_gen,		/* 1 + generation on the multi-gen LRU, */
+	PG_lru_gen_last = PG_lru_gen + 2,	/* three bits */
 #endif
 	__NR_PAGEFLAGS,
 
@@ -372,10 +376,16 @@ static inline void __ClearPageTail(struct page *page)
 #define __PG_MLOCKED		0
 #endif
 
+#ifdef CONFIG_LRU_GEN
+#define __PG_LRU_GEN		(7 << PG_lru_gen)
+#else
+#define __PG_LRU_GEN		0
+#endif
+
 #define PAGE_FLAGS	(1 << PG_lru   | 1 << PG_private   | 1 << PG_locked | \
 			 1 << PG_buddy | 1 << PG_writeback | \
 			 1 << PG_slab  | 1 << PG_swapcache | 1 << PG_active | \
-			 __PG_UNEVICTABLE | __PG_MLOCKED)
+			 __PG_UNEVICTABLE | __PG_MLOCKED | __PG_LRU_GEN)
 
 /*
  * Flags checked in bad_page().  Pages on the free list should not have
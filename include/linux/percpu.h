@@ -65,6 +65,41 @@
 
 #ifdef CONFIG_SMP
 
+#ifdef CONFIG_HAVE_DYNAMIC_PER_CPU_AREA
+
+/*
+ * Dynamic percpu areas live in chunks laid out like the static percpu
+ * area: one unit per cpu, each unit the same distance from the next.
+ * A dynamic percpu pointer therefore relocates to any cpu's copy the
+ * same way a static one does, by adding per_cpu_offset().
+ *
+ * Every unit is at least PCPU_MIN_UNIT_SIZE, which is also the largest
+ * allocation supported.  The first chunk, which holds the static percpu
+ * data, leaves PERCPU_DYNAMIC_RESERVE bytes free for modules and early
+ * dynamic allocations.
+ */
+#define PCPU_MIN_UNIT_SIZE		(16UL << PAGE_SHIFT)
+
+#if BITS_PER_LONG > 32
+#define PERCPU_DYNAMIC_RESERVE		(20 << 10)
+#else
+#define PERCPU_DYNAMIC_RESERVE		(12 << 10)
+#endif
+
+extern void *pcpu_base_addr;
+extern size_t pcpu_unit_size;
+
+extern size_t __init pcpu_embed_first_chunk(size_t static_size,
+					    size_t dyn_size);
+
+#define per_cpu_ptr(ptr, cpu)	SHIFT_PERCPU_PTR((ptr), per_cpu_offset((cpu)))
+#define percpu_ptr(ptr, cpu)	per_cpu_ptr((ptr), (cpu))
+
+extern void *__alloc_percpu(size_t size, size_t align);
+extern void free_percpu(void *__pdata);
+
+#else /* CONFIG_HAVE_DYNAMIC_PER_CPU_AREA */
+
 struct percpu_data {
 	void *ptrs[1];
 };
@@ -85,6 +120,8 @@ struct percpu_data {
 extern void *__percpu_alloc_mask(size_t size, gfp_t gfp, cpumask_t *mask);
 extern void percpu_free(void *__pdata);
 
+#endif /* CONFIG_HAVE_DYNAMIC_PER_CPU_AREA */
+
 #else /* CONFIG_SMP */
 
 #define percpu_ptr(ptr, cpu) ({ (void)(cpu); (ptr); })
@@ -102,6 +139,8 @@ static inline void percpu_free(void *__pdata)
 
 #endif /* CONFIG_SMP */
 
+#if !defined(CONFIG_SMP) || !defined(CONFIG_HAVE_DYNAMIC_PER_CPU_AREA)
+
 #define percpu_alloc_mask(size, gfp, mask) \
 	__percpu_alloc_mask((size), (gfp), &(mask))
 
@@ -109,10 +148,14 @@ static inline void percpu_free(void *__pdata)
 
 /* (legacy) interface for use without CPU hotplug handling */
 
-#define __alloc_percpu(size)	percpu_alloc_mask((size), GFP_KERNEL, \
+#define __alloc_percpu(size, align)	percpu_alloc_mask((size), GFP_KERNEL, \
 						  cpu_possible_map)
-#define alloc_percpu(type)	(type *)__alloc_percpu(sizeof(type))
 #define free_percpu(ptr)	percpu_free((ptr))
 #define per_cpu_ptr(ptr, cpu)	percpu_ptr((ptr), (cpu))
 
+#endif
+
+#define alloc_percpu(type)	(type *)__alloc_percpu(sizeof(type), \
+						       __alignof__(type))
+
 #endif /* __LINUX_PERCPU_H */
@@ -53,6 +53,25 @@ static inline int radix_tree_is_indirect_ptr(void *ptr)
 	return (int)((unsigned long)ptr & RADIX_TREE_INDIRECT_PTR);
 }
 
+/*
+ * An exceptional entry is a value stored in a slot in place of an item:
+ * the page cache uses them to remember pages it has evicted.  They have
+ * the second lowest bit set, which no item pointer can have, and carry
+ * their payload above RADIX_TREE_EXCEPTIONAL_SHIFT.
+ *
+ * Exceptional entries are not items: radix_tree_gang_lookup and friends
+ * skip over them, and radix_tree_next_hole treats them as holes.  Only
+ * radix_tree_lookup, radix_tree_lookup_slot and
+ * radix_tree_gang_lookup_exceptional return them.
+ */
+#define RADIX_TREE_EXCEPTIONAL_ENTRY	2
+#define RADIX_TREE_EXCEPTIONAL_SHIFT	2
+
+static inline int radix_tree_exceptional_entry(void *arg)
+{
+	return !!((unsigned long)arg & RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
 /*** radix-tree API starts here ***/
 
 #define RADIX_TREE_MAX_TAGS 2
@@ -103,11 +122,12 @@ do {									\
  * radix_tree_tag_get
  * radix_tree_gang_lookup
  * radix_tree_gang_lookup_slot
+ * radix_tree_gang_lookup_exceptional
  * radix_tree_gang_lookup_tag
  * radix_tree_gang_lookup_tag_slot
  * radix_tree_tagged
  *
- * The first 7 functions are able to be called locklessly, using RCU. The
+ * The first 8 functions are able to be called locklessly, using RCU. The
  * caller must ensure calls to these functions are made within rcu_read_lock()
  * regions. Other readers (lock-free or otherwise) and modifications may be
  * running concurrently.
@@ -165,6 +185,10 @@ radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 unsigned int
 radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
 			unsigned long first_index, unsigned int max_items);
+unsigned int
+radix_tree_gang_lookup_exceptional(struct radix_tree_root *root,
+			void **results, unsigned long *indices,
+			unsigned long first_index, unsigned int max_items);
 unsigned long radix_tree_next_hole(struct radix_tree_root *root,
 				unsigned long index, unsigned long max_scan);
 int radix_tree_preload(gfp_t gfp_mask);
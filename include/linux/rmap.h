@@ -20,12 +20,24 @@
  * directly to a vma: instead it points to an anon_vma, on whose list
  * the related vmas can be easily linked or unlinked.
  *
+ * Each process gets a new anon_vma for its private vmas when it forks,
+ * so a page faulted after the fork points to an anon_vma which lists
+ * only the vmas of that process and its own descendants, not those of
+ * its parent and siblings: see anon_vma_chain below.  All the anon_vmas
+ * descended from one root share the root's lock.
+ *
  * After unlinking the last vma on the list, we must garbage collect
  * the anon_vma object itself: we're guaranteed no page can be
  * pointing to this anon_vma once its vma list is empty.
  */
 struct anon_vma {
-	spinlock_t lock;	/* Serialize access to vma list */
+	struct anon_vma *root;	/* Root of this anon_vma tree */
+	spinlock_t lock;	/* Serialize access to vma list: root's only */
+	/*
+	 * References other than from vmas: from the other anon_vmas of
+	 * the tree on their root, and from KSM's rmap_items.
+	 */
+	atomic_t refcount;
 	/*
 	 * NOTE: the LSB of the head.next is set by
 	 * mm_take_all_locks() _after_ taking the above lock. So the
@@ -34,23 +46,86 @@ struct anon_vma {
 	 * is serialized by a system wide lock only visible to
 	 * mm_take_all_locks() (mm_all_locks_mutex).
 	 */
-	struct list_head head;	/* List of private "related" vmas */
+	struct list_head head;	/* Chain of private "related" vmas */
+};
+
+/*
+ * The copy-on-write semantics of fork mean that an anon_vma
+ * can become associated with multiple processes. Furthermore,
+ * each child process will have its own anon_vma, where new
+ * pages for that process are instantiated.
+ *
+ * This structure allows us to find the anon_vmas associated
+ * with a VMA, or the VMAs associated with an anon_vma.
+ * The "same_vma" list contains the anon_vma_chains linking
+ * all the anon_vmas associated with this VMA.
+ * The "same_anon_vma" list contains the anon_vma_chains
+ * which link all the VMAs associated with this anon_vma.
+ */
+struct anon_vma_chain {
+	struct vm_area_struct *vma;
+	struct anon_vma *anon_vma;
+	struct list_head same_vma;	/* locked by mmap_sem & page_table_lock */
+	struct list_head same_anon_vma;	/* locked by anon_vma->root->lock */
 };
 
 #ifdef CONFIG_MMU
+extern struct kmem_cache *anon_vma_cachep;
 
-static inline void anon_vma_lock(struct vm_area_struct *vma)
+static inline struct anon_vma *anon_vma_alloc(void)
+{
+	struct anon_vma *anon_vma;
+
+	anon_vma = kmem_cache_alloc(anon_vma_cachep, GFP_KERNEL);
+	if (anon_vma)
+		anon_vma->root = anon_vma;
+	return anon_vma;
+}
+
+static inline void anon_vma_free(struct anon_vma *anon_vma)
+{
+	kmem_cache_free(anon_vma_cachep, anon_vma);
+}
+
+static inline void anon_vma_lock(struct anon_vma *anon_vma)
+{
+	spin_lock(&anon_vma->root->lock);
+}
+
+static inline void anon_vma_unlock(struct anon_vma *anon_vma)
+{
+	spin_unlock(&anon_vma->root->lock);
+}
+
+static inline void vma_lock_anon_vma(struct vm_area_struct *vma)
 {
 	struct anon_vma *anon_vma = vma->anon_vma;
 	if (anon_vma)
-		spin_lock(&anon_vma->lock);
+		anon_vma_lock(anon_vma);
 }
 
-static inline void anon_vma_unlock(struct vm_area_struct *vma)
+static inline void vma_unlock_anon_vma(struct vm_area_struct *vma)
 {
 	struct anon_vma *anon_vma = vma->anon_vma;
 	if (anon_vma)
-		spin_unlock(&anon_vma->lock);
+		anon_vma_unlock(anon_vma);
+}
+
+static inline void get_anon_vma(struct anon_vma *anon_vma)
+{
+	atomic_inc(&anon_vma->refcount);
+}
+
+/*
+ * The anon_vma an anonymous page points to, or NULL for a KSM page
+ * or a page which is not anonymous.
+ */
+static inline struct anon_vma *page_anon_vma(struct page *page)
+{
+	if (((unsigned long)page->mapping & PAGE_MAPPING_FLAGS) !=
+					    PAGE_MAPPING_ANON)
+		return NULL;
+	return (void *)page->mapping - PAGE_MAPPING_ANON;
 }
 
 /*
@@ -58,10 +133,11 @@ static inline void anon_vma_unlock(struct vm_area_struct *vma)
  */
 void anon_vma_init(void);	/* create anon_vma_cachep */
 int  anon_vma_prepare(struct vm_area_struct *);
-void __anon_vma_merge(struct vm_area_struct *, struct vm_area_struct *);
-void anon_vma_unlink(struct vm_area_struct *);
-void anon_vma_link(struct vm_area_struct *);
-void __anon_vma_link(struct vm_area_struct *);
+void unlink_anon_vmas(struct vm_area_struct *);
+int anon_vma_clone(struct vm_area_struct *, struct vm_area_struct *);
+int anon_vma_fork(struct vm_area_struct *, struct vm_area_struct *);
+void anon_vma_merge(struct vm_area_struct *, struct vm_area_struct *);
+void put_anon_vma(struct anon_vma *);
 
 extern struct anon_vma *page_lock_anon_vma(struct page *page);
 extern void page_unlock_anon_vma(struct anon_vma *anon_vma);
@@ -89,6 +165,15 @@ static inline void page_dup_rmap(struct page *page, struct vm_area_struct *vma,
 int page_referenced(struct page *, int is_locked, struct mem_cgroup *cnt);
 int try_to_unmap(struct page *, int ignore_refs);
 
+/*
+ * Called by mm/ksm.c to reverse-map KSM pages through their rmap_items
+ */
+int page_referenced_one(struct page *, struct vm_area_struct *,
+			unsigned long address, unsigned int *mapcount);
+int try_to_unmap_one(struct page *, struct vm_area_struct *,
+			unsigned long address, int migration);
+int try_to_mlock_page(struct page *, struct vm_area_struct *);
+
 /*
  * Called from mm/filemap_xip.c to unmap empty zero page
  */
@@ -125,7 +210,6 @@ static inline int try_to_munlock(struct page *page)
 
 #define anon_vma_init()		do {} while (0)
 #define anon_vma_prepare(vma)	(0)
-#define anon_vma_link(vma)	do {} while (0)
 
 #define page_referenced(page,l,cnt) TestClearPageReferenced(page)
 #define try_to_unmap(page, refs) SWAP_FAIL
@@ -419,6 +419,13 @@ extern int get_dumpable(struct mm_struct *mm);
 # define MMF_DUMP_MASK_DEFAULT_ELF	0
 #endif
 
+#define MMF_VM_HUGEPAGE		9	/* mm is on the khugepaged scan list */
+#define MMF_VM_MERGEABLE	10	/* mm is on the ksmd scan list */
+#define MMF_OOM_VICTIM		11	/* mm belongs to an OOM-killed task */
+
+/* Bits inherited by a new mm from the one that created it */
+#define MMF_INIT_MASK		(((1 << MMF_DUMPABLE_BITS) - 1) | MMF_DUMP_FILTER_MASK)
+
 struct sighand_struct {
 	atomic_t		count;
 	struct k_sigaction	action[_NSIG];
@@ -1328,6 +1335,14 @@ struct task_struct {
 #ifdef CONFIG_NUMA
 	struct mempolicy *mempolicy;
 	short il_next;
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	int numa_scan_seq;		/* mm->numa_scan_seq at last placement */
+	unsigned int numa_scan_period;	/* ms of runtime between scans */
+	u64 node_stamp;			/* runtime at the last scan request */
+	int numa_preferred_nid;		/* node most of our faults are on */
+	unsigned long *numa_faults;	/* hinting faults per node, decaying */
+	unsigned long numa_faults_locality[2];	/* local, migrated */
 #endif
 	atomic_t fs_excl;	/* holding fs exclusive resources */
 	struct rcu_head rcu;
@@ -1689,6 +1704,28 @@ int sched_rt_handler(struct ctl_table *table, int write,
 
 extern unsigned int sysctl_sched_compat_yield;
 
+#ifdef CONFIG_NUMA_BALANCING
+extern int sysctl_numa_balancing;
+extern unsigned int sysctl_numa_balancing_scan_delay;
+extern unsigned int sysctl_numa_balancing_scan_period_min;
+extern unsigned int sysctl_numa_balancing_scan_period_max;
+extern unsigned int sysctl_numa_balancing_scan_size;
+
+extern void task_numa_work(void);
+extern void task_numa_fault(int node, int pages, int migrated);
+extern void task_numa_free(struct task_struct *p);
+#else
+static inline void task_numa_work(void)
+{
+}
+static inline void task_numa_fault(int node, int pages, int migrated)
+{
+}
+static inline void task_numa_free(struct task_struct *p)
+{
+}
+#endif
+
 #ifdef CONFIG_RT_MUTEXES
 extern int rt_mutex_getprio(struct task_struct *p);
 extern void rt_mutex_setprio(struct task_struct *p, int prio);
@@ -1881,6 +1918,7 @@ static inline void mmdrop(struct mm_struct * mm)
 
 /* mmput gets rid of the mappings and all user-space */
 extern void mmput(struct mm_struct *);
+extern int sysctl_async_teardown_mb;
 /* Grab a reference to a task's mm, if it is not already going away */
 extern struct mm_struct *get_task_mm(struct task_struct *task);
 /* Remove the current tasks stale references to the old mm_struct */
@@ -1640,6 +1640,7 @@ extern __wsum	       skb_copy_and_csum_bits(const struct sk_buff *skb,
 					      int offset, u8 *to, int len,
 					      __wsum csum);
 extern int             skb_splice_bits(struct sk_buff *skb,
+						struct sock *sk,
 						unsigned int offset,
 						struct pipe_inode_info *pipe,
 						unsigned int len,
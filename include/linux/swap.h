@@ -121,6 +121,7 @@ enum {
 	SWP_USED	= (1 << 0),	/* is slot in swap_info[] used? */
 	SWP_WRITEOK	= (1 << 1),	/* ok to write to this swap?	*/
 	SWP_ACTIVE	= (SWP_USED | SWP_WRITEOK),
+	SWP_BLKDEV	= (1 << 2),	/* its a block device */
 					/* add others here before... */
 	SWP_SCANNING	= (1 << 8),	/* refcount in scan_swap_map */
 };
@@ -171,12 +172,22 @@ extern unsigned int nr_free_pagecache_pages(void);
 #define nr_free_pages() global_page_state(NR_FREE_PAGES)
 
 
+/* linux/mm/workingset.c */
+extern void *workingset_eviction(struct address_space *mapping,
+				 struct page *page);
+extern int workingset_refault(void *shadow);
+extern void workingset_activation(struct page *page);
+extern void workingset_shadow_stored(struct address_space *mapping);
+extern void workingset_shadows_dropped(unsigned long nr);
+extern void workingset_forget_mapping(struct address_space *mapping);
+
 /* linux/mm/swap.c */
 extern void __lru_cache_add(struct page *, enum lru_list lru);
 extern void lru_cache_add_lru(struct page *, enum lru_list lru);
 extern void lru_cache_add_active_or_unevictable(struct page *,
 					struct vm_area_struct *);
 extern void activate_page(struct page *);
+extern void deactivate_page(struct page *page);
 extern void mark_page_accessed(struct page *);
 extern void lru_add_drain(void);
 extern int lru_add_drain_all(void);
@@ -214,6 +225,9 @@ extern unsigned long try_to_free_pages(struct zonelist *zonelist, int order,
 					gfp_t gfp_mask);
 extern unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *mem,
 							gfp_t gfp_mask);
+extern unsigned long mem_cgroup_shrink_zone(struct mem_cgroup *mem,
+					struct zone *zone, gfp_t gfp_mask,
+					int priority);
 extern int __isolate_lru_page(struct page *page, int mode, int file);
 extern unsigned long shrink_all_memory(unsigned long nr_pages);
 extern int vm_swappiness;
@@ -261,6 +275,24 @@ static inline int scan_unevictable_register_node(struct node *node)
 static inline void scan_unevictable_unregister_node(struct node *node) { }
 #endif
 
+#ifdef CONFIG_LRU_GEN
+extern void lru_gen_add_mm(struct mm_struct *mm);
+extern void lru_gen_del_mm(struct mm_struct *mm);
+extern void lru_gen_init_zone(struct zone *zone);
+#else
+static inline void lru_gen_add_mm(struct mm_struct *mm)
+{
+}
+
+static inline void lru_gen_del_mm(struct mm_struct *mm)
+{
+}
+
+static inline void lru_gen_init_zone(struct zone *zone)
+{
+}
+#endif
+
 extern int kswapd_run(int nid);
 
 #ifdef CONFIG_MMU
@@ -274,6 +306,7 @@ extern void swap_unplug_io_fn(struct backing_dev_info *, struct page *);
 /* linux/mm/page_io.c */
 extern int swap_readpage(struct file *, struct page *);
 extern int swap_writepage(struct page *page, struct writeback_control *wbc);
+extern int __swap_writepage(struct page *page, struct writeback_control *wbc);
 extern void end_swap_bio_read(struct bio *bio, int err);
 
 /* linux/mm/swap_state.c */
@@ -576,6 +576,8 @@ static inline void set_notify_resume(struct task_struct *task)
  */
 static inline void tracehook_notify_resume(struct pt_regs *regs)
 {
+	/* the scheduler tick asks for NUMA hinting scans this way */
+	task_numa_work();
 }
 #endif	/* TIF_NOTIFY_RESUME */
 
@@ -38,6 +38,10 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 		FOR_ALL_ZONES(PGSCAN_DIRECT),
 		PGINODESTEAL, SLABS_SCANNED, KSWAPD_STEAL, KSWAPD_INODESTEAL,
 		PAGEOUTRUN, ALLOCSTALL, PGROTATED,
+#ifdef CONFIG_COMPACTION
+		COMPACTBLOCKS, COMPACTPAGES, COMPACTPAGEFAILED,
+		COMPACTSTALL, COMPACTFAIL, COMPACTSUCCESS,
+#endif
 #ifdef CONFIG_HUGETLB_PAGE
 		HTLB_BUDDY_PGALLOC, HTLB_BUDDY_PGALLOC_FAIL,
 #endif
@@ -50,6 +54,27 @@ enum vm_event_item { PGPGIN, PGPGOUT, PSWPIN, PSWPOUT,
 		UNEVICTABLE_PGCLEARED,	/* on COW, page truncate */
 		UNEVICTABLE_PGSTRANDED,	/* unable to isolate on unlock */
 		UNEVICTABLE_MLOCKFREED,
+#endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		THP_FAULT_ALLOC,
+		THP_FAULT_FALLBACK,
+		THP_COLLAPSE_ALLOC,
+		THP_COLLAPSE_ALLOC_FAILED,
+		THP_SPLIT,
+#endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+		PGFAULT_SPECULATIVE,
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+		NUMA_PTE_UPDATES,	/* ptes armed for hinting faults */
+		NUMA_HINT_FAULTS,
+		NUMA_HINT_FAULTS_LOCAL,	/* page was on the faulting node */
+		NUMA_PAGE_MIGRATE,
+#endif
+#ifdef CONFIG_LRU_GEN
+		LRU_GEN_AGING,		/* new youngest generations */
+		LRU_GEN_MM_WALK,	/* page tables walked for aging */
+		LRU_GEN_PROMOTED,	/* young pages found by the walks */
 #endif
 		NR_VM_EVENT_ITEMS
 };
@@ -0,0 +1,39 @@
+#ifndef _LINUX_ZSWAP_H
+#define _LINUX_ZSWAP_H
+
+/*
+ * zswap: a compressed cache of swap pages, sitting between
+ * swap_writepage()/swap_readpage() and the swap device.
+ */
+
+#include <linux/types.h>
+#include <linux/errno.h>
+
+struct page;
+
+#ifdef CONFIG_ZSWAP
+extern int zswap_store(struct page *page);
+extern int zswap_load(struct page *page);
+extern void zswap_invalidate(unsigned type, pgoff_t offset);
+extern void zswap_swapoff(unsigned type);
+#else
+static inline int zswap_store(struct page *page)
+{
+	return -ENODEV;
+}
+
+static inline int zswap_load(struct page *page)
+{
+	return -ENOENT;
+}
+
+static inline void zswap_invalidate(unsigned type, pgoff_t offset)
+{
+}
+
+static inline void zswap_swapoff(unsigned type)
+{
+}
+#endif /* CONFIG_ZSWAP */
+
+#endif /* _LINUX_ZSWAP_H */
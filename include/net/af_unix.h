@@ -8,7 +8,9 @@
 
 extern void unix_inflight(struct file *fp);
 extern void unix_notinflight(struct file *fp);
+extern void unix_peek_inflight(struct file *fp);
 extern void unix_gc(void);
+extern void unix_gc_flush(void);
 extern void wait_for_unix_gc(void);
 
 #define UNIX_HASH_SIZE	256
@@ -28,6 +30,7 @@ struct unix_skb_parms {
 #ifdef CONFIG_SECURITY_NETWORK
 	u32			secid;		/* Security ID		*/
 #endif
+	u32			consumed;	/* Bytes already read	*/
 };
 
 #define UNIXCB(skb) 	(*(struct unix_skb_parms*)&((skb)->cb))
@@ -54,6 +57,7 @@ struct unix_sock {
 	struct list_head	link;
         atomic_long_t           inflight;
         spinlock_t		lock;
+	long			gc_refs;
 	unsigned int		gc_candidate : 1;
 	unsigned int		gc_maybe_cycle : 1;
         wait_queue_head_t       peer_wait;
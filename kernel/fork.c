@@ -59,6 +59,7 @@
 #include <linux/tty.h>
 #include <linux/proc_fs.h>
 #include <linux/blkdev.h>
+#include <linux/ksm.h>
 #include <trace/sched.h>
 
 #include <asm/pgtable.h>
@@ -151,6 +152,7 @@ void __put_task_struct(struct task_struct *tsk)
 	free_uid(tsk->user);
 	put_group_info(tsk->group_info);
 	delayacct_tsk_free(tsk);
+	task_numa_free(tsk);
 
 	if (!profile_handoff_task(tsk))
 		free_task(tsk);
@@ -281,6 +283,12 @@ static int dup_mmap(struct mm_struct *mm, struct mm_struct *oldmm)
 	rb_link = &mm->mm_rb.rb_node;
 	rb_parent = NULL;
 	pprev = &mm->mmap;
+	retval = khugepaged_fork(mm, oldmm);
+	if (retval)
+		goto out;
+	retval = ksm_fork(mm, oldmm);
+	if (retval)
+		goto out;
 
 	for (mpnt = oldmm->mmap; mpnt; mpnt = mpnt->vm_next) {
 		struct file *file;
@@ -311,7 +319,9 @@ static int dup_mmap(struct mm_struct *mm, struct mm_struct *oldmm)
 		tmp->vm_flags &= ~VM_LOCKED;
 		tmp->vm_mm = mm;
 		tmp->vm_next = NULL;
-		anon_vma_link(tmp);
+		INIT_LIST_HEAD(&tmp->anon_vma_chain);
+		if (anon_vma_fork(tmp, mpnt))
+			goto fail_nomem_anon_vma_fork;
 		file = tmp->vm_file;
 		if (file) {
 			struct inode *inode = file->f_path.dentry->d_inode;
@@ -366,6 +376,8 @@ out:
 	flush_tlb_mm(oldmm);
 	up_write(&oldmm->mmap_sem);
 	return retval;
+fail_nomem_anon_vma_fork:
+	mpol_put(pol);
 fail_nomem_policy:
 	kmem_cache_free(vm_area_cachep, tmp);
 fail_nomem:
@@ -405,10 +417,17 @@ static struct mm_struct * mm_init(struct mm_struct * mm, struct task_struct *p)
 	atomic_set(&mm->mm_count, 1);
 	init_rwsem(&mm->mmap_sem);
 	INIT_LIST_HEAD(&mm->mmlist);
-	mm->flags = (current->mm) ? current->mm->flags
-				  : MMF_DUMP_FILTER_DEFAULT;
+	mm->flags = (current->mm) ?
+		(current->mm->flags & MMF_INIT_MASK) : MMF_DUMP_FILTER_DEFAULT;
 	mm->core_state = NULL;
 	mm->nr_ptes = 0;
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	INIT_LIST_HEAD(&mm->pmd_huge_pte);
+#endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	seqcount_init(&mm->mm_rb_seq);
+	seqcount_init(&mm->mm_remap_seq);
+#endif
 	set_mm_counter(mm, file_rss, 0);
 	set_mm_counter(mm, anon_rss, 0);
 	spin_lock_init(&mm->page_table_lock);
@@ -417,10 +436,17 @@ static struct mm_struct * mm_init(struct mm_struct * mm, struct task_struct *p)
 	mm->free_area_cache = TASK_UNMAPPED_BASE;
 	mm->cached_hole_size = ~0UL;
 	mm_init_owner(mm, p);
+#ifdef CONFIG_NUMA_BALANCING
+	mm->numa_next_scan = jiffies +
+		msecs_to_jiffies(sysctl_numa_balancing_scan_delay);
+	mm->numa_scan_offset = 0;
+	mm->numa_scan_seq = 0;
+#endif
 
 	if (likely(!mm_alloc_pgd(mm))) {
 		mm->def_flags = 0;
 		mmu_notifier_mm_init(mm);
+		lru_gen_add_mm(mm);
 		return mm;
 	}
 
@@ -451,6 +477,7 @@ struct mm_struct * mm_alloc(void)
 void __mmdrop(struct mm_struct *mm)
 {
 	BUG_ON(mm == &init_mm);
+	lru_gen_del_mm(mm);
 	mm_free_pgd(mm);
 	destroy_context(mm);
 	mmu_notifier_mm_destroy(mm);
@@ -461,21 +488,68 @@ EXPORT_SYMBOL_GPL(__mmdrop);
 /*
  * Decrement the use count and release all resources for an mm.
  */
+static void __mmput(struct mm_struct *mm)
+{
+	exit_mmap(mm);
+	set_mm_exe_file(mm, NULL);
+	if (!list_empty(&mm->mmlist)) {
+		spin_lock(&mmlist_lock);
+		list_del(&mm->mmlist);
+		spin_unlock(&mmlist_lock);
+	}
+	put_swap_token(mm);
+	mmdrop(mm);
+}
+
+/*
+ * Tearing down a big address space takes a while, and the exiting task
+ * (and whoever waits for it) need not sit through it.  Above this many
+ * megabytes of rss, mmput() leaves it to a per-cpu workqueue, so that
+ * separate exits are torn down in parallel.  0 disables it.
+ */
+int sysctl_async_teardown_mb __read_mostly;
+static struct workqueue_struct *mm_teardown_wq;
+
+static void mmput_async_fn(struct work_struct *work)
+{
+	__mmput(container_of(work, struct mm_struct, async_put_work));
+}
+
+static int mmput_async(struct mm_struct *mm)
+{
+	unsigned long thresh = sysctl_async_teardown_mb;
+
+	if (!thresh || !mm_teardown_wq)
+		return 0;
+	/*
+	 * The OOM killer waits for its victim's memory to come back, and
+	 * the last mmput() may not come from the victim itself.
+	 */
+	if (test_bit(MMF_OOM_VICTIM, &mm->flags))
+		return 0;
+	if (get_mm_rss(mm) < thresh << (20 - PAGE_SHIFT))
+		return 0;
+	INIT_WORK(&mm->async_put_work, mmput_async_fn);
+	queue_work(mm_teardown_wq, &mm->async_put_work);
+	return 1;
+}
+
+static int __init mmput_async_init(void)
+{
+	mm_teardown_wq = create_workqueue("mm_teardown");
+	return 0;
+}
+__initcall(mmput_async_init);
+
 void mmput(struct mm_struct *mm)
 {
 	might_sleep();
 
 	if (atomic_dec_and_test(&mm->mm_users)) {
+		lru_gen_del_mm(mm);
 		exit_aio(mm);
-		exit_mmap(mm);
-		set_mm_exe_file(mm, NULL);
-		if (!list_empty(&mm->mmlist)) {
-			spin_lock(&mmlist_lock);
-			list_del(&mm->mmlist);
-			spin_unlock(&mmlist_lock);
-		}
-		put_swap_token(mm);
-		mmdrop(mm);
+		if (!mmput_async(mm))
+			__mmput(mm);
 	}
 }
 EXPORT_SYMBOL_GPL(mmput);
@@ -613,6 +687,7 @@ fail_nocontext:
 	 * If init_new_context() failed, we cannot use mmput() to free the mm
 	 * because it calls destroy_context()
 	 */
+	lru_gen_del_mm(mm);
 	mm_free_pgd(mm);
 	free_mm(mm);
 	return NULL;
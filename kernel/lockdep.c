@@ -639,8 +639,13 @@ static int static_obj(void *obj)
 	 */
 	for_each_possible_cpu(i) {
 		start = (unsigned long) &__per_cpu_start + per_cpu_offset(i);
+#ifdef CONFIG_HAVE_DYNAMIC_PER_CPU_AREA
+		/* module percpu data is usually in the first chunk */
+		end   = start + pcpu_unit_size;
+#else
 		end   = (unsigned long) &__per_cpu_start + PERCPU_ENOUGH_ROOM
 					+ per_cpu_offset(i);
+#endif
 
 		if ((addr >= start) && (addr < end))
 			return 1;
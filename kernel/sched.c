@@ -72,6 +72,8 @@
 #include <linux/debugfs.h>
 #include <linux/ctype.h>
 #include <linux/ftrace.h>
+#include <linux/mempolicy.h>
+#include <linux/hugetlb.h>
 #include <trace/sched.h>
 
 #include <asm/tlb.h>
@@ -2377,6 +2379,16 @@ static void __sched_fork(struct task_struct *p)
 	INIT_HLIST_HEAD(&p->preempt_notifiers);
 #endif
 
+#ifdef CONFIG_NUMA_BALANCING
+	p->node_stamp = 0ULL;
+	p->numa_scan_seq = p->mm ? p->mm->numa_scan_seq : 0;
+	p->numa_scan_period = sysctl_numa_balancing_scan_delay;
+	p->numa_preferred_nid = -1;
+	p->numa_faults = NULL;
+	p->numa_faults_locality[0] = 0;
+	p->numa_faults_locality[1] = 0;
+#endif
+
 	/*
 	 * We mark the process as running here, but have not actually
 	 * inserted it onto the runqueue yet. This guarantees that
@@ -2935,6 +2947,17 @@ int can_migrate_task(struct task_struct *p, struct rq *rq, int this_cpu,
 		return 0;
 	}
 
+	/*
+	 * NUMA balancing: going to the node the task's memory is on beats
+	 * cache hotness, leaving it needs as many failed attempts as a
+	 * cache hot task.
+	 */
+	if (migrate_improves_locality(p, cpu_of(rq), this_cpu))
+		return 1;
+	if (migrate_degrades_locality(p, cpu_of(rq), this_cpu) &&
+	    sd->nr_balance_failed <= sd->cache_nice_tries)
+		return 0;
+
 	/*
 	 * Aggressive migration if:
 	 * 1) task is cache cold, or
@@ -1592,6 +1592,229 @@ move_one_task_fair(struct rq *this_rq, int this_cpu, struct rq *busiest,
 }
 #endif /* CONFIG_SMP */
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Automatic NUMA balancing: every numa_balancing_scan_period ms of its
+ * runtime, a task makes the next numa_balancing_scan_size MB of its
+ * address space inaccessible (see change_prot_numa()).  The hinting
+ * faults that follow move pages to the node they are used from, and
+ * tell which node the task's memory is on; the load balancer then
+ * prefers to keep the task there.
+ */
+int sysctl_numa_balancing = 1;
+unsigned int sysctl_numa_balancing_scan_delay = 1000;		/* ms */
+unsigned int sysctl_numa_balancing_scan_period_min = 100;	/* ms */
+unsigned int sysctl_numa_balancing_scan_period_max = 100 * 16;	/* ms */
+unsigned int sysctl_numa_balancing_scan_size = 256;		/* MB */
+
+/*
+ * Called once per pass of the scanner over the mm: prefer the node with
+ * the most faults, and adapt the scan rate to how much memory is still
+ * on the wrong node.
+ */
+static void task_numa_placement(struct task_struct *p)
+{
+	int seq = ACCESS_ONCE(p->mm->numa_scan_seq);
+	unsigned long faults, max_faults = 0;
+	unsigned long local, migrated;
+	int nid, max_nid = -1;
+
+	if (p->numa_scan_seq == seq)
+		return;
+	p->numa_scan_seq = seq;
+
+	for (nid = 0; nid < nr_node_ids; nid++) {
+		faults = p->numa_faults[nid];
+		if (faults > max_faults) {
+			max_faults = faults;
+			max_nid = nid;
+		}
+		/* decay, so that the placement follows the task's phases */
+		p->numa_faults[nid] = faults / 2;
+	}
+	if (max_nid != -1)
+		p->numa_preferred_nid = max_nid;
+
+	local = p->numa_faults_locality[0];
+	migrated = p->numa_faults_locality[1];
+	if (migrated * 4 > local + migrated)
+		p->numa_scan_period = max(p->numa_scan_period / 2,
+					  sysctl_numa_balancing_scan_period_min);
+	else
+		p->numa_scan_period = min(p->numa_scan_period * 2,
+					  sysctl_numa_balancing_scan_period_max);
+	p->numa_faults_locality[0] = 0;
+	p->numa_faults_locality[1] = 0;
+}
+
+/*
+ * Account a NUMA hinting fault of the current task on @pages pages that
+ * are now on @node.
+ */
+void task_numa_fault(int node, int pages, int migrated)
+{
+	struct task_struct *p = current;
+
+	if (!sysctl_numa_balancing)
+		return;
+
+	if (unlikely(!p->numa_faults)) {
+		p->numa_faults = kzalloc(sizeof(*p->numa_faults) * nr_node_ids,
+					 GFP_KERNEL | __GFP_NOWARN);
+		if (!p->numa_faults)
+			return;
+	}
+
+	task_numa_placement(p);
+
+	p->numa_faults[node] += pages;
+	p->numa_faults_locality[!!migrated] += pages;
+}
+
+void task_numa_free(struct task_struct *p)
+{
+	kfree(p->numa_faults);
+}
+
+/*
+ * Arm the next chunk of the address space for hinting faults.  Run by
+ * the task itself on its way back to user space, after task_tick_numa()
+ * asked for it.
+ */
+void task_numa_work(void)
+{
+	struct task_struct *p = current;
+	struct mm_struct *mm = p->mm;
+	struct vm_area_struct *vma;
+	unsigned long migrate, next_scan, now = jiffies;
+	unsigned long start, end;
+	long pages, virtpages;
+
+	if (!sysctl_numa_balancing || !mm || (p->flags & PF_EXITING))
+		return;
+
+	/* One thread of the mm scans per period: the one moving the stamp */
+	migrate = mm->numa_next_scan;
+	if (time_before(now, migrate))
+		return;
+	next_scan = now + msecs_to_jiffies(p->numa_scan_period);
+	if (cmpxchg(&mm->numa_next_scan, migrate, next_scan) != migrate)
+		return;
+
+	pages = (long)sysctl_numa_balancing_scan_size << (20 - PAGE_SHIFT);
+	if (!pages)
+		return;
+	/* don't walk page tables for too long in a sparse address space */
+	virtpages = pages * 8;
+
+	down_read(&mm->mmap_sem);
+	start = mm->numa_scan_offset;
+	vma = find_vma(mm, start);
+	if (!vma) {
+		mm->numa_scan_seq++;
+		start = 0;
+		vma = mm->mmap;
+	}
+	for (; vma; vma = vma->vm_next) {
+		if (!vma_migratable(vma) || is_vm_hugetlb_page(vma) ||
+		    !(vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC)))
+			continue;
+
+		do {
+			start = max(start, vma->vm_start);
+			end = min(vma->vm_end,
+				  start + ((unsigned long)pages << PAGE_SHIFT));
+			pages -= change_prot_numa(vma, start, end);
+			virtpages -= (end - start) >> PAGE_SHIFT;
+			start = end;
+			if (pages <= 0 || virtpages <= 0)
+				goto out;
+		} while (end != vma->vm_end);
+	}
+out:
+	/* Resume from here next time, or start the next pass */
+	if (vma) {
+		mm->numa_scan_offset = start;
+	} else {
+		mm->numa_scan_offset = 0;
+		mm->numa_scan_seq++;
+	}
+	up_read(&mm->mmap_sem);
+}
+
+/*
+ * Ask for a scan every numa_scan_period ms of the task's own runtime, so
+ * that tasks which hardly run cost nothing.  Page tables can't be walked
+ * from the tick, so the task does it in task_numa_work() before it
+ * returns to user space.
+ */
+static void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+	u64 period, now;
+
+	if (!sysctl_numa_balancing || !curr->mm || (curr->flags & PF_EXITING))
+		return;
+
+	now = curr->se.sum_exec_runtime;
+	period = (u64)curr->numa_scan_period * NSEC_PER_MSEC;
+	if (now - curr->node_stamp > period) {
+		curr->node_stamp = now;
+		if (!time_before(jiffies, curr->mm->numa_next_scan))
+			set_tsk_thread_flag(curr, TIF_NOTIFY_RESUME);
+	}
+}
+
+/*
+ * Load balancing hints: moving a task to the node its memory is on is
+ * worth its cache footprint; moving it away from there is not, unless
+ * balancing keeps failing.
+ */
+static int
+migrate_improves_locality(struct task_struct *p, int src_cpu, int dst_cpu)
+{
+	int src_nid = cpu_to_node(src_cpu), dst_nid = cpu_to_node(dst_cpu);
+
+	if (!sysctl_numa_balancing || p->numa_preferred_nid == -1)
+		return 0;
+	return src_nid != dst_nid && dst_nid == p->numa_preferred_nid;
+}
+
+static int
+migrate_degrades_locality(struct task_struct *p, int src_cpu, int dst_cpu)
+{
+	int src_nid = cpu_to_node(src_cpu), dst_nid = cpu_to_node(dst_cpu);
+
+	if (!sysctl_numa_balancing || p->numa_preferred_nid == -1)
+		return 0;
+	return src_nid != dst_nid && src_nid == p->numa_preferred_nid;
+}
+
+static int __init numa_balancing_init(void)
+{
+	/* nothing to balance */
+	if (num_online_nodes() == 1)
+		sysctl_numa_balancing = 0;
+	return 0;
+}
+late_initcall(numa_balancing_init);
+#else
+static inline void task_tick_numa(struct rq *rq, struct task_struct *curr)
+{
+}
+
+static inline int
+migrate_improves_locality(struct task_struct *p, int src_cpu, int dst_cpu)
+{
+	return 0;
+}
+
+static inline int
+migrate_degrades_locality(struct task_struct *p, int src_cpu, int dst_cpu)
+{
+	return 0;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 /*
  * scheduler tick hitting a task of our scheduling class:
  */
@@ -1604,6 +1827,8 @@ static void task_tick_fair(struct rq *rq, struct task_struct *curr, int queued)
 		cfs_rq = cfs_rq_of(se);
 		entity_tick(cfs_rq, se, queued);
 	}
+
+	task_tick_numa(rq, curr);
 }
 
 #define swap(a, b) do { typeof(a) tmp = (a); (a) = (b); (b) = tmp; } while (0)
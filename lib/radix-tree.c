@@ -640,7 +640,7 @@ EXPORT_SYMBOL(radix_tree_tag_get);
  *
  *	Returns: the index of the hole if found, otherwise returns an index
  *	outside of the set specified (in which case 'return - index >= max_scan'
- *	will be true).
+ *	will be true).  Exceptional entries count as holes.
  *
  *	radix_tree_next_hole may be called under rcu_read_lock. However, like
  *	radix_tree_gang_lookup, this will not atomically search a snapshot of the
@@ -654,7 +654,9 @@ unsigned long radix_tree_next_hole(struct radix_tree_root *root,
 	unsigned long i;
 
 	for (i = 0; i < max_scan; i++) {
-		if (!radix_tree_lookup(root, index))
+		void *item = radix_tree_lookup(root, index);
+
+		if (!item || radix_tree_exceptional_entry(item))
 			break;
 		index++;
 		if (index == 0)
@@ -665,9 +667,15 @@ unsigned long radix_tree_next_hole(struct radix_tree_root *root,
 }
 EXPORT_SYMBOL(radix_tree_next_hole);
 
+/*
+ * Collect the slots of items (@exceptional == 0) or of exceptional entries
+ * (@exceptional == 1) from @index onwards, and their indices if @indices
+ * is non-NULL.
+ */
 static unsigned int
-__lookup(struct radix_tree_node *slot, void ***results, unsigned long index,
-	unsigned int max_items, unsigned long *next_index)
+__lookup(struct radix_tree_node *slot, void ***results, unsigned long *indices,
+	unsigned long index, unsigned int max_items, unsigned long *next_index,
+	int exceptional)
 {
 	unsigned int nr_found = 0;
 	unsigned int shift, height;
@@ -700,8 +708,12 @@ __lookup(struct radix_tree_node *slot, void ***results, unsigned long index,
 
 	/* Bottom level: grab some items */
 	for (i = index & RADIX_TREE_MAP_MASK; i < RADIX_TREE_MAP_SIZE; i++) {
+		void *item = slot->slots[i];
+
 		index++;
-		if (slot->slots[i]) {
+		if (item && radix_tree_exceptional_entry(item) == exceptional) {
+			if (indices)
+				indices[nr_found] = index - 1;
 			results[nr_found++] = &(slot->slots[i]);
 			if (nr_found == max_items)
 				goto out;
@@ -745,7 +757,7 @@ radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 		return 0;
 
 	if (!radix_tree_is_indirect_ptr(node)) {
-		if (first_index > 0)
+		if (first_index > 0 || radix_tree_exceptional_entry(node))
 			return 0;
 		results[0] = node;
 		return 1;
@@ -761,13 +773,13 @@ radix_tree_gang_lookup(struct radix_tree_root *root, void **results,
 
 		if (cur_index > max_index)
 			break;
-		slots_found = __lookup(node, (void ***)results + ret, cur_index,
-					max_items - ret, &next_index);
+		slots_found = __lookup(node, (void ***)results + ret, NULL,
+					cur_index, max_items - ret, &next_index, 0);
 		nr_found = 0;
 		for (i = 0; i < slots_found; i++) {
 			struct radix_tree_node *slot;
 			slot = *(((void ***)results)[ret + i]);
-			if (!slot)
+			if (!slot || radix_tree_exceptional_entry(slot))
 				continue;
 			results[ret + nr_found] = rcu_dereference(slot);
 			nr_found++;
@@ -813,7 +825,7 @@ radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
 		return 0;
 
 	if (!radix_tree_is_indirect_ptr(node)) {
-		if (first_index > 0)
+		if (first_index > 0 || radix_tree_exceptional_entry(node))
 			return 0;
 		results[0] = (void **)&root->rnode;
 		return 1;
@@ -829,8 +841,8 @@ radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
 
 		if (cur_index > max_index)
 			break;
-		slots_found = __lookup(node, results + ret, cur_index,
-					max_items - ret, &next_index);
+		slots_found = __lookup(node, results + ret, NULL, cur_index,
+					max_items - ret, &next_index, 0);
 		ret += slots_found;
 		if (next_index == 0)
 			break;
@@ -841,6 +853,76 @@ radix_tree_gang_lookup_slot(struct radix_tree_root *root, void ***results,
 }
 EXPORT_SYMBOL(radix_tree_gang_lookup_slot);
 
+/**
+ *	radix_tree_gang_lookup_exceptional - multiple exceptional entry lookup
+ *	@root:		radix tree root
+ *	@results:	where the entries are placed
+ *	@indices:	where their indices are placed
+ *	@first_index:	start the lookup from this key
+ *	@max_items:	place up to this many entries at *@results
+ *
+ *	Performs an index-ascending scan of the tree for exceptional entries,
+ *	which the other gang lookups skip.  Places them at *@results, their
+ *	indices at *@indices, and returns the number found.
+ *
+ *	Like radix_tree_gang_lookup as far as RCU and locking goes; an entry
+ *	found under RCU only may have changed by the time it is returned.
+ */
+unsigned int
+radix_tree_gang_lookup_exceptional(struct radix_tree_root *root,
+			void **results, unsigned long *indices,
+			unsigned long first_index, unsigned int max_items)
+{
+	unsigned long max_index;
+	struct radix_tree_node *node;
+	unsigned long cur_index = first_index;
+	unsigned int ret;
+
+	node = rcu_dereference(root->rnode);
+	if (!node)
+		return 0;
+
+	if (!radix_tree_is_indirect_ptr(node)) {
+		if (first_index > 0 || !radix_tree_exceptional_entry(node))
+			return 0;
+		results[0] = node;
+		indices[0] = 0;
+		return 1;
+	}
+	node = radix_tree_indirect_to_ptr(node);
+
+	max_index = radix_tree_maxindex(node->height);
+
+	ret = 0;
+	while (ret < max_items) {
+		unsigned int nr_found, slots_found, i;
+		unsigned long next_index;	/* Index of next search */
+
+		if (cur_index > max_index)
+			break;
+		slots_found = __lookup(node, (void ***)results + ret,
+					indices + ret, cur_index,
+					max_items - ret, &next_index, 1);
+		nr_found = 0;
+		for (i = 0; i < slots_found; i++) {
+			void *entry = *(((void ***)results)[ret + i]);
+
+			if (!radix_tree_exceptional_entry(entry))
+				continue;
+			results[ret + nr_found] = entry;
+			indices[ret + nr_found] = indices[ret + i];
+			nr_found++;
+		}
+		ret += nr_found;
+		if (next_index == 0)
+			break;
+		cur_index = next_index;
+	}
+
+	return ret;
+}
+EXPORT_SYMBOL(radix_tree_gang_lookup_exceptional);
+
 /*
  * FIXME: the two tag_get()s here should use find_next_bit() instead of
  * open-coding the search.
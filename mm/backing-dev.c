@@ -6,10 +6,34 @@
 #include <linux/module.h>
 #include <linux/writeback.h>
 #include <linux/device.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/cpuset.h>
+#include <linux/slab.h>
 
 
 static struct class *bdi_class;
 
+/*
+ * bdi_lock protects bdi_list, the work lists and the flusher thread
+ * pointers of all the registered backing devices.
+ */
+DEFINE_SPINLOCK(bdi_lock);
+LIST_HEAD(bdi_list);
+
+static struct task_struct *bdi_default_task;
+
+/*
+ * A flusher thread which has had nothing to write for this long is
+ * reaped; the default thread brings it back when there is work again.
+ */
+#define BDI_FLUSHER_IDLE	(300 * HZ)
+
+/*
+ * Initial write bandwidth estimation of a bdi, in pages per second: 100 MB/s
+ */
+#define INIT_BW		(100 << (20 - PAGE_SHIFT))
+
 #ifdef CONFIG_DEBUG_FS
 #include <linux/debugfs.h>
 #include <linux/seq_file.h>
@@ -32,16 +56,26 @@ static int bdi_debug_stats_show(struct seq_file *m, void *v)
 
 #define K(x) ((x) << (PAGE_SHIFT - 10))
 	seq_printf(m,
-		   "BdiWriteback:     %8lu kB\n"
-		   "BdiReclaimable:   %8lu kB\n"
-		   "BdiDirtyThresh:   %8lu kB\n"
-		   "DirtyThresh:      %8lu kB\n"
-		   "BackgroundThresh: %8lu kB\n",
+		   "BdiWriteback:       %10lu kB\n"
+		   "BdiReclaimable:     %10lu kB\n"
+		   "BdiDirtyThresh:     %10lu kB\n"
+		   "DirtyThresh:        %10lu kB\n"
+		   "BackgroundThresh:   %10lu kB\n"
+		   "BdiDirtied:         %10lu kB\n"
+		   "BdiWritten:         %10lu kB\n"
+		   "BdiWriteBandwidth:  %10lu kBps\n"
+		   "DirtyRatelimit:     %10lu kBps\n"
+		   "BalancedRatelimit:  %10lu kBps\n",
 		   (unsigned long) K(bdi_stat(bdi, BDI_WRITEBACK)),
 		   (unsigned long) K(bdi_stat(bdi, BDI_RECLAIMABLE)),
 		   K(bdi_thresh),
 		   K(dirty_thresh),
-		   K(background_thresh));
+		   K(background_thresh),
+		   (unsigned long) K(bdi_stat(bdi, BDI_DIRTIED)),
+		   (unsigned long) K(bdi_stat(bdi, BDI_WRITTEN)),
+		   (unsigned long) K(bdi->write_bandwidth),
+		   (unsigned long) K(bdi->dirty_ratelimit),
+		   (unsigned long) K(bdi->balanced_dirty_ratelimit));
 #undef K
 
 	return 0;
@@ -229,22 +263,71 @@ int bdi_init(struct backing_dev_info *bdi)
 	}
 
 	bdi->dirty_exceeded = 0;
+
+	spin_lock_init(&bdi->bw_lock);
+	bdi->bw_time_stamp = jiffies;
+	bdi->dirtied_stamp = 0;
+	bdi->written_stamp = 0;
+	bdi->write_bandwidth = INIT_BW;
+	bdi->avg_write_bandwidth = INIT_BW;
+	bdi->dirty_ratelimit = INIT_BW;
+	bdi->balanced_dirty_ratelimit = INIT_BW;
+
 	err = prop_local_init_percpu(&bdi->completions);
 
 	if (err) {
 err:
 		while (i--)
 			percpu_counter_destroy(&bdi->bdi_stat[i]);
+		return err;
 	}
 
-	return err;
+	INIT_LIST_HEAD(&bdi->work_list);
+	bdi->wb_task = NULL;
+	bdi->wb_last_active = jiffies;
+	bdi->wb_last_old_flush = jiffies;
+
+	spin_lock_bh(&bdi_lock);
+	list_add_tail(&bdi->bdi_list, &bdi_list);
+	spin_unlock_bh(&bdi_lock);
+
+	return 0;
 }
 EXPORT_SYMBOL(bdi_init);
 
+static int bdi_sched_wait(void *word)
+{
+	schedule();
+	return 0;
+}
+
 void bdi_destroy(struct backing_dev_info *bdi)
 {
+	struct task_struct *task;
 	int i;
 
+	spin_lock_bh(&bdi_lock);
+	list_del(&bdi->bdi_list);
+	spin_unlock_bh(&bdi_lock);
+
+	/*
+	 * The bdi is off the list now, so the default thread will not
+	 * touch it again once it is done with what it has in flight.
+	 */
+	wait_on_bit(&bdi->state, BDI_pending, bdi_sched_wait,
+			TASK_UNINTERRUPTIBLE);
+
+	spin_lock_bh(&bdi_lock);
+	task = bdi->wb_task;
+	bdi->wb_task = NULL;
+	spin_unlock_bh(&bdi_lock);
+
+	if (task)
+		kthread_stop(task);
+
+	/* Whatever the thread left behind, finish it here */
+	wb_do_writeback(bdi);
+
 	bdi_unregister(bdi);
 
 	for (i = 0; i < NR_BDI_STAT_ITEMS; i++)
@@ -254,6 +337,227 @@ void bdi_destroy(struct backing_dev_info *bdi)
 }
 EXPORT_SYMBOL(bdi_destroy);
 
+/*
+ * The per-device flusher thread: it runs the writeback work queued to its
+ * bdi and the periodic kupdate-style writeback, and sleeps in between.
+ */
+static int bdi_writeback_thread(void *data)
+{
+	struct backing_dev_info *bdi = data;
+	cpumask_t cpus_allowed;
+
+	current->flags |= PF_FLUSHER | PF_SWAPWRITE;
+	set_freezable();
+
+	/*
+	 * The flusher can spend a lot of time doing encryption via dm-crypt.
+	 * We don't want to do that at keventd's priority.
+	 */
+	set_user_nice(current, 0);
+
+	/*
+	 * Flusher threads are created and reaped on demand, so cut back to
+	 * our cpuset's cpus_allowed like the boottime threads would be.
+	 */
+	cpuset_cpus_allowed(current, &cpus_allowed);
+	set_cpus_allowed_ptr(current, &cpus_allowed);
+
+	while (!kthread_should_stop()) {
+		if (wb_do_writeback(bdi))
+			bdi->wb_last_active = jiffies;
+
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (!list_empty(&bdi->work_list) || kthread_should_stop()) {
+			__set_current_state(TASK_RUNNING);
+			continue;
+		}
+
+		if (dirty_writeback_interval)
+			schedule_timeout(dirty_writeback_interval);
+		else
+			schedule();
+
+		try_to_freeze();
+	}
+
+	return 0;
+}
+
+static void bdi_start_flusher(struct backing_dev_info *bdi)
+{
+	struct task_struct *task;
+
+	task = kthread_run(bdi_writeback_thread, bdi, "flush-%s",
+			   bdi->dev ? dev_name(bdi->dev) : "anon");
+
+	if (IS_ERR(task)) {
+		/*
+		 * No thread for this device; do its work from here so that
+		 * sync() and friends do not wait forever.
+		 */
+		wb_do_writeback(bdi);
+		return;
+	}
+
+	spin_lock_bh(&bdi_lock);
+	bdi->wb_last_active = jiffies;
+	bdi->wb_task = task;
+	spin_unlock_bh(&bdi_lock);
+}
+
+static void bdi_reap_flusher(struct backing_dev_info *bdi)
+{
+	struct task_struct *task = NULL;
+
+	/* Don't reap the thread while inodes are still waiting for it */
+	if (bdi_has_dirty_inodes(bdi))
+		return;
+
+	spin_lock_bh(&bdi_lock);
+	if (list_empty(&bdi->work_list)) {
+		task = bdi->wb_task;
+		bdi->wb_task = NULL;
+	}
+	spin_unlock_bh(&bdi_lock);
+
+	if (task)
+		kthread_stop(task);
+}
+
+/*
+ * Does @bdi need the default thread to start or stop its flusher?
+ * Called with bdi_lock held.
+ */
+static int bdi_needs_attention(struct backing_dev_info *bdi)
+{
+	/*
+	 * Queued work wants a thread right away.  Dirty inodes alone only
+	 * need the periodic writeback, so they can wait for the interval.
+	 */
+	if (!bdi->wb_task)
+		return !list_empty(&bdi->work_list) ||
+			(dirty_writeback_interval &&
+			 test_bit(BDI_dirty, &bdi->state) &&
+			 bdi_cap_writeback_dirty(bdi) &&
+			 time_after(jiffies, bdi->wb_last_active +
+					     dirty_writeback_interval));
+
+	return list_empty(&bdi->work_list) &&
+		time_after(jiffies, bdi->wb_last_active + BDI_FLUSHER_IDLE);
+}
+
+/*
+ * The default thread creates the flusher threads of the devices which got
+ * work or dirty inodes, and reaps those which have been idle for a while.
+ * It also takes over the periodic superblock writeback that used to be
+ * done by the kupdate timer.
+ */
+static int bdi_default_thread(void *unused)
+{
+	unsigned long last_sync = jiffies;
+
+	set_freezable();
+	set_user_nice(current, 0);
+
+	for (;;) {
+		struct backing_dev_info *bdi;
+		int found = 0;
+
+		set_current_state(TASK_INTERRUPTIBLE);
+
+		spin_lock_bh(&bdi_lock);
+		list_for_each_entry(bdi, &bdi_list, bdi_list) {
+			if (!bdi_needs_attention(bdi))
+				continue;
+			/* bdi_destroy() waits for us to be done with it */
+			set_bit(BDI_pending, &bdi->state);
+			found = 1;
+			break;
+		}
+		spin_unlock_bh(&bdi_lock);
+
+		if (found) {
+			__set_current_state(TASK_RUNNING);
+
+			if (!bdi->wb_task)
+				bdi_start_flusher(bdi);
+			else
+				bdi_reap_flusher(bdi);
+			/*
+			 * Mark it attended to, so that the scan moves on to
+			 * the next bdi rather than trying this one again.
+			 */
+			bdi->wb_last_active = jiffies;
+
+			clear_bit(BDI_pending, &bdi->state);
+			smp_mb__after_clear_bit();
+			wake_up_bit(&bdi->state, BDI_pending);
+			continue;
+		}
+
+		if (dirty_writeback_interval &&
+		    time_after_eq(jiffies, last_sync + dirty_writeback_interval)) {
+			__set_current_state(TASK_RUNNING);
+			sync_supers();
+			last_sync = jiffies;
+			continue;
+		}
+
+		if (dirty_writeback_interval)
+			schedule_timeout(dirty_writeback_interval);
+		else
+			schedule();
+
+		try_to_freeze();
+	}
+
+	return 0;
+}
+
+/*
+ * New work has been queued to @bdi: wake its flusher thread, or the
+ * default thread to create one.  Called with bdi_lock held.
+ */
+void bdi_kick_flusher(struct backing_dev_info *bdi)
+{
+	if (bdi->wb_task)
+		wake_up_process(bdi->wb_task);
+	else if (bdi_default_task)
+		wake_up_process(bdi_default_task);
+}
+
+/*
+ * Wake the default thread and all the flusher threads, so that they
+ * notice a changed dirty_writeback_interval.
+ */
+void bdi_wakeup_flushers(void)
+{
+	struct backing_dev_info *bdi;
+
+	spin_lock_bh(&bdi_lock);
+	if (bdi_default_task)
+		wake_up_process(bdi_default_task);
+	list_for_each_entry(bdi, &bdi_list, bdi_list)
+		if (bdi->wb_task)
+			wake_up_process(bdi->wb_task);
+	spin_unlock_bh(&bdi_lock);
+}
+
+static int __init bdi_default_thread_init(void)
+{
+	struct task_struct *task;
+
+	task = kthread_run(bdi_default_thread, NULL, "bdi-default");
+	if (IS_ERR(task))
+		return PTR_ERR(task);
+
+	spin_lock_bh(&bdi_lock);
+	bdi_default_task = task;
+	spin_unlock_bh(&bdi_lock);
+	return 0;
+}
+module_init(bdi_default_thread_init);
+
 static wait_queue_head_t congestion_wqh[2] = {
 		__WAIT_QUEUE_HEAD_INITIALIZER(congestion_wqh[0]),
 		__WAIT_QUEUE_HEAD_INITIALIZER(congestion_wqh[1])
@@ -0,0 +1,411 @@
+/*
+ * linux/mm/compaction.c
+ *
+ * Memory compaction: reduce external fragmentation by moving movable
+ * pages out of the way of a free block of the wanted size, rather than
+ * reclaiming them.
+ *
+ * Two scanners work towards each other through a zone.  The migration
+ * scanner starts at the bottom and picks windows of the wanted size that
+ * hold nothing but free and LRU pages; each window's pageblocks are
+ * isolated with start_isolate_page_range() so nothing freed inside them
+ * can be handed out again, and the in-use pages are moved out with
+ * migrate_pages().  The free scanner starts at the top and collects the
+ * free pages they are moved into.  Compaction stops once the allocation
+ * it was run for can succeed, or when the scanners meet.
+ */
+#include <linux/swap.h>
+#include <linux/migrate.h>
+#include <linux/compaction.h>
+#include <linux/page-isolation.h>
+#include <linux/mm_inline.h>
+#include <linux/cpuset.h>
+#include <linux/sysctl.h>
+#include <linux/vmstat.h>
+#include "internal.h"
+
+struct compact_control {
+	struct zone *zone;
+	int order;			/* order wanted, -1 for the whole zone */
+	unsigned long window;		/* pages in a migration window */
+	unsigned long block;		/* pages isolated around a window */
+
+	unsigned long migrate_pfn;	/* next block for the migration scanner */
+	unsigned long free_pfn;		/* end of the next free scanner block */
+
+	struct list_head migratepages;	/* pages being migrated */
+	unsigned long nr_migratepages;
+	struct list_head freepages;	/* pages to migrate into */
+	unsigned long nr_freepages;
+};
+
+static void release_freepages(struct compact_control *cc)
+{
+	struct page *page, *next;
+
+	list_for_each_entry_safe(page, next, &cc->freepages, lru) {
+		list_del(&page->lru);
+		__free_page(page);
+	}
+	cc->nr_freepages = 0;
+}
+
+/*
+ * Refill cc->freepages from the pageblocks below cc->free_pfn, never
+ * going below the block the migration scanner is working on.
+ */
+static void isolate_freepages(struct compact_control *cc)
+{
+	struct zone *zone = cc->zone;
+	unsigned int max_order = cc->order < 0 ? pageblock_order : cc->order;
+	unsigned long pfn;
+
+	while (cc->nr_freepages < cc->nr_migratepages) {
+		pfn = cc->free_pfn - pageblock_nr_pages;
+		if (cc->free_pfn < pageblock_nr_pages ||
+		    pfn < cc->migrate_pfn + cc->block)
+			break;
+		cc->free_pfn = pfn;
+
+		if (!pfn_valid(pfn))
+			continue;
+		if (page_zone(pfn_to_page(pfn)) != zone)
+			continue;
+		if (get_pageblock_migratetype(pfn_to_page(pfn)) !=
+							MIGRATE_MOVABLE)
+			continue;
+
+		cc->nr_freepages += isolate_freepages_block(zone, pfn,
+						max_order, &cc->freepages);
+	}
+}
+
+/* new_page_t callback for migrate_pages() */
+static struct page *compaction_alloc(struct page *migratepage,
+				     unsigned long data, int **result)
+{
+	struct compact_control *cc = (struct compact_control *)data;
+	struct page *freepage;
+
+	if (list_empty(&cc->freepages)) {
+		isolate_freepages(cc);
+		if (list_empty(&cc->freepages))
+			return NULL;
+	}
+
+	freepage = list_entry(cc->freepages.next, struct page, lru);
+	list_del(&freepage->lru);
+	cc->nr_freepages--;
+	return freepage;
+}
+
+/*
+ * Count the pages in [pfn, pfn + nr) that would have to be migrated to
+ * free the whole range, or return -1 if something in it cannot be moved.
+ * This runs without zone->lock or lru_lock, so the answer is only a
+ * hint; isolate_window() copes with whatever changed since.
+ */
+static long window_inuse(struct zone *zone, unsigned long pfn,
+			 unsigned long nr)
+{
+	unsigned long end_pfn = pfn + nr;
+	long inuse = 0;
+
+	while (pfn < end_pfn) {
+		struct page *page;
+
+		if (!pfn_valid_within(pfn))
+			return -1;
+		page = pfn_to_page(pfn);
+		if (PageBuddy(page)) {
+			unsigned long order = page_private(page);
+
+			pfn += order < MAX_ORDER ? 1UL << order : 1;
+			continue;
+		}
+		pfn++;
+		/* free, but still on a per-cpu list */
+		if (!page_count(page))
+			continue;
+		if (!PageLRU(page))
+			return -1;
+		inuse++;
+	}
+	return inuse;
+}
+
+/*
+ * Pick the window in the block at @block_pfn that needs the fewest
+ * pages moved and store its first pfn in @window_pfn.  Returns 0 when
+ * no window in the block is worth migrating: one is already free, or
+ * none can be freed.
+ */
+static int pick_window(struct compact_control *cc, unsigned long block_pfn,
+		       unsigned long *window_pfn)
+{
+	unsigned long pfn;
+	long inuse, best = -1;
+
+	for (pfn = block_pfn; pfn < block_pfn + cc->block;
+	     pfn += pageblock_nr_pages) {
+		struct page *page;
+
+		if (!pfn_valid(pfn))
+			return 0;
+		page = pfn_to_page(pfn);
+		if (page_zone(page) != cc->zone ||
+		    get_pageblock_migratetype(page) != MIGRATE_MOVABLE)
+			return 0;
+	}
+
+	for (pfn = block_pfn; pfn < block_pfn + cc->block;
+	     pfn += cc->window) {
+		inuse = window_inuse(cc->zone, pfn, cc->window);
+		if (inuse == 0)
+			return 0;
+		if (inuse > 0 && (best < 0 || inuse < best)) {
+			best = inuse;
+			*window_pfn = pfn;
+		}
+	}
+	return best > 0;
+}
+
+/*
+ * Take the in-use pages of the window at @pfn off the LRU.  Fails if
+ * anything in the window is in use but not on the LRU any more, as the
+ * window could not be freed anyway.
+ */
+static int isolate_window(struct compact_control *cc, unsigned long pfn)
+{
+	unsigned long end_pfn = pfn + cc->window;
+
+	for (; pfn < end_pfn; pfn++) {
+		struct page *page;
+
+		if (!pfn_valid_within(pfn))
+			continue;
+		page = pfn_to_page(pfn);
+		if (PageBuddy(page) || !page_count(page))
+			continue;
+		if (isolate_lru_page(page)) {
+			if (page_count(page) && !PageBuddy(page))
+				return -EBUSY;
+			continue;
+		}
+		list_add(&page->lru, &cc->migratepages);
+		cc->nr_migratepages++;
+	}
+	return 0;
+}
+
+static void compact_block(struct compact_control *cc, unsigned long block_pfn)
+{
+	unsigned long pfn, end_pfn = block_pfn + cc->block;
+	int nr = 0, nr_failed;
+
+	if (!pick_window(cc, block_pfn, &pfn))
+		return;
+
+	if (start_isolate_page_range(block_pfn, end_pfn))
+		return;
+
+	if (!isolate_window(cc, pfn) && cc->nr_migratepages) {
+		nr = cc->nr_migratepages;
+		nr_failed = migrate_pages(&cc->migratepages, compaction_alloc,
+					  (unsigned long)cc);
+		/* -ENOMEM: we ran out of pages to migrate into */
+		if (nr_failed < 0 || nr_failed > nr)
+			nr_failed = nr;
+		count_vm_events(COMPACTPAGES, nr - nr_failed);
+		count_vm_events(COMPACTPAGEFAILED, nr_failed);
+		if (!nr_failed)
+			count_vm_event(COMPACTBLOCKS);
+	} else
+		putback_lru_pages(&cc->migratepages);
+	INIT_LIST_HEAD(&cc->migratepages);
+	cc->nr_migratepages = 0;
+
+	/*
+	 * The old pages are freed through the LRU pagevecs and the per-cpu
+	 * free lists; push them back to the buddy lists so they merge
+	 * before the pageblock is handed back to the allocator.
+	 */
+	if (nr) {
+		lru_add_drain();
+		drain_all_pages();
+	}
+	undo_isolate_page_range(block_pfn, end_pfn);
+}
+
+static int compact_finished(struct zone *zone, struct compact_control *cc)
+{
+	if (fatal_signal_pending(current))
+		return COMPACT_PARTIAL;
+
+	if (cc->migrate_pfn + cc->block > cc->free_pfn)
+		return COMPACT_COMPLETE;
+
+	if (cc->order < 0)
+		return COMPACT_CONTINUE;
+
+	if (zone_watermark_ok(zone, cc->order, zone->pages_low, 0, 0))
+		return COMPACT_PARTIAL;
+
+	return COMPACT_CONTINUE;
+}
+
+static int compact_zone(struct zone *zone, struct compact_control *cc)
+{
+	unsigned long start_pfn = zone->zone_start_pfn;
+	unsigned long end_pfn = start_pfn + zone->spanned_pages;
+	int ret;
+
+	cc->window = cc->order < 0 ? pageblock_nr_pages : 1UL << cc->order;
+	cc->block = max(cc->window, pageblock_nr_pages);
+	cc->migrate_pfn = ALIGN(start_pfn, cc->block);
+	cc->free_pfn = end_pfn & ~(pageblock_nr_pages - 1);
+	INIT_LIST_HEAD(&cc->migratepages);
+	cc->nr_migratepages = 0;
+	INIT_LIST_HEAD(&cc->freepages);
+	cc->nr_freepages = 0;
+
+	migrate_prep();
+
+	while ((ret = compact_finished(zone, cc)) == COMPACT_CONTINUE) {
+		compact_block(cc, cc->migrate_pfn);
+		cc->migrate_pfn += cc->block;
+		cond_resched();
+	}
+
+	release_freepages(cc);
+	return ret;
+}
+
+/*
+ * Is compaction of @zone likely to make an allocation of @order succeed?
+ * COMPACT_SKIPPED if there is too little free memory to migrate into or
+ * the failure is down to a lack of memory rather than fragmentation,
+ * COMPACT_PARTIAL if the allocation should succeed already.
+ */
+static int compaction_suitable(struct zone *zone, int order)
+{
+	int fragindex;
+
+	if (!zone_watermark_ok(zone, 0, zone->pages_low + (2UL << order),
+			       0, 0))
+		return COMPACT_SKIPPED;
+
+	fragindex = fragmentation_index(zone, order);
+	if (fragindex >= 0 && fragindex <= COMPACT_FRAGINDEX_THRESHOLD)
+		return COMPACT_SKIPPED;
+
+	if (fragindex == -1000 &&
+	    zone_watermark_ok(zone, order, zone->pages_low, 0, 0))
+		return COMPACT_PARTIAL;
+
+	return COMPACT_CONTINUE;
+}
+
+/**
+ * try_to_compact_pages - direct compaction for a high-order allocation
+ * @zonelist: the zonelist the allocation is being made from
+ * @order: the order of the allocation
+ * @gfp_mask: the gfp mask of the allocation
+ * @nodemask: the allowed nodes, or NULL
+ *
+ * Compacts the zones of @zonelist in turn until one of them has a free
+ * block of @order.  Returns COMPACT_SKIPPED if no zone was compacted,
+ * COMPACT_PARTIAL if a block should now be available.
+ */
+unsigned long try_to_compact_pages(struct zonelist *zonelist,
+			int order, gfp_t gfp_mask, nodemask_t *nodemask)
+{
+	enum zone_type high_zoneidx = gfp_zone(gfp_mask);
+	struct compact_control cc;
+	struct zoneref *z;
+	struct zone *zone;
+	int status, rc = COMPACT_SKIPPED;
+
+	/* migration may have to write out dirty pages */
+	if (!order || !(gfp_mask & __GFP_FS) || !(gfp_mask & __GFP_IO))
+		return rc;
+
+	for_each_zone_zonelist_nodemask(zone, z, zonelist, high_zoneidx,
+								nodemask) {
+		if (!cpuset_zone_allowed_softwall(zone, gfp_mask))
+			continue;
+		if (compaction_deferred(zone))
+			continue;
+
+		status = compaction_suitable(zone, order);
+		if (status == COMPACT_CONTINUE) {
+			if (rc == COMPACT_SKIPPED)
+				count_vm_event(COMPACTSTALL);
+			cc.zone = zone;
+			cc.order = order;
+			status = compact_zone(zone, &cc);
+			if (status == COMPACT_COMPLETE)
+				defer_compaction(zone);
+		}
+		rc = max(status, rc);
+		if (status == COMPACT_PARTIAL)
+			break;
+	}
+	return rc;
+}
+
+/* Compact all zones within a node */
+static void compact_node(int nid)
+{
+	pg_data_t *pgdat = NODE_DATA(nid);
+	struct compact_control cc;
+	int zoneid;
+
+	for (zoneid = 0; zoneid < MAX_NR_ZONES; zoneid++) {
+		struct zone *zone = &pgdat->node_zones[zoneid];
+
+		if (!populated_zone(zone))
+			continue;
+
+		cc.zone = zone;
+		cc.order = -1;
+		compact_zone(zone, &cc);
+	}
+}
+
+/* This is the entry point for compacting all nodes via /proc/sys/vm */
+int sysctl_compact_memory;
+
+int sysctl_compaction_handler(struct ctl_table *table, int write,
+			struct file *file, void __user *buffer, size_t *length,
+			loff_t *ppos)
+{
+	int nid;
+
+	if (write)
+		for_each_online_node(nid)
+			compact_node(nid);
+	return 0;
+}
+
+/* Writing a node id to /proc/sys/vm/compact_node compacts just that node */
+int sysctl_compact_node;
+
+int sysctl_compact_node_handler(struct ctl_table *table, int write,
+			struct file *file, void __user *buffer, size_t *length,
+			loff_t *ppos)
+{
+	int ret;
+
+	ret = proc_dointvec_minmax(table, write, file, buffer, length, ppos);
+	if (ret || !write)
+		return ret;
+
+	if (sysctl_compact_node >= nr_node_ids ||
+	    !node_online(sysctl_compact_node))
+		return -EINVAL;
+
+	compact_node(sysctl_compact_node);
+	return 0;
+}
@@ -111,12 +111,28 @@
  * Remove a page from the page cache and free it. Caller has to make
  * sure the page is locked and that nobody else uses it - or that usage
  * is safe.  The caller must hold the mapping's tree_lock.
+ *
+ * If @shadow is given, it takes the page's place in the radix tree, for
+ * add_to_page_cache_lru() to find if the page is read back in.
  */
-void __remove_from_page_cache(struct page *page)
+void __remove_from_page_cache(struct page *page, void *shadow)
 {
 	struct address_space *mapping = page->mapping;
 
-	radix_tree_delete(&mapping->page_tree, page->index);
+	if (shadow) {
+		void **slot;
+
+		/* Shadow entries carry no tags */
+		radix_tree_tag_clear(&mapping->page_tree, page->index,
+					PAGECACHE_TAG_DIRTY);
+		radix_tree_tag_clear(&mapping->page_tree, page->index,
+					PAGECACHE_TAG_WRITEBACK);
+		slot = radix_tree_lookup_slot(&mapping->page_tree, page->index);
+		radix_tree_replace_slot(slot, shadow);
+		mapping->nrshadows++;
+		workingset_shadow_stored(mapping);
+	} else
+		radix_tree_delete(&mapping->page_tree, page->index);
 	page->mapping = NULL;
 	mapping->nrpages--;
 	__dec_zone_page_state(page, NR_FILE_PAGES);
@@ -143,7 +159,7 @@ void remove_from_page_cache(struct page *page)
 	BUG_ON(!PageLocked(page));
 
 	spin_lock_irq(&mapping->tree_lock);
-	__remove_from_page_cache(page);
+	__remove_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 }
 
@@ -442,18 +458,34 @@ int filemap_write_and_wait_range(struct address_space *mapping,
 	return err;
 }
 
-/**
- * add_to_page_cache_locked - add a locked page to the pagecache
- * @page:	page to add
- * @mapping:	the page's address_space
- * @offset:	page index
- * @gfp_mask:	page allocation mode
- *
- * This function is used to add a page to the pagecache. It must be locked.
- * This function does not add the page to the LRU.  The caller must do that.
+/*
+ * Insert @page at its index, in place of the shadow entry of an evicted
+ * page if there is one: that is then returned in *@shadowp.
  */
-int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
-		pgoff_t offset, gfp_t gfp_mask)
+static int page_cache_tree_insert(struct address_space *mapping,
+				  struct page *page, void **shadowp)
+{
+	void **slot;
+	void *p;
+
+	slot = radix_tree_lookup_slot(&mapping->page_tree, page->index);
+	if (slot) {
+		p = radix_tree_deref_slot(slot);
+		if (!radix_tree_exceptional_entry(p))
+			return -EEXIST;
+		radix_tree_replace_slot(slot, page);
+		mapping->nrshadows--;
+		workingset_shadows_dropped(1);
+		if (shadowp)
+			*shadowp = p;
+		return 0;
+	}
+	return radix_tree_insert(&mapping->page_tree, page->index, page);
+}
+
+static int __add_to_page_cache_locked(struct page *page,
+		struct address_space *mapping, pgoff_t offset,
+		gfp_t gfp_mask, void **shadowp)
 {
 	int error;
 
@@ -471,7 +503,7 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 		page->index = offset;
 
 		spin_lock_irq(&mapping->tree_lock);
-		error = radix_tree_insert(&mapping->page_tree, offset, page);
+		error = page_cache_tree_insert(mapping, page, shadowp);
 		if (likely(!error)) {
 			mapping->nrpages++;
 			__inc_zone_page_state(page, NR_FILE_PAGES);
@@ -488,11 +520,29 @@ int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
 out:
 	return error;
 }
+
+/**
+ * add_to_page_cache_locked - add a locked page to the pagecache
+ * @page:	page to add
+ * @mapping:	the page's address_space
+ * @offset:	page index
+ * @gfp_mask:	page allocation mode
+ *
+ * This function is used to add a page to the pagecache. It must be locked.
+ * This function does not add the page to the LRU.  The caller must do that.
+ */
+int add_to_page_cache_locked(struct page *page, struct address_space *mapping,
+		pgoff_t offset, gfp_t gfp_mask)
+{
+	return __add_to_page_cache_locked(page, mapping, offset,
+					  gfp_mask, NULL);
+}
 EXPORT_SYMBOL(add_to_page_cache_locked);
 
 int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 				pgoff_t offset, gfp_t gfp_mask)
 {
+	void *shadow = NULL;
 	int ret;
 
 	/*
@@ -504,14 +554,22 @@ int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 	if (mapping_cap_swap_backed(mapping))
 		SetPageSwapBacked(page);
 
-	ret = add_to_page_cache(page, mapping, offset, gfp_mask);
-	if (ret == 0) {
-		if (page_is_file_cache(page))
-			lru_cache_add_file(page);
-		else
-			lru_cache_add_active_anon(page);
+	__set_page_locked(page);
+	ret = __add_to_page_cache_locked(page, mapping, offset,
+					 gfp_mask, &shadow);
+	if (unlikely(ret)) {
+		__clear_page_locked(page);
+		return ret;
 	}
-	return ret;
+
+	if (!page_is_file_cache(page))
+		lru_cache_add_active_anon(page);
+	else if (shadow && workingset_refault(shadow))
+		/* Evicted from the working set: it goes back there */
+		lru_cache_add_active_file(page);
+	else
+		lru_cache_add_file(page);
+	return 0;
 }
 
 #ifdef CONFIG_NUMA
@@ -664,6 +722,11 @@ repeat:
 		page = radix_tree_deref_slot(pagep);
 		if (unlikely(!page || page == RADIX_TREE_RETRY))
 			goto repeat;
+		/* A shadow entry of an evicted page: not present */
+		if (radix_tree_exceptional_entry(page)) {
+			page = NULL;
+			goto out;
+		}
 
 		if (!page_cache_get_speculative(page))
 			goto repeat;
@@ -678,6 +741,7 @@ repeat:
 			goto repeat;
 		}
 	}
+out:
 	//reader退出临界区
 	rcu_read_unlock();
 
@@ -795,6 +859,9 @@ repeat:
 		 */
 		if (unlikely(page == RADIX_TREE_RETRY))
 			goto restart;
+		/* Evicted since the lookup */
+		if (radix_tree_exceptional_entry(page))
+			continue;
 
 		if (!page_cache_get_speculative(page))
 			goto repeat;
@@ -848,6 +915,9 @@ repeat:
 		 */
 		if (unlikely(page == RADIX_TREE_RETRY))
 			goto restart;
+		/* Evicted since the lookup: the run is broken */
+		if (radix_tree_exceptional_entry(page))
+			break;
 
 		if (page->mapping == NULL || page->index != index)
 			break;
@@ -905,6 +975,9 @@ repeat:
 		 */
 		if (unlikely(page == RADIX_TREE_RETRY))
 			goto restart;
+		/* Evicted since the lookup */
+		if (radix_tree_exceptional_entry(page))
+			continue;
 
 		if (!page_cache_get_speculative(page))
 			goto repeat;
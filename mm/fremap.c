@@ -210,7 +210,9 @@ SYSCALL_DEFINE5(remap_file_pages, unsigned long, start, unsigned long, size,
 		}
 		spin_lock(&mapping->i_mmap_lock);
 		flush_dcache_mmap_lock(mapping);
+		vm_write_begin(vma);
 		vma->vm_flags |= VM_NONLINEAR;
+		vm_write_end(vma);
 		vma_prio_tree_remove(vma, &mapping->i_mmap);
 		vma_nonlinear_insert(vma, &mapping->i_mmap_nonlinear);
 		flush_dcache_mmap_unlock(mapping);
@@ -223,7 +225,9 @@ SYSCALL_DEFINE5(remap_file_pages, unsigned long, start, unsigned long, size,
 		 */
 		unsigned int saved_flags = vma->vm_flags;
 		munlock_vma_pages_range(vma, start, start + size);
+		vm_write_begin(vma);
 		vma->vm_flags = saved_flags;
+		vm_write_end(vma);
 	}
 
 	mmu_notifier_invalidate_range_start(mm, start, start + size);
@@ -0,0 +1,937 @@
+/*
+ *  mm/huge_memory.c - transparent huge pages for anonymous memory
+ *
+ *  A private anonymous range that is aligned to and spans a whole pmd is
+ *  mapped at fault time with a single huge pmd, backed by HPAGE_PMD_NR
+ *  physically contiguous order-0 pages.  Each of those pages is an
+ *  ordinary anonymous page: it has its own count, mapcount and rmap, sits
+ *  on the LRU by itself and can be swapped or migrated once the pmd has
+ *  been split.  That keeps reclaim, swap and migration unchanged: they
+ *  only ever see ptes, because every pte walker splits a huge pmd (a
+ *  cheap and infallible operation, see __split_huge_pmd()) before it
+ *  descends into it.
+ *
+ *  khugepaged later promotes ranges that ended up mapped by ptes, either
+ *  because no huge page was available at fault time or because they were
+ *  split, by copying them into a fresh huge page.
+ */
+
+#include <linux/mm.h>
+#include <linux/sched.h>
+#include <linux/highmem.h>
+#include <linux/hugetlb.h>
+#include <linux/mmu_notifier.h>
+#include <linux/rmap.h>
+#include <linux/swap.h>
+#include <linux/mman.h>
+#include <linux/memcontrol.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/init.h>
+#include <asm/tlb.h>
+#include <asm/pgalloc.h>
+#include "internal.h"
+
+unsigned long transparent_hugepage_flags __read_mostly =
+	(1 << TRANSPARENT_HUGEPAGE_FLAG);
+
+/* khugepaged tunables, see Documentation/vm/transhuge.txt */
+static unsigned int khugepaged_pages_to_scan __read_mostly = HPAGE_PMD_NR * 8;
+static unsigned int khugepaged_scan_sleep_millisecs __read_mostly = 10000;
+static unsigned int khugepaged_max_ptes_none __read_mostly = HPAGE_PMD_NR - 1;
+static unsigned int khugepaged_pages_collapsed;
+static unsigned int khugepaged_full_scans;
+
+static DECLARE_WAIT_QUEUE_HEAD(khugepaged_wait);
+static struct task_struct *khugepaged_thread;
+
+/*
+ * Every mm with an eligible vma is on khugepaged_mm_head, holding an
+ * mm_count reference; khugepaged drops it once it finds the mm dead.
+ * The cursor is only used by khugepaged itself, the lock protects the
+ * list against concurrent registration.
+ */
+struct mm_slot {
+	struct list_head mm_node;
+	struct mm_struct *mm;
+};
+
+static LIST_HEAD(khugepaged_mm_head);
+static DEFINE_SPINLOCK(khugepaged_mm_lock);
+
+static struct {
+	struct mm_slot *mm_slot;
+	unsigned long address;
+} khugepaged_scan;
+
+/*
+ * Every huge pmd owns a preallocated pte table, counted in nr_ptes, so
+ * that splitting it never has to allocate.  The tables are kept on a
+ * per-mm list under page_table_lock.
+ */
+static void pgtable_trans_huge_deposit(struct mm_struct *mm, pgtable_t pgtable)
+{
+	assert_spin_locked(&mm->page_table_lock);
+	list_add(&pgtable->lru, &mm->pmd_huge_pte);
+}
+
+static pgtable_t pgtable_trans_huge_withdraw(struct mm_struct *mm)
+{
+	pgtable_t pgtable;
+
+	assert_spin_locked(&mm->page_table_lock);
+	VM_BUG_ON(list_empty(&mm->pmd_huge_pte));
+	pgtable = list_entry(mm->pmd_huge_pte.next, struct page, lru);
+	list_del(&pgtable->lru);
+	return pgtable;
+}
+
+static pmd_t *mm_find_pmd(struct mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(mm, address);
+	if (!pgd_present(*pgd))
+		return NULL;
+
+	pud = pud_offset(pgd, address);
+	if (!pud_present(*pud))
+		return NULL;
+
+	pmd = pmd_offset(pud, address);
+	if (!pmd_present(*pmd))
+		return NULL;
+	return pmd;
+}
+
+static pmd_t mk_huge_pmd(struct page *page, struct vm_area_struct *vma)
+{
+	pte_t entry;
+
+	/*
+	 * Dirty and young from the start: the split never has to carry
+	 * hardware-set bits over into the ptes.
+	 */
+	entry = pte_mkyoung(pte_mkdirty(mk_pte(page, vma->vm_page_prot)));
+	if (likely(vma->vm_flags & VM_WRITE))
+		entry = pte_mkwrite(entry);
+	return pte_mktranshuge(entry);
+}
+
+static struct page *alloc_hugepage(gfp_t gfp_mask)
+{
+	struct page *page;
+
+	page = alloc_pages(gfp_mask | __GFP_NOWARN, HPAGE_PMD_ORDER);
+	if (page)
+		split_page(page, HPAGE_PMD_ORDER);
+	return page;
+}
+
+static void free_hugepage(struct page *page)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		__free_page(page + i);
+}
+
+static int charge_hugepage(struct page *page, struct mm_struct *mm)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		if (mem_cgroup_charge(page + i, mm, GFP_KERNEL)) {
+			while (--i >= 0)
+				mem_cgroup_uncharge_page(page + i);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+static void uncharge_free_hugepage(struct page *page)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		mem_cgroup_uncharge_page(page + i);
+	free_hugepage(page);
+}
+
+/* Called with page_table_lock held, before the pmd is made visible */
+static void hugepage_add_new_anon(struct page *page,
+				  struct vm_area_struct *vma,
+				  unsigned long haddr)
+{
+	int i;
+
+	for (i = 0; i < HPAGE_PMD_NR; i++, haddr += PAGE_SIZE) {
+		SetPageSwapBacked(page + i);
+		lru_cache_add_active_or_unevictable(page + i, vma);
+		page_add_new_anon_rmap(page + i, vma, haddr);
+	}
+}
+
+static int __khugepaged_enter(struct mm_struct *mm)
+{
+	struct mm_slot *mm_slot;
+
+	if (test_and_set_bit(MMF_VM_HUGEPAGE, &mm->flags))
+		return 0;
+
+	mm_slot = kmalloc(sizeof(*mm_slot), GFP_KERNEL);
+	if (!mm_slot) {
+		clear_bit(MMF_VM_HUGEPAGE, &mm->flags);
+		return -ENOMEM;
+	}
+	mm_slot->mm = mm;
+	atomic_inc(&mm->mm_count);
+
+	spin_lock(&khugepaged_mm_lock);
+	list_add_tail(&mm_slot->mm_node, &khugepaged_mm_head);
+	spin_unlock(&khugepaged_mm_lock);
+	return 0;
+}
+
+static inline int khugepaged_enter(struct vm_area_struct *vma)
+{
+	if (!test_bit(MMF_VM_HUGEPAGE, &vma->vm_mm->flags))
+		return __khugepaged_enter(vma->vm_mm);
+	return 0;
+}
+
+int khugepaged_fork(struct mm_struct *mm, struct mm_struct *oldmm)
+{
+	if (test_bit(MMF_VM_HUGEPAGE, &oldmm->flags))
+		return __khugepaged_enter(mm);
+	return 0;
+}
+
+/*
+ * Try to map the pmd-sized range around @address with a huge page.
+ * Returns VM_FAULT_FALLBACK if the caller should use small pages instead.
+ */
+int do_huge_anonymous_page(struct mm_struct *mm, struct vm_area_struct *vma,
+			   unsigned long address, pmd_t *pmd, int write_access)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	struct page *page;
+	pgtable_t pgtable;
+	pmd_t entry;
+	int i;
+
+	if (haddr < vma->vm_start || haddr + HPAGE_PMD_SIZE > vma->vm_end)
+		return VM_FAULT_FALLBACK;
+	if (unlikely(anon_vma_prepare(vma)))
+		return VM_FAULT_OOM;
+	if (unlikely(khugepaged_enter(vma)))
+		return VM_FAULT_OOM;
+
+	page = alloc_hugepage(GFP_HIGHUSER_MOVABLE | __GFP_NORETRY);
+	if (unlikely(!page))
+		goto fallback;
+	if (unlikely(charge_hugepage(page, mm))) {
+		free_hugepage(page);
+		goto fallback;
+	}
+	pgtable = pte_alloc_one(mm, haddr);
+	if (unlikely(!pgtable)) {
+		uncharge_free_hugepage(page);
+		return VM_FAULT_OOM;
+	}
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		clear_user_highpage(page + i, haddr + i * PAGE_SIZE);
+		__SetPageUptodate(page + i);
+	}
+	entry = mk_huge_pmd(page, vma);
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_none(*pmd))) {
+		/* Lost the race: let the fault be retried on what is there */
+		spin_unlock(&mm->page_table_lock);
+		pte_free(mm, pgtable);
+		uncharge_free_hugepage(page);
+		return 0;
+	}
+	hugepage_add_new_anon(page, vma, haddr);
+	pgtable_trans_huge_deposit(mm, pgtable);
+	mm->nr_ptes++;
+	add_mm_counter(mm, anon_rss, HPAGE_PMD_NR);
+	set_pmd(pmd, entry);
+	spin_unlock(&mm->page_table_lock);
+
+	count_vm_event(THP_FAULT_ALLOC);
+	return 0;
+
+fallback:
+	count_vm_event(THP_FAULT_FALLBACK);
+	return VM_FAULT_FALLBACK;
+}
+
+/*
+ * A fault on an address that is already mapped huge: either another
+ * thread just installed the pmd, or this is a write to a read-only
+ * mapping (ptrace poking a private text copy).  Only the latter needs
+ * the pte path, which gets there by splitting.
+ */
+int do_huge_pmd_fault(struct mm_struct *mm, struct vm_area_struct *vma,
+		      unsigned long address, pmd_t *pmd, int write_access)
+{
+	if (write_access && !pte_write(pmd_trans_huge_pte(*pmd, 0))) {
+		__split_huge_pmd(mm, pmd, address);
+		return VM_FAULT_FALLBACK;
+	}
+	return 0;
+}
+
+/* Called with page_table_lock held and the pmd checked to be huge */
+struct page *follow_trans_huge_pmd(struct mm_struct *mm, unsigned long address,
+				   pmd_t *pmd, unsigned int flags)
+{
+	struct page *page;
+
+	assert_spin_locked(&mm->page_table_lock);
+	if ((flags & FOLL_WRITE) && !pte_write(pmd_trans_huge_pte(*pmd, 0)))
+		return NULL;
+
+	page = pmd_trans_huge_page(*pmd) +
+		((address & ~HPAGE_PMD_MASK) >> PAGE_SHIFT);
+	if (flags & FOLL_GET)
+		get_page(page);
+	if (flags & FOLL_TOUCH)
+		mark_page_accessed(page);
+	return page;
+}
+
+/*
+ * Unmap a whole huge pmd.  The pages go through the mmu_gather like any
+ * others, so they are not freed before the TLB has been flushed.
+ */
+int zap_huge_pmd(struct mmu_gather *tlb, struct vm_area_struct *vma,
+		 pmd_t *pmd)
+{
+	struct mm_struct *mm = tlb->mm;
+	struct page *page;
+	pgtable_t pgtable;
+	int i;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		return 0;
+	}
+	page = pmd_trans_huge_page(*pmd);
+	pmd_clear(pmd);
+	pgtable = pgtable_trans_huge_withdraw(mm);
+	mm->nr_ptes--;
+	add_mm_counter(mm, anon_rss, -HPAGE_PMD_NR);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		page_remove_rmap(page + i, vma);
+		tlb_remove_page(tlb, page + i);
+	}
+	spin_unlock(&mm->page_table_lock);
+
+	pte_free(mm, pgtable);
+	return 1;
+}
+
+/*
+ * Fork: map the pages of a huge pmd into the child with a huge pmd too,
+ * write-protected in both like any other COW range; the first write then
+ * splits it and copies the page written to.  Returns 1 if the pmd was
+ * split meanwhile, so the caller copies its ptes instead.
+ */
+int copy_huge_pmd(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+		  pmd_t *dst_pmd, pmd_t *src_pmd, unsigned long addr,
+		  struct vm_area_struct *vma)
+{
+	unsigned long haddr = addr & HPAGE_PMD_MASK;
+	struct page *page;
+	pgtable_t pgtable;
+	pmd_t pmd;
+	int i;
+
+	pgtable = pte_alloc_one(dst_mm, haddr);
+	if (unlikely(!pgtable))
+		return -ENOMEM;
+
+	spin_lock(&dst_mm->page_table_lock);
+	spin_lock_nested(&src_mm->page_table_lock, SINGLE_DEPTH_NESTING);
+	if (unlikely(!pmd_trans_huge(*src_pmd))) {
+		spin_unlock(&src_mm->page_table_lock);
+		spin_unlock(&dst_mm->page_table_lock);
+		pte_free(dst_mm, pgtable);
+		return 1;
+	}
+	pmdp_trans_huge_set_wrprotect(src_pmd);
+	pmd = *src_pmd;
+	page = pmd_trans_huge_page(pmd);
+	for (i = 0; i < HPAGE_PMD_NR; i++) {
+		get_page(page + i);
+		page_dup_rmap(page + i, vma, haddr + i * PAGE_SIZE);
+	}
+	pgtable_trans_huge_deposit(dst_mm, pgtable);
+	dst_mm->nr_ptes++;
+	add_mm_counter(dst_mm, anon_rss, HPAGE_PMD_NR);
+	set_pmd(dst_pmd, pmd);
+	spin_unlock(&src_mm->page_table_lock);
+	spin_unlock(&dst_mm->page_table_lock);
+	return 0;
+}
+
+/*
+ * Replace a huge pmd by the pte table deposited for it, mapping the same
+ * pages with the same protection.  The pages themselves are untouched, so
+ * rmap, LRU and the mm counters need no update.
+ */
+void __split_huge_pmd(struct mm_struct *mm, pmd_t *pmd, unsigned long address)
+{
+	unsigned long haddr = address & HPAGE_PMD_MASK;
+	pgtable_t pgtable;
+	pmd_t old;
+	pte_t *pte;
+	int i;
+
+	spin_lock(&mm->page_table_lock);
+	if (unlikely(!pmd_trans_huge(*pmd))) {
+		spin_unlock(&mm->page_table_lock);
+		return;
+	}
+	old = *pmd;
+	pgtable = pgtable_trans_huge_withdraw(mm);
+	pte = (pte_t *)page_address(pgtable);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		set_pte_at(mm, haddr + i * PAGE_SIZE, pte + i,
+			   pmd_trans_huge_pte(old, i));
+
+	/*
+	 * The large TLB entry must be gone before the small ones can be
+	 * loaded: some CPUs do not cope with both at once.  Only faults
+	 * can see the pmd clear meanwhile, and they serialize on
+	 * page_table_lock before touching it.
+	 */
+	pmd_clear(pmd);
+	flush_tlb_mm(mm);
+	smp_wmb(); /* See comment in __pte_alloc */
+	pmd_populate(mm, pmd, pgtable);
+	spin_unlock(&mm->page_table_lock);
+
+	count_vm_event(THP_SPLIT);
+}
+
+/*
+ * page_referenced() for a page mapped by a huge pmd, which has a single
+ * accessed bit for all of its pages: test it without splitting.  Whichever
+ * subpage reclaim ages first clears the bit, and hands the reference on
+ * to all the others by setting PG_referenced, which page_referenced()
+ * consumes as they come up; so every subpage sees the range as used once
+ * per access, whatever order the LRU holds them in.  Returns -1 if @page
+ * is not mapped huge at @address.
+ */
+int page_referenced_trans_huge(struct page *page, struct mm_struct *mm,
+			       unsigned long address)
+{
+	unsigned long index = (address & ~HPAGE_PMD_MASK) >> PAGE_SHIFT;
+	pmd_t *pmd;
+	int young = -1;
+
+	pmd = mm_find_pmd(mm, address);
+	if (!pmd || !pmd_trans_huge(*pmd))
+		return -1;
+
+	spin_lock(&mm->page_table_lock);
+	if (likely(pmd_trans_huge(*pmd)) &&
+	    pmd_trans_huge_page(*pmd) + index == page) {
+		young = pmdp_trans_huge_test_and_clear_young(pmd);
+		if (young) {
+			struct page *head = page - index;
+			int i;
+
+			for (i = 0; i < HPAGE_PMD_NR; i++)
+				if (head + i != page)
+					SetPageReferenced(head + i);
+		}
+	}
+	spin_unlock(&mm->page_table_lock);
+	return young;
+}
+
+int hugepage_madvise(struct vm_area_struct *vma,
+		     unsigned long *vm_flags, int advice)
+{
+	switch (advice) {
+	case MADV_HUGEPAGE:
+		if (vma->vm_file || vma->vm_ops)
+			return -EINVAL;
+		*vm_flags &= ~VM_NOHUGEPAGE;
+		*vm_flags |= VM_HUGEPAGE;
+		/*
+		 * Register now: nothing may ever fault a huge page in here
+		 * if all of it is already populated.
+		 */
+		return __khugepaged_enter(vma->vm_mm);
+	case MADV_NOHUGEPAGE:
+		*vm_flags &= ~VM_HUGEPAGE;
+		*vm_flags |= VM_NOHUGEPAGE;
+		break;
+	}
+	return 0;
+}
+
+/*
+ * Can the pmd-sized range at @address be collapsed?  Every page in it
+ * must be a private, writable, exclusively mapped anonymous page without
+ * other references; up to khugepaged_max_ptes_none holes are filled with
+ * zeroes.  Called with mmap_sem held.
+ */
+static int khugepaged_scan_pmd(struct mm_struct *mm,
+			       struct vm_area_struct *vma,
+			       unsigned long address)
+{
+	pmd_t *pmd;
+	pte_t *pte, *_pte;
+	spinlock_t *ptl;
+	unsigned long _address;
+	int none = 0, ret = 0;
+
+	pmd = mm_find_pmd(mm, address);
+	if (!pmd || pmd_trans_huge(*pmd) || pmd_ptes_shared(*pmd))
+		return 0;
+
+	pte = pte_offset_map_lock(mm, pmd, address, &ptl);
+	for (_pte = pte, _address = address; _pte < pte + HPAGE_PMD_NR;
+	     _pte++, _address += PAGE_SIZE) {
+		pte_t pteval = *_pte;
+		struct page *page;
+
+		if (pte_none(pteval)) {
+			if (++none <= khugepaged_max_ptes_none)
+				continue;
+			goto out_unmap;
+		}
+		if (!pte_present(pteval) || !pte_write(pteval))
+			goto out_unmap;
+		page = vm_normal_page(vma, _address, pteval);
+		if (!page || !PageAnon(page) || PageSwapCache(page) ||
+		    page_count(page) != 1)
+			goto out_unmap;
+	}
+	ret = none < HPAGE_PMD_NR;
+out_unmap:
+	pte_unmap_unlock(pte, ptl);
+	return ret;
+}
+
+/*
+ * Recheck what khugepaged_scan_pmd() found, now that the ptes can no
+ * longer change, and lock the pages so that reclaim and migration keep
+ * off them.  Called with the pte lock held.
+ */
+static int __collapse_huge_page_isolate(struct vm_area_struct *vma,
+					unsigned long address, pte_t *pte)
+{
+	pte_t *_pte;
+	unsigned long _address;
+	int none = 0;
+
+	for (_pte = pte, _address = address; _pte < pte + HPAGE_PMD_NR;
+	     _pte++, _address += PAGE_SIZE) {
+		pte_t pteval = *_pte;
+		struct page *page;
+
+		if (pte_none(pteval)) {
+			if (++none <= khugepaged_max_ptes_none)
+				continue;
+			goto out;
+		}
+		if (!pte_present(pteval) || !pte_write(pteval))
+			goto out;
+		page = vm_normal_page(vma, _address, pteval);
+		if (!page || !PageAnon(page))
+			goto out;
+		if (!trylock_page(page))
+			goto out;
+		/* A page is added to swap cache under its lock */
+		if (PageSwapCache(page) || page_count(page) != 1) {
+			unlock_page(page);
+			goto out;
+		}
+	}
+	return 1;
+
+out:
+	while (--_pte >= pte)
+		if (!pte_none(*_pte))
+			unlock_page(pte_page(*_pte));
+	return 0;
+}
+
+static void __collapse_huge_page_copy(pte_t *pte, struct page *page,
+				      struct vm_area_struct *vma,
+				      unsigned long address, spinlock_t *ptl)
+{
+	pte_t *_pte;
+
+	for (_pte = pte; _pte < pte + HPAGE_PMD_NR;
+	     _pte++, page++, address += PAGE_SIZE) {
+		pte_t pteval = *_pte;
+		struct page *src_page;
+
+		if (pte_none(pteval)) {
+			clear_user_highpage(page, address);
+		} else {
+			src_page = pte_page(pteval);
+			copy_user_highpage(page, src_page, address, vma);
+			spin_lock(ptl);
+			pte_clear(vma->vm_mm, address, _pte);
+			page_remove_rmap(src_page, vma);
+			spin_unlock(ptl);
+			unlock_page(src_page);
+			put_page(src_page);
+		}
+		__SetPageUptodate(page);
+	}
+}
+
+static void collapse_huge_page(struct mm_struct *mm, unsigned long address)
+{
+	struct vm_area_struct *vma;
+	struct page *new_page;
+	pmd_t *pmd, _pmd;
+	pte_t *pte;
+	pgtable_t pgtable;
+	spinlock_t *ptl;
+	int isolated, none = 0, i;
+
+	VM_BUG_ON(address & ~HPAGE_PMD_MASK);
+
+	/* Allocate before taking mmap_sem: this may have to reclaim */
+	new_page = alloc_hugepage(GFP_HIGHUSER_MOVABLE);
+	if (unlikely(!new_page)) {
+		count_vm_event(THP_COLLAPSE_ALLOC_FAILED);
+		return;
+	}
+	if (unlikely(charge_hugepage(new_page, mm))) {
+		free_hugepage(new_page);
+		return;
+	}
+
+	/*
+	 * mmap_sem for writing keeps out page faults and get_user_pages():
+	 * once the pmd is cleared below, nothing but rmap can get at the
+	 * ptes, and rmap is locked out by the anon_vma lock.
+	 */
+	down_write(&mm->mmap_sem);
+	vma = find_vma(mm, address);
+	if (!vma || address < vma->vm_start ||
+	    address + HPAGE_PMD_SIZE > vma->vm_end ||
+	    !transparent_hugepage_enabled(vma) || !vma->anon_vma)
+		goto out;
+
+	pmd = mm_find_pmd(mm, address);
+	if (!pmd || pmd_trans_huge(*pmd) || pmd_ptes_shared(*pmd))
+		goto out;
+
+	mmu_notifier_invalidate_range_start(mm, address,
+					    address + HPAGE_PMD_SIZE);
+	anon_vma_lock(vma->anon_vma);
+
+	spin_lock(&mm->page_table_lock);
+	_pmd = *pmd;
+	pmd_clear(pmd);
+	spin_unlock(&mm->page_table_lock);
+	flush_tlb_range(vma, address, address + HPAGE_PMD_SIZE);
+
+	pte = pte_offset_map(&_pmd, address);
+	ptl = pte_lockptr(mm, &_pmd);
+	spin_lock(ptl);
+	isolated = __collapse_huge_page_isolate(vma, address, pte);
+	spin_unlock(ptl);
+
+	if (unlikely(!isolated)) {
+		pte_unmap(pte);
+		spin_lock(&mm->page_table_lock);
+		pmd_populate(mm, pmd, pmd_pgtable(_pmd));
+		spin_unlock(&mm->page_table_lock);
+		anon_vma_unlock(vma->anon_vma);
+		mmu_notifier_invalidate_range_end(mm, address,
+						  address + HPAGE_PMD_SIZE);
+		goto out;
+	}
+
+	/* The ptes are unreachable now, rmap walkers will find nothing */
+	anon_vma_unlock(vma->anon_vma);
+
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		if (pte_none(pte[i]))
+			none++;
+	__collapse_huge_page_copy(pte, new_page, vma, address, ptl);
+	pte_unmap(pte);
+
+	/* The emptied pte table becomes the one deposited for the split */
+	pgtable = pmd_pgtable(_pmd);
+
+	spin_lock(&mm->page_table_lock);
+	BUG_ON(!pmd_none(*pmd));
+	hugepage_add_new_anon(new_page, vma, address);
+	pgtable_trans_huge_deposit(mm, pgtable);
+	add_mm_counter(mm, anon_rss, none);
+	set_pmd(pmd, mk_huge_pmd(new_page, vma));
+	spin_unlock(&mm->page_table_lock);
+
+	mmu_notifier_invalidate_range_end(mm, address,
+					  address + HPAGE_PMD_SIZE);
+
+	count_vm_event(THP_COLLAPSE_ALLOC);
+	khugepaged_pages_collapsed++;
+	up_write(&mm->mmap_sem);
+	return;
+
+out:
+	up_write(&mm->mmap_sem);
+	uncharge_free_hugepage(new_page);
+}
+
+/* Move the cursor past @mm_slot, freeing it if its mm has exited */
+static void khugepaged_next_mm(struct mm_slot *mm_slot, int drop)
+{
+	spin_lock(&khugepaged_mm_lock);
+	if (mm_slot->mm_node.next != &khugepaged_mm_head) {
+		khugepaged_scan.mm_slot = list_entry(mm_slot->mm_node.next,
+						     struct mm_slot, mm_node);
+	} else {
+		khugepaged_scan.mm_slot = NULL;
+		khugepaged_full_scans++;
+	}
+	khugepaged_scan.address = 0;
+	if (drop)
+		list_del(&mm_slot->mm_node);
+	spin_unlock(&khugepaged_mm_lock);
+
+	if (drop) {
+		mmdrop(mm_slot->mm);
+		kfree(mm_slot);
+	}
+}
+
+static unsigned int khugepaged_scan_mm_slot(struct mm_slot *mm_slot,
+					    unsigned int pages)
+{
+	struct mm_struct *mm = mm_slot->mm;
+	struct vm_area_struct *vma;
+	unsigned long address = khugepaged_scan.address;
+	unsigned int progress = 1;	/* for the mm itself */
+
+	if (!atomic_inc_not_zero(&mm->mm_users)) {
+		khugepaged_next_mm(mm_slot, 1);
+		return 1;
+	}
+
+	down_read(&mm->mmap_sem);
+	for (vma = find_vma(mm, address); vma; vma = vma->vm_next) {
+		unsigned long hstart, hend;
+
+		progress++;
+		if (!transparent_hugepage_enabled(vma))
+			continue;
+		hstart = (vma->vm_start + ~HPAGE_PMD_MASK) & HPAGE_PMD_MASK;
+		hend = vma->vm_end & HPAGE_PMD_MASK;
+		if (address < hstart)
+			address = hstart;
+		for (; address < hend; address += HPAGE_PMD_SIZE) {
+			if (progress >= pages)
+				goto out;
+			progress += HPAGE_PMD_NR;
+			if (khugepaged_scan_pmd(mm, vma, address)) {
+				up_read(&mm->mmap_sem);
+				collapse_huge_page(mm, address);
+				khugepaged_scan.address = address +
+							  HPAGE_PMD_SIZE;
+				mmput(mm);
+				return progress;
+			}
+			cond_resched();
+		}
+	}
+out:
+	up_read(&mm->mmap_sem);
+	if (vma)
+		khugepaged_scan.address = address;
+	else
+		khugepaged_next_mm(mm_slot, 0);
+	mmput(mm);
+	return progress;
+}
+
+static void khugepaged_do_scan(void)
+{
+	unsigned int progress = 0, pages = khugepaged_pages_to_scan;
+
+	while (progress < pages) {
+		struct mm_slot *mm_slot;
+
+		spin_lock(&khugepaged_mm_lock);
+		if (!khugepaged_scan.mm_slot) {
+			if (list_empty(&khugepaged_mm_head)) {
+				spin_unlock(&khugepaged_mm_lock);
+				break;
+			}
+			khugepaged_scan.mm_slot = list_entry(
+				khugepaged_mm_head.next, struct mm_slot, mm_node);
+			khugepaged_scan.address = 0;
+		}
+		mm_slot = khugepaged_scan.mm_slot;
+		spin_unlock(&khugepaged_mm_lock);
+
+		progress += khugepaged_scan_mm_slot(mm_slot, pages - progress);
+		if (kthread_should_stop())
+			break;
+	}
+}
+
+static int khugepaged(void *none)
+{
+	set_freezable();
+	set_user_nice(current, 19);
+
+	while (!kthread_should_stop()) {
+		if (test_bit(TRANSPARENT_HUGEPAGE_FLAG,
+			     &transparent_hugepage_flags) ||
+		    test_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			     &transparent_hugepage_flags))
+			khugepaged_do_scan();
+		wait_event_freezable_timeout(khugepaged_wait,
+			kthread_should_stop(),
+			msecs_to_jiffies(khugepaged_scan_sleep_millisecs));
+	}
+	return 0;
+}
+
+#ifdef CONFIG_SYSFS
+static ssize_t enabled_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	if (test_bit(TRANSPARENT_HUGEPAGE_FLAG, &transparent_hugepage_flags))
+		return sprintf(buf, "[always] madvise never\n");
+	if (test_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+		     &transparent_hugepage_flags))
+		return sprintf(buf, "always [madvise] never\n");
+	return sprintf(buf, "always madvise [never]\n");
+}
+
+static ssize_t enabled_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	if (!memcmp("always", buf, min(sizeof("always")-1, count))) {
+		set_bit(TRANSPARENT_HUGEPAGE_FLAG, &transparent_hugepage_flags);
+		clear_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			  &transparent_hugepage_flags);
+	} else if (!memcmp("madvise", buf, min(sizeof("madvise")-1, count))) {
+		clear_bit(TRANSPARENT_HUGEPAGE_FLAG,
+			  &transparent_hugepage_flags);
+		set_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			&transparent_hugepage_flags);
+	} else if (!memcmp("never", buf, min(sizeof("never")-1, count))) {
+		clear_bit(TRANSPARENT_HUGEPAGE_FLAG,
+			  &transparent_hugepage_flags);
+		clear_bit(TRANSPARENT_HUGEPAGE_REQ_MADV_FLAG,
+			  &transparent_hugepage_flags);
+	} else
+		return -EINVAL;
+
+	return count;
+}
+static struct kobj_attribute enabled_attr =
+	__ATTR(enabled, 0644, enabled_show, enabled_store);
+
+static struct attribute *hugepage_attr[] = {
+	&enabled_attr.attr,
+	NULL,
+};
+
+static struct attribute_group hugepage_attr_group = {
+	.attrs = hugepage_attr,
+};
+
+#define KHUGEPAGED_ATTR(_name, _min, _max)				\
+static ssize_t _name##_show(struct kobject *kobj,			\
+			    struct kobj_attribute *attr, char *buf)	\
+{									\
+	return sprintf(buf, "%u\n", khugepaged_##_name);		\
+}									\
+static ssize_t _name##_store(struct kobject *kobj,			\
+			     struct kobj_attribute *attr,		\
+			     const char *buf, size_t count)		\
+{									\
+	unsigned long val;						\
+									\
+	if (strict_strtoul(buf, 10, &val) || val < (_min) || val > (_max)) \
+		return -EINVAL;						\
+	khugepaged_##_name = val;					\
+	return count;							\
+}									\
+static struct kobj_attribute _name##_attr =				\
+	__ATTR(_name, 0644, _name##_show, _name##_store)
+
+#define KHUGEPAGED_ATTR_RO(_name)					\
+static ssize_t _name##_show(struct kobject *kobj,			\
+			    struct kobj_attribute *attr, char *buf)	\
+{									\
+	return sprintf(buf, "%u\n", khugepaged_##_name);		\
+}									\
+static struct kobj_attribute _name##_attr = __ATTR_RO(_name)
+
+KHUGEPAGED_ATTR(pages_to_scan, 1, UINT_MAX);
+KHUGEPAGED_ATTR(scan_sleep_millisecs, 0, UINT_MAX);
+KHUGEPAGED_ATTR(max_ptes_none, 0, HPAGE_PMD_NR - 1);
+KHUGEPAGED_ATTR_RO(pages_collapsed);
+KHUGEPAGED_ATTR_RO(full_scans);
+
+static struct attribute *khugepaged_attr[] = {
+	&pages_to_scan_attr.attr,
+	&scan_sleep_millisecs_attr.attr,
+	&max_ptes_none_attr.attr,
+	&pages_collapsed_attr.attr,
+	&full_scans_attr.attr,
+	NULL,
+};
+
+static struct attribute_group khugepaged_attr_group = {
+	.attrs = khugepaged_attr,
+	.name = "khugepaged",
+};
+
+static void __init hugepage_sysfs_init(void)
+{
+	struct kobject *hugepage_kobj;
+
+	hugepage_kobj = kobject_create_and_add("transparent_hugepage", mm_kobj);
+	if (!hugepage_kobj)
+		return;
+
+	if (sysfs_create_group(hugepage_kobj, &hugepage_attr_group) ||
+	    sysfs_create_group(hugepage_kobj, &khugepaged_attr_group))
+		printk(KERN_ERR "hugepage: unable to register sysfs files\n");
+}
+#else
+static inline void hugepage_sysfs_init(void)
+{
+}
+#endif /* CONFIG_SYSFS */
+
+static int __init hugepage_init(void)
+{
+	hugepage_sysfs_init();
+
+	khugepaged_thread = kthread_run(khugepaged, NULL, "khugepaged");
+	if (IS_ERR(khugepaged_thread)) {
+		printk(KERN_ERR "hugepage: unable to start khugepaged\n");
+		khugepaged_thread = NULL;
+	}
+	return 0;
+}
+module_init(hugepage_init)
@@ -50,6 +50,11 @@ extern void putback_lru_page(struct page *page);
  * in mm/page_alloc.c
  */
 extern void __free_pages_bootmem(struct page *page, unsigned int order);
+#ifdef CONFIG_COMPACTION
+extern unsigned long isolate_freepages_block(struct zone *zone,
+		unsigned long block_pfn, unsigned int max_order,
+		struct list_head *freelist);
+#endif
 
 /*
  * function for dealing with page's order in buddy system.
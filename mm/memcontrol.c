@@ -34,11 +34,16 @@
 #include <linux/vmalloc.h>
 #include <linux/mm_inline.h>
 #include <linux/page_cgroup.h>
+#include <linux/rbtree.h>
+#include <linux/workqueue.h>
+#include <linux/cpu.h>
 
 #include <asm/uaccess.h>
 
 struct cgroup_subsys mem_cgroup_subsys __read_mostly;
 #define MEM_CGROUP_RECLAIM_RETRIES	5
+#define SOFTLIMIT_EVENTS_THRESH		(1000)
+#define CHARGE_SIZE			(32 * PAGE_SIZE)
 
 /*
  * Statistics for memory cgroup.
@@ -51,6 +56,8 @@ enum mem_cgroup_stat_index {
 	MEM_CGROUP_STAT_RSS,	   /* # of pages charged as rss */
 	MEM_CGROUP_STAT_PGPGIN_COUNT,	/* # of pages paged in */
 	MEM_CGROUP_STAT_PGPGOUT_COUNT,	/* # of pages paged out */
+	MEM_CGROUP_STAT_EVENTS,	/* # of charges + uncharges, reset for */
+				/* soft limit tree updates */
 
 	MEM_CGROUP_STAT_NSTATS,
 };
@@ -82,6 +89,19 @@ static s64 mem_cgroup_read_stat(struct mem_cgroup_stat *stat,
 	return ret;
 }
 
+static s64 __mem_cgroup_stat_read_local(struct mem_cgroup_stat_cpu *stat,
+		enum mem_cgroup_stat_index idx)
+{
+	return stat->count[idx];
+}
+
+static inline void __mem_cgroup_stat_reset_safe(
+		struct mem_cgroup_stat_cpu *stat,
+		enum mem_cgroup_stat_index idx)
+{
+	stat->count[idx] = 0;
+}
+
 /*
  * per-zone information in memory controller.
  */
@@ -92,6 +112,11 @@ struct mem_cgroup_per_zone {
 	spinlock_t		lru_lock;
 	struct list_head	lists[NR_LRU_LISTS];
 	unsigned long		count[NR_LRU_LISTS];
+
+	struct rb_node		tree_node;	/* soft limit tree node */
+	unsigned long long	usage_in_excess;/* key in the soft limit tree */
+	bool			on_tree;
+	struct mem_cgroup	*mem;		/* back pointer */
 };
 /* Macro for accessing counter */
 #define MEM_CGROUP_ZSTAT(mz, idx)	((mz)->count[(idx)])
@@ -104,16 +129,39 @@ struct mem_cgroup_lru_info {
 	struct mem_cgroup_per_node *nodeinfo[MAX_NUMNODES];
 };
 
+/*
+ * Cgroups whose usage is above their soft limit are kept in a per-zone
+ * RB tree, sorted by how much they exceed it, so that kswapd can go
+ * after the largest offender in the zone it is balancing.
+ */
+struct mem_cgroup_tree_per_zone {
+	struct rb_root rb_root;
+	spinlock_t lock;
+};
+
+struct mem_cgroup_tree_per_node {
+	struct mem_cgroup_tree_per_zone rb_tree_per_zone[MAX_NR_ZONES];
+};
+
+struct mem_cgroup_tree {
+	struct mem_cgroup_tree_per_node *rb_tree_per_node[MAX_NUMNODES];
+};
+
+static struct mem_cgroup_tree soft_limit_tree __read_mostly;
+
+/* background reclaim above the high watermark */
+static struct workqueue_struct *memcg_reclaim_wq;
+
 /*
  * The memory controller data structure. The memory controller controls both
  * page cache and RSS per cgroup. We would eventually like to provide
  * statistics based on the statistics developed by Rik Van Riel for clock-pro,
  * to help the administrator determine what knobs to tune.
  *
- * TODO: Add a water mark for the memory controller. Reclaim will begin when
- * we hit the water mark. May be even add a low water mark, such that
- * no reclaim occurs from a cgroup at it's low water mark, this is
- * a feature that will be implemented much later in the future.
+ * Besides the hard limit, there is a soft limit, which global reclaim
+ * pushes the usage back to before it touches other cgroups, and a high
+ * watermark, above which the usage is reclaimed in the background before
+ * the hard limit is hit.
  */
 struct mem_cgroup {
 	struct cgroup_subsys_state css;
@@ -128,6 +176,11 @@ struct mem_cgroup {
 	struct mem_cgroup_lru_info info;
 
 	int	prev_priority;	/* for recording reclaim priority */
+	/*
+	 * usage above which high_work reclaims in the background
+	 */
+	unsigned long long high_wmark;
+	struct work_struct high_work;
 	/*
 	 * statistics.
 	 */
@@ -182,6 +235,7 @@ static void mem_cgroup_charge_statistics(struct mem_cgroup *mem,
 	else
 		__mem_cgroup_stat_add_safe(cpustat,
 				MEM_CGROUP_STAT_PGPGOUT_COUNT, 1);
+	__mem_cgroup_stat_add_safe(cpustat, MEM_CGROUP_STAT_EVENTS, 1);
 }
 
 static struct mem_cgroup_per_zone *
@@ -200,6 +254,180 @@ page_cgroup_zoneinfo(struct page_cgroup *pc)
 	return mem_cgroup_zoneinfo(mem, nid, zid);
 }
 
+static struct mem_cgroup_tree_per_zone *
+soft_limit_tree_node_zone(int nid, int zid)
+{
+	return &soft_limit_tree.rb_tree_per_node[nid]->rb_tree_per_zone[zid];
+}
+
+static void
+__mem_cgroup_insert_exceeded(struct mem_cgroup_per_zone *mz,
+			     struct mem_cgroup_tree_per_zone *mctz,
+			     unsigned long long excess)
+{
+	struct rb_node **p = &mctz->rb_root.rb_node;
+	struct rb_node *parent = NULL;
+	struct mem_cgroup_per_zone *mz_node;
+
+	if (mz->on_tree)
+		return;
+
+	mz->usage_in_excess = excess;
+	while (*p) {
+		parent = *p;
+		mz_node = rb_entry(parent, struct mem_cgroup_per_zone,
+					tree_node);
+		if (mz->usage_in_excess < mz_node->usage_in_excess)
+			p = &(*p)->rb_left;
+		else
+			p = &(*p)->rb_right;
+	}
+	rb_link_node(&mz->tree_node, parent, p);
+	rb_insert_color(&mz->tree_node, &mctz->rb_root);
+	mz->on_tree = true;
+}
+
+static void
+__mem_cgroup_remove_exceeded(struct mem_cgroup_per_zone *mz,
+			     struct mem_cgroup_tree_per_zone *mctz)
+{
+	if (!mz->on_tree)
+		return;
+	rb_erase(&mz->tree_node, &mctz->rb_root);
+	mz->on_tree = false;
+}
+
+/*
+ * Returns true every SOFTLIMIT_EVENTS_THRESH charge events on this cpu,
+ * so that the soft limit tree is not updated on every charge.
+ */
+static bool mem_cgroup_soft_limit_check(struct mem_cgroup *mem)
+{
+	struct mem_cgroup_stat_cpu *cpustat;
+	bool ret = false;
+
+	cpustat = &mem->stat.cpustat[get_cpu()];
+	if (unlikely(__mem_cgroup_stat_read_local(cpustat,
+			MEM_CGROUP_STAT_EVENTS) > SOFTLIMIT_EVENTS_THRESH)) {
+		__mem_cgroup_stat_reset_safe(cpustat, MEM_CGROUP_STAT_EVENTS);
+		ret = true;
+	}
+	put_cpu();
+	return ret;
+}
+
+/*
+ * Requeue the cgroup in the soft limit tree of @page's zone according
+ * to its current excess.  Trees of other zones are only updated when
+ * pages from there are charged or uncharged, so their order is fuzzy;
+ * soft limit reclaim rechecks the excess before it acts on it.
+ */
+static void mem_cgroup_update_tree(struct mem_cgroup *mem, struct page *page)
+{
+	unsigned long long excess;
+	struct mem_cgroup_per_zone *mz;
+	struct mem_cgroup_tree_per_zone *mctz;
+	int nid = page_to_nid(page);
+	int zid = page_zonenum(page);
+	unsigned long flags;
+
+	mz = mem_cgroup_zoneinfo(mem, nid, zid);
+	mctz = soft_limit_tree_node_zone(nid, zid);
+	excess = res_counter_soft_limit_excess(&mem->res);
+
+	spin_lock_irqsave(&mctz->lock, flags);
+	__mem_cgroup_remove_exceeded(mz, mctz);
+	if (excess)
+		__mem_cgroup_insert_exceeded(mz, mctz, excess);
+	spin_unlock_irqrestore(&mctz->lock, flags);
+}
+
+static void mem_cgroup_remove_from_trees(struct mem_cgroup *mem)
+{
+	struct mem_cgroup_per_zone *mz;
+	struct mem_cgroup_tree_per_zone *mctz;
+	unsigned long flags;
+	int node, zid;
+
+	for_each_node_state(node, N_POSSIBLE)
+		for (zid = 0; zid < MAX_NR_ZONES; zid++) {
+			mz = mem_cgroup_zoneinfo(mem, node, zid);
+			mctz = soft_limit_tree_node_zone(node, zid);
+			spin_lock_irqsave(&mctz->lock, flags);
+			__mem_cgroup_remove_exceeded(mz, mctz);
+			spin_unlock_irqrestore(&mctz->lock, flags);
+		}
+}
+
+/*
+ * Take the largest offender off the tree and return it with a css
+ * reference held; the caller puts it back if it is still over its soft
+ * limit after reclaim.
+ */
+static struct mem_cgroup_per_zone *
+mem_cgroup_largest_soft_limit_node(struct mem_cgroup_tree_per_zone *mctz)
+{
+	struct rb_node *rightmost;
+	struct mem_cgroup_per_zone *mz;
+
+	spin_lock_irq(&mctz->lock);
+retry:
+	mz = NULL;
+	rightmost = rb_last(&mctz->rb_root);
+	if (!rightmost)
+		goto done;
+	mz = rb_entry(rightmost, struct mem_cgroup_per_zone, tree_node);
+	__mem_cgroup_remove_exceeded(mz, mctz);
+	if (!res_counter_soft_limit_excess(&mz->mem->res))
+		goto retry;
+	css_get(&mz->mem->css);
+done:
+	spin_unlock_irq(&mctz->lock);
+	return mz;
+}
+
+/*
+ * Queue background reclaim if the usage went above the high watermark.
+ * The work item holds a css reference until it is done.
+ */
+static void mem_cgroup_check_high_wmark(struct mem_cgroup *mem)
+{
+	if (likely(mem->res.usage <= mem->high_wmark) || !memcg_reclaim_wq)
+		return;
+	css_get(&mem->css);
+	if (!queue_work(memcg_reclaim_wq, &mem->high_work))
+		css_put(&mem->css);
+}
+
+#define MEM_CGROUP_HIGH_RECLAIM_LOOPS	16
+
+/*
+ * Do a bounded number of reclaim passes so that a group which keeps
+ * charging as fast as we free cannot pin a worker forever; if the usage
+ * is still above the watermark, requeue ourselves behind the other
+ * groups and hand the css reference on to the next run.
+ */
+static void mem_cgroup_high_work(struct work_struct *work)
+{
+	struct mem_cgroup *mem = container_of(work, struct mem_cgroup,
+						high_work);
+	int retry = MEM_CGROUP_RECLAIM_RETRIES;
+	int loops = MEM_CGROUP_HIGH_RECLAIM_LOOPS;
+
+	while (mem->res.usage > mem->high_wmark) {
+		if (!try_to_free_mem_cgroup_pages(mem, GFP_KERNEL) && !--retry)
+			goto out;
+		if (!--loops)
+			break;
+		cond_resched();
+	}
+	if (mem->res.usage > mem->high_wmark &&
+	    queue_work(memcg_reclaim_wq, &mem->high_work))
+		return;
+out:
+	css_put(&mem->css);
+}
+
 static unsigned long mem_cgroup_get_all_zonestat(struct mem_cgroup *mem,
 					enum lru_list idx)
 {
@@ -445,8 +673,7 @@ unsigned long mem_cgroup_isolate_pages(unsigned long nr_to_scan,
 		 * TODO: play better with lumpy reclaim, grabbing anything.
 		 */
 		if (PageUnevictable(page) ||
-		    (PageActive(page) && !active) ||
-		    (!PageActive(page) && active)) {
+		    !is_active_lru(page_lru(page)) != !active) {
 			__mem_cgroup_move_lists(pc, page_lru(page));
 			continue;
 		}
@@ -467,6 +694,160 @@ unsigned long mem_cgroup_isolate_pages(unsigned long nr_to_scan,
 	return nr_taken;
 }
 
+#define MEM_CGROUP_SOFT_LIMIT_RECLAIM_LOOPS	4
+
+/*
+ * Called by kswapd before it scans @zone: reclaim from the cgroups that
+ * exceed their soft limit the most, so that they give memory back
+ * before everybody else has to.
+ */
+unsigned long mem_cgroup_soft_limit_reclaim(struct zone *zone, int order,
+					    gfp_t gfp_mask, int priority)
+{
+	struct mem_cgroup_tree_per_zone *mctz;
+	struct mem_cgroup_per_zone *mz;
+	unsigned long long excess;
+	unsigned long nr_reclaimed = 0;
+	int loop = 0;
+
+	if (mem_cgroup_subsys.disabled)
+		return 0;
+	/* the per cgroup LRU is no use to lumpy reclaim */
+	if (order > 0)
+		return 0;
+
+	mctz = soft_limit_tree_node_zone(zone_to_nid(zone), zone_idx(zone));
+	do {
+		if (RB_EMPTY_ROOT(&mctz->rb_root))
+			break;
+		mz = mem_cgroup_largest_soft_limit_node(mctz);
+		if (!mz)
+			break;
+
+		nr_reclaimed += mem_cgroup_shrink_zone(mz->mem, zone,
+						       gfp_mask, priority);
+
+		excess = res_counter_soft_limit_excess(&mz->mem->res);
+		spin_lock_irq(&mctz->lock);
+		if (excess)
+			__mem_cgroup_insert_exceeded(mz, mctz, excess);
+		spin_unlock_irq(&mctz->lock);
+		css_put(&mz->mem->css);
+	} while (!nr_reclaimed &&
+		 ++loop < MEM_CGROUP_SOFT_LIMIT_RECLAIM_LOOPS);
+
+	return nr_reclaimed;
+}
+
+/*
+ * Charging a page takes the res_counter lock, which is shared by all cpus
+ * charging to the cgroup.  To keep it off the fault path, every cpu
+ * charges CHARGE_SIZE at once and keeps what the page didn't need in a
+ * stock, from which the following charges to the same cgroup are taken
+ * without touching the counter.  A cpu stocks for one cgroup at a time,
+ * and holds a css reference on it meanwhile.  The stocks are given back
+ * when a cgroup runs into its limit, is resized or emptied, and when a
+ * cpu goes offline.
+ */
+struct memcg_stock_pcp {
+	struct mem_cgroup *cached;	/* cgroup the charge is stocked for */
+	int charge;			/* bytes charged but not used yet */
+	struct work_struct work;
+};
+static DEFINE_PER_CPU(struct memcg_stock_pcp, memcg_stock);
+
+/*
+ * Take a page's worth of charge from this cpu's stock, if it is stocked
+ * for @mem.  Returns true on success.
+ */
+static bool consume_stock(struct mem_cgroup *mem)
+{
+	struct memcg_stock_pcp *stock;
+	bool ret = true;
+
+	stock = &get_cpu_var(memcg_stock);
+	if (mem == stock->cached && stock->charge)
+		stock->charge -= PAGE_SIZE;
+	else
+		ret = false;
+	put_cpu_var(memcg_stock);
+	return ret;
+}
+
+/*
+ * Give the stocked charge back to the res_counter.  Called with
+ * preemption disabled, or for the stock of a dead cpu.
+ */
+static void drain_stock(struct memcg_stock_pcp *stock)
+{
+	struct mem_cgroup *old = stock->cached;
+
+	if (!old)
+		return;
+	if (stock->charge)
+		res_counter_uncharge(&old->res, stock->charge);
+	stock->charge = 0;
+	stock->cached = NULL;
+	css_put(&old->css);
+}
+
+static void drain_local_stock(struct work_struct *dummy)
+{
+	drain_stock(&get_cpu_var(memcg_stock));
+	put_cpu_var(memcg_stock);
+}
+
+/*
+ * Stock @val bytes of charge for @mem on this cpu, giving back what is
+ * stocked for another cgroup.
+ */
+static void refill_stock(struct mem_cgroup *mem, int val)
+{
+	struct memcg_stock_pcp *stock = &get_cpu_var(memcg_stock);
+
+	if (stock->cached != mem) {
+		drain_stock(stock);
+		css_get(&mem->css);
+		stock->cached = mem;
+	}
+	stock->charge += val;
+	put_cpu_var(memcg_stock);
+}
+
+/*
+ * Ask the cpus stocking for @mem to give their charge back, without
+ * waiting for them.  Used when @mem runs into its limit.
+ */
+static void drain_all_stock_async(struct mem_cgroup *mem)
+{
+	int cpu;
+
+	get_online_cpus();
+	for_each_online_cpu(cpu) {
+		struct memcg_stock_pcp *stock = &per_cpu(memcg_stock, cpu);
+
+		if (stock->cached == mem)
+			schedule_work_on(cpu, &stock->work);
+	}
+	put_online_cpus();
+}
+
+/* Drain all stocks and wait for it */
+static void drain_all_stock_sync(void)
+{
+	schedule_on_each_cpu(drain_local_stock);
+}
+
+static int __cpuinit memcg_stock_cpu_callback(struct notifier_block *nb,
+					unsigned long action, void *hcpu)
+{
+	int cpu = (unsigned long)hcpu;
+
+	if (action == CPU_DEAD || action == CPU_DEAD_FROZEN)
+		drain_stock(&per_cpu(memcg_stock, cpu));
+	return NOTIFY_OK;
+}
+
 /*
  * Charge the memory controller for page usage.
  * Return
@@ -482,6 +863,7 @@ static int mem_cgroup_charge_common(struct page *page, struct mm_struct *mm,
 	unsigned long nr_retries = MEM_CGROUP_RECLAIM_RETRIES;
 	struct mem_cgroup_per_zone *mz;
 	unsigned long flags;
+	int csize = CHARGE_SIZE;
 
 	pc = lookup_page_cgroup(page);
 	/* can happen at boot */
@@ -512,10 +894,19 @@ static int mem_cgroup_charge_common(struct page *page, struct mm_struct *mm,
 		css_get(&memcg->css);
 	}
 
-	while (unlikely(res_counter_charge(&mem->res, PAGE_SIZE))) {
+	if (consume_stock(mem))
+		goto charged;
+
+	while (unlikely(res_counter_charge(&mem->res, csize))) {
+		/* no room for a whole batch, charge just the page */
+		if (csize > PAGE_SIZE) {
+			csize = PAGE_SIZE;
+			continue;
+		}
 		if (!(gfp_mask & __GFP_WAIT))
 			goto out;
 
+		drain_all_stock_async(mem);
 		if (try_to_free_mem_cgroup_pages(mem, gfp_mask))
 			continue;
 
@@ -534,8 +925,10 @@ static int mem_cgroup_charge_common(struct page *page, struct mm_struct *mm,
 			goto out;
 		}
 	}
+	if (csize > PAGE_SIZE)
+		refill_stock(mem, csize - PAGE_SIZE);
 
-
+charged:
 	lock_page_cgroup(pc);
 	if (unlikely(PageCgroupUsed(pc))) {
 		unlock_page_cgroup(pc);
@@ -558,6 +951,9 @@ static int mem_cgroup_charge_common(struct page *page, struct mm_struct *mm,
 	spin_unlock_irqrestore(&mz->lru_lock, flags);
 	unlock_page_cgroup(pc);
 
+	if (mem_cgroup_soft_limit_check(mem))
+		mem_cgroup_update_tree(mem, page);
+	mem_cgroup_check_high_wmark(mem);
 done:
 	return 0;
 out:
@@ -666,6 +1062,8 @@ __mem_cgroup_uncharge_common(struct page *page, enum charge_type ctype)
 	unlock_page_cgroup(pc);
 
 	res_counter_uncharge(&mem->res, PAGE_SIZE);
+	if (mem_cgroup_soft_limit_check(mem))
+		mem_cgroup_update_tree(mem, page);
 	css_put(&mem->css);
 
 	return;
@@ -795,6 +1193,9 @@ int mem_cgroup_resize_limit(struct mem_cgroup *memcg, unsigned long long val)
 			ret = -EBUSY;
 			break;
 		}
+		/* stocked charge may be all that is in the way */
+		if (retry_count == MEM_CGROUP_RECLAIM_RETRIES)
+			drain_all_stock_sync();
 		progress = try_to_free_mem_cgroup_pages(memcg, GFP_KERNEL);
 		if (!progress)
 			retry_count--;
@@ -869,6 +1270,7 @@ static int mem_cgroup_force_empty(struct mem_cgroup *mem)
 			goto out;
 		/* This is for making all *used* pages to be on LRU. */
 		lru_add_drain_all();
+		drain_all_stock_sync();
 		for_each_node_state(node, N_POSSIBLE)
 			for (zid = 0; zid < MAX_NR_ZONES; zid++) {
 				struct mem_cgroup_per_zone *mz;
@@ -892,7 +1294,7 @@ static u64 mem_cgroup_read(struct cgroup *cont, struct cftype *cft)
 }
 /*
  * The user of this function is...
- * RES_LIMIT.
+ * RES_LIMIT, RES_SOFT_LIMIT.
  */
 static int mem_cgroup_write(struct cgroup *cont, struct cftype *cft,
 			    const char *buffer)
@@ -908,6 +1310,11 @@ static int mem_cgroup_write(struct cgroup *cont, struct cftype *cft,
 		if (!ret)
 			ret = mem_cgroup_resize_limit(memcg, val);
 		break;
+	case RES_SOFT_LIMIT:
+		ret = res_counter_memparse_write_strategy(buffer, &val);
+		if (!ret)
+			res_counter_set_soft_limit(&memcg->res, val);
+		break;
 	default:
 		ret = -EINVAL; /* should be BUG() ? */
 		break;
@@ -915,6 +1322,28 @@ static int mem_cgroup_write(struct cgroup *cont, struct cftype *cft,
 	return ret;
 }
 
+static u64 mem_cgroup_high_wmark_read(struct cgroup *cont, struct cftype *cft)
+{
+	return mem_cgroup_from_cont(cont)->high_wmark;
+}
+
+static int mem_cgroup_high_wmark_write(struct cgroup *cont, struct cftype *cft,
+				       const char *buffer)
+{
+	struct mem_cgroup *memcg = mem_cgroup_from_cont(cont);
+	unsigned long long val;
+	int ret;
+
+	ret = res_counter_memparse_write_strategy(buffer, &val);
+	if (ret)
+		return ret;
+	if (val > memcg->res.limit)
+		return -EINVAL;
+	memcg->high_wmark = val;
+	mem_cgroup_check_high_wmark(memcg);
+	return 0;
+}
+
 static int mem_cgroup_reset(struct cgroup *cont, unsigned int event)
 {
 	struct mem_cgroup *mem;
@@ -953,7 +1382,7 @@ static int mem_control_stat_show(struct cgroup *cont, struct cftype *cft,
 	struct mem_cgroup_stat *stat = &mem_cont->stat;
 	int i;
 
-	for (i = 0; i < ARRAY_SIZE(stat->cpustat[0].count); i++) {
+	for (i = 0; i < ARRAY_SIZE(mem_cgroup_stat_desc); i++) {
 		s64 val;
 
 		val = mem_cgroup_read_stat(stat, i);
@@ -1005,6 +1434,17 @@ static struct cftype mem_cgroup_files[] = {
 		.write_string = mem_cgroup_write,
 		.read_u64 = mem_cgroup_read,
 	},
+	{
+		.name = "soft_limit_in_bytes",
+		.private = RES_SOFT_LIMIT,
+		.write_string = mem_cgroup_write,
+		.read_u64 = mem_cgroup_read,
+	},
+	{
+		.name = "high_wmark_in_bytes",
+		.write_string = mem_cgroup_high_wmark_write,
+		.read_u64 = mem_cgroup_high_wmark_read,
+	},
 	{
 		.name = "failcnt",
 		.private = RES_FAILCNT,
@@ -1049,6 +1489,7 @@ static int alloc_mem_cgroup_per_zone_info(struct mem_cgroup *mem, int node)
 		spin_lock_init(&mz->lru_lock);
 		for_each_lru(l)
 			INIT_LIST_HEAD(&mz->lists[l]);
+		mz->mem = mem;
 	}
 	return 0;
 }
@@ -1058,6 +1499,31 @@ static void free_mem_cgroup_per_zone_info(struct mem_cgroup *mem, int node)
 	kfree(mem->info.nodeinfo[node]);
 }
 
+static int mem_cgroup_soft_limit_tree_init(void)
+{
+	struct mem_cgroup_tree_per_node *rtpn;
+	struct mem_cgroup_tree_per_zone *rtpz;
+	int node, zone, tmp;
+
+	for_each_node_state(node, N_POSSIBLE) {
+		tmp = node;
+		if (!node_state(node, N_NORMAL_MEMORY))
+			tmp = -1;
+		rtpn = kzalloc_node(sizeof(*rtpn), GFP_KERNEL, tmp);
+		if (!rtpn)
+			return 1;
+
+		soft_limit_tree.rb_tree_per_node[node] = rtpn;
+
+		for (zone = 0; zone < MAX_NR_ZONES; zone++) {
+			rtpz = &rtpn->rb_tree_per_zone[zone];
+			rtpz->rb_root = RB_ROOT;
+			spin_lock_init(&rtpz->lock);
+		}
+	}
+	return 0;
+}
+
 static struct mem_cgroup *mem_cgroup_alloc(void)
 {
 	struct mem_cgroup *mem;
@@ -1088,7 +1554,15 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 	int node;
 
 	if (unlikely((cont->parent) == NULL)) {
+		int cpu;
+
 		mem = &init_mem_cgroup;
+		if (mem_cgroup_soft_limit_tree_init())
+			return ERR_PTR(-ENOMEM);
+		for_each_possible_cpu(cpu)
+			INIT_WORK(&per_cpu(memcg_stock, cpu).work,
+				  drain_local_stock);
+		hotcpu_notifier(memcg_stock_cpu_callback, 0);
 	} else {
 		mem = mem_cgroup_alloc();
 		if (!mem)
@@ -1096,6 +1570,8 @@ mem_cgroup_create(struct cgroup_subsys *ss, struct cgroup *cont)
 	}
 
 	res_counter_init(&mem->res);
+	mem->high_wmark = RESOURCE_MAX;
+	INIT_WORK(&mem->high_work, mem_cgroup_high_work);
 
 	for_each_node_state(node, N_POSSIBLE)
 		if (alloc_mem_cgroup_per_zone_info(mem, node))
@@ -1115,6 +1591,8 @@ static void mem_cgroup_pre_destroy(struct cgroup_subsys *ss,
 {
 	struct mem_cgroup *mem = mem_cgroup_from_cont(cont);
 	mem_cgroup_force_empty(mem);
+	/* soft limit reclaim must not find us once rmdir has succeeded */
+	mem_cgroup_remove_from_trees(mem);
 }
 
 static void mem_cgroup_destroy(struct cgroup_subsys *ss,
@@ -1123,6 +1601,8 @@ static void mem_cgroup_destroy(struct cgroup_subsys *ss,
 	int node;
 	struct mem_cgroup *mem = mem_cgroup_from_cont(cont);
 
+	mem_cgroup_remove_from_trees(mem);
+
 	for_each_node_state(node, N_POSSIBLE)
 		free_mem_cgroup_per_zone_info(mem, node);
 
@@ -1172,3 +1652,12 @@ struct cgroup_subsys mem_cgroup_subsys = {
 	.attach = mem_cgroup_move_task,
 	.early_init = 0,
 };
+
+static int __init mem_cgroup_reclaim_init(void)
+{
+	if (mem_cgroup_subsys.disabled)
+		return 0;
+	memcg_reclaim_wq = create_singlethread_workqueue("memcg_reclaim");
+	return 0;
+}
+__initcall(mem_cgroup_reclaim_init);
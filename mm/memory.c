@@ -52,6 +52,8 @@
 #include <linux/writeback.h>
 #include <linux/memcontrol.h>
 #include <linux/mmu_notifier.h>
+#include <linux/ksm.h>
+#include <linux/migrate.h>
 
 #include <asm/pgalloc.h>
 #include <asm/uaccess.h>
@@ -284,7 +286,7 @@ void free_pgtables(struct mmu_gather *tlb, struct vm_area_struct *vma,
 		/*
 		 * Hide vma from rmap and vmtruncate before freeing pgtables
 		 */
-		anon_vma_unlink(vma);
+		unlink_anon_vmas(vma);
 		unlink_file_vma(vma);
 
 		if (is_vm_hugetlb_page(vma)) {
@@ -298,7 +300,7 @@ void free_pgtables(struct mmu_gather *tlb, struct vm_area_struct *vma,
 			       && !is_vm_hugetlb_page(next)) {
 				vma = next;
 				next = vma->vm_next;
-				anon_vma_unlink(vma);
+				unlink_anon_vmas(vma);
 				unlink_file_vma(vma);
 			}
 			free_pgd_range(tlb, addr, vma->vm_end,
@@ -602,6 +604,302 @@ again:
 	return 0;
 }
 
+#ifdef CONFIG_FORK_SHARE_PTES
+/*
+ * Lazy page table copy: rather than copying the ptes of a whole pmd of
+ * private anonymous memory, fork may map the parent's pte table into the
+ * child as well, with both pmds write-protected.  The pages are not
+ * touched at all then, which is what makes fork of a huge process slow.
+ *
+ * A shared table stands for one set of mappings: its pages and swap
+ * entries are counted once in mapcount and swap_map, however many mms
+ * map it.  Before an mm changes any pte in there - on any fault in its
+ * range, as writes fault on the pmd - it copies the table for itself in
+ * __unshare_pte_table(), accounting the pages once more just as fork
+ * would have done; the last mm left simply gets write access back.
+ * Until then rmap does not see the shared ptes (page_check_address()),
+ * so reclaim and migration leave those pages alone.
+ *
+ * The number of mms sharing a table besides the first one is kept in
+ * the table page's _mapcount, under the table's pte lock: that is why
+ * this needs split pte locks.  Every mm mapping a shared table has its
+ * present ptes in its rss.
+ */
+int sysctl_fork_share_ptes __read_mostly;
+
+static inline int pte_table_sharers(struct page *table)
+{
+	return page_mapcount(table);
+}
+
+static int pte_table_rss(pmd_t *pmd, unsigned long addr)
+{
+	pte_t *pte = pte_offset_map(pmd, addr);
+	int i, rss = 0;
+
+	for (i = 0; i < PTRS_PER_PTE; i++)
+		if (pte_present(pte[i]))
+			rss++;
+	pte_unmap(pte);
+	return rss;
+}
+
+static inline int can_share_pte_table(struct vm_area_struct *vma,
+				      unsigned long addr, unsigned long end)
+{
+	if (!USE_SPLIT_PTLOCKS || !sysctl_fork_share_ptes)
+		return 0;
+	if (vma->vm_file || vma->vm_ops || !is_cow_mapping(vma->vm_flags) ||
+	    (vma->vm_flags & VM_LOCKED))
+		return 0;
+	return !(addr & ~PMD_MASK) && end - addr == PMD_SIZE;
+}
+
+static void share_pte_table(struct mm_struct *dst_mm, struct mm_struct *src_mm,
+			    pmd_t *dst_pmd, pmd_t *src_pmd, unsigned long addr)
+{
+	struct page *table = pmd_page(*src_pmd);
+	spinlock_t *ptl = pte_lockptr(src_mm, src_pmd);
+	int rss;
+
+	spin_lock(ptl);
+	rss = pte_table_rss(src_pmd, addr);
+	set_pmd(src_pmd, pmd_wrprotect(*src_pmd));
+	atomic_inc(&table->_mapcount);
+	spin_unlock(ptl);
+
+	pmd_populate(dst_mm, dst_pmd, table);
+	set_pmd(dst_pmd, pmd_wrprotect(*dst_pmd));
+	dst_mm->nr_ptes++;
+	add_mm_rss(dst_mm, 0, rss);
+
+	/* swapoff must find the swap entries through the child too */
+	if (unlikely(!list_empty(&src_mm->mmlist) &&
+		     list_empty(&dst_mm->mmlist))) {
+		spin_lock(&mmlist_lock);
+		if (list_empty(&dst_mm->mmlist))
+			list_add(&dst_mm->mmlist, &src_mm->mmlist);
+		spin_unlock(&mmlist_lock);
+	}
+}
+
+int __unshare_pte_table(struct vm_area_struct *vma, pmd_t *pmd,
+			unsigned long address)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	unsigned long addr = address & PMD_MASK;
+	struct page *table;
+	pgtable_t new;
+	spinlock_t *ptl;
+	pte_t *src_pte, *dst_pte;
+	int i, rss[2];
+
+	new = pte_alloc_one(mm, addr);
+	if (!new)
+		return -ENOMEM;
+
+	spin_lock(&mm->page_table_lock);
+	if (!pmd_ptes_shared(*pmd))	/* another thread was first */
+		goto out;
+	table = pmd_page(*pmd);
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock(ptl);
+	if (!pte_table_sharers(table)) {
+		/* The others are gone: the table is all ours again */
+		set_pmd(pmd, pmd_mkwrite(*pmd));
+		spin_unlock(ptl);
+		goto out;
+	}
+
+	/* rss is accounted already, see above */
+	rss[1] = rss[0] = 0;
+	src_pte = pte_offset_map(pmd, addr);
+	dst_pte = kmap_atomic(new, KM_PTE1);
+	arch_enter_lazy_mmu_mode();
+	for (i = 0; i < PTRS_PER_PTE; i++, addr += PAGE_SIZE) {
+		if (pte_none(src_pte[i]))
+			continue;
+		copy_one_pte(mm, mm, dst_pte + i, src_pte + i, vma, addr, rss);
+	}
+	arch_leave_lazy_mmu_mode();
+	kunmap_atomic(dst_pte, KM_PTE1);
+	pte_unmap(src_pte);
+
+	smp_wmb(); /* See comment in __pte_alloc */
+	pmd_populate(mm, pmd, new);
+	new = NULL;
+	/* Nothing of ours may use the old table once the others can free it */
+	flush_tlb_range(vma, address & PMD_MASK,
+			(address & PMD_MASK) + PMD_SIZE);
+	atomic_dec(&table->_mapcount);
+	spin_unlock(ptl);
+out:
+	spin_unlock(&mm->page_table_lock);
+	if (new)
+		pte_free(mm, new);
+	return 0;
+}
+
+/*
+ * Exit unmaps a shared table by just dropping it from the mm: the page
+ * has to stay around until our TLB is flushed though, whoever frees it.
+ * If the others have gone already, the table is ours alone again and
+ * returns 0 for the caller to zap its ptes as usual.
+ */
+static int detach_pte_table(struct mmu_gather *tlb, pmd_t *pmd,
+			    unsigned long addr)
+{
+	struct mm_struct *mm = tlb->mm;
+	struct page *table = pmd_page(*pmd);
+	spinlock_t *ptl = pte_lockptr(mm, pmd);
+	int rss;
+
+	spin_lock(&mm->page_table_lock);
+	spin_lock(ptl);
+	if (!pte_table_sharers(table)) {
+		set_pmd(pmd, pmd_mkwrite(*pmd));
+		spin_unlock(ptl);
+		spin_unlock(&mm->page_table_lock);
+		return 0;
+	}
+	rss = pte_table_rss(pmd, addr);
+	pmd_clear(pmd);
+	get_page(table);
+	atomic_dec(&table->_mapcount);
+	spin_unlock(ptl);
+	tlb_remove_page(tlb, table);
+	spin_unlock(&mm->page_table_lock);
+	mm->nr_ptes--;
+	add_mm_rss(mm, 0, -rss);
+	return 1;
+}
+
+/*
+ * Other unmaps of a shared table stop zapping at it, and unmap_vmas()
+ * comes here to unshare it before going on: neither allocating nor
+ * failing is allowed inside the mmu_gather.
+ */
+static pmd_t *zap_shared_pmd(struct vm_area_struct *vma, unsigned long addr)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	pgd = pgd_offset(vma->vm_mm, addr);
+	if (!pgd_present(*pgd))
+		return NULL;
+	pud = pud_offset(pgd, addr);
+	if (!pud_present(*pud))
+		return NULL;
+	pmd = pmd_offset(pud, addr);
+	return pmd_ptes_shared(*pmd) ? pmd : NULL;
+}
+
+static inline int zap_pte_table_shared(struct vm_area_struct *vma,
+				       unsigned long addr)
+{
+	return zap_shared_pmd(vma, addr) != NULL;
+}
+
+/*
+ * Drop our reference to a shared table without copying it: everything
+ * it maps, inside the range being unmapped or not, is gone from the mm.
+ */
+static void drop_pte_table(struct vm_area_struct *vma, pmd_t *pmd,
+			   unsigned long addr)
+{
+	struct mm_struct *mm = vma->vm_mm;
+	struct page *table;
+	spinlock_t *ptl;
+	int rss;
+
+	addr &= PMD_MASK;
+	spin_lock(&mm->page_table_lock);
+	if (!pmd_ptes_shared(*pmd))
+		goto out;
+	table = pmd_page(*pmd);
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock(ptl);
+	if (!pte_table_sharers(table)) {
+		/* The others are gone: zap it like any other table */
+		set_pmd(pmd, pmd_mkwrite(*pmd));
+		spin_unlock(ptl);
+		goto out;
+	}
+	rss = pte_table_rss(pmd, addr);
+	pmd_clear(pmd);
+	flush_tlb_range(vma, addr, addr + PMD_SIZE);
+	atomic_dec(&table->_mapcount);
+	spin_unlock(ptl);
+	mm->nr_ptes--;
+	add_mm_rss(mm, 0, -rss);
+out:
+	spin_unlock(&mm->page_table_lock);
+}
+
+/*
+ * pte_alloc_one() only fails for an OOM-killed task, which must not be
+ * kept looping here; as all the users of its mm have been killed with
+ * it, losing the rest of the table's mappings is of no consequence.
+ */
+static void zap_unshare_pte_table(struct vm_area_struct *vma,
+				  unsigned long addr)
+{
+	pmd_t *pmd = zap_shared_pmd(vma, addr);
+
+	if (pmd && unshare_pte_table(vma, pmd, addr))
+		drop_pte_table(vma, pmd, addr);
+}
+
+/*
+ * Unshare every table mapping [addr, end) up front, for callers that
+ * cannot fail half way through.  Called with mmap_sem held for writing,
+ * so that fork cannot share them again before the caller is done.
+ */
+int unshare_pte_range(struct vm_area_struct *vma, unsigned long addr,
+		      unsigned long end)
+{
+	pmd_t *pmd;
+
+	for (addr &= PMD_MASK; addr < end; addr += PMD_SIZE) {
+		pmd = zap_shared_pmd(vma, addr);
+		if (pmd && unshare_pte_table(vma, pmd, addr))
+			return -ENOMEM;
+		cond_resched();
+	}
+	return 0;
+}
+#else
+static inline int can_share_pte_table(struct vm_area_struct *vma,
+				      unsigned long addr, unsigned long end)
+{
+	return 0;
+}
+
+static inline void share_pte_table(struct mm_struct *dst_mm,
+				   struct mm_struct *src_mm, pmd_t *dst_pmd,
+				   pmd_t *src_pmd, unsigned long addr)
+{
+}
+
+static inline int detach_pte_table(struct mmu_gather *tlb, pmd_t *pmd,
+				   unsigned long addr)
+{
+	return 0;
+}
+
+static inline int zap_pte_table_shared(struct vm_area_struct *vma,
+				       unsigned long addr)
+{
+	return 0;
+}
+
+static inline void zap_unshare_pte_table(struct vm_area_struct *vma,
+					 unsigned long addr)
+{
+}
+#endif /* CONFIG_FORK_SHARE_PTES */
+
 static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 		pud_t *dst_pud, pud_t *src_pud, struct vm_area_struct *vma,
 		unsigned long addr, unsigned long end)
@@ -615,8 +913,20 @@ static inline int copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src
 	src_pmd = pmd_offset(src_pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		if (pmd_trans_huge(*src_pmd)) {
+			int err = copy_huge_pmd(dst_mm, src_mm, dst_pmd,
+						src_pmd, addr, vma);
+			if (err < 0)
+				return -ENOMEM;
+			if (!err)
+				continue;
+		}
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
+		if (can_share_pte_table(vma, addr, next)) {
+			share_pte_table(dst_mm, src_mm, dst_pmd, src_pmd, addr);
+			continue;
+		}
 		if (copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
 						vma, addr, next))
 			return -ENOMEM;
@@ -794,10 +1104,28 @@ static inline unsigned long zap_pmd_range(struct mmu_gather *tlb,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(pmd)) {
+		if (pmd_trans_huge(*pmd)) {
+			if (next - addr != HPAGE_PMD_SIZE)
+				split_huge_pmd(vma->vm_mm, pmd, addr);
+			else if (zap_huge_pmd(tlb, vma, pmd)) {
+				(*zap_work) -= HPAGE_PMD_SIZE;
+				continue;
+			}
+		}
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd)) {
 			(*zap_work)--;
 			continue;
 		}
+		if (pmd_ptes_shared(*pmd) && tlb->fullmm &&
+		    next - addr == PMD_SIZE && detach_pte_table(tlb, pmd, addr)) {
+			(*zap_work) -= PTRS_PER_PTE;
+			continue;
+		}
+		if (pmd_ptes_shared(*pmd)) {
+			/* see zap_unshare_pte_table() */
+			*zap_work = 0;
+			return addr;
+		}
 		next = zap_pte_range(tlb, vma, pmd, addr, next,
 						zap_work, details);
 	} while (pmd++, addr = next, (addr != end && *zap_work > 0));
@@ -877,7 +1205,9 @@ static unsigned long unmap_page_range(struct mmu_gather *tlb,
  *
  * We aim to not hold locks for too long (for scheduling latency reasons).
  * So zap pages in ZAP_BLOCK_SIZE bytecounts.  This means we need to
- * return the ending mmu_gather to the caller.
+ * return the ending mmu_gather to the caller.  The gather is only
+ * finished between blocks when we actually have to stop: otherwise the
+ * pages keep piling up in it and are freed in large batches.
  *
  * Only addresses between `start' and `end' will be unmapped.
  *
@@ -949,6 +1279,13 @@ unsigned long unmap_vmas(struct mmu_gather **tlbp,
 				break;
 			}
 
+			if (!need_resched() &&
+			    !(i_mmap_lock && spin_needbreak(i_mmap_lock)) &&
+			    (start == end || !zap_pte_table_shared(vma, start))) {
+				zap_work = ZAP_BLOCK_SIZE;
+				continue;
+			}
+
 			tlb_finish_mmu(*tlbp, tlb_start, start);
 
 			if (need_resched() ||
@@ -959,6 +1296,7 @@ unsigned long unmap_vmas(struct mmu_gather **tlbp,
 				}
 				cond_resched();
 			}
+			zap_unshare_pte_table(vma, start);
 
 			*tlbp = tlb_gather_mmu(vma->vm_mm, fullmm);
 			tlb_start_valid = 0;
@@ -1056,6 +1394,15 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 	pmd = pmd_offset(pud, address);
 	if (pmd_none(*pmd))
 		goto no_page_table;
+	if (pmd_trans_huge(*pmd)) {
+		spin_lock(&mm->page_table_lock);
+		if (likely(pmd_trans_huge(*pmd))) {
+			page = follow_trans_huge_pmd(mm, address, pmd, flags);
+			spin_unlock(&mm->page_table_lock);
+			goto out;
+		}
+		spin_unlock(&mm->page_table_lock);
+	}
 	if (pmd_huge(*pmd)) {
 		BUG_ON(flags & FOLL_GET);
 		page = follow_huge_pmd(mm, address, pmd, flags & FOLL_WRITE);
@@ -1069,7 +1416,8 @@ struct page *follow_page(struct vm_area_struct *vma, unsigned long address,
 	pte = *ptep;
 	if (!pte_present(pte))
 		goto no_page;
-	if ((flags & FOLL_WRITE) && !pte_write(pte))
+	if ((flags & FOLL_WRITE) &&
+	    (!pte_write(pte) || pmd_ptes_shared(*pmd)))
 		goto unlock;
 	page = vm_normal_page(vma, address, pte);
 	if (unlikely(!page))
@@ -1643,6 +1991,7 @@ static int apply_to_pmd_range(struct mm_struct *mm, pud_t *pud,
 		return -ENOMEM;
 	do {
 		next = pmd_addr_end(addr, end);
+		split_huge_pmd(mm, pmd, addr);
 		err = apply_to_pte_range(mm, pmd, addr, next, fn, data);
 		if (err)
 			break;
@@ -1805,9 +2154,9 @@ static int do_wp_page(struct mm_struct *mm, struct vm_area_struct *vma,
 
 	/*
 	 * Take out anonymous pages first, anonymous shared vmas are
-	 * not dirty accountable.
+	 * not dirty accountable.  A KSM page is always copied.
 	 */
-	if (PageAnon(old_page)) {
+	if (PageAnon(old_page) && !PageKsm(old_page)) {
 		if (trylock_page(old_page)) {
 			reuse = can_share_swap_page(old_page);
 			unlock_page(old_page);
@@ -2323,6 +2672,12 @@ static int do_swap_page(struct mm_struct *mm, struct vm_area_struct *vma,
 	lock_page(page);
 	delayacct_clear_flag(DELAYACCT_PF_SWAPIN);
 
+	page = ksm_might_need_to_copy(page, vma, address);
+	if (!page) {
+		ret = VM_FAULT_OOM;
+		goto out;
+	}
+
 	if (mem_cgroup_charge(page, mm, GFP_KERNEL)) {
 		ret = VM_FAULT_OOM;
 		unlock_page(page);
@@ -2650,6 +3005,78 @@ static int do_nonlinear_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	return __do_fault(mm, vma, address, pmd, pgoff, flags, orig_pte);
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+/*
+ * Where should @page live, now that the current task touched it?
+ * Returns the node to migrate it to, or -1 to leave it alone.
+ */
+static int numa_migrate_target(struct vm_area_struct *vma, struct page *page)
+{
+	int nid = numa_node_id();
+
+	if (page_to_nid(page) == nid)
+		return -1;
+	/* an explicit memory policy knows better than a hint */
+	if (vma->vm_policy || current->mempolicy)
+		return -1;
+	/* pages of several processes would just bounce between them */
+	if (page_mapcount(page) != 1 || PageKsm(page))
+		return -1;
+	return nid;
+}
+
+/*
+ * A NUMA hinting fault: the pte was made inaccessible by the scanner in
+ * task_numa_work() to find out where the page is used from.  Restore
+ * the access, account the fault to the task, and move the page to the
+ * faulting node if it is misplaced.
+ */
+static int do_numa_page(struct mm_struct *mm, struct vm_area_struct *vma,
+		unsigned long address, pte_t *page_table, pmd_t *pmd,
+		pte_t orig_pte)
+{
+	struct page *page;
+	spinlock_t *ptl;
+	pte_t entry;
+	int page_nid, target_nid;
+	int migrated = 0;
+
+	ptl = pte_lockptr(mm, pmd);
+	spin_lock(ptl);
+	if (unlikely(!pte_same(*page_table, orig_pte))) {
+		pte_unmap_unlock(page_table, ptl);
+		return 0;
+	}
+
+	/* Not present to the hardware, so there is no TLB entry to flush */
+	entry = pte_mkyoung(pte_modify(orig_pte, vma->vm_page_prot));
+	set_pte_at(mm, address, page_table, entry);
+	update_mmu_cache(vma, address, entry);
+
+	page = vm_normal_page(vma, address, entry);
+	if (!page) {
+		pte_unmap_unlock(page_table, ptl);
+		return 0;
+	}
+	count_vm_event(NUMA_HINT_FAULTS);
+	page_nid = page_to_nid(page);
+	target_nid = numa_migrate_target(vma, page);
+	if (target_nid == -1)
+		count_vm_event(NUMA_HINT_FAULTS_LOCAL);
+	else
+		get_page(page);
+	pte_unmap_unlock(page_table, ptl);
+
+	if (target_nid != -1) {
+		migrated = migrate_misplaced_page(page, target_nid);
+		if (migrated)
+			page_nid = target_nid;
+	}
+	task_numa_fault(page_nid, 1, migrated);
+	return 0;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 /*
  * These routines also need to handle stuff like marking pages dirty
  * and/or accessed for architectures that don't do it in hardware (most
@@ -2688,6 +3115,13 @@ static inline int handle_pte_fault(struct mm_struct *mm,
 					pte, pmd, write_access, entry);
 	}
 
+#ifdef CONFIG_NUMA_BALANCING
+	/* A real PROT_NONE vma never gets here, the access check fails */
+	if (pte_protnone(entry) &&
+	    (vma->vm_flags & (VM_READ | VM_WRITE | VM_EXEC)))
+		return do_numa_page(mm, vma, address, pte, pmd, entry);
+#endif
+
 	ptl = pte_lockptr(mm, pmd);
 	spin_lock(ptl);
 	if (unlikely(!pte_same(*pte, entry)))
@@ -2741,13 +3175,199 @@ int handle_mm_fault(struct mm_struct *mm, struct vm_area_struct *vma,
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
-	pte = pte_alloc_map(mm, pmd, address);
-	if (!pte)
+	if (pmd_none(*pmd) && transparent_hugepage_enabled(vma)) {
+		int ret = do_huge_anonymous_page(mm, vma, address, pmd,
+						 write_access);
+		if (!(ret & VM_FAULT_FALLBACK))
+			return ret;
+	} else if (pmd_trans_huge(*pmd)) {
+		int ret = do_huge_pmd_fault(mm, vma, address, pmd,
+					    write_access);
+		if (!(ret & VM_FAULT_FALLBACK))
+			return ret;
+	}
+	if (unshare_pte_table(vma, pmd, address))
+		return VM_FAULT_OOM;
+	if (unlikely(!pmd_present(*pmd)) && __pte_alloc(mm, pmd, address))
 		return VM_FAULT_OOM;
+	/*
+	 * A huge pmd may have been installed by a racing fault after we
+	 * fell back to small pages: map it with ptes before descending.
+	 */
+	split_huge_pmd(mm, pmd, address);
+	pte = pte_offset_map(pmd, address);
 
 	return handle_pte_fault(mm, vma, address, pte, pmd, write_access);
 }
 
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+/*
+ * Speculative fault: try to resolve the simplest faults without taking
+ * mmap_sem, so that threads faulting in separate parts of the address
+ * space do not all bounce the same rw_semaphore cacheline.
+ *
+ * The vma is found under rcu_read_lock (vmas are RCU-freed) and its
+ * vm_sequence snapshotted; the page table is walked with interrupts
+ * disabled, which keeps it from being freed under us as in gup_fast.
+ * Once the pte lock is held, the vma is checked to be unchanged: from
+ * then on munmap or mprotect have to wait on that pte lock to zap or
+ * change the pte we install, so it is as if we had faulted under
+ * mmap_sem just before them.
+ *
+ * Only two kinds of fault are handled: a not-present anonymous pte in a
+ * vma which already has its anon_vma, and a read fault on a file page
+ * already uptodate in the page cache.  Anything else, or any sign of a
+ * race, returns -EAGAIN for the caller to retry with handle_mm_fault()
+ * under mmap_sem.  Returns 0 when the fault has been handled.
+ */
+int handle_speculative_fault(struct mm_struct *mm, unsigned long address,
+			     int write_access)
+{
+	struct vm_area_struct *vma;
+	struct page *page = NULL;
+	unsigned int seq, remap_seq;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd, pmdval;
+	pte_t *pte;
+	spinlock_t *ptl;
+	pte_t entry;
+	int anon;
+
+	remap_seq = mm->mm_remap_seq.sequence;
+	smp_rmb();
+	if (remap_seq & 1)
+		return -EAGAIN;
+
+	rcu_read_lock();
+	vma = find_vma_speculative(mm, address, &seq);
+	if (!vma)
+		goto out_rcu;
+	if (vma->vm_flags & (VM_IO | VM_PFNMAP | VM_MIXEDMAP | VM_HUGETLB |
+			     VM_NONLINEAR | VM_LOCKED))
+		goto out_rcu;
+	if (write_access) {
+		if (!(vma->vm_flags & VM_WRITE))
+			goto out_rcu;
+	} else {
+		if (!(vma->vm_flags & (VM_READ | VM_EXEC | VM_WRITE)))
+			goto out_rcu;
+	}
+
+	anon = !vma->vm_ops && !vma->vm_file;
+	if (anon) {
+		if (!vma->anon_vma || vma_policy(vma))
+			goto out_rcu;
+		/* Allocating must not sleep, we are inside rcu_read_lock */
+		page = alloc_page_vma((GFP_HIGHUSER_MOVABLE & ~__GFP_WAIT) |
+				      __GFP_NOWARN, vma, address);
+		if (!page)
+			goto out_rcu;
+		clear_user_highpage(page, address);
+		__SetPageUptodate(page);
+		if (mem_cgroup_charge(page, mm, GFP_NOWAIT)) {
+			page_cache_release(page);
+			goto out_rcu;
+		}
+	} else if (write_access || !vma->vm_file || !vma->vm_ops ||
+		   vma->vm_ops->fault != filemap_fault)
+		goto out_rcu;
+
+	local_irq_disable();
+	pgd = pgd_offset(mm, address);
+	if (pgd_none(*pgd) || unlikely(pgd_bad(*pgd)))
+		goto out_irq;
+	pud = pud_offset(pgd, address);
+	if (pud_none(*pud) || unlikely(pud_bad(*pud)))
+		goto out_irq;
+	pmd = pmd_offset(pud, address);
+	pmdval = *pmd;
+	if (pmd_none(pmdval) || pmd_trans_huge(pmdval) ||
+	    pmd_ptes_shared(pmdval) || unlikely(pmd_bad(pmdval)))
+		goto out_irq;
+
+	ptl = pte_lockptr(mm, pmd);
+	pte = pte_offset_map(pmd, address);
+	if (!spin_trylock(ptl)) {
+		pte_unmap(pte);
+		goto out_irq;
+	}
+	/*
+	 * With the pte lock held and the vma and page table unchanged,
+	 * we can let the page table go out from under irq protection.
+	 */
+	if (read_seqcount_retry(&vma->vm_sequence, seq) ||
+	    read_seqcount_retry(&mm->mm_remap_seq, remap_seq) ||
+	    pmd_val(pmdval) != pmd_val(*pmd))
+		goto out_unlock_irq;
+	local_irq_enable();
+
+	if (!pte_none(*pte))
+		goto out_unlock;
+
+	if (anon) {
+		entry = mk_pte(page, vma->vm_page_prot);
+		entry = maybe_mkwrite(pte_mkdirty(entry), vma);
+		inc_mm_counter(mm, anon_rss);
+		SetPageSwapBacked(page);
+		lru_cache_add_active_or_unevictable(page, vma);
+		page_add_new_anon_rmap(page, vma, address);
+	} else {
+		struct address_space *mapping = vma->vm_file->f_mapping;
+		pgoff_t pgoff;
+
+		/*
+		 * The vma still holds its reference on the file, and
+		 * munmap has to come past our pte lock before dropping it.
+		 */
+		pgoff = ((address - vma->vm_start) >> PAGE_SHIFT) +
+			vma->vm_pgoff;
+		page = find_get_page(mapping, pgoff);
+		if (!page)
+			goto out_unlock;
+		if (!trylock_page(page))
+			goto out_unlock;
+		if (page->mapping != mapping || !PageUptodate(page) ||
+		    pgoff >= DIV_ROUND_UP(i_size_read(mapping->host),
+					  PAGE_CACHE_SIZE)) {
+			unlock_page(page);
+			goto out_unlock;
+		}
+		entry = mk_pte(page, vma->vm_page_prot);
+		inc_mm_counter(mm, file_rss);
+		page_add_file_rmap(page);
+		mark_page_accessed(page);
+		unlock_page(page);
+	}
+	set_pte_at(mm, address, pte, entry);
+
+	/* No need to invalidate - it was non-present before */
+	update_mmu_cache(vma, address, entry);
+	pte_unmap_unlock(pte, ptl);
+	rcu_read_unlock();
+	count_vm_event(PGFAULT);
+	count_vm_event(PGFAULT_SPECULATIVE);
+	return 0;
+
+out_unlock_irq:
+	local_irq_enable();
+out_unlock:
+	pte_unmap_unlock(pte, ptl);
+	goto out_page;
+out_irq:
+	local_irq_enable();
+out_page:
+	if (page) {
+		if (anon)
+			mem_cgroup_uncharge_page(page);
+		page_cache_release(page);
+	}
+out_rcu:
+	rcu_read_unlock();
+	return -EAGAIN;
+}
+#endif /* CONFIG_SPECULATIVE_PAGE_FAULT */
+
 #ifndef __PAGETABLE_PUD_FOLDED
 /*
  * Allocate page upper directory.
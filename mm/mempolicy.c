@@ -428,7 +428,8 @@ static inline int check_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(pmd))
+		split_huge_pmd(vma->vm_mm, pmd, addr);
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			continue;
 		if (check_pte_range(vma, pmd, addr, next, nodes,
 				    flags, private))
@@ -538,7 +539,9 @@ static int policy_vma(struct vm_area_struct *vma, struct mempolicy *new)
 		err = vma->vm_ops->set_policy(vma, new);
 	if (!err) {
 		mpol_get(new);
+		vm_write_begin(vma);
 		vma->vm_policy = new;
+		vm_write_end(vma);
 		mpol_put(old);
 	}
 	return err;
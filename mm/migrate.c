@@ -30,6 +30,7 @@
 #include <linux/vmalloc.h>
 #include <linux/security.h>
 #include <linux/memcontrol.h>
+#include <linux/ksm.h>
 #include <linux/syscalls.h>
 
 #include "internal.h"
@@ -100,7 +101,7 @@ static void remove_migration_pte(struct vm_area_struct *vma,
                 return;
 
 	pmd = pmd_offset(pud, addr);
-	if (!pmd_present(*pmd))
+	if (!pmd_present(*pmd) || pmd_trans_huge(*pmd))
 		return;
 
 	ptep = pte_offset_map(pmd, addr);
@@ -183,7 +184,7 @@ static void remove_file_migration_ptes(struct page *old, struct page *new)
 static void remove_anon_migration_ptes(struct page *old, struct page *new)
 {
 	struct anon_vma *anon_vma;
-	struct vm_area_struct *vma;
+	struct anon_vma_chain *avc;
 	unsigned long mapping;
 
 	mapping = (unsigned long)new->mapping;
@@ -195,12 +196,12 @@ static void remove_anon_migration_ptes(struct page *old, struct page *new)
 	 * We hold the mmap_sem lock. So no need to call page_lock_anon_vma.
 	 */
 	anon_vma = (struct anon_vma *) (mapping - PAGE_MAPPING_ANON);
-	spin_lock(&anon_vma->lock);
+	anon_vma_lock(anon_vma);
 
-	list_for_each_entry(vma, &anon_vma->head, anon_vma_node)
-		remove_migration_pte(vma, old, new);
+	list_for_each_entry(avc, &anon_vma->head, same_anon_vma)
+		remove_migration_pte(avc->vma, old, new);
 
-	spin_unlock(&anon_vma->lock);
+	anon_vma_unlock(anon_vma);
 }
 
 /*
@@ -642,6 +643,15 @@ static int unmap_and_move(new_page_t get_new_page, unsigned long private,
 		lock_page(page);
 	}
 
+	/*
+	 * A KSM page is mapped through the rmap_items of its stable_node,
+	 * which know nothing of migration ptes: leave it where it is.
+	 */
+	if (PageKsm(page)) {
+		rc = -EBUSY;
+		goto unlock;
+	}
+
 	if (PageWriteback(page)) {
 		if (!force)
 			goto unlock;
@@ -796,6 +806,41 @@ out:
 	return nr_failed + retry;
 }
 
+#ifdef CONFIG_NUMA_BALANCING
+static struct page *alloc_misplaced_dst_page(struct page *page,
+					     unsigned long data, int **result)
+{
+	int nid = (int)data;
+
+	/* Not worth reclaim or the reserves: it is only a hint */
+	return alloc_pages_node(nid, (GFP_HIGHUSER_MOVABLE | GFP_THISNODE |
+				      __GFP_NOMEMALLOC) & ~__GFP_WAIT, 0);
+}
+
+/*
+ * Move @page, which a NUMA hinting fault found to be used from @node,
+ * to that node.  Drops the caller's reference on the page.  Returns 1
+ * if the page was migrated.
+ */
+int migrate_misplaced_page(struct page *page, int node)
+{
+	LIST_HEAD(migratepages);
+	int isolated;
+
+	isolated = !isolate_lru_page(page);
+	put_page(page);
+	if (!isolated)
+		return 0;
+
+	list_add(&page->lru, &migratepages);
+	if (migrate_pages(&migratepages, alloc_misplaced_dst_page, node))
+		return 0;
+
+	count_vm_event(NUMA_PAGE_MIGRATE);
+	return 1;
+}
+#endif /* CONFIG_NUMA_BALANCING */
+
 #ifdef CONFIG_NUMA
 /*
  * Move a list of individual pages
@@ -327,7 +327,9 @@ long mlock_vma_pages_range(struct vm_area_struct *vma,
 	make_pages_present(start, end);
 
 no_mlock:
+	vm_write_begin(vma);
 	vma->vm_flags &= ~VM_LOCKED;	/* and don't come back! */
+	vm_write_end(vma);
 	return nr_pages;		/* error or pages NOT mlocked */
 }
 
@@ -353,7 +355,9 @@ no_mlock:
 void munlock_vma_pages_range(struct vm_area_struct *vma,
 			   unsigned long start, unsigned long end)
 {
+	vm_write_begin(vma);
 	vma->vm_flags &= ~VM_LOCKED;
+	vm_write_end(vma);
 	__mlock_vma_pages_range(vma, start, end, 0);
 }
 
@@ -421,7 +425,9 @@ success:
 	 * It's okay if try_to_unmap_one unmaps a page just after we
 	 * set VM_LOCKED, __mlock_vma_pages_range will bring it back.
 	 */
+	vm_write_begin(vma);
 	vma->vm_flags = newflags;
+	vm_write_end(vma);
 
 	if (lock) {
 		ret = __mlock_vma_pages_range(vma, start, end, 1);
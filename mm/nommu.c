@@ -1014,7 +1014,7 @@ unsigned long do_mmap_pgoff(struct file *file,
 	if (!vma)
 		goto error_getting_vma;
 
-	INIT_LIST_HEAD(&vma->anon_vma_node);
+	INIT_LIST_HEAD(&vma->anon_vma_chain);
 	atomic_set(&vma->vm_usage, 1);
 	if (file) {
 		get_file(file);
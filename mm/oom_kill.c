@@ -337,6 +337,12 @@ static void __oom_kill_task(struct task_struct *p, int verbose)
 	p->rt.time_slice = HZ;
 	set_tsk_thread_flag(p, TIF_MEMDIE);
 
+	/* Whoever drops the last reference must free the memory at once */
+	task_lock(p);
+	if (p->mm)
+		set_bit(MMF_OOM_VICTIM, &p->mm->flags);
+	task_unlock(p);
+
 	force_sig(SIGKILL, p);
 }
 
@@ -46,6 +46,7 @@
 #include <linux/page-isolation.h>
 #include <linux/page_cgroup.h>
 #include <linux/debugobjects.h>
+#include <linux/compaction.h>
 
 #include <asm/tlbflush.h>
 #include <asm/div64.h>
@@ -982,18 +983,15 @@ void mark_free_pages(struct zone *zone)
 #endif /* CONFIG_PM */
 
 /*
- * Free a 0-order page
+ * Checks and debug hooks for a 0-order page about to be freed: returns 0
+ * if the page is bad and must not be freed.
  */
-static void free_hot_cold_page(struct page *page, int cold)
+static int free_hot_cold_page_prepare(struct page *page)
 {
-	struct zone *zone = page_zone(page);
-	struct per_cpu_pages *pcp;
-	unsigned long flags;
-
 	if (PageAnon(page))
 		page->mapping = NULL;
 	if (free_pages_check(page))
-		return;
+		return 0;
 
 	if (!PageHighMem(page)) {
 		debug_check_no_locks_freed(page_address(page), PAGE_SIZE);
@@ -1001,9 +999,16 @@ static void free_hot_cold_page(struct page *page, int cold)
 	}
 	arch_free_page(page, 0);
 	kernel_map_pages(page, 1, 0);
+	return 1;
+}
 
-	pcp = &zone_pcp(zone, get_cpu())->pcp;
-	local_irq_save(flags);
+/* Put a prepared page on this cpu's list, with interrupts disabled */
+static void free_hot_cold_page_pcp(struct page *page, int cold)
+{
+	struct zone *zone = page_zone(page);
+	struct per_cpu_pages *pcp;
+
+	pcp = &zone_pcp(zone, smp_processor_id())->pcp;
 	__count_vm_event(PGFREE);
 	if (cold)
 		list_add_tail(&page->lru, &pcp->list);
@@ -1015,8 +1020,51 @@ static void free_hot_cold_page(struct page *page, int cold)
 		free_pages_bulk(zone, pcp->batch, &pcp->list, 0);
 		pcp->count -= pcp->batch;
 	}
+}
+
+/*
+ * Free a 0-order page
+ */
+static void free_hot_cold_page(struct page *page, int cold)
+{
+	unsigned long flags;
+
+	if (!free_hot_cold_page_prepare(page))
+		return;
+
+	local_irq_save(flags);
+	free_hot_cold_page_pcp(page, cold);
 	local_irq_restore(flags);
-	put_cpu();
+}
+
+/*
+ * Free a list of 0-order pages, linked through page->lru, as a batch:
+ * interrupts are disabled once per SWAP_CLUSTER_MAX pages rather than
+ * once per page, and the pages go through the per-cpu lists, so that
+ * zone->lock is only taken when those overflow.
+ */
+void free_hot_cold_page_list(struct list_head *list, int cold)
+{
+	struct page *page, *next;
+	unsigned long flags;
+	int batch = 0;
+
+	list_for_each_entry_safe(page, next, list, lru)
+		if (!free_hot_cold_page_prepare(page))
+			list_del(&page->lru);
+
+	local_irq_save(flags);
+	list_for_each_entry_safe(page, next, list, lru) {
+		free_hot_cold_page_pcp(page, cold);
+		/* Don't keep interrupts off for a long list */
+		if (++batch == SWAP_CLUSTER_MAX) {
+			batch = 0;
+			local_irq_restore(flags);
+			local_irq_save(flags);
+		}
+	}
+	local_irq_restore(flags);
+	INIT_LIST_HEAD(list);
 }
 
 void free_hot_page(struct page *page)
@@ -1047,6 +1095,67 @@ void split_page(struct page *page, unsigned int order)
 		set_page_refcounted(page + i);
 }
 
+#ifdef CONFIG_COMPACTION
+/*
+ * Take the free blocks smaller than @max_order out of the pageblock at
+ * @block_pfn and hand them to compaction, split into order-0 pages on
+ * @freelist, as targets to migrate into.  Larger free blocks are left
+ * alone: they are what compaction is trying to produce.  Stops early
+ * rather than push the zone below its low watermark.  Returns the number
+ * of pages put on @freelist.
+ */
+unsigned long isolate_freepages_block(struct zone *zone,
+		unsigned long block_pfn, unsigned int max_order,
+		struct list_head *freelist)
+{
+	unsigned long pfn, end_pfn = block_pfn + pageblock_nr_pages;
+	unsigned long flags, nr_taken = 0;
+	struct page *page, *next;
+	LIST_HEAD(taken);
+
+	spin_lock_irqsave(&zone->lock, flags);
+	for (pfn = block_pfn; pfn < end_pfn; pfn++) {
+		unsigned long order;
+
+		if (!pfn_valid_within(pfn))
+			continue;
+		page = pfn_to_page(pfn);
+		if (!PageBuddy(page))
+			continue;
+		order = page_order(page);
+		if (order >= max_order) {
+			pfn += (1UL << order) - 1;
+			continue;
+		}
+		if (!zone_watermark_ok(zone, 0, zone->pages_low + (1UL << order),
+				       0, 0))
+			break;
+
+		list_del(&page->lru);
+		zone->free_area[order].nr_free--;
+		__mod_zone_page_state(zone, NR_FREE_PAGES, -(1UL << order));
+		/* keep the order in ->private until the block is split */
+		__ClearPageBuddy(page);
+		list_add(&page->lru, &taken);
+		pfn += (1UL << order) - 1;
+	}
+	spin_unlock_irqrestore(&zone->lock, flags);
+
+	list_for_each_entry_safe(page, next, &taken, lru) {
+		unsigned long i, order = page_private(page);
+
+		list_del(&page->lru);
+		for (i = 0; i < (1UL << order); i++) {
+			if (prep_new_page(page + i, 0, GFP_HIGHUSER_MOVABLE))
+				continue;
+			list_add(&page[i].lru, freelist);
+			nr_taken++;
+		}
+	}
+	return nr_taken;
+}
+#endif
+
 /*
  * Really, prep_compound_page() should be called from __rmqueue_bulk().  But
  * we cheat by calling it from here, in the order > 0 path.  Saves a branch
@@ -1561,6 +1670,34 @@ nofail_alloc:
 
 	cond_resched();
 
+#ifdef CONFIG_COMPACTION
+	/*
+	 * Before evicting anything, see whether moving movable pages out
+	 * of the way assembles a free block of the order we want.
+	 */
+	if (order) {
+		unsigned long compact_result;
+
+		p->flags |= PF_MEMALLOC;
+		compact_result = try_to_compact_pages(zonelist, order,
+						      gfp_mask, nodemask);
+		p->flags &= ~PF_MEMALLOC;
+
+		if (compact_result != COMPACT_SKIPPED) {
+			page = get_page_from_freelist(gfp_mask, nodemask,
+					order, zonelist, high_zoneidx,
+					alloc_flags);
+			if (page) {
+				compaction_succeeded(page_zone(page));
+				count_vm_event(COMPACTSUCCESS);
+				goto got_pg;
+			}
+			count_vm_event(COMPACTFAIL);
+		}
+		cond_resched();
+	}
+#endif
+
 	/* We now go into synchronous reclaim */
 	cpuset_memory_pressure_bump();
 	/*
@@ -3519,6 +3656,7 @@ static void __paginginit free_area_init_core(struct pglist_data *pgdat,
 			INIT_LIST_HEAD(&zone->lru[l].list);
 			zone->lru[l].nr_scan = 0;
 		}
+		lru_gen_init_zone(zone);
 		zone->recent_rotated[0] = 0;
 		zone->recent_rotated[1] = 0;
 		zone->recent_scanned[0] = 0;
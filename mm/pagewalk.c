@@ -33,7 +33,14 @@ static int walk_pmd_range(pud_t *pud, unsigned long addr, unsigned long end,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(pmd)) {
+		if (walk->huge_pmd_entry && pmd_trans_huge(*pmd)) {
+			err = walk->huge_pmd_entry(pmd, addr, next, walk);
+			if (err)
+				break;
+			continue;
+		}
+		split_huge_pmd(walk->mm, pmd, addr);
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd)) {
 			if (walk->pte_hole)
 				err = walk->pte_hole(addr, next, walk);
 			if (err)
@@ -95,6 +102,12 @@ static int walk_pud_range(pgd_t *pgd, unsigned long addr, unsigned long end,
  * associated range, and a copy of the original mm_walk for access to
  * the ->private or ->mm fields.
  *
+ * A transparent huge pmd is split before its ptes are walked, unless
+ * ->huge_pmd_entry is given: that is then called for it instead of the
+ * lower levels, without page_table_lock, so it has to cope with the pmd
+ * having been split meanwhile.  Walkers that only look at the range
+ * should provide one, splitting is for those that change the ptes.
+ *
  * No locks are taken, but the bottom level iterator will map PTE
  * directories from highmem if necessary.
  *
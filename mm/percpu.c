@@ -0,0 +1,548 @@
+/*
+ * linux/mm/percpu.c - percpu memory allocator
+ *
+ * The static percpu area of a cpu is a copy of the .data.percpu section
+ * at per_cpu_offset(cpu) from the section itself.  Dynamic percpu memory
+ * comes from chunks with the same layout: one unit per cpu, the unit of
+ * cpu N at N * pcpu_unit_size from the start of the chunk, and an area
+ * at offset off in the chunk takes up off in every unit.  The pointer
+ * handed out for an area is the address of its copy in unit 0, moved by
+ * the distance between the static section and the static area of cpu 0,
+ * so that adding per_cpu_offset(cpu) - exactly as for a static percpu
+ * variable - gives the copy of any cpu.
+ *
+ * The first chunk holds the static percpu areas.  It is set up by the
+ * architecture early during boot, and the room it leaves behind the
+ * static data serves modules and the first dynamic allocations.  Later
+ * chunks are mapped into vmalloc space, each unit backed by pages from
+ * the node of its cpu.
+ *
+ * Areas in a chunk are managed with an allocation map, like the one the
+ * module loader used to keep for module percpu data: an array of area
+ * sizes in address order, negative for the areas in use.
+ *
+ * Allocation may sleep.  pcpu_alloc_mutex serialises the allocators,
+ * which may have to grow a map or create a chunk.  The maps and the
+ * chunk list are protected by pcpu_lock, which is all free_percpu()
+ * takes, so it can be called from any context.  Chunks that become
+ * completely free are destroyed from a work item.
+ */
+
+#include <linux/bootmem.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/pfn.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#include <asm/dma.h>
+#include <asm/sections.h>
+
+#define PCPU_DFL_MAP_ALLOC	16	/* start a map with 16 ents */
+
+struct pcpu_chunk {
+	struct list_head	list;		/* linked to pcpu_chunks */
+	int			free_size;	/* free bytes in the chunk */
+	int			contig_hint;	/* max contiguous size hint */
+	void			*base_addr;	/* address of unit 0 */
+	struct vm_struct	*vm;		/* mapped vmalloc region */
+	int			map_used;	/* # of map entries used */
+	int			map_alloc;	/* # of map entries allocated */
+	int			*map;		/* allocation map */
+	struct page		*page[];	/* unit pages of each cpu */
+};
+
+static int pcpu_unit_pages __read_mostly;
+size_t pcpu_unit_size __read_mostly;
+static size_t pcpu_chunk_size __read_mostly;
+static size_t pcpu_chunk_struct_size __read_mostly;
+
+/* address of the first chunk, which starts with the static percpu area */
+void *pcpu_base_addr __read_mostly;
+
+static struct pcpu_chunk pcpu_first_chunk;
+static int pcpu_first_map[PCPU_DFL_MAP_ALLOC];
+
+static DEFINE_MUTEX(pcpu_alloc_mutex);	/* serialises alloc and reclaim */
+static DEFINE_SPINLOCK(pcpu_lock);	/* protects the maps and pcpu_chunks */
+
+static LIST_HEAD(pcpu_chunks);		/* the first chunk comes first */
+
+static void pcpu_reclaim(struct work_struct *work);
+static DECLARE_WORK(pcpu_reclaim_work, pcpu_reclaim);
+
+static unsigned long pcpu_unit_addr(struct pcpu_chunk *chunk, unsigned int cpu)
+{
+	return (unsigned long)chunk->base_addr + cpu * pcpu_unit_size;
+}
+
+static void *__addr_to_pcpu_ptr(void *addr)
+{
+	return (void *)((unsigned long)addr - (unsigned long)pcpu_base_addr +
+			(unsigned long)__per_cpu_start);
+}
+
+static void *__pcpu_ptr_to_addr(void *ptr)
+{
+	return (void *)((unsigned long)ptr + (unsigned long)pcpu_base_addr -
+			(unsigned long)__per_cpu_start);
+}
+
+/*
+ * Find the chunk that unit 0 address @addr belongs to.  The pages of
+ * vmalloc'ed chunks point back at their chunk through page->index.
+ */
+static struct pcpu_chunk *pcpu_chunk_addr_search(void *addr)
+{
+	if (addr >= pcpu_base_addr && addr < pcpu_base_addr + pcpu_unit_size)
+		return &pcpu_first_chunk;
+
+	return (struct pcpu_chunk *)vmalloc_to_page(addr)->index;
+}
+
+/*
+ * Allocating an area splits a free block into up to three, so the map
+ * must have room for two more entries.  Returns the size the map has to
+ * be extended to, or 0 if it is large enough.
+ */
+static int pcpu_need_to_extend(struct pcpu_chunk *chunk)
+{
+	int new_alloc;
+
+	if (chunk->map_alloc >= chunk->map_used + 2)
+		return 0;
+
+	new_alloc = PCPU_DFL_MAP_ALLOC;
+	while (new_alloc < chunk->map_used + 2)
+		new_alloc *= 2;
+
+	return new_alloc;
+}
+
+/*
+ * Grow the map of @chunk to @new_alloc entries.  Called without
+ * pcpu_lock; pcpu_alloc_mutex keeps the chunk alive and frees only
+ * ever shrink the map.
+ */
+static int pcpu_extend_area_map(struct pcpu_chunk *chunk, int new_alloc)
+{
+	int *old, *new;
+
+	new = kzalloc(new_alloc * sizeof(new[0]), GFP_KERNEL);
+	if (!new)
+		return -ENOMEM;
+
+	spin_lock_irq(&pcpu_lock);
+	if (new_alloc <= chunk->map_alloc) {
+		old = new;
+	} else {
+		memcpy(new, chunk->map, chunk->map_used * sizeof(new[0]));
+		old = chunk->map;
+		chunk->map = new;
+		chunk->map_alloc = new_alloc;
+	}
+	spin_unlock_irq(&pcpu_lock);
+
+	if (old != pcpu_first_map)
+		kfree(old);
+	return 0;
+}
+
+/*
+ * Split the free block @i of @chunk's map into @head, the middle and
+ * @tail; either of @head and @tail may be 0.  The caller has made sure
+ * the map has room for the new entries.
+ */
+static void pcpu_split_block(struct pcpu_chunk *chunk, int i,
+			     int head, int tail)
+{
+	int nr_extra = !!head + !!tail;
+
+	BUG_ON(chunk->map_alloc < chunk->map_used + nr_extra);
+
+	memmove(&chunk->map[i + nr_extra], &chunk->map[i],
+		sizeof(chunk->map[0]) * (chunk->map_used - i));
+	chunk->map_used += nr_extra;
+
+	if (head) {
+		chunk->map[i + 1] = chunk->map[i] - head;
+		chunk->map[i++] = head;
+	}
+	if (tail) {
+		chunk->map[i++] -= tail;
+		chunk->map[i] = tail;
+	}
+}
+
+/*
+ * Try to allocate @size bytes aligned at @align from @chunk.  Returns
+ * the offset of the area in the chunk, or -1 if there is no room; the
+ * contig_hint is brought up to date in that case.  Called with
+ * pcpu_lock held.
+ */
+static int pcpu_alloc_area(struct pcpu_chunk *chunk, int size, int align)
+{
+	int max_contig = 0;
+	int i, off;
+
+	for (i = 0, off = 0; i < chunk->map_used; off += abs(chunk->map[i++])) {
+		bool is_last = i + 1 == chunk->map_used;
+		int head, tail;
+
+		/* extra for alignment requirement */
+		head = ALIGN(off, align) - off;
+		BUG_ON(i == 0 && head != 0);
+
+		if (chunk->map[i] < 0)
+			continue;
+		if (chunk->map[i] < head + size) {
+			max_contig = max(chunk->map[i], max_contig);
+			continue;
+		}
+
+		/*
+		 * If the head is too small to be worth an entry, or the
+		 * previous block is free, give it to the previous block.
+		 */
+		if (head && (head < sizeof(int) || chunk->map[i - 1] > 0)) {
+			if (chunk->map[i - 1] > 0)
+				chunk->map[i - 1] += head;
+			else {
+				chunk->map[i - 1] -= head;
+				chunk->free_size -= head;
+			}
+			chunk->map[i] -= head;
+			off += head;
+			head = 0;
+		}
+
+		/* a tiny tail just stays with the area */
+		tail = chunk->map[i] - head - size;
+		if (tail < sizeof(int))
+			tail = 0;
+
+		if (head || tail) {
+			pcpu_split_block(chunk, i, head, tail);
+			if (head) {
+				i++;
+				off += head;
+				max_contig = max(chunk->map[i - 1], max_contig);
+			}
+			if (tail)
+				max_contig = max(chunk->map[i + 1], max_contig);
+		}
+
+		if (is_last)
+			chunk->contig_hint = max_contig; /* fully scanned */
+		else
+			chunk->contig_hint = max(chunk->contig_hint,
+						 max_contig);
+
+		chunk->free_size -= chunk->map[i];
+		chunk->map[i] = -chunk->map[i];
+		return off;
+	}
+
+	chunk->contig_hint = max_contig;	/* fully scanned */
+	return -1;
+}
+
+/*
+ * Free the area at offset @freeme in @chunk and merge it with its free
+ * neighbours.  Called with pcpu_lock held.
+ */
+static void pcpu_free_area(struct pcpu_chunk *chunk, int freeme)
+{
+	int i, off;
+
+	for (i = 0, off = 0; i < chunk->map_used; off += abs(chunk->map[i++]))
+		if (off == freeme)
+			break;
+	BUG_ON(i == chunk->map_used);
+	BUG_ON(chunk->map[i] > 0);
+
+	chunk->map[i] = -chunk->map[i];
+	chunk->free_size += chunk->map[i];
+
+	/* merge with previous? */
+	if (i > 0 && chunk->map[i - 1] >= 0) {
+		chunk->map[i - 1] += chunk->map[i];
+		chunk->map_used--;
+		memmove(&chunk->map[i], &chunk->map[i + 1],
+			(chunk->map_used - i) * sizeof(chunk->map[0]));
+		i--;
+	}
+	/* merge with next? */
+	if (i + 1 < chunk->map_used && chunk->map[i + 1] >= 0) {
+		chunk->map[i] += chunk->map[i + 1];
+		chunk->map_used--;
+		memmove(&chunk->map[i + 1], &chunk->map[i + 2],
+			(chunk->map_used - (i + 1)) * sizeof(chunk->map[0]));
+	}
+
+	chunk->contig_hint = max(chunk->map[i], chunk->contig_hint);
+}
+
+static void pcpu_destroy_chunk(struct pcpu_chunk *chunk)
+{
+	int i;
+
+	if (chunk->vm) {
+		/* flush the TLBs before the pages go back */
+		unmap_kernel_range((unsigned long)chunk->base_addr,
+				   pcpu_chunk_size);
+		free_vm_area(chunk->vm);
+	}
+	for (i = 0; i < nr_cpu_ids * pcpu_unit_pages; i++)
+		if (chunk->page[i])
+			__free_page(chunk->page[i]);
+	kfree(chunk->map);
+	kfree(chunk);
+}
+
+/*
+ * Create a chunk in vmalloc space and back the unit of every possible
+ * cpu with pages from that cpu's node.
+ */
+static struct pcpu_chunk *pcpu_create_chunk(void)
+{
+	struct pcpu_chunk *chunk;
+	unsigned int cpu;
+	int i;
+
+	chunk = kzalloc(pcpu_chunk_struct_size, GFP_KERNEL);
+	if (!chunk)
+		return NULL;
+
+	chunk->map = kzalloc(PCPU_DFL_MAP_ALLOC * sizeof(chunk->map[0]),
+			     GFP_KERNEL);
+	if (!chunk->map)
+		goto fail;
+	chunk->map_alloc = PCPU_DFL_MAP_ALLOC;
+	chunk->map[chunk->map_used++] = pcpu_unit_size;
+
+	chunk->vm = get_vm_area(pcpu_chunk_size, VM_ALLOC);
+	if (!chunk->vm)
+		goto fail;
+	chunk->base_addr = chunk->vm->addr;
+
+	for_each_possible_cpu(cpu) {
+		struct page **pages = &chunk->page[cpu * pcpu_unit_pages];
+		int node = cpu_to_node(cpu);
+
+		if (node < 0 || !node_online(node))
+			node = -1;
+
+		for (i = 0; i < pcpu_unit_pages; i++) {
+			pages[i] = alloc_pages_node(node,
+					GFP_KERNEL | __GFP_HIGHMEM, 0);
+			if (!pages[i])
+				goto fail;
+			pages[i]->index = (unsigned long)chunk;
+		}
+
+		if (map_kernel_range(pcpu_unit_addr(chunk, cpu),
+				     pcpu_unit_size, PAGE_KERNEL, pages) < 0)
+			goto fail;
+	}
+
+	chunk->free_size = pcpu_unit_size;
+	chunk->contig_hint = pcpu_unit_size;
+	return chunk;
+
+fail:
+	pcpu_destroy_chunk(chunk);
+	return NULL;
+}
+
+/**
+ * __alloc_percpu - allocate dynamic percpu area
+ * @size: size of area to allocate in bytes
+ * @align: alignment of area (max PAGE_SIZE)
+ *
+ * Allocate a zeroed area of @size bytes, aligned at @align, for every
+ * possible cpu.  Might sleep.
+ *
+ * Returns the percpu pointer to the area on success, NULL on failure.
+ */
+void *__alloc_percpu(size_t size, size_t align)
+{
+	struct pcpu_chunk *chunk;
+	unsigned int cpu;
+	int off, new_alloc;
+
+	if (unlikely(!size || size > pcpu_unit_size || align > PAGE_SIZE)) {
+		WARN(1, "illegal size (%zu) or align (%zu) for "
+		     "percpu allocation\n", size, align);
+		return NULL;
+	}
+
+	mutex_lock(&pcpu_alloc_mutex);
+	spin_lock_irq(&pcpu_lock);
+restart:
+	list_for_each_entry(chunk, &pcpu_chunks, list) {
+		if (size > chunk->contig_hint)
+			continue;
+
+		new_alloc = pcpu_need_to_extend(chunk);
+		if (new_alloc) {
+			spin_unlock_irq(&pcpu_lock);
+			if (pcpu_extend_area_map(chunk, new_alloc) < 0)
+				goto fail_unlock_mutex;
+			spin_lock_irq(&pcpu_lock);
+			goto restart;
+		}
+
+		off = pcpu_alloc_area(chunk, size, align);
+		if (off >= 0)
+			goto area_found;
+	}
+	spin_unlock_irq(&pcpu_lock);
+
+	/* no room anywhere, add a chunk */
+	chunk = pcpu_create_chunk();
+	if (!chunk)
+		goto fail_unlock_mutex;
+
+	spin_lock_irq(&pcpu_lock);
+	list_add_tail(&chunk->list, &pcpu_chunks);
+	goto restart;
+
+area_found:
+	spin_unlock_irq(&pcpu_lock);
+
+	for_each_possible_cpu(cpu)
+		memset((void *)pcpu_unit_addr(chunk, cpu) + off, 0, size);
+
+	mutex_unlock(&pcpu_alloc_mutex);
+	return __addr_to_pcpu_ptr(chunk->base_addr + off);
+
+fail_unlock_mutex:
+	mutex_unlock(&pcpu_alloc_mutex);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(__alloc_percpu);
+
+/*
+ * Destroy all completely free chunks but one, which is kept around so
+ * that alternating allocations and frees don't keep creating chunks.
+ */
+static void pcpu_reclaim(struct work_struct *work)
+{
+	LIST_HEAD(todo);
+	struct pcpu_chunk *chunk, *next;
+	int kept = 0;
+
+	mutex_lock(&pcpu_alloc_mutex);
+	spin_lock_irq(&pcpu_lock);
+
+	list_for_each_entry_safe(chunk, next, &pcpu_chunks, list) {
+		if (chunk->free_size != pcpu_unit_size)
+			continue;
+		if (!kept++)
+			continue;
+		list_move(&chunk->list, &todo);
+	}
+
+	spin_unlock_irq(&pcpu_lock);
+	mutex_unlock(&pcpu_alloc_mutex);
+
+	list_for_each_entry_safe(chunk, next, &todo, list)
+		pcpu_destroy_chunk(chunk);
+}
+
+/**
+ * free_percpu - free percpu area
+ * @ptr: pointer to area to free
+ *
+ * Free percpu area @ptr.  Can be called from any context.
+ */
+void free_percpu(void *ptr)
+{
+	void *addr;
+	struct pcpu_chunk *chunk;
+	unsigned long flags;
+
+	if (!ptr)
+		return;
+
+	addr = __pcpu_ptr_to_addr(ptr);
+
+	spin_lock_irqsave(&pcpu_lock, flags);
+
+	chunk = pcpu_chunk_addr_search(addr);
+	pcpu_free_area(chunk, addr - chunk->base_addr);
+
+	/* reclaim if this makes for more than one free chunk */
+	if (chunk->free_size == pcpu_unit_size) {
+		struct pcpu_chunk *pos;
+
+		list_for_each_entry(pos, &pcpu_chunks, list)
+			if (pos != chunk && pos->free_size == pcpu_unit_size) {
+				schedule_work(&pcpu_reclaim_work);
+				break;
+			}
+	}
+
+	spin_unlock_irqrestore(&pcpu_lock, flags);
+}
+EXPORT_SYMBOL_GPL(free_percpu);
+
+/**
+ * pcpu_embed_first_chunk - set up the first chunk in bootmem
+ * @static_size: size of the static percpu area in bytes
+ * @dyn_size: room to leave behind the static area for dynamic allocations
+ *
+ * Allocate the units of the first chunk as one bootmem block and copy
+ * the static percpu section into the unit of every possible cpu.  The
+ * unit of cpu N lives at pcpu_base_addr + N * pcpu_unit_size; it is up
+ * to the architecture to make per_cpu_offset() point there.
+ *
+ * The unit size chosen here applies to all chunks.  Returns it.
+ */
+size_t __init pcpu_embed_first_chunk(size_t static_size, size_t dyn_size)
+{
+	struct pcpu_chunk *chunk = &pcpu_first_chunk;
+	unsigned int cpu;
+
+	pcpu_unit_size = max_t(size_t, PFN_ALIGN(static_size + dyn_size),
+			       PCPU_MIN_UNIT_SIZE);
+	pcpu_unit_pages = pcpu_unit_size >> PAGE_SHIFT;
+	pcpu_chunk_size = nr_cpu_ids * pcpu_unit_size;
+	pcpu_chunk_struct_size = sizeof(struct pcpu_chunk) +
+		nr_cpu_ids * pcpu_unit_pages * sizeof(struct page *);
+
+	pcpu_base_addr = __alloc_bootmem_nopanic(pcpu_chunk_size, PAGE_SIZE,
+						 __pa(MAX_DMA_ADDRESS));
+	if (!pcpu_base_addr)
+		panic("PERCPU: failed to allocate %zu bytes for the first "
+		      "chunk\n", pcpu_chunk_size);
+
+	for (cpu = 0; cpu < nr_cpu_ids; cpu++) {
+		void *ptr = pcpu_base_addr + cpu * pcpu_unit_size;
+
+		if (cpu_possible(cpu))
+			memcpy(ptr, __per_cpu_start, static_size);
+		else
+			free_bootmem(__pa(ptr), pcpu_unit_size);
+	}
+
+	chunk->base_addr = pcpu_base_addr;
+	chunk->map = pcpu_first_map;
+	chunk->map_alloc = ARRAY_SIZE(pcpu_first_map);
+	chunk->map[chunk->map_used++] = -static_size;
+	chunk->map[chunk->map_used++] = pcpu_unit_size - static_size;
+	chunk->free_size = pcpu_unit_size - static_size;
+	chunk->contig_hint = chunk->free_size;
+	list_add(&chunk->list, &pcpu_chunks);
+
+	printk(KERN_INFO "PERCPU: Embedded %d pages per cpu, static data "
+	       "%zu bytes\n", pcpu_unit_pages, static_size);
+
+	return pcpu_unit_size;
+}
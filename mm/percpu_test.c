@@ -0,0 +1,173 @@
+/*
+ * mm/percpu_test.c - dynamic percpu allocator test
+ *
+ * Allocates a few thousand percpu areas of pseudo random sizes between
+ * 4 bytes and a page, frees every other one, and fills the holes again,
+ * so that the allocator has to deal with a fragmented chunk map and to
+ * create and reclaim chunks.  Every area is checked to come back zeroed
+ * on all cpus, and to keep what was written to it while its neighbours
+ * are allocated and freed.  Then alloc/free pairs of a few common sizes
+ * are timed.
+ *
+ * Loading the module runs the test; it then fails to load so that it
+ * can simply be loaded again.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/random.h>
+#include <linux/vmalloc.h>
+#include <linux/timex.h>
+
+#define NR_AREAS	4096
+#define NR_TIMED	10000
+
+struct test_area {
+	void *ptr;
+	size_t size;
+	u8 pattern;
+};
+
+static struct test_area *areas;
+static int errors;
+
+static size_t random_size(void)
+{
+	/* mostly small areas, like counters, with the odd large one */
+	switch (random32() % 8) {
+	case 0:
+		return 4 + random32() % PAGE_SIZE;
+	case 1:
+	case 2:
+		return 4 + random32() % 256;
+	default:
+		return sizeof(int) << (random32() % 4);
+	}
+}
+
+static int fill_area(struct test_area *a, u8 pattern)
+{
+	int cpu;
+
+	a->size = random_size();
+	a->ptr = __alloc_percpu(a->size, a->size >= sizeof(long) ?
+					 sizeof(long) : sizeof(int));
+	if (!a->ptr)
+		return -ENOMEM;
+	a->pattern = pattern;
+
+	for_each_possible_cpu(cpu) {
+		u8 *p = per_cpu_ptr(a->ptr, cpu);
+		size_t i;
+
+		for (i = 0; i < a->size; i++)
+			if (p[i]) {
+				printk(KERN_ERR "percpu_test: %p not zeroed "
+				       "on cpu %d\n", a->ptr, cpu);
+				errors++;
+				break;
+			}
+		memset(p, pattern ^ cpu, a->size);
+	}
+	return 0;
+}
+
+static void check_area(struct test_area *a)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		u8 *p = per_cpu_ptr(a->ptr, cpu);
+		size_t i;
+
+		for (i = 0; i < a->size; i++)
+			if (p[i] != (u8)(a->pattern ^ cpu)) {
+				printk(KERN_ERR "percpu_test: %p (%zu bytes) "
+				       "corrupted on cpu %d\n", a->ptr,
+				       a->size, cpu);
+				errors++;
+				break;
+			}
+	}
+}
+
+static int test_fragmentation(void)
+{
+	int i, ret = 0;
+
+	for (i = 0; i < NR_AREAS; i++) {
+		ret = fill_area(&areas[i], i);
+		if (ret)
+			goto out;
+	}
+
+	/* punch holes, then refill them with different sizes */
+	for (i = 0; i < NR_AREAS; i += 2) {
+		check_area(&areas[i]);
+		free_percpu(areas[i].ptr);
+		areas[i].ptr = NULL;
+	}
+	for (i = 0; i < NR_AREAS; i += 2) {
+		ret = fill_area(&areas[i], ~i);
+		if (ret)
+			goto out;
+	}
+
+	for (i = 0; i < NR_AREAS; i++)
+		check_area(&areas[i]);
+out:
+	for (i = 0; i < NR_AREAS; i++)
+		free_percpu(areas[i].ptr);
+	return ret;
+}
+
+static void test_speed(size_t size)
+{
+	cycles_t alloc = 0, free = 0, start;
+	int i;
+
+	for (i = 0; i < NR_TIMED; i++) {
+		start = get_cycles();
+		areas[i % NR_AREAS].ptr = __alloc_percpu(size, sizeof(int));
+		alloc += get_cycles() - start;
+
+		if (i % NR_AREAS == NR_AREAS - 1 || i == NR_TIMED - 1) {
+			int j;
+
+			start = get_cycles();
+			for (j = 0; j <= i % NR_AREAS; j++)
+				free_percpu(areas[j].ptr);
+			free += get_cycles() - start;
+		}
+	}
+
+	printk(KERN_INFO "percpu_test: %5zu bytes: alloc %lu free %lu "
+	       "cycles\n", size, (unsigned long)alloc / NR_TIMED,
+	       (unsigned long)free / NR_TIMED);
+}
+
+static int __init percpu_test_init(void)
+{
+	int ret;
+
+	areas = vmalloc(NR_AREAS * sizeof(*areas));
+	if (!areas)
+		return -ENOMEM;
+	memset(areas, 0, NR_AREAS * sizeof(*areas));
+
+	ret = test_fragmentation();
+	printk(KERN_INFO "percpu_test: fragmentation test %s, %d errors\n",
+	       ret ? "ran out of memory" : "done", errors);
+
+	test_speed(4);
+	test_speed(64);
+	test_speed(PAGE_SIZE);
+
+	vfree(areas);
+	return -EAGAIN;
+}
+
+module_init(percpu_test_init);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Dynamic percpu allocator test");
@@ -50,21 +50,37 @@
 #include <linux/kallsyms.h>
 #include <linux/memcontrol.h>
 #include <linux/mmu_notifier.h>
+#include <linux/ksm.h>
 
 #include <asm/tlbflush.h>
 
 #include "internal.h"
 
-static struct kmem_cache *anon_vma_cachep;
+struct kmem_cache *anon_vma_cachep;
+static struct kmem_cache *anon_vma_chain_cachep;
 
-static inline struct anon_vma *anon_vma_alloc(void)
+static inline struct anon_vma_chain *anon_vma_chain_alloc(void)
 {
-	return kmem_cache_alloc(anon_vma_cachep, GFP_KERNEL);
+	return kmem_cache_alloc(anon_vma_chain_cachep, GFP_KERNEL);
 }
 
-static inline void anon_vma_free(struct anon_vma *anon_vma)
+static void anon_vma_chain_free(struct anon_vma_chain *anon_vma_chain)
 {
-	kmem_cache_free(anon_vma_cachep, anon_vma);
+	kmem_cache_free(anon_vma_chain_cachep, anon_vma_chain);
+}
+
+/*
+ * Link avc between vma and anon_vma: the caller holds the anon_vma lock,
+ * and mmap_sem for writing or page_table_lock to serialize the vma's list.
+ */
+static void anon_vma_chain_link(struct vm_area_struct *vma,
+				struct anon_vma_chain *avc,
+				struct anon_vma *anon_vma)
+{
+	avc->vma = vma;
+	avc->anon_vma = anon_vma;
+	list_add(&avc->same_vma, &vma->anon_vma_chain);
+	list_add_tail(&avc->same_anon_vma, &anon_vma->head);
 }
 
 /**
@@ -97,80 +113,195 @@ static inline void anon_vma_free(struct anon_vma *anon_vma)
 int anon_vma_prepare(struct vm_area_struct *vma)
 {
 	struct anon_vma *anon_vma = vma->anon_vma;
+	struct anon_vma_chain *avc;
 
 	might_sleep();
 	if (unlikely(!anon_vma)) {
 		struct mm_struct *mm = vma->vm_mm;
 		struct anon_vma *allocated;
 
+		avc = anon_vma_chain_alloc();
+		if (!avc)
+			goto out_enomem;
+
 		anon_vma = find_mergeable_anon_vma(vma);
 		allocated = NULL;
 		if (!anon_vma) {
 			anon_vma = anon_vma_alloc();
 			if (unlikely(!anon_vma))
-				return -ENOMEM;
+				goto out_enomem_free_avc;
 			allocated = anon_vma;
 		}
-		spin_lock(&anon_vma->lock);
+		anon_vma_lock(anon_vma);
 
 		/* page_table_lock to protect against threads */
 		spin_lock(&mm->page_table_lock);
 		if (likely(!vma->anon_vma)) {
 			vma->anon_vma = anon_vma;
-			list_add_tail(&vma->anon_vma_node, &anon_vma->head);
+			anon_vma_chain_link(vma, avc, anon_vma);
 			allocated = NULL;
+			avc = NULL;
 		}
 		spin_unlock(&mm->page_table_lock);
 
-		spin_unlock(&anon_vma->lock);
+		anon_vma_unlock(anon_vma);
 		if (unlikely(allocated))
 			anon_vma_free(allocated);
+		if (unlikely(avc))
+			anon_vma_chain_free(avc);
 	}
 	return 0;
+
+ out_enomem_free_avc:
+	anon_vma_chain_free(avc);
+ out_enomem:
+	return -ENOMEM;
 }
 
-void __anon_vma_merge(struct vm_area_struct *vma, struct vm_area_struct *next)
+/*
+ * Attach the anon_vmas from src to dst.
+ * Returns 0 on success, -ENOMEM on failure.
+ */
+int anon_vma_clone(struct vm_area_struct *dst, struct vm_area_struct *src)
 {
-	BUG_ON(vma->anon_vma != next->anon_vma);
-	list_del(&next->anon_vma_node);
+	struct anon_vma_chain *avc, *pavc;
+
+	list_for_each_entry_reverse(pavc, &src->anon_vma_chain, same_vma) {
+		avc = anon_vma_chain_alloc();
+		if (!avc)
+			goto enomem_failure;
+		anon_vma_lock(pavc->anon_vma);
+		anon_vma_chain_link(dst, avc, pavc->anon_vma);
+		anon_vma_unlock(pavc->anon_vma);
+	}
+	return 0;
+
+ enomem_failure:
+	unlink_anon_vmas(dst);
+	return -ENOMEM;
 }
 
-void __anon_vma_link(struct vm_area_struct *vma)
+/*
+ * Attach vma to its own anon_vma, as well as to the anon_vmas that
+ * the corresponding VMA in the parent process is attached to.
+ * Returns 0 on success, non-zero on failure.
+ */
+int anon_vma_fork(struct vm_area_struct *vma, struct vm_area_struct *pvma)
 {
-	struct anon_vma *anon_vma = vma->anon_vma;
+	struct anon_vma_chain *avc;
+	struct anon_vma *anon_vma;
+
+	/* Don't bother if the parent process has no anon_vma here. */
+	if (!pvma->anon_vma)
+		return 0;
 
-	if (anon_vma)
-		list_add_tail(&vma->anon_vma_node, &anon_vma->head);
+	/*
+	 * First, attach the new VMA to the parent VMA's anon_vmas,
+	 * so rmap can find non-COWed pages in child processes.
+	 */
+	if (anon_vma_clone(vma, pvma))
+		return -ENOMEM;
+
+	/* Then add our own anon_vma. */
+	anon_vma = anon_vma_alloc();
+	if (!anon_vma)
+		goto out_error;
+	avc = anon_vma_chain_alloc();
+	if (!avc)
+		goto out_error_free_anon_vma;
+
+	/*
+	 * The root anon_vma's lock serializes the whole tree: it must
+	 * outlive every anon_vma which uses it.
+	 */
+	anon_vma->root = pvma->anon_vma->root;
+	get_anon_vma(anon_vma->root);
+	/* Mark this anon_vma as the one where our new (COWed) pages go. */
+	vma->anon_vma = anon_vma;
+	anon_vma_lock(anon_vma);
+	anon_vma_chain_link(vma, avc, anon_vma);
+	anon_vma_unlock(anon_vma);
+
+	return 0;
+
+ out_error_free_anon_vma:
+	anon_vma_free(anon_vma);
+ out_error:
+	unlink_anon_vmas(vma);
+	return -ENOMEM;
 }
 
-void anon_vma_link(struct vm_area_struct *vma)
+/*
+ * Drop a reference taken by get_anon_vma(), freeing the anon_vma if
+ * that was the last reference and no vma is left on its list.
+ */
+void put_anon_vma(struct anon_vma *anon_vma)
 {
-	struct anon_vma *anon_vma = vma->anon_vma;
+	struct anon_vma *root = anon_vma->root;
+
+	if (atomic_dec_and_lock(&anon_vma->refcount, &root->lock)) {
+		int empty = list_empty(&anon_vma->head);
 
-	if (anon_vma) {
-		spin_lock(&anon_vma->lock);
-		list_add_tail(&vma->anon_vma_node, &anon_vma->head);
-		spin_unlock(&anon_vma->lock);
+		spin_unlock(&root->lock);
+		if (empty) {
+			if (root != anon_vma)
+				put_anon_vma(root);
+			anon_vma_free(anon_vma);
+		}
 	}
 }
 
-void anon_vma_unlink(struct vm_area_struct *vma)
+static void anon_vma_unlink(struct anon_vma_chain *anon_vma_chain)
 {
-	struct anon_vma *anon_vma = vma->anon_vma;
+	struct anon_vma *anon_vma = anon_vma_chain->anon_vma;
 	int empty;
 
+	/* If anon_vma_fork fails, we can get an empty anon_vma_chain. */
 	if (!anon_vma)
 		return;
 
-	spin_lock(&anon_vma->lock);
-	list_del(&vma->anon_vma_node);
+	anon_vma_lock(anon_vma);
+	list_del(&anon_vma_chain->same_anon_vma);
 
-	/* We must garbage collect the anon_vma if it's empty */
-	empty = list_empty(&anon_vma->head);
-	spin_unlock(&anon_vma->lock);
+	/*
+	 * We must garbage collect the anon_vma if it's empty, unless
+	 * KSM or another anon_vma of the tree still holds it: then it
+	 * is freed by the last put_anon_vma().
+	 */
+	empty = list_empty(&anon_vma->head) && !atomic_read(&anon_vma->refcount);
+	anon_vma_unlock(anon_vma);
 
-	if (empty)
+	if (empty) {
+		/* We no longer need the root anon_vma */
+		if (anon_vma->root != anon_vma)
+			put_anon_vma(anon_vma->root);
 		anon_vma_free(anon_vma);
+	}
+}
+
+void unlink_anon_vmas(struct vm_area_struct *vma)
+{
+	struct anon_vma_chain *avc, *next;
+
+	/*
+	 * Unlink each anon_vma chained to the VMA.  This list is ordered
+	 * from newest to oldest, ensuring the root anon_vma gets freed last.
+	 */
+	list_for_each_entry_safe(avc, next, &vma->anon_vma_chain, same_vma) {
+		anon_vma_unlink(avc);
+		list_del(&avc->same_vma);
+		anon_vma_chain_free(avc);
+	}
+}
+
+/*
+ * vma_adjust() is removing next, whose pages are now covered by vma:
+ * the two share the same anon_vma, and next's links can simply go.
+ */
+void anon_vma_merge(struct vm_area_struct *vma, struct vm_area_struct *next)
+{
+	VM_BUG_ON(vma->anon_vma != next->anon_vma);
+	unlink_anon_vmas(next);
 }
 
 static void anon_vma_ctor(void *data)
@@ -178,6 +309,7 @@ static void anon_vma_ctor(void *data)
 	struct anon_vma *anon_vma = data;
 
 	spin_lock_init(&anon_vma->lock);
+	atomic_set(&anon_vma->refcount, 0);
 	INIT_LIST_HEAD(&anon_vma->head);
 }
 
@@ -185,27 +317,35 @@ void __init anon_vma_init(void)
 {
 	anon_vma_cachep = kmem_cache_create("anon_vma", sizeof(struct anon_vma),
 			0, SLAB_DESTROY_BY_RCU|SLAB_PANIC, anon_vma_ctor);
+	anon_vma_chain_cachep = KMEM_CACHE(anon_vma_chain, SLAB_PANIC);
 }
 
 /*
  * Getting a lock on a stable anon_vma from a page off the LRU is
  * tricky: page_lock_anon_vma rely on RCU to guard against the races.
+ * The anon_vma may be freed and reused while we wait for its root's
+ * lock: but if the page is still mapped once we hold that lock, the
+ * anon_vma is still the page's, and cannot have changed its root.
  */
 struct anon_vma *page_lock_anon_vma(struct page *page)
 {
-	struct anon_vma *anon_vma;
+	struct anon_vma *anon_vma, *root;
 	unsigned long anon_mapping;
 
 	rcu_read_lock();
-	anon_mapping = (unsigned long) page->mapping;
-	if (!(anon_mapping & PAGE_MAPPING_ANON))
+	anon_mapping = (unsigned long) ACCESS_ONCE(page->mapping);
+	if ((anon_mapping & PAGE_MAPPING_FLAGS) != PAGE_MAPPING_ANON)
 		goto out;
 	if (!page_mapped(page))
 		goto out;
 
 	anon_vma = (struct anon_vma *) (anon_mapping - PAGE_MAPPING_ANON);
-	spin_lock(&anon_vma->lock);
-	return anon_vma;
+	root = ACCESS_ONCE(anon_vma->root);
+	spin_lock(&root->lock);
+	if (page_mapped(page) && root == anon_vma->root &&
+	    anon_mapping == (unsigned long) page->mapping)
+		return anon_vma;
+	spin_unlock(&root->lock);
 out:
 	rcu_read_unlock();
 	return NULL;
@@ -213,7 +353,7 @@ out:
 
 void page_unlock_anon_vma(struct anon_vma *anon_vma)
 {
-	spin_unlock(&anon_vma->lock);
+	anon_vma_unlock(anon_vma);
 	rcu_read_unlock();
 }
 
@@ -243,8 +383,14 @@ vma_address(struct page *page, struct vm_area_struct *vma)
 unsigned long page_address_in_vma(struct page *page, struct vm_area_struct *vma)
 {
 	if (PageAnon(page)) {
-		if ((void *)vma->anon_vma !=
-		    (void *)page->mapping - PAGE_MAPPING_ANON)
+		struct anon_vma *page__anon_vma = page_anon_vma(page);
+
+		/*
+		 * Note: swapoff's unuse_vma() is more efficient with this
+		 * check, and needs it to match anon_vma when KSM is active.
+		 */
+		if (!vma->anon_vma || !page__anon_vma ||
+		    vma->anon_vma->root != page__anon_vma->root)
 			return -EFAULT;
 	} else if (page->mapping && !(vma->vm_flags & VM_NONLINEAR)) {
 		if (!vma->vm_file ||
@@ -284,6 +430,10 @@ pte_t *page_check_address(struct page *page, struct mm_struct *mm,
 	pmd = pmd_offset(pud, address);
 	if (!pmd_present(*pmd))
 		return NULL;
+	split_huge_pmd(mm, pmd, address);
+	/* ptes shared since fork are left alone until unshared */
+	if (pmd_ptes_shared(*pmd))
+		return NULL;
 
 	pte = pte_offset_map(pmd, address);
 	/* Make a quick check before getting the lock */
@@ -330,24 +480,27 @@ static int page_mapped_in_vma(struct page *page, struct vm_area_struct *vma)
 
 /*
  * Subfunctions of page_referenced: page_referenced_one called
- * repeatedly from either page_referenced_anon or page_referenced_file.
+ * repeatedly from either page_referenced_anon or page_referenced_file,
+ * or from page_referenced_ksm.
  */
-static int page_referenced_one(struct page *page,
-	struct vm_area_struct *vma, unsigned int *mapcount)
+int page_referenced_one(struct page *page, struct vm_area_struct *vma,
+			unsigned long address, unsigned int *mapcount)
 {
 	struct mm_struct *mm = vma->vm_mm;
-	unsigned long address;
-	pte_t *pte;
+	pte_t *pte = NULL;
 	spinlock_t *ptl;
 	int referenced = 0;
+	int young;
 
-	address = vma_address(page, vma);
-	if (address == -EFAULT)
-		goto out;
-
-	pte = page_check_address(page, mm, address, &ptl, 0);
-	if (!pte)
-		goto out;
+	/* Aging alone is no reason to split a huge pmd */
+	young = -1;
+	if (PageAnon(page))
+		young = page_referenced_trans_huge(page, mm, address);
+	if (young < 0) {
+		pte = page_check_address(page, mm, address, &ptl, 0);
+		if (!pte)
+			goto out;
+	}
 
 	/*
 	 * Don't want to elevate referenced for mlocked page that gets this far,
@@ -359,7 +512,7 @@ static int page_referenced_one(struct page *page,
 		goto out_unmap;
 	}
 
-	if (ptep_clear_flush_young_notify(vma, address, pte))
+	if (pte ? ptep_clear_flush_young_notify(vma, address, pte) : young)
 		referenced++;
 
 	/* Pretend the page is referenced if the task has the
@@ -370,7 +523,8 @@ static int page_referenced_one(struct page *page,
 
 out_unmap:
 	(*mapcount)--;
-	pte_unmap_unlock(pte, ptl);
+	if (pte)
+		pte_unmap_unlock(pte, ptl);
 out:
 	return referenced;
 }
@@ -380,7 +534,7 @@ static int page_referenced_anon(struct page *page,
 {
 	unsigned int mapcount;
 	struct anon_vma *anon_vma;
-	struct vm_area_struct *vma;
+	struct anon_vma_chain *avc;
 	int referenced = 0;
 
 	anon_vma = page_lock_anon_vma(page);
@@ -388,15 +542,20 @@ static int page_referenced_anon(struct page *page,
 		return referenced;
 
 	mapcount = page_mapcount(page);
-	list_for_each_entry(vma, &anon_vma->head, anon_vma_node) {
+	list_for_each_entry(avc, &anon_vma->head, same_anon_vma) {
+		struct vm_area_struct *vma = avc->vma;
 		/*
 		 * If we are reclaiming on behalf of a cgroup, skip
 		 * counting on behalf of references from different
 		 * cgroups
 		 */
+		unsigned long address = vma_address(page, vma);
+		if (address == -EFAULT)
+			continue;
 		if (mem_cont && !mm_match_cgroup(vma->vm_mm, mem_cont))
 			continue;
-		referenced += page_referenced_one(page, vma, &mapcount);
+		referenced += page_referenced_one(page, vma, address,
+						  &mapcount);
 		if (!mapcount)
 			break;
 	}
@@ -456,9 +615,13 @@ static int page_referenced_file(struct page *page,
 		 * counting on behalf of references from different
 		 * cgroups
 		 */
+		unsigned long address = vma_address(page, vma);
+		if (address == -EFAULT)
+			continue;
 		if (mem_cont && !mm_match_cgroup(vma->vm_mm, mem_cont))
 			continue;
-		referenced += page_referenced_one(page, vma, &mapcount);
+		referenced += page_referenced_one(page, vma, address,
+						  &mapcount);
 		if (!mapcount)
 			break;
 	}
@@ -485,7 +648,19 @@ int page_referenced(struct page *page, int is_locked,
 		referenced++;
 
 	if (page_mapped(page) && page->mapping) {
-		if (PageAnon(page))
+		if (PageKsm(page)) {
+			/* rmap_items are only stable under the page lock */
+			if (is_locked)
+				referenced += page_referenced_ksm(page,
+								  mem_cont);
+			else if (!trylock_page(page))
+				referenced++;
+			else {
+				referenced += page_referenced_ksm(page,
+								  mem_cont);
+				unlock_page(page);
+			}
+		} else if (PageAnon(page))
 			referenced += page_referenced_anon(page, mem_cont);
 		else if (is_locked)
 			referenced += page_referenced_file(page, mem_cont);
@@ -581,13 +756,22 @@ EXPORT_SYMBOL_GPL(page_mkclean);
  * @page:	the page to add the mapping to
  * @vma:	the vm area in which the mapping is added
  * @address:	the user virtual address mapped
+ * @exclusive:	the page is known to be mapped by this vma alone
  */
 static void __page_set_anon_rmap(struct page *page,
-	struct vm_area_struct *vma, unsigned long address)
+	struct vm_area_struct *vma, unsigned long address, int exclusive)
 {
 	struct anon_vma *anon_vma = vma->anon_vma;
 
 	BUG_ON(!anon_vma);
+	/*
+	 * A page which may also be mapped by our relatives, a swapcache
+	 * page for instance, must point to the oldest anon_vma, the one
+	 * every vma of the tree is chained to; only a page we know to be
+	 * our own can point to the vma's anon_vma, which lists fewer vmas.
+	 */
+	if (!exclusive)
+		anon_vma = anon_vma->root;
 	anon_vma = (void *) anon_vma + PAGE_MAPPING_ANON;
 	page->mapping = (struct address_space *) anon_vma;
 
@@ -622,9 +806,10 @@ static void __page_check_anon_rmap(struct page *page,
 	 * are initially only visible via the pagetables, and the pte is locked
 	 * over the call to page_add_new_anon_rmap.
 	 */
-	struct anon_vma *anon_vma = vma->anon_vma;
-	anon_vma = (void *) anon_vma + PAGE_MAPPING_ANON;
-	BUG_ON(page->mapping != (struct address_space *)anon_vma);
+	struct anon_vma *anon_vma;
+
+	anon_vma = (void *) page->mapping - PAGE_MAPPING_ANON;
+	BUG_ON(anon_vma->root != vma->anon_vma->root);
 	BUG_ON(page->index != linear_page_index(vma, address));
 #endif
 }
@@ -635,15 +820,23 @@ static void __page_check_anon_rmap(struct page *page,
  * @vma:	the vm area in which the mapping is added
  * @address:	the user virtual address mapped
  *
- * The caller needs to hold the pte lock and the page must be locked.
+ * The caller needs to hold the pte lock, and the page must be locked
+ * unless it is a KSM page: its mapping is the stable_node, left alone here.
  */
 void page_add_anon_rmap(struct page *page,
 	struct vm_area_struct *vma, unsigned long address)
 {
+	int first = atomic_inc_and_test(&page->_mapcount);
+
+	if (unlikely(PageKsm(page))) {
+		if (first)
+			__inc_zone_page_state(page, NR_ANON_PAGES);
+		return;
+	}
 	VM_BUG_ON(!PageLocked(page));
 	VM_BUG_ON(address < vma->vm_start || address >= vma->vm_end);
-	if (atomic_inc_and_test(&page->_mapcount))
-		__page_set_anon_rmap(page, vma, address);
+	if (first)
+		__page_set_anon_rmap(page, vma, address, 0);
 	else
 		__page_check_anon_rmap(page, vma, address);
 }
@@ -663,7 +856,7 @@ void page_add_new_anon_rmap(struct page *page,
 {
 	BUG_ON(address < vma->vm_start || address >= vma->vm_end);
 	atomic_set(&page->_mapcount, 0); /* elevate count by 1 (starts at -1) */
-	__page_set_anon_rmap(page, vma, address);
+	__page_set_anon_rmap(page, vma, address, 1);
 }
 
 /**
@@ -694,7 +887,7 @@ void page_add_file_rmap(struct page *page)
 void page_dup_rmap(struct page *page, struct vm_area_struct *vma, unsigned long address)
 {
 	BUG_ON(page_mapcount(page) == 0);
-	if (PageAnon(page))
+	if (PageAnon(page) && !PageKsm(page))
 		__page_check_anon_rmap(page, vma, address);
 	atomic_inc(&page->_mapcount);
 }
@@ -755,22 +948,18 @@ void page_remove_rmap(struct page *page, struct vm_area_struct *vma)
 
 /*
  * Subfunctions of try_to_unmap: try_to_unmap_one called
- * repeatedly from either try_to_unmap_anon or try_to_unmap_file.
+ * repeatedly from either try_to_unmap_anon or try_to_unmap_file,
+ * or from try_to_unmap_ksm.
  */
-static int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
-				int migration)
+int try_to_unmap_one(struct page *page, struct vm_area_struct *vma,
+		     unsigned long address, int migration)
 {
 	struct mm_struct *mm = vma->vm_mm;
-	unsigned long address;
 	pte_t *pte;
 	pte_t pteval;
 	spinlock_t *ptl;
 	int ret = SWAP_AGAIN;
 
-	address = vma_address(page, vma);
-	if (address == -EFAULT)
-		goto out;
-
 	pte = page_check_address(page, mm, address, &ptl, 0);
 	if (!pte)
 		goto out;
@@ -972,7 +1161,7 @@ static int try_to_unmap_cluster(unsigned long cursor, unsigned int *mapcount,
 /*
  * common handling for pages mapped in VM_LOCKED vmas
  */
-static int try_to_mlock_page(struct page *page, struct vm_area_struct *vma)
+int try_to_mlock_page(struct page *page, struct vm_area_struct *vma)
 {
 	int mlocked = 0;
 
@@ -1006,7 +1195,7 @@ static int try_to_mlock_page(struct page *page, struct vm_area_struct *vma)
 static int try_to_unmap_anon(struct page *page, int unlock, int migration)
 {
 	struct anon_vma *anon_vma;
-	struct vm_area_struct *vma;
+	struct anon_vma_chain *avc;
 	unsigned int mlocked = 0;
 	int ret = SWAP_AGAIN;
 
@@ -1017,14 +1206,19 @@ static int try_to_unmap_anon(struct page *page, int unlock, int migration)
 	if (!anon_vma)
 		return ret;
 
-	list_for_each_entry(vma, &anon_vma->head, anon_vma_node) {
+	list_for_each_entry(avc, &anon_vma->head, same_anon_vma) {
+		struct vm_area_struct *vma = avc->vma;
+
 		if (MLOCK_PAGES && unlikely(unlock)) {
 			if (!((vma->vm_flags & VM_LOCKED) &&
 			      page_mapped_in_vma(page, vma)))
 				continue;  /* must visit all unlocked vmas */
 			ret = SWAP_MLOCK;  /* saw at least one mlocked vma */
 		} else {
-			ret = try_to_unmap_one(page, vma, migration);
+			unsigned long address = vma_address(page, vma);
+			if (address == -EFAULT)
+				continue;
+			ret = try_to_unmap_one(page, vma, address, migration);
 			if (ret == SWAP_FAIL || !page_mapped(page))
 				break;
 		}
@@ -1084,7 +1278,10 @@ static int try_to_unmap_file(struct page *page, int unlock, int migration)
 				continue;	/* must visit all vmas */
 			ret = SWAP_MLOCK;
 		} else {
-			ret = try_to_unmap_one(page, vma, migration);
+			unsigned long address = vma_address(page, vma);
+			if (address == -EFAULT)
+				continue;
+			ret = try_to_unmap_one(page, vma, address, migration);
 			if (ret == SWAP_FAIL || !page_mapped(page))
 				goto out;
 		}
@@ -1200,7 +1397,9 @@ int try_to_unmap(struct page *page, int migration)
 
 	BUG_ON(!PageLocked(page));
 
-	if (PageAnon(page))
+	if (unlikely(PageKsm(page)))
+		ret = try_to_unmap_ksm(page, 0, migration);
+	else if (PageAnon(page))
 		ret = try_to_unmap_anon(page, 0, migration);
 	else
 		ret = try_to_unmap_file(page, 0, migration);
@@ -1228,7 +1427,9 @@ int try_to_munlock(struct page *page)
 {
 	VM_BUG_ON(!PageLocked(page) || PageLRU(page));
 
-	if (PageAnon(page))
+	if (unlikely(PageKsm(page)))
+		return try_to_unmap_ksm(page, 1, 0);
+	else if (PageAnon(page))
 		return try_to_unmap_anon(page, 1, 0);
 	else
 		return try_to_unmap_file(page, 1, 0);
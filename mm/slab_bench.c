@@ -0,0 +1,157 @@
+/*
+ * mm/slab_bench.c - slab allocator microbenchmark
+ *
+ * Times kmalloc()/kfree() for a range of object sizes.  Each size is run
+ * in two patterns: allocating a batch of objects and then freeing them
+ * all, which exercises the slowpaths and the partial lists, and freeing
+ * each object right after allocating it, which stays on the fastpath.
+ * Both are run on a single cpu and then on all online cpus concurrently.
+ *
+ * The results are printed in cycles per operation; loading the module
+ * runs the benchmark, and it then fails to load so that it can simply
+ * be loaded again.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/timex.h>
+
+#define TEST_COUNT	10000
+
+static int sizes[] = { 8, 64, 256, 1024, 2048 };
+
+static void **objects;
+
+struct bench_result {
+	cycles_t alloc;		/* Batch of allocations */
+	cycles_t free;		/* Batch of frees */
+	cycles_t pair;		/* Alloc immediately followed by free */
+};
+
+static void bench_size(void **objs, int size, struct bench_result *r)
+{
+	cycles_t start;
+	int i;
+
+	start = get_cycles();
+	for (i = 0; i < TEST_COUNT; i++)
+		objs[i] = kmalloc(size, GFP_KERNEL);
+	r->alloc = get_cycles() - start;
+
+	start = get_cycles();
+	for (i = 0; i < TEST_COUNT; i++)
+		kfree(objs[i]);
+	r->free = get_cycles() - start;
+
+	start = get_cycles();
+	for (i = 0; i < TEST_COUNT; i++)
+		kfree(kmalloc(size, GFP_KERNEL));
+	r->pair = get_cycles() - start;
+}
+
+static void print_result(const char *what, int size, struct bench_result *r,
+			 int runs)
+{
+	unsigned long ops = (unsigned long)TEST_COUNT * runs;
+
+	printk(KERN_INFO "%-10s %5d bytes: alloc %lu free %lu "
+		"alloc/free %lu cycles\n", what, size,
+		(unsigned long)r->alloc / ops, (unsigned long)r->free / ops,
+		(unsigned long)r->pair / ops);
+}
+
+/*
+ * The concurrent test runs one kthread per online cpu.  They all wait
+ * for the starting gun, so that they really hit the allocator at once.
+ */
+static DECLARE_COMPLETION(bench_start);
+static atomic_t bench_running;
+static DECLARE_COMPLETION(bench_done);
+static int bench_cur_size;
+static DEFINE_PER_CPU(struct bench_result, bench_results);
+
+static int bench_thread(void *arg)
+{
+	int cpu = (long)arg;
+
+	wait_for_completion(&bench_start);
+	bench_size(objects + cpu * TEST_COUNT, bench_cur_size,
+		   &per_cpu(bench_results, cpu));
+	if (atomic_dec_and_test(&bench_running))
+		complete(&bench_done);
+	return 0;
+}
+
+static void bench_concurrent(int size)
+{
+	struct bench_result sum = { 0, 0, 0 };
+	struct task_struct *p;
+	int cpu, nr = 0;
+
+	INIT_COMPLETION(bench_start);
+	INIT_COMPLETION(bench_done);
+	bench_cur_size = size;
+	atomic_set(&bench_running, 1);
+
+	for_each_online_cpu(cpu) {
+		p = kthread_create(bench_thread, (void *)(long)cpu,
+				   "slab_bench/%d", cpu);
+		if (IS_ERR(p))
+			continue;
+		kthread_bind(p, cpu);
+		atomic_inc(&bench_running);
+		wake_up_process(p);
+		nr++;
+	}
+
+	complete_all(&bench_start);
+	if (!atomic_dec_and_test(&bench_running))
+		wait_for_completion(&bench_done);
+
+	if (!nr)
+		return;
+
+	for_each_online_cpu(cpu) {
+		struct bench_result *r = &per_cpu(bench_results, cpu);
+
+		sum.alloc += r->alloc;
+		sum.free += r->free;
+		sum.pair += r->pair;
+		memset(r, 0, sizeof(*r));
+	}
+	print_result("concurrent", size, &sum, nr);
+}
+
+static int __init slab_bench_init(void)
+{
+	struct bench_result r;
+	int i;
+
+	objects = vmalloc(sizeof(void *) * TEST_COUNT * nr_cpu_ids);
+	if (!objects)
+		return -ENOMEM;
+
+	printk(KERN_INFO "slab_bench: %d operations per test, %d cpus\n",
+		TEST_COUNT, num_online_cpus());
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++) {
+		bench_size(objects, sizes[i], &r);
+		print_result("single", sizes[i], &r, 1);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(sizes); i++)
+		bench_concurrent(sizes[i]);
+
+	vfree(objects);
+	return -EAGAIN;
+}
+
+module_init(slab_bench_init);
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Slab allocator microbenchmark");
@@ -24,6 +24,7 @@
 #include <linux/kallsyms.h>
 #include <linux/memory.h>
 #include <linux/math64.h>
+#include <linux/uaccess.h>
 
 /*
  * Lock order:
@@ -236,6 +237,68 @@ static inline struct kmem_cache_cpu *get_cpu_slab(struct kmem_cache *s, int cpu)
 #endif
 }
 
+/*
+ * The allocation and free fastpaths run with only preemption disabled.
+ * Whenever the slowpaths change the cpu slab or its freelist, with
+ * interrupts disabled, they advance the transaction id, so that a
+ * fastpath interrupted in the middle fails its cmpxchg and retries.
+ */
+static inline unsigned long next_tid(unsigned long tid)
+{
+	return tid + 1;
+}
+
+/*
+ * Replace the cpu freelist, provided neither it nor the transaction id
+ * changed since the caller read them.  The caller must have preemption
+ * disabled: this is only atomic against interrupts on the local cpu.
+ *
+ * A kmem_cache_cpu that overflowed the static per cpu array comes from
+ * kmalloc, which does not guarantee the double word alignment under
+ * slab debugging; those take the interrupt disabling path.
+ */
+static inline int cpu_freelist_cmpxchg(struct kmem_cache_cpu *c,
+		void *freelist, unsigned long tid, void *new_freelist)
+{
+	unsigned long flags;
+	int ret = 0;
+
+#ifdef __HAVE_ARCH_CMPXCHG_DOUBLE
+	if (system_has_cmpxchg_double() &&
+			IS_ALIGNED((unsigned long)c, 2 * sizeof(void *)))
+		return cmpxchg_double_local(&c->freelist,
+				(unsigned long)freelist, tid,
+				(unsigned long)new_freelist, next_tid(tid));
+#endif
+	local_irq_save(flags);
+	if (c->freelist == freelist && c->tid == tid) {
+		c->freelist = new_freelist;
+		c->tid = next_tid(tid);
+		ret = 1;
+	}
+	local_irq_restore(flags);
+	return ret;
+}
+
+/*
+ * The allocation fastpath reads the free pointer of an object that an
+ * interrupt may have allocated, and whose slab may even have been freed,
+ * in the meantime.  The cmpxchg will fail then, but with
+ * DEBUG_PAGEALLOC the read itself may fault.
+ */
+static inline void *get_freepointer_safe(struct kmem_cache_cpu *c,
+					 void **object)
+{
+	void *p;
+
+#ifdef CONFIG_DEBUG_PAGEALLOC
+	probe_kernel_read(&p, object + c->offset, sizeof(p));
+#else
+	p = object[c->offset];
+#endif
+	return p;
+}
+
 /* Verify that a pointer has an address that is valid within a slab page */
 static inline int check_valid_pointer(struct kmem_cache *s,
 				struct page *page, const void *object)
@@ -1265,10 +1328,16 @@ static inline int lock_and_freeze_slab(struct kmem_cache_node *n,
 
 /*
  * Try to allocate a partial slab from a specific node.
+ *
+ * If @c is given, also take a few more slabs to refill its cpu partial
+ * list while we hold the list_lock, so that the next cpu slabs can be
+ * had without it.
  */
-static struct page *get_partial_node(struct kmem_cache_node *n)
+static struct page *get_partial_node(struct kmem_cache *s,
+		struct kmem_cache_node *n, struct kmem_cache_cpu *c)
 {
-	struct page *page;
+	struct page *page, *page2;
+	struct page *first = NULL;
 
 	/*
 	 * Racy check. If we mistakenly see no partial slabs then we
@@ -1280,13 +1349,26 @@ static struct page *get_partial_node(struct kmem_cache_node *n)
 		return NULL;
 
 	spin_lock(&n->list_lock);
-	list_for_each_entry(page, &n->partial, lru)
-		if (lock_and_freeze_slab(n, page))
-			goto out;
-	page = NULL;
-out:
+	list_for_each_entry_safe(page, page2, &n->partial, lru) {
+		if (!lock_and_freeze_slab(n, page))
+			continue;
+
+		if (!first) {
+			first = page;	/* Stays locked for the caller */
+			if (!c)
+				break;
+			continue;
+		}
+
+		list_add(&page->lru, &c->partial);
+		c->nr_partial++;
+		stat(c, CPU_PARTIAL_NODE);
+		slab_unlock(page);
+		if (c->nr_partial > s->cpu_partial / 2)
+			break;
+	}
 	spin_unlock(&n->list_lock);
-	return page;
+	return first;
 }
 
 /*
@@ -1331,7 +1413,7 @@ static struct page *get_any_partial(struct kmem_cache *s, gfp_t flags)
 
 		if (n && cpuset_zone_allowed_hardwall(zone, flags) &&
 				n->nr_partial > n->min_partial) {
-			page = get_partial_node(n);
+			page = get_partial_node(s, n, NULL);
 			if (page)
 				return page;
 		}
@@ -1343,12 +1425,14 @@ static struct page *get_any_partial(struct kmem_cache *s, gfp_t flags)
 /*
  * Get a partial page, lock it and return it.
  */
-static struct page *get_partial(struct kmem_cache *s, gfp_t flags, int node)
+static struct page *get_partial(struct kmem_cache *s, gfp_t flags, int node,
+				struct kmem_cache_cpu *c)
 {
 	struct page *page;
 	int searchnode = (node == -1) ? numa_node_id() : node;
 
-	page = get_partial_node(get_node(s, searchnode));
+	page = get_partial_node(s, get_node(s, searchnode),
+				s->cpu_partial ? c : NULL);
 	if (page || (flags & __GFP_THISNODE))
 		return page;
 
@@ -1433,9 +1517,60 @@ static void deactivate_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 		page->inuse--;
 	}
 	c->page = NULL;
+	c->tid = next_tid(c->tid);
 	unfreeze_slab(s, page, tail);
 }
 
+/*
+ * Put the slabs on the cpu partial list back onto the node partial lists,
+ * taking each node's list_lock once for a run of slabs from that node.
+ *
+ * Interrupts must be disabled, or the cpu must be dead.
+ */
+static void unfreeze_partials(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+	struct kmem_cache_node *n = NULL;
+	struct page *page, *page2;
+	LIST_HEAD(discard);
+
+	list_for_each_entry_safe(page, page2, &c->partial, lru) {
+		struct kmem_cache_node *n2 = get_node(s, page_to_nid(page));
+
+		if (n != n2) {
+			if (n)
+				spin_unlock(&n->list_lock);
+			n = n2;
+			spin_lock(&n->list_lock);
+		}
+
+		/*
+		 * A frozen slab is on no node list, so whoever holds its
+		 * slab lock is freeing to it and won't take a list_lock:
+		 * waiting for it under ours is safe.
+		 */
+		slab_lock(page);
+		__ClearPageSlubFrozen(page);
+		list_del(&page->lru);
+		if (!page->inuse && n->nr_partial >= n->min_partial)
+			list_add(&page->lru, &discard);
+		else {
+			list_add_tail(&page->lru, &n->partial);
+			n->nr_partial++;
+		}
+		slab_unlock(page);
+		stat(c, CPU_PARTIAL_DRAIN);
+	}
+	if (n)
+		spin_unlock(&n->list_lock);
+	c->nr_partial = 0;
+
+	list_for_each_entry_safe(page, page2, &discard, lru) {
+		list_del(&page->lru);
+		stat(c, FREE_SLAB);
+		discard_slab(s, page);
+	}
+}
+
 static inline void flush_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
 {
 	stat(c, CPUSLAB_FLUSH);
@@ -1452,8 +1587,14 @@ static inline void __flush_cpu_slab(struct kmem_cache *s, int cpu)
 {
 	struct kmem_cache_cpu *c = get_cpu_slab(s, cpu);
 
-	if (likely(c && c->page))
+	if (unlikely(!c))
+		return;
+
+	if (likely(c->page))
 		flush_slab(s, c);
+
+	if (c->nr_partial)
+		unfreeze_partials(s, c);
 }
 
 static void flush_cpu_slab(void *d)
@@ -1485,29 +1626,35 @@ static inline int node_match(struct kmem_cache_cpu *c, int node)
  * Slow path. The lockless freelist is empty or we need to perform
  * debugging duties.
  *
- * Interrupts are disabled.
+ * Interrupts are disabled here, the fastpath only disables preemption.
  *
  * Processing is still very fast if new objects have been freed to the
  * regular freelist. In that case we simply take over the regular freelist
  * as the lockless freelist and zap the regular freelist.
  *
- * If that is not working then we fall back to the partial lists. We take the
- * first element of the freelist as the object to allocate now and move the
- * rest of the freelist to the lockless freelist.
+ * If that is not working then we fall back to the cpu partial list and
+ * then to the node partial lists. We take the first element of the
+ * freelist as the object to allocate now and move the rest of the freelist
+ * to the lockless freelist.
  *
  * And if we were unable to get a new slab from the partial slab lists then
  * we need to allocate a new slab. This is the slowest path since it involves
  * a call to the page allocator and the setup of a new slab.
  */
 static void *__slab_alloc(struct kmem_cache *s,
-		gfp_t gfpflags, int node, void *addr, struct kmem_cache_cpu *c)
+		gfp_t gfpflags, int node, void *addr)
 {
 	void **object;
 	struct page *new;
+	struct kmem_cache_cpu *c;
+	unsigned long flags;
 
 	/* We handle __GFP_ZERO in the caller */
 	gfpflags &= ~__GFP_ZERO;
 
+	local_irq_save(flags);
+	c = get_cpu_slab(s, smp_processor_id());
+
 	if (!c->page)
 		goto new_slab;
 
@@ -1529,15 +1676,30 @@ load_freelist:
 	c->page->freelist = NULL;
 	c->node = page_to_nid(c->page);
 unlock_out:
+	c->tid = next_tid(c->tid);
 	slab_unlock(c->page);
 	stat(c, ALLOC_SLOWPATH);
+	local_irq_restore(flags);
 	return object;
 
 another_slab:
 	deactivate_slab(s, c);
 
 new_slab:
-	new = get_partial(s, gfpflags, node);
+	if (!list_empty(&c->partial)) {
+		new = list_entry(c->partial.next, struct page, lru);
+		if (node == -1 || page_to_nid(new) == node) {
+			/* Already frozen, nobody else can get at it */
+			list_del(&new->lru);
+			c->nr_partial--;
+			slab_lock(new);
+			c->page = new;
+			stat(c, CPU_PARTIAL_ALLOC);
+			goto load_freelist;
+		}
+	}
+
+	new = get_partial(s, gfpflags, node, c);
 	if (new) {
 		c->page = new;
 		stat(c, ALLOC_FROM_PARTIAL);
@@ -1562,6 +1724,7 @@ new_slab:
 		c->page = new;
 		goto load_freelist;
 	}
+	local_irq_restore(flags);
 	return NULL;
 debug:
 	if (!alloc_debug_processing(s, c->page, object, addr))
@@ -1581,29 +1744,43 @@ debug:
  * The fastpath works by first checking if the lockless freelist can be used.
  * If not then __slab_alloc is called for slow processing.
  *
- * Otherwise we can simply pick the next object from the lockless free list.
+ * Otherwise we can simply pick the next object from the lockless free list,
+ * with a cmpxchg of the freelist and transaction id instead of disabling
+ * interrupts.
  */
 static __always_inline void *slab_alloc(struct kmem_cache *s,
 		gfp_t gfpflags, int node, void *addr)
 {
 	void **object;
 	struct kmem_cache_cpu *c;
-	unsigned long flags;
+	unsigned long tid;
 	unsigned int objsize;
 
-	local_irq_save(flags);
+redo:
+	preempt_disable();
 	c = get_cpu_slab(s, smp_processor_id());
-	objsize = c->objsize;
-	if (unlikely(!c->freelist || !node_match(c, node)))
-
-		object = __slab_alloc(s, gfpflags, node, addr, c);
+	/*
+	 * The transaction id has to be read before the freelist, so that
+	 * the cmpxchg fails if an interrupt got in between.
+	 */
+	tid = c->tid;
+	barrier();
 
-	else {
-		object = c->freelist;
-		c->freelist = object[c->offset];
+	objsize = c->objsize;
+	object = c->freelist;
+	if (unlikely(!object || !node_match(c, node))) {
+		preempt_enable();
+		object = __slab_alloc(s, gfpflags, node, addr);
+	} else {
+		if (unlikely(!cpu_freelist_cmpxchg(c, object, tid,
+					get_freepointer_safe(c, object)))) {
+			stat(c, CMPXCHG_DOUBLE_CPU_FAIL);
+			preempt_enable();
+			goto redo;
+		}
 		stat(c, ALLOC_FASTPATH);
+		preempt_enable();
 	}
-	local_irq_restore(flags);
 
 	if (unlikely((gfpflags & __GFP_ZERO) && object))
 		memset(object, 0, objsize);
@@ -1631,7 +1808,9 @@ EXPORT_SYMBOL(kmem_cache_alloc_node);
  *
  * So we still attempt to reduce cache line usage. Just take the slab
  * lock and free the item. If there is no additional partial page
- * handling required then we can return immediately.
+ * handling required then we can return immediately.  A slab that was
+ * full goes onto the cpu partial list rather than the node partial list,
+ * so that we need not take the list_lock for it.
  */
 static void __slab_free(struct kmem_cache *s, struct page *page,
 				void *x, void *addr, unsigned int offset)
@@ -1639,8 +1818,10 @@ static void __slab_free(struct kmem_cache *s, struct page *page,
 	void *prior;
 	void **object = (void *)x;
 	struct kmem_cache_cpu *c;
+	unsigned long flags;
 
-	c = get_cpu_slab(s, raw_smp_processor_id());
+	local_irq_save(flags);
+	c = get_cpu_slab(s, smp_processor_id());
 	stat(c, FREE_SLOWPATH);
 	slab_lock(page);
 
@@ -1665,12 +1846,24 @@ checks_ok:
 	 * then add it.
 	 */
 	if (unlikely(!prior)) {
+		if (s->cpu_partial && !(SLABDEBUG && PageSlubDebug(page))) {
+			__SetPageSlubFrozen(page);
+			list_add(&page->lru, &c->partial);
+			c->nr_partial++;
+			stat(c, CPU_PARTIAL_FREE);
+			slab_unlock(page);
+			if (c->nr_partial > s->cpu_partial)
+				unfreeze_partials(s, c);
+			goto out;
+		}
 		add_partial(get_node(s, page_to_nid(page)), page, 1);
 		stat(c, FREE_ADD_PARTIAL);
 	}
 
 out_unlock:
 	slab_unlock(page);
+out:
+	local_irq_restore(flags);
 	return;
 
 slab_empty:
@@ -1684,6 +1877,7 @@ slab_empty:
 	slab_unlock(page);
 	stat(c, FREE_SLAB);
 	discard_slab(s, page);
+	local_irq_restore(flags);
 	return;
 
 debug:
@@ -1698,7 +1892,8 @@ debug:
  *
  * The fastpath is only possible if we are freeing to the current cpu slab
  * of this processor. This typically the case if we have just allocated
- * the item before.
+ * the item before.  Like the allocation fastpath it does not disable
+ * interrupts, but relies on the transaction id to catch them.
  *
  * If fastpath is not possible then fall back to __slab_free where we deal
  * with all sorts of special processing.
@@ -1708,21 +1903,32 @@ static __always_inline void slab_free(struct kmem_cache *s,
 {
 	void **object = (void *)x;
 	struct kmem_cache_cpu *c;
-	unsigned long flags;
+	unsigned long tid;
 
-	local_irq_save(flags);
-	c = get_cpu_slab(s, smp_processor_id());
-	debug_check_no_locks_freed(object, c->objsize);
+	debug_check_no_locks_freed(object, s->objsize);
 	if (!(s->flags & SLAB_DEBUG_OBJECTS))
 		debug_check_no_obj_freed(object, s->objsize);
+
+redo:
+	preempt_disable();
+	c = get_cpu_slab(s, smp_processor_id());
+	tid = c->tid;
+	barrier();
+
 	if (likely(page == c->page && c->node >= 0)) {
-		object[c->offset] = c->freelist;
-		c->freelist = object;
+		void **freelist = c->freelist;
+
+		object[c->offset] = freelist;
+		if (unlikely(!cpu_freelist_cmpxchg(c, freelist, tid, object))) {
+			stat(c, CMPXCHG_DOUBLE_CPU_FAIL);
+			preempt_enable();
+			goto redo;
+		}
 		stat(c, FREE_FASTPATH);
 	} else
 		__slab_free(s, page, x, addr, c->offset);
 
-	local_irq_restore(flags);
+	preempt_enable();
 }
 
 void kmem_cache_free(struct kmem_cache *s, void *x)
@@ -1906,9 +2112,12 @@ static void init_kmem_cache_cpu(struct kmem_cache *s,
 {
 	c->page = NULL;
 	c->freelist = NULL;
+	c->tid = 0;
 	c->node = 0;
 	c->offset = s->offset / sizeof(void *);
 	c->objsize = s->objsize;
+	c->nr_partial = 0;
+	INIT_LIST_HEAD(&c->partial);
 #ifdef CONFIG_SLUB_STATS
 	memset(c->stat, 0, NR_SLUB_STAT_ITEMS * sizeof(unsigned));
 #endif
@@ -2312,6 +2521,20 @@ static int kmem_cache_open(struct kmem_cache *s, gfp_t gfpflags,
 	if (!calculate_sizes(s, -1))
 		goto error;
 
+	/*
+	 * The number of slabs a cpu may keep frozen on its partial list.
+	 * Debugging needs every free to go through the slowpath, and larger
+	 * objects pin more memory per slab, so keep fewer of those.
+	 */
+	if (s->flags & (DEBUG_DEFAULT_FLAGS | SLAB_TRACE))
+		s->cpu_partial = 0;
+	else if (s->size >= PAGE_SIZE)
+		s->cpu_partial = 2;
+	else if (s->size >= 1024)
+		s->cpu_partial = 4;
+	else
+		s->cpu_partial = 6;
+
 	s->refcount = 1;
 #ifdef CONFIG_NUMA
 	s->remote_node_defrag_ratio = 1000;
@@ -2729,6 +2952,7 @@ size_t ksize(const void *object)
 	 */
 	return s->size;
 }
+EXPORT_SYMBOL(ksize);
 
 void kfree(const void *x)
 {
@@ -3817,6 +4041,30 @@ static ssize_t order_show(struct kmem_cache *s, char *buf)
 }
 SLAB_ATTR(order);
 
+static ssize_t cpu_partial_show(struct kmem_cache *s, char *buf)
+{
+	return sprintf(buf, "%d\n", s->cpu_partial);
+}
+
+static ssize_t cpu_partial_store(struct kmem_cache *s, const char *buf,
+				 size_t length)
+{
+	unsigned long slabs;
+	int err;
+
+	err = strict_strtoul(buf, 10, &slabs);
+	if (err)
+		return err;
+
+	if (slabs && (s->flags & (DEBUG_DEFAULT_FLAGS | SLAB_TRACE)))
+		return -EINVAL;
+
+	s->cpu_partial = slabs;
+	flush_all(s);
+	return length;
+}
+SLAB_ATTR(cpu_partial);
+
 static ssize_t ctor_show(struct kmem_cache *s, char *buf)
 {
 	if (s->ctor) {
@@ -4125,6 +4373,11 @@ STAT_ATTR(DEACTIVATE_TO_HEAD, deactivate_to_head);
 STAT_ATTR(DEACTIVATE_TO_TAIL, deactivate_to_tail);
 STAT_ATTR(DEACTIVATE_REMOTE_FREES, deactivate_remote_frees);
 STAT_ATTR(ORDER_FALLBACK, order_fallback);
+STAT_ATTR(CMPXCHG_DOUBLE_CPU_FAIL, cmpxchg_double_cpu_fail);
+STAT_ATTR(CPU_PARTIAL_ALLOC, cpu_partial_alloc);
+STAT_ATTR(CPU_PARTIAL_FREE, cpu_partial_free);
+STAT_ATTR(CPU_PARTIAL_NODE, cpu_partial_node);
+STAT_ATTR(CPU_PARTIAL_DRAIN, cpu_partial_drain);
 #endif
 
 static struct attribute *slab_attrs[] = {
@@ -4132,6 +4385,7 @@ static struct attribute *slab_attrs[] = {
 	&object_size_attr.attr,
 	&objs_per_slab_attr.attr,
 	&order_attr.attr,
+	&cpu_partial_attr.attr,
 	&objects_attr.attr,
 	&objects_partial_attr.attr,
 	&total_objects_attr.attr,
@@ -4178,6 +4432,11 @@ static struct attribute *slab_attrs[] = {
 	&deactivate_to_tail_attr.attr,
 	&deactivate_remote_frees_attr.attr,
 	&order_fallback_attr.attr,
+	&cmpxchg_double_cpu_fail_attr.attr,
+	&cpu_partial_alloc_attr.attr,
+	&cpu_partial_free_attr.attr,
+	&cpu_partial_node_attr.attr,
+	&cpu_partial_drain_attr.attr,
 #endif
 	NULL
 };
@@ -28,6 +28,8 @@
 #include <linux/capability.h>
 #include <linux/syscalls.h>
 #include <linux/memcontrol.h>
+#include <linux/ksm.h>
+#include <linux/zswap.h>
 
 #include <asm/pgtable.h>
 #include <asm/tlbflush.h>
@@ -286,6 +288,13 @@ static int swap_entry_free(struct swap_info_struct *p, unsigned long offset)
 				swap_list.next = p - swap_info;
 			nr_swap_pages++;
 			p->inuse_pages--;
+			zswap_invalidate(p - swap_info, offset);
+			if (p->flags & SWP_BLKDEV) {
+				struct gendisk *disk = p->bdev->bd_disk;
+				if (disk->fops->swap_slot_free_notify)
+					disk->fops->swap_slot_free_notify(
+							p->bdev, offset);
+			}
 		}
 	}
 	return count;
@@ -334,6 +343,9 @@ int can_share_swap_page(struct page *page)
 	int count;
 
 	BUG_ON(!PageLocked(page));
+	/* A KSM page is never written in place, however few map it */
+	if (unlikely(PageKsm(page)))
+		return 0;
 	count = page_mapcount(page);
 	if (count <= 1 && PageSwapCache(page))
 		count += page_swapcount(page);
@@ -608,8 +620,12 @@ static inline int unuse_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
-		if (pmd_none_or_clear_bad(pmd))
+		/* a huge pmd never maps swap entries */
+		if (pmd_none_or_trans_huge_or_clear_bad(pmd))
 			continue;
+		/* the entry may be in there only once for several mms */
+		if (unshare_pte_table(vma, pmd, addr))
+			return -ENOMEM;
 		ret = unuse_pte_range(vma, pmd, addr, next, entry, page);
 		if (ret)
 			return ret;
@@ -644,7 +660,7 @@ static int unuse_vma(struct vm_area_struct *vma,
 	unsigned long addr, end, next;
 	int ret;
 
-	if (page->mapping) {
+	if (page->mapping && !PageKsm(page)) {
 		addr = page_address_in_vma(page, vma);
 		if (addr == -EFAULT)
 			return 0;
@@ -1341,6 +1357,7 @@ SYSCALL_DEFINE1(swapoff, const char __user *, specialfile)
 	p->swap_map = NULL;
 	p->flags = 0;
 	spin_unlock(&swap_lock);
+	zswap_swapoff(type);
 	mutex_unlock(&swapon_mutex);
 	vfree(swap_map);
 	inode = mapping->host;
@@ -1549,6 +1566,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 		if (error < 0)
 			goto bad_swap;
 		p->bdev = bdev;
+		p->flags |= SWP_BLKDEV;
 	} else if (S_ISREG(inode->i_mode)) {
 		p->bdev = inode->i_sb->s_bdev;
 		mutex_lock(&inode->i_mutex);
@@ -1696,7 +1714,7 @@ SYSCALL_DEFINE2(swapon, const char __user *, specialfile, int, swap_flags)
 	else
 		p->prio = --least_priority;
 	p->swap_map = swap_map;
-	p->flags = SWP_ACTIVE;
+	p->flags |= SWP_WRITEOK;
 	nr_swap_pages += nr_good_pages;
 	total_swap_pages += nr_good_pages;
 
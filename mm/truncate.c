@@ -135,6 +135,37 @@ invalidate_complete_page(struct address_space *mapping, struct page *page)
 	return ret;
 }
 
+/*
+ * Drop the shadow entries that reclaim left in the range for evicted pages:
+ * nothing is going to refault there any more.
+ */
+static void clear_shadow_entries(struct address_space *mapping,
+				 pgoff_t start, pgoff_t end)
+{
+	void *entries[PAGEVEC_SIZE];
+	unsigned long indices[PAGEVEC_SIZE];
+	pgoff_t next = start;
+	unsigned int i, nr;
+
+	while (next <= end && mapping->nrshadows) {
+		spin_lock_irq(&mapping->tree_lock);
+		nr = radix_tree_gang_lookup_exceptional(&mapping->page_tree,
+					entries, indices, next, PAGEVEC_SIZE);
+		for (i = 0; i < nr && indices[i] <= end; i++) {
+			radix_tree_delete(&mapping->page_tree, indices[i]);
+			mapping->nrshadows--;
+		}
+		workingset_shadows_dropped(i);
+		spin_unlock_irq(&mapping->tree_lock);
+		if (i < PAGEVEC_SIZE)
+			break;
+		next = indices[i - 1] + 1;
+		if (next == 0)
+			break;
+		cond_resched();
+	}
+}
+
 /**
  * truncate_inode_pages - truncate range of pages specified by start & end byte offsets
  * @mapping: mapping to truncate
@@ -168,7 +199,7 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	pgoff_t next;
 	int i;
 
-	if (mapping->nrpages == 0)
+	if (mapping->nrpages == 0 && mapping->nrshadows == 0)
 		return;
 
 	BUG_ON((lend & (PAGE_CACHE_SIZE - 1)) != (PAGE_CACHE_SIZE - 1));
@@ -251,6 +282,12 @@ void truncate_inode_pages_range(struct address_space *mapping,
 		}
 		pagevec_release(&pvec);
 	}
+
+	/*
+	 * Reclaim may have raced with us and left shadow entries for pages
+	 * it evicted meanwhile, so only now clear them out.
+	 */
+	clear_shadow_entries(mapping, start, end);
 }
 EXPORT_SYMBOL(truncate_inode_pages_range);
 
@@ -282,6 +319,7 @@ unsigned long __invalidate_mapping_pages(struct address_space *mapping,
 			struct page *page = pvec.pages[i];
 			pgoff_t index;
 			int lock_failed;
+			int invalidated;
 
 			lock_failed = !trylock_page(page);
 
@@ -298,13 +336,20 @@ unsigned long __invalidate_mapping_pages(struct address_space *mapping,
 			if (lock_failed)
 				continue;
 
-			if (PageDirty(page) || PageWriteback(page))
-				goto unlock;
-			if (page_mapped(page))
-				goto unlock;
-			ret += invalidate_complete_page(mapping, page);
-unlock:
+			if (PageDirty(page) || PageWriteback(page) ||
+			    page_mapped(page))
+				invalidated = 0;
+			else
+				invalidated = invalidate_complete_page(mapping,
+								       page);
 			unlock_page(page);
+			/*
+			 * A page we could not drop now should at least be the
+			 * first to go when reclaim comes around.
+			 */
+			if (!invalidated)
+				deactivate_page(page);
+			ret += invalidated;
 			if (next > end)
 				break;
 		}
@@ -357,7 +402,7 @@ invalidate_complete_page2(struct address_space *mapping, struct page *page)
 
 	clear_page_mlock(page);
 	BUG_ON(PagePrivate(page));
-	__remove_from_page_cache(page);
+	__remove_from_page_cache(page, NULL);
 	spin_unlock_irq(&mapping->tree_lock);
 	page_cache_release(page);	/* pagecache ref */
 	return 1;
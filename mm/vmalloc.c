@@ -256,6 +256,18 @@ static DEFINE_SPINLOCK(vmap_area_lock);
 static struct rb_root vmap_area_root = RB_ROOT;
 static LIST_HEAD(vmap_area_list);
 
+/*
+ * The vmap cache globals are protected by vmap_area_lock.  free_vmap_cache
+ * is the area most recently allocated, or the one below the most recently
+ * freed area, and the search for a new area starts there instead of at
+ * vstart.  cached_hole_size is the largest hole seen below it, so that a
+ * request that would fit into such a hole still goes back to vstart.
+ */
+static struct rb_node *free_vmap_cache;
+static unsigned long cached_hole_size;
+static unsigned long cached_vstart;
+static unsigned long cached_align;
+
 static struct vmap_area *__find_vmap_area(unsigned long addr)
 {
 	struct rb_node *n = vmap_area_root.rb_node;
@@ -318,7 +330,7 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 				unsigned long vstart, unsigned long vend,
 				int node, gfp_t gfp_mask)
 {
-	struct vmap_area *va;
+	struct vmap_area *va, *first;
 	struct rb_node *n;
 	unsigned long addr;
 	int purged = 0;
@@ -331,50 +343,64 @@ static struct vmap_area *alloc_vmap_area(unsigned long size,
 		return ERR_PTR(-ENOMEM);
 
 retry:
-	addr = ALIGN(vstart, align);
-
 	spin_lock(&vmap_area_lock);
-	/* XXX: could have a last_hole cache */
-	n = vmap_area_root.rb_node;
-	if (n) {
-		struct vmap_area *first = NULL;
+	/*
+	 * Invalidate the cache if we have more permissive parameters than
+	 * the search that left it, or if the request fits into a hole below.
+	 */
+	if (!free_vmap_cache ||
+			size <= cached_hole_size ||
+			vstart < cached_vstart ||
+			align < cached_align) {
+nocache:
+		cached_hole_size = 0;
+		free_vmap_cache = NULL;
+	}
+	cached_vstart = vstart;
+	cached_align = align;
+
+	/* find starting point for our search */
+	if (free_vmap_cache) {
+		first = rb_entry(free_vmap_cache, struct vmap_area, rb_node);
+		addr = ALIGN(first->va_end + PAGE_SIZE, align);
+		if (addr < vstart)
+			goto nocache;
+	} else {
+		addr = ALIGN(vstart, align);
 
-		do {
+		n = vmap_area_root.rb_node;
+		first = NULL;
+		while (n) {
 			struct vmap_area *tmp;
+
 			tmp = rb_entry(n, struct vmap_area, rb_node);
 			if (tmp->va_end >= addr) {
-				if (!first && tmp->va_start < addr + size)
-					first = tmp;
-				n = n->rb_left;
-			} else {
 				first = tmp;
+				if (tmp->va_start <= addr)
+					break;
+				n = n->rb_left;
+			} else
 				n = n->rb_right;
-			}
-		} while (n);
+		}
 
 		if (!first)
 			goto found;
+	}
 
-		if (first->va_end < addr) {
-			n = rb_next(&first->rb_node);
-			if (n)
-				first = rb_entry(n, struct vmap_area, rb_node);
-			else
-				goto found;
-		}
-
-		while (addr + size > first->va_start && addr + size <= vend) {
-			addr = ALIGN(first->va_end + PAGE_SIZE, align);
+	/* from the starting point, walk areas until a suitable hole is found */
+	while (addr + size > first->va_start && addr + size <= vend) {
+		if (addr + cached_hole_size < first->va_start)
+			cached_hole_size = first->va_start - addr;
+		addr = ALIGN(first->va_end + PAGE_SIZE, align);
 
-			n = rb_next(&first->rb_node);
-			if (n)
-				first = rb_entry(n, struct vmap_area, rb_node);
-			else
-				goto found;
-		}
+		n = rb_next(&first->rb_node);
+		if (n)
+			first = rb_entry(n, struct vmap_area, rb_node);
+		else
+			goto found;
 	}
 found:
-	if (addr + size > vend) {
+	if (addr + size > vend || addr + size < addr) {
 		spin_unlock(&vmap_area_lock);
 		if (!purged) {
 			purge_vmap_area_lazy();
@@ -384,6 +410,7 @@ found:
 		if (printk_ratelimit())
 			printk(KERN_WARNING "vmap allocation failed: "
 				 "use vmalloc=<size> to increase size.\n");
+		kfree(va);
 		return ERR_PTR(-EBUSY);
 	}
 
@@ -393,6 +420,7 @@ found:
 	va->va_end = addr + size;
 	va->flags = 0;
 	__insert_vmap_area(va);
+	free_vmap_cache = &va->rb_node;
 	spin_unlock(&vmap_area_lock);
 
 	return va;
@@ -408,6 +436,24 @@ static void rcu_free_va(struct rcu_head *head)
 static void __free_vmap_area(struct vmap_area *va)
 {
 	BUG_ON(RB_EMPTY_NODE(&va->rb_node));
+
+	if (free_vmap_cache) {
+		if (va->va_end < cached_vstart) {
+			free_vmap_cache = NULL;
+		} else {
+			struct vmap_area *cache;
+
+			cache = rb_entry(free_vmap_cache,
+					 struct vmap_area, rb_node);
+			/*
+			 * Restart the next search below the hole we are
+			 * making.  cached_hole_size and cached_align are
+			 * left alone, which costs at most a longer walk.
+			 */
+			if (va->va_start <= cache->va_start)
+				free_vmap_cache = rb_prev(&va->rb_node);
+		}
+	}
 	rb_erase(&va->rb_node, &vmap_area_root);
 	RB_CLEAR_NODE(&va->rb_node);
 	list_del_rcu(&va->list);
@@ -461,7 +507,9 @@ static unsigned long lazy_max_pages(void)
 static atomic_t vmap_lazy_nr = ATOMIC_INIT(0);
 
 /*
- * Purges all lazily-freed vmap areas.
+ * Purges all lazily-freed vmap areas.  Their page tables were already
+ * cleared when they were freed, so all that is left to do is one TLB
+ * flush covering all of them before their address space is reused.
  *
  * If sync is 0 then don't purge if there is already a purge in progress.
  * If force_flush is 1, then flush kernel TLBs between *start and *end even
@@ -497,7 +545,6 @@ static void __purge_vmap_area_lazy(unsigned long *start, unsigned long *end,
 			if (va->va_end > *end)
 				*end = va->va_end;
 			nr += (va->va_end - va->va_start) >> PAGE_SHIFT;
-			unmap_vmap_area(va);
 			list_add_tail(&va->purge_list, &valist);
 			va->flags |= VM_LAZY_FREEING;
 			va->flags &= ~VM_LAZY_FREE;
@@ -544,10 +591,11 @@ static void purge_vmap_area_lazy(void)
 }
 
 /*
- * Free and unmap a vmap area, caller ensuring flush_cache_vunmap had been
- * called for the correct range previously.
+ * Free a vmap area whose page tables have already been cleared.  The
+ * TLB flush, and with it the reuse of the address space, is deferred
+ * until enough lazily freed areas have accumulated.
  */
-static void free_unmap_vmap_area_noflush(struct vmap_area *va)
+static void free_vmap_area_noflush(struct vmap_area *va)
 {
 	va->flags |= VM_LAZY_FREE;
 	atomic_add((va->va_end - va->va_start) >> PAGE_SHIFT, &vmap_lazy_nr);
@@ -555,6 +603,18 @@ static void free_unmap_vmap_area_noflush(struct vmap_area *va)
 		try_purge_vmap_area_lazy();
 }
 
+/*
+ * Free and unmap a vmap area, caller ensuring flush_cache_vunmap had been
+ * called for the correct range previously.  The page tables are cleared
+ * right away, so that nothing can access the pages through this mapping
+ * any more; only stale TLB entries are left behind until the purge.
+ */
+static void free_unmap_vmap_area_noflush(struct vmap_area *va)
+{
+	unmap_vmap_area(va);
+	free_vmap_area_noflush(va);
+}
+
 /*
  * Free and unmap a vmap area
  */
@@ -628,15 +688,11 @@ struct vmap_block {
 	struct vmap_area *va;
 	struct vmap_block_queue *vbq;
 	unsigned long free, dirty;
+	unsigned long dirty_min, dirty_max; /* Range not yet TLB flushed */
 	DECLARE_BITMAP(alloc_map, VMAP_BBMAP_BITS);
-	DECLARE_BITMAP(dirty_map, VMAP_BBMAP_BITS);
-	union {
-		struct {
-			struct list_head free_list;
-			struct list_head dirty_list;
-		};
-		struct rcu_head rcu_head;
-	};
+	struct list_head free_list;
+	struct list_head dirty_list;	/* RCU walked by vm_unmap_aliases */
+	struct rcu_head rcu_head;
 };
 
 /* Queue of free and dirty vmap blocks, for allocation and flushing purposes */
@@ -698,8 +754,9 @@ static struct vmap_block *new_vmap_block(gfp_t gfp_mask)
 	vb->va = va;
 	vb->free = VMAP_BBMAP_BITS;
 	vb->dirty = 0;
+	vb->dirty_min = VMAP_BBMAP_BITS;
+	vb->dirty_max = 0;
 	bitmap_zero(vb->alloc_map, VMAP_BBMAP_BITS);
-	bitmap_zero(vb->dirty_map, VMAP_BBMAP_BITS);
 	INIT_LIST_HEAD(&vb->free_list);
 	INIT_LIST_HEAD(&vb->dirty_list);
 
@@ -735,8 +792,8 @@ static void free_vmap_block(struct vmap_block *vb)
 	spin_lock(&vb->vbq->lock);
 	if (!list_empty(&vb->free_list))
 		list_del(&vb->free_list);
-	if (!list_empty(&vb->dirty_list))
-		list_del(&vb->dirty_list);
+	/* Only a fully dirty block is freed, so it is on the dirty list */
+	list_del_rcu(&vb->dirty_list);
 	spin_unlock(&vb->vbq->lock);
 
 	vb_idx = addr_to_vb_idx(vb->va->va_start);
@@ -745,7 +802,7 @@ static void free_vmap_block(struct vmap_block *vb)
 	spin_unlock(&vmap_block_tree_lock);
 	BUG_ON(tmp != vb);
 
-	free_unmap_vmap_area_noflush(vb->va);
+	free_vmap_area_noflush(vb->va);
 	call_rcu(&vb->rcu_head, rcu_free_vb);
 }
 
@@ -813,6 +870,7 @@ static void vb_free(const void *addr, unsigned long size)
 	order = get_order(size);
 
 	offset = (unsigned long)addr & (VMAP_BLOCK_SIZE - 1);
+	offset >>= PAGE_SHIFT;
 
 	vb_idx = addr_to_vb_idx((unsigned long)addr);
 	rcu_read_lock();
@@ -820,11 +878,17 @@ static void vb_free(const void *addr, unsigned long size)
 	rcu_read_unlock();
 	BUG_ON(!vb);
 
+	vunmap_page_range((unsigned long)addr, (unsigned long)addr + size);
+
 	spin_lock(&vb->lock);
-	bitmap_allocate_region(vb->dirty_map, offset >> PAGE_SHIFT, order);
+
+	/* Expand dirty range */
+	vb->dirty_min = min(vb->dirty_min, offset);
+	vb->dirty_max = max(vb->dirty_max, offset + (1UL << order));
+
 	if (!vb->dirty) {
 		spin_lock(&vb->vbq->lock);
-		list_add(&vb->dirty_list, &vb->vbq->dirty);
+		list_add_rcu(&vb->dirty_list, &vb->vbq->dirty);
 		spin_unlock(&vb->vbq->lock);
 	}
 	vb->dirty += 1UL << order;
@@ -863,30 +927,23 @@ void vm_unmap_aliases(void)
 		struct vmap_block *vb;
 
 		rcu_read_lock();
-		list_for_each_entry_rcu(vb, &vbq->free, free_list) {
-			int i;
-
+		list_for_each_entry_rcu(vb, &vbq->dirty, dirty_list) {
 			spin_lock(&vb->lock);
-			i = find_first_bit(vb->dirty_map, VMAP_BBMAP_BITS);
-			while (i < VMAP_BBMAP_BITS) {
+			if (vb->dirty_max > vb->dirty_min) {
 				unsigned long s, e;
-				int j;
-				j = find_next_zero_bit(vb->dirty_map,
-					VMAP_BBMAP_BITS, i);
 
-				s = vb->va->va_start + (i << PAGE_SHIFT);
-				e = vb->va->va_start + (j << PAGE_SHIFT);
-				vunmap_page_range(s, e);
-				flush = 1;
+				s = vb->va->va_start +
+					(vb->dirty_min << PAGE_SHIFT);
+				e = vb->va->va_start +
+					(vb->dirty_max << PAGE_SHIFT);
 
-				if (s < start)
-					start = s;
-				if (e > end)
-					end = e;
+				start = min(s, start);
+				end = max(e, end);
 
-				i = j;
-				i = find_next_bit(vb->dirty_map,
-							VMAP_BBMAP_BITS, i);
+				/* The purge below flushes this range */
+				vb->dirty_min = VMAP_BBMAP_BITS;
+				vb->dirty_max = 0;
+				flush = 1;
 			}
 			spin_unlock(&vb->lock);
 		}
@@ -986,6 +1043,25 @@ void __init vmalloc_init(void)
 	vmap_initialized = true;
 }
 
+/**
+ * map_kernel_range - map kernel VM area with the specified pages
+ * @addr: start of the VM area to map
+ * @size: size of the VM area to map
+ * @prot: page protection flags to use
+ * @pages: pages to map
+ *
+ * Map PFN_UP(@size) pages at @addr, which must lie in an area obtained
+ * from get_vm_area() or its friends.  Unlike map_vm_area() this can map
+ * any part of the area, so the caller can leave holes in it.
+ *
+ * Returns the number of pages mapped on success, -errno on failure.
+ */
+int map_kernel_range(unsigned long addr, unsigned long size,
+		     pgprot_t prot, struct page **pages)
+{
+	return vmap_page_range(addr, addr + size, prot, pages);
+}
+
 void unmap_kernel_range(unsigned long addr, unsigned long size)
 {
 	unsigned long end = addr + size;
@@ -393,9 +393,11 @@ static pageout_t pageout(struct page *page, struct address_space *mapping,
 
 /*
  * Same as remove_mapping, but if the page is removed from the mapping, it
- * gets returned with a refcount of 0.
+ * gets returned with a refcount of 0.  A page cache page that is @reclaimed
+ * leaves a shadow entry behind, to detect its refault.
  */
-static int __remove_mapping(struct address_space *mapping, struct page *page)
+static int __remove_mapping(struct address_space *mapping, struct page *page,
+			    int reclaimed)
 {
 	BUG_ON(!PageLocked(page));
 	BUG_ON(mapping != page_mapping(page));
@@ -440,7 +442,11 @@ static int __remove_mapping(struct address_space *mapping, struct page *page)
 		spin_unlock_irq(&mapping->tree_lock);
 		swap_free(swap);
 	} else {
-		__remove_from_page_cache(page);
+		void *shadow = NULL;
+
+		if (reclaimed && page_is_file_cache(page))
+			shadow = workingset_eviction(mapping, page);
+		__remove_from_page_cache(page, shadow);
 		spin_unlock_irq(&mapping->tree_lock);
 	}
 
@@ -459,7 +465,7 @@ cannot_free:
  */
 int remove_mapping(struct address_space *mapping, struct page *page)
 {
-	if (__remove_mapping(mapping, page)) {
+	if (__remove_mapping(mapping, page, 0)) {
 		/*
 		 * Unfreezing the refcount with 1 rather than 2 effectively
 		 * drops the pagecache ref for us without requiring another
@@ -732,7 +738,7 @@ static unsigned long shrink_page_list(struct list_head *page_list,
 			}
 		}
 
-		if (!mapping || !__remove_mapping(mapping, page))
+		if (!mapping || !__remove_mapping(mapping, page, 1))
 			goto keep_locked;
 
 		/*
@@ -802,9 +808,10 @@ int __isolate_lru_page(struct page *page, int mode, int file)
 	/*
 	 * When checking the active state, we need to be sure we are
 	 * dealing with comparible boolean values.  Take the logical not
-	 * of each.
+	 * of each.  Pages on the multi-gen LRU count as active while in
+	 * the youngest generations.
 	 */
-	if (mode != ISOLATE_BOTH && (!PageActive(page) != !mode))
+	if (mode != ISOLATE_BOTH && (!is_active_lru(page_lru(page)) != !mode))
 		return ret;
 
 	if (mode != ISOLATE_BOTH && (!page_is_file_cache(page) != !file))
@@ -826,6 +833,7 @@ int __isolate_lru_page(struct page *page, int mode, int file)
 		 * page release code relies on it.
 		 */
 		ClearPageLRU(page);
+		lru_gen_isolate_page(page);
 		ret = 0;
 	}
 
@@ -938,6 +946,131 @@ static unsigned long isolate_lru_pages(unsigned long nr_to_scan,
 	return nr_taken;
 }
 
+#ifdef CONFIG_LRU_GEN
+#ifdef CONFIG_LRU_GEN_ENABLED
+int lru_gen_enabled_flag __read_mostly = 1;
+#else
+int lru_gen_enabled_flag __read_mostly;
+#endif
+
+/* Pages folded into the next generation per hold of the lru_lock */
+#define LRU_GEN_FOLD_BATCH	64
+
+/*
+ * Whether reclaim evicts anon pages at all: if not, nothing but aging
+ * will ever empty the oldest anon generation.
+ */
+static inline int lru_gen_can_swap(void)
+{
+	return nr_swap_pages > 0 && vm_swappiness;
+}
+
+/*
+ * Start a new youngest generation in @zone, with zone->lru_lock held.
+ * min_seq is only moved up by eviction, past the generations it emptied:
+ * while a type still uses all MAX_NR_GENS, no generation is started and
+ * 0 is returned.  Anon pages which cannot be evicted are the exception:
+ * their oldest generation is folded into the next one instead, a batch
+ * of pages at a time, dropping the lock in between.  The generation
+ * which now drops out of the youngest MIN_NR_GENS is moved from the
+ * active to the inactive counts.
+ */
+static int lru_gen_inc_max_seq(struct zone *zone)
+{
+	struct lru_gen *lrugen = &zone->lrugen;
+	struct page *page;
+	unsigned long nr;
+	int file, old, gen, batch;
+
+restart:
+	for (file = 0; file < 2; file++) {
+		while (lrugen->max_seq - lrugen->min_seq[file] + 1 >=
+		       MAX_NR_GENS) {
+			old = lrugen->min_seq[file] % MAX_NR_GENS;
+			if (list_empty(&lrugen->lists[old][file])) {
+				lrugen->min_seq[file]++;
+				continue;
+			}
+			if (file || lru_gen_can_swap())
+				return 0;
+
+			gen = (lrugen->min_seq[file] + 1) % MAX_NR_GENS;
+			for (batch = LRU_GEN_FOLD_BATCH; batch; batch--) {
+				if (list_empty(&lrugen->lists[old][file]))
+					break;
+				/* oldest last: keep the order on the list */
+				page = list_entry(lrugen->lists[old][file].next,
+						  struct page, lru);
+				set_page_lru_gen(page, gen);
+				list_move_tail(&page->lru,
+					       &lrugen->lists[gen][file]);
+				lrugen->nr_pages[old][file]--;
+				lrugen->nr_pages[gen][file]++;
+			}
+			if (!batch) {
+				spin_unlock_irq(&zone->lru_lock);
+				cond_resched();
+				spin_lock_irq(&zone->lru_lock);
+				goto restart;
+			}
+		}
+	}
+
+	gen = (lrugen->max_seq - 1) % MAX_NR_GENS;
+	for (file = 0; file < 2; file++) {
+		nr = lrugen->nr_pages[gen][file];
+		__mod_zone_page_state(zone, NR_ACTIVE_ANON + file * LRU_FILE,
+				      -(long)nr);
+		__mod_zone_page_state(zone, NR_INACTIVE_ANON + file * LRU_FILE,
+				      nr);
+	}
+	lrugen->max_seq++;
+	__count_vm_event(LRU_GEN_AGING);
+	return 1;
+}
+
+/*
+ * Take pages from the oldest generation of this type which has any,
+ * moving min_seq up past empty ones.  When only the youngest MIN_NR_GENS
+ * are left, start a new generation here rather than wait for kswapd to
+ * age the zone: the pages still get shrink_page_list()'s reference check.
+ * If the other type has no generation to spare, its own eviction has to
+ * make room first.  Called with zone->lru_lock held, which
+ * lru_gen_inc_max_seq() may drop for a moment.
+ */
+static unsigned long lru_gen_isolate_pages(unsigned long nr,
+					   struct list_head *dst,
+					   unsigned long *scanned, int order,
+					   int mode, struct zone *z, int file)
+{
+	struct lru_gen *lrugen = &z->lrugen;
+	int gen, tries = 2 * MAX_NR_GENS;
+
+	*scanned = 0;
+	for (gen = 0; gen < MAX_NR_GENS; gen++)
+		if (lrugen->nr_pages[gen][file])
+			break;
+	if (gen == MAX_NR_GENS)
+		return 0;
+
+	for (;;) {
+		gen = lrugen->min_seq[file] % MAX_NR_GENS;
+		if (lrugen->min_seq[file] + MIN_NR_GENS > lrugen->max_seq) {
+			if (!lru_gen_inc_max_seq(z))
+				return 0;
+		} else if (list_empty(&lrugen->lists[gen][file]))
+			lrugen->min_seq[file]++;
+		else
+			break;
+		if (!--tries)
+			return 0;
+	}
+
+	return isolate_lru_pages(nr, &lrugen->lists[gen][file], dst, scanned,
+				 order, mode, file);
+}
+#endif /* CONFIG_LRU_GEN */
+
 static unsigned long isolate_pages_global(unsigned long nr,
 					struct list_head *dst,
 					unsigned long *scanned, int order,
@@ -946,6 +1079,12 @@ static unsigned long isolate_pages_global(unsigned long nr,
 					int active, int file)
 {
 	int lru = LRU_BASE;
+
+#ifdef CONFIG_LRU_GEN
+	if (lru_gen_enabled() && !active)
+		return lru_gen_isolate_pages(nr, dst, scanned, order, mode,
+					     z, !!file);
+#endif
 	if (active)
 		lru += LRU_ACTIVE;
 	if (file)
@@ -1141,7 +1280,7 @@ static unsigned long shrink_inactive_list(unsigned long max_scan,
 			lru = page_lru(page);
 			add_page_to_lru_list(zone, page, lru);
 			mem_cgroup_move_lists(page, lru);
-			if (PageActive(page) && scan_global_lru(sc)) {
+			if (is_active_lru(lru) && scan_global_lru(sc)) {
 				int file = !!page_is_file_cache(page);
 				zone->recent_rotated[file]++;
 			}
@@ -1272,9 +1411,15 @@ static void shrink_active_list(unsigned long nr_pages, struct zone *zone,
 		VM_BUG_ON(!PageActive(page));
 		ClearPageActive(page);
 
-		list_move(&page->lru, &zone->lru[lru].list);
-		mem_cgroup_move_lists(page, lru);
-		pgmoved++;
+		/* Under the multi-gen LRU, only memcg reclaim comes here */
+		list_del(&page->lru);
+		if (lru_gen_add_page(zone, page, lru))
+			pgdeactivate++;
+		else {
+			list_add(&page->lru, &zone->lru[lru].list);
+			pgmoved++;
+		}
+		mem_cgroup_move_lists(page, page_lru(page));
 		if (!pagevec_add(&pvec, page)) {
 			__mod_zone_page_state(zone, NR_LRU_BASE + lru, pgmoved);
 			spin_unlock_irq(&zone->lru_lock);
@@ -1404,6 +1549,285 @@ static void get_scan_ratio(struct zone *zone, struct scan_control *sc,
 	percent[1] = 100 - percent[0];
 }
 
+#ifdef CONFIG_LRU_GEN
+/*
+ * Every mm that has page tables, for kswapd to age.  A walker pins the mm
+ * it is on with mm_users, which keeps it on the list until it moves on.
+ * An mm leaves the list when its last user goes away, or at the latest
+ * when it is freed, for the setup failures that never had a user.
+ */
+static LIST_HEAD(lru_gen_mm_list);
+static DEFINE_SPINLOCK(lru_gen_mm_lock);
+
+void lru_gen_add_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	list_add_tail(&mm->lru_gen_list, &lru_gen_mm_list);
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+void lru_gen_del_mm(struct mm_struct *mm)
+{
+	spin_lock(&lru_gen_mm_lock);
+	list_del_init(&mm->lru_gen_list);
+	spin_unlock(&lru_gen_mm_lock);
+}
+
+#define LRU_GEN_BATCH	32
+
+struct lru_gen_walk {
+	pg_data_t *pgdat;
+	struct vm_area_struct *vma;
+	unsigned long nr_promoted;
+	int nr;
+	struct page *pages[LRU_GEN_BATCH];
+};
+
+/*
+ * Move the young pages the walk collected to the youngest generation of
+ * their zones, taking each lru_lock once for a run of pages in its zone.
+ * No references are held on the pages, so they may have been freed or
+ * isolated meanwhile: only those still on a generation are moved.
+ */
+static void lru_gen_promote_batch(struct lru_gen_walk *args)
+{
+	struct zone *zone = NULL;
+	int i;
+
+	for (i = 0; i < args->nr; i++) {
+		struct page *page = args->pages[i];
+		struct zone *pagezone = page_zone(page);
+		int gen;
+
+		if (pagezone != zone) {
+			if (zone)
+				spin_unlock_irq(&zone->lru_lock);
+			zone = pagezone;
+			spin_lock_irq(&zone->lru_lock);
+		}
+		gen = zone->lrugen.max_seq % MAX_NR_GENS;
+		if (!PageLRU(page) || page_lru_gen(page) < 0 ||
+		    page_lru_gen(page) == gen)
+			continue;
+		lru_gen_move_page(zone, page, gen);
+		args->nr_promoted++;
+	}
+	if (zone)
+		spin_unlock_irq(&zone->lru_lock);
+	args->nr = 0;
+}
+
+static void lru_gen_collect_page(struct lru_gen_walk *args, struct page *page)
+{
+	args->pages[args->nr++] = page;
+	if (args->nr == LRU_GEN_BATCH)
+		lru_gen_promote_batch(args);
+}
+
+static int lru_gen_walk_pte_range(pmd_t *pmd, unsigned long addr,
+				  unsigned long end, struct mm_walk *walk)
+{
+	struct lru_gen_walk *args = walk->private;
+	struct vm_area_struct *vma = args->vma;
+	pte_t *pte;
+	spinlock_t *ptl;
+
+	pte = pte_offset_map_lock(walk->mm, pmd, addr, &ptl);
+	for (; addr != end; pte++, addr += PAGE_SIZE) {
+		struct page *page;
+
+		if (!pte_present(*pte) || !pte_young(*pte))
+			continue;
+		page = vm_normal_page(vma, addr, *pte);
+		if (!page || page_to_nid(page) != args->pgdat->node_id)
+			continue;
+		if (ptep_test_and_clear_young(vma, addr, pte))
+			lru_gen_collect_page(args, page);
+	}
+	pte_unmap_unlock(pte - 1, ptl);
+	cond_resched();
+	return 0;
+}
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/* One accessed bit covers all the pages of a huge pmd: don't split it */
+static int lru_gen_walk_huge_pmd(pmd_t *pmd, unsigned long addr,
+				 unsigned long end, struct mm_walk *walk)
+{
+	struct lru_gen_walk *args = walk->private;
+	struct page *page;
+	int i;
+
+	spin_lock(&walk->mm->page_table_lock);
+	if (likely(pmd_trans_huge(*pmd)) &&
+	    pte_young(pmd_trans_huge_pte(*pmd, 0))) {
+		page = pmd_trans_huge_page(*pmd);
+		if (page_to_nid(page) == args->pgdat->node_id &&
+		    pmdp_trans_huge_test_and_clear_young(pmd)) {
+			for (i = 0; i < HPAGE_PMD_NR; i++)
+				lru_gen_collect_page(args, page + i);
+		}
+	}
+	spin_unlock(&walk->mm->page_table_lock);
+	return 0;
+}
+#endif
+
+static void lru_gen_walk_mm(struct mm_struct *mm, struct lru_gen_walk *args)
+{
+	struct mm_walk walk = {
+		.pmd_entry = lru_gen_walk_pte_range,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+		.huge_pmd_entry = lru_gen_walk_huge_pmd,
+#endif
+		.mm = mm,
+		.private = args,
+	};
+	struct vm_area_struct *vma;
+
+	for (vma = mm->mmap; vma; vma = vma->vm_next) {
+		if (vma->vm_flags & (VM_IO | VM_PFNMAP | VM_HUGETLB |
+				     VM_LOCKED))
+			continue;
+		args->vma = vma;
+		walk_page_range(vma->vm_start, vma->vm_end, &walk);
+	}
+	__count_vm_event(LRU_GEN_MM_WALK);
+}
+
+/*
+ * Age the zones of @pgdat: start a new youngest generation in each, then
+ * walk the page tables of every mm, moving the pages they have used since
+ * the last walk up to it.  Accessed bits are found a page table at a time
+ * this way, instead of one rmap walk per page as shrink_active_list() does.
+ *
+ * Only kswapd walks: mmput() of the last reference to an mm is too much
+ * for direct reclaim, which may hold filesystem locks.
+ */
+static void lru_gen_age_node(pg_data_t *pgdat)
+{
+	struct lru_gen_walk args = { .pgdat = pgdat };
+	struct mm_struct *mm, *prev = NULL;
+	struct list_head *pos = &lru_gen_mm_list;
+	int i;
+
+	for (i = 0; i < pgdat->nr_zones; i++) {
+		struct zone *zone = pgdat->node_zones + i;
+
+		if (!populated_zone(zone))
+			continue;
+		spin_lock_irq(&zone->lru_lock);
+		lru_gen_inc_max_seq(zone);
+		spin_unlock_irq(&zone->lru_lock);
+	}
+
+	spin_lock(&lru_gen_mm_lock);
+	while ((pos = pos->next) != &lru_gen_mm_list) {
+		mm = list_entry(pos, struct mm_struct, lru_gen_list);
+		if (!atomic_inc_not_zero(&mm->mm_users))
+			continue;
+		spin_unlock(&lru_gen_mm_lock);
+
+		if (prev)
+			mmput(prev);
+		prev = mm;
+		if (down_read_trylock(&mm->mmap_sem)) {
+			lru_gen_walk_mm(mm, &args);
+			up_read(&mm->mmap_sem);
+		}
+		cond_resched();
+
+		spin_lock(&lru_gen_mm_lock);
+	}
+	spin_unlock(&lru_gen_mm_lock);
+	if (prev)
+		mmput(prev);
+
+	lru_gen_promote_batch(&args);
+	count_vm_events(LRU_GEN_PROMOTED, args.nr_promoted);
+}
+
+/*
+ * Age once a type with pages is down to its youngest MIN_NR_GENS
+ * generations: reclaim has evicted everything older.  Unlocked, this
+ * is only a hint.
+ */
+static int lru_gen_need_aging(struct zone *zone)
+{
+	struct lru_gen *lrugen = &zone->lrugen;
+	int file, gen;
+
+	for (file = 0; file < 2; file++) {
+		if (lrugen->min_seq[file] + MIN_NR_GENS <= lrugen->max_seq)
+			continue;
+		for (gen = 0; gen < MAX_NR_GENS; gen++)
+			if (lrugen->nr_pages[gen][file])
+				return 1;
+	}
+	return 0;
+}
+
+/*
+ * shrink_zone() for the multi-gen LRU: there is no active list to scan,
+ * the inactive scan evicts from the oldest generations instead.
+ */
+static unsigned long lru_gen_shrink_zone(int priority, struct zone *zone,
+					 struct scan_control *sc)
+{
+	unsigned long nr[2];
+	unsigned long nr_to_scan;
+	unsigned long nr_reclaimed = 0;
+	unsigned long percent[2];	/* anon @ 0; file @ 1 */
+	int file;
+
+	if (lru_gen_need_aging(zone)) {
+		if (current_is_kswapd())
+			lru_gen_age_node(zone->zone_pgdat);
+		else {
+			spin_lock_irq(&zone->lru_lock);
+			lru_gen_inc_max_seq(zone);
+			spin_unlock_irq(&zone->lru_lock);
+		}
+	}
+
+	get_scan_ratio(zone, sc, percent);
+
+	for (file = 0; file < 2; file++) {
+		enum lru_list l = LRU_BASE + file * LRU_FILE;
+		unsigned long scan;
+
+		scan = zone_page_state(zone, NR_LRU_BASE + l) +
+			zone_page_state(zone, NR_LRU_BASE + l + LRU_ACTIVE);
+		if (priority) {
+			scan >>= priority;
+			scan = (scan * percent[file]) / 100;
+		}
+		zone->lru[l].nr_scan += scan;
+		nr[file] = zone->lru[l].nr_scan;
+		if (nr[file] >= sc->swap_cluster_max)
+			zone->lru[l].nr_scan = 0;
+		else
+			nr[file] = 0;
+	}
+
+	while (nr[0] || nr[1]) {
+		for (file = 0; file < 2; file++) {
+			if (nr[file]) {
+				nr_to_scan = min(nr[file],
+					(unsigned long)sc->swap_cluster_max);
+				nr[file] -= nr_to_scan;
+
+				nr_reclaimed += shrink_inactive_list(nr_to_scan,
+						zone, sc, priority, file);
+			}
+		}
+	}
+
+	throttle_vm_writeout(sc->gfp_mask);
+	return nr_reclaimed;
+}
+#endif /* CONFIG_LRU_GEN */
+
 
 /*
  * This is a basic per-zone page freer.  Used by both kswapd and direct reclaim.
@@ -1417,6 +1841,12 @@ static unsigned long shrink_zone(int priority, struct zone *zone,
 	unsigned long percent[2];	/* anon @ 0; file @ 1 */
 	enum lru_list l;
 
+#ifdef CONFIG_LRU_GEN
+	/* Memory controller reclaim stays on the active/inactive scan */
+	if (lru_gen_enabled() && scan_global_lru(sc))
+		return lru_gen_shrink_zone(priority, zone, sc);
+#endif
+
 	get_scan_ratio(zone, sc, percent);
 
 	for_each_evictable_lru(l) {
@@ -1538,10 +1968,10 @@ static unsigned long shrink_zones(int priority, struct zonelist *zonelist,
  *
  * If the caller is !__GFP_FS then the probability of a failure is reasonably
  * high - the zone may be full of dirty or under-writeback pages, which this
- * caller can't do much about.  We kick pdflush and take explicit naps in the
- * hope that some of these pages can be written.  But if the allocating task
- * holds filesystem locks which prevent writeout this might not work, and the
- * allocation attempt will fail.
+ * caller can't do much about.  We kick the flusher threads and take explicit
+ * naps in the hope that some of these pages can be written.  But if the
+ * allocating task holds filesystem locks which prevent writeout this might not
+ * work, and the allocation attempt will fail.
  *
  * returns:	0, if no pages reclaimed
  * 		else, the number of pages reclaimed
@@ -1607,7 +2037,7 @@ static unsigned long do_try_to_free_pages(struct zonelist *zonelist,
 		 */
 		if (total_scanned > sc->swap_cluster_max +
 					sc->swap_cluster_max / 2) {
-			wakeup_pdflush(laptop_mode ? 0 : total_scanned);
+			wakeup_flusher_threads(laptop_mode ? 0 : total_scanned);
 			sc->may_writepage = 1;
 		}
 
@@ -1683,6 +2113,29 @@ unsigned long try_to_free_mem_cgroup_pages(struct mem_cgroup *mem_cont,
 	zonelist = NODE_DATA(numa_node_id())->node_zonelists;
 	return do_try_to_free_pages(zonelist, &sc);
 }
+
+/*
+ * Reclaim the pages of one cgroup from one zone only, for soft limit
+ * reclaim on behalf of kswapd.
+ */
+unsigned long mem_cgroup_shrink_zone(struct mem_cgroup *mem,
+				     struct zone *zone, gfp_t gfp_mask,
+				     int priority)
+{
+	struct scan_control sc = {
+		.may_writepage = !laptop_mode,
+		.may_swap = 1,
+		.swap_cluster_max = SWAP_CLUSTER_MAX,
+		.swappiness = vm_swappiness,
+		.order = 0,
+		.mem_cgroup = mem,
+		.isolate_pages = mem_cgroup_isolate_pages,
+	};
+
+	sc.gfp_mask = (gfp_mask & GFP_RECLAIM_MASK) |
+			(GFP_HIGHUSER_MOVABLE & ~GFP_RECLAIM_MASK);
+	return shrink_zone(priority, zone, &sc);
+}
 #endif
 
 /*
@@ -1766,7 +2219,7 @@ loop_again:
 			 * Do some background aging of the anon list, to give
 			 * pages a chance to be referenced before reclaiming.
 			 */
-			if (inactive_anon_is_low(zone))
+			if (!lru_gen_enabled() && inactive_anon_is_low(zone))
 				shrink_active_list(SWAP_CLUSTER_MAX, zone,
 							&sc, priority, 0);
 
@@ -1811,6 +2264,13 @@ loop_again:
 			temp_priority[i] = priority;
 			sc.nr_scanned = 0;
 			note_zone_scanning_priority(zone, priority);
+
+			/*
+			 * Cgroups over their soft limit give back memory
+			 * before the zone's LRU is scanned.
+			 */
+			nr_reclaimed += mem_cgroup_soft_limit_reclaim(zone,
+						order, sc.gfp_mask, priority);
 			/*
 			 * We put equal pressure on every zone, unless one
 			 * zone has way too many pages free already.
@@ -2392,8 +2852,8 @@ retry:
 		enum lru_list l = LRU_INACTIVE_ANON + page_is_file_cache(page);
 
 		__dec_zone_state(zone, NR_UNEVICTABLE);
-		list_move(&page->lru, &zone->lru[l].list);
-		__inc_zone_state(zone, NR_INACTIVE_ANON + l);
+		list_del(&page->lru);
+		add_page_to_lru_list(zone, page, l);
 		__count_vm_event(UNEVICTABLE_PGRESCUED);
 	} else {
 		/*
@@ -2590,3 +3050,171 @@ void scan_unevictable_unregister_node(struct node *node)
 }
 
 #endif
+
+#ifdef CONFIG_LRU_GEN
+void __meminit lru_gen_init_zone(struct zone *zone)
+{
+	struct lru_gen *lrugen = &zone->lrugen;
+	int gen, file;
+
+	lrugen->max_seq = MAX_NR_GENS - 1;
+	for (file = 0; file < 2; file++) {
+		lrugen->min_seq[file] = 0;
+		for (gen = 0; gen < MAX_NR_GENS; gen++) {
+			INIT_LIST_HEAD(&lrugen->lists[gen][file]);
+			lrugen->nr_pages[gen][file] = 0;
+		}
+	}
+}
+
+static DEFINE_MUTEX(lru_gen_state_mutex);
+
+/*
+ * Move up to @batch pages of @zone from the classic lists to generations,
+ * or back when !@enable: active pages to the youngest generation and
+ * inactive ones to the oldest, and back to the list that generation is
+ * counted in.  Returns 1 once there is nothing left to move.
+ */
+static int lru_gen_switch_zone(struct zone *zone, int enable, int batch)
+{
+	struct lru_gen *lrugen = &zone->lrugen;
+	struct list_head *list;
+	struct page *page;
+	unsigned long seq;
+	enum lru_list l;
+	int file, gen;
+
+	if (enable) {
+		for_each_evictable_lru(l) {
+			file = is_file_lru(l);
+			seq = is_active_lru(l) ? lrugen->max_seq :
+						 lrugen->min_seq[file];
+			gen = seq % MAX_NR_GENS;
+			list = &zone->lru[l].list;
+			while (!list_empty(list)) {
+				if (!batch--)
+					return 0;
+				page = lru_to_page(list);
+				ClearPageActive(page);
+				set_page_lru_gen(page, gen);
+				__dec_zone_state(zone, NR_LRU_BASE + l);
+				lru_gen_update_size(zone, page, gen, 1);
+				list_move(&page->lru, &lrugen->lists[gen][file]);
+			}
+		}
+		return 1;
+	}
+
+	for (file = 0; file < 2; file++) {
+		for (seq = lrugen->min_seq[file]; seq <= lrugen->max_seq; seq++) {
+			gen = seq % MAX_NR_GENS;
+			l = lru_gen_lru(zone, gen, file);
+			list = &lrugen->lists[gen][file];
+			while (!list_empty(list)) {
+				if (!batch--)
+					return 0;
+				page = lru_to_page(list);
+				if (is_active_lru(l))
+					SetPageActive(page);
+				set_page_lru_gen(page, -1);
+				lrugen->nr_pages[gen][file]--;
+				list_move(&page->lru, &zone->lru[l].list);
+			}
+		}
+	}
+	return 1;
+}
+
+static void lru_gen_change_state(int enable)
+{
+	struct zone *zone;
+	int done;
+
+	mutex_lock(&lru_gen_state_mutex);
+	if (enable == lru_gen_enabled_flag)
+		goto out;
+
+	/*
+	 * All generations are empty while disabled: give the classic
+	 * inactive pages MAX_NR_GENS - MIN_NR_GENS old ones to go to.
+	 */
+	if (enable) {
+		for_each_zone(zone) {
+			if (!populated_zone(zone))
+				continue;
+			spin_lock_irq(&zone->lru_lock);
+			zone->lrugen.min_seq[0] = zone->lrugen.min_seq[1] =
+				zone->lrugen.max_seq - MAX_NR_GENS + 1;
+			spin_unlock_irq(&zone->lru_lock);
+		}
+	}
+
+	/*
+	 * Pages come onto the LRU on the new side from now on; each zone's
+	 * existing pages are then moved over a batch at a time, as reclaim
+	 * of those not yet moved can wait.
+	 */
+	lru_gen_enabled_flag = enable;
+	for_each_zone(zone) {
+		if (!populated_zone(zone))
+			continue;
+		do {
+			spin_lock_irq(&zone->lru_lock);
+			done = lru_gen_switch_zone(zone, enable,
+						   SWAP_CLUSTER_MAX * 16);
+			spin_unlock_irq(&zone->lru_lock);
+			cond_resched();
+		} while (!done);
+	}
+out:
+	mutex_unlock(&lru_gen_state_mutex);
+}
+
+static int __init setup_lru_gen(char *str)
+{
+	lru_gen_enabled_flag = !!simple_strtoul(str, NULL, 0);
+	return 1;
+}
+__setup("lru_gen=", setup_lru_gen);
+
+#ifdef CONFIG_SYSFS
+static ssize_t enabled_show(struct kobject *kobj, struct kobj_attribute *attr,
+			    char *buf)
+{
+	return sprintf(buf, "%d\n", lru_gen_enabled_flag);
+}
+
+static ssize_t enabled_store(struct kobject *kobj, struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	unsigned long enable;
+
+	if (strict_strtoul(buf, 10, &enable) || enable > 1)
+		return -EINVAL;
+
+	lru_gen_change_state(enable);
+	return count;
+}
+
+static struct kobj_attribute lru_gen_enabled_attr =
+	__ATTR(enabled, 0644, enabled_show, enabled_store);
+
+static struct attribute *lru_gen_attrs[] = {
+	&lru_gen_enabled_attr.attr,
+	NULL,
+};
+
+static struct attribute_group lru_gen_attr_group = {
+	.attrs = lru_gen_attrs,
+	.name = "lru_gen",
+};
+
+static int __init lru_gen_sysfs_init(void)
+{
+	if (sysfs_create_group(mm_kobj, &lru_gen_attr_group))
+		printk(KERN_ERR "lru_gen: register sysfs failed\n");
+	return 0;
+}
+module_init(lru_gen_sysfs_init)
+#endif /* CONFIG_SYSFS */
+#endif /* CONFIG_LRU_GEN */
@@ -15,6 +15,8 @@
 #include <linux/cpu.h>
 #include <linux/vmstat.h>
 #include <linux/sched.h>
+#include <linux/math64.h>
+#include <linux/compaction.h>
 
 #ifdef CONFIG_VM_EVENT_COUNTERS
 DEFINE_PER_CPU(struct vm_event_state, vm_event_states) = {{0}};
@@ -383,6 +385,73 @@ void zone_statistics(struct zone *preferred_zone, struct zone *z)
 }
 #endif
 
+#if defined(CONFIG_PROC_FS) || defined(CONFIG_COMPACTION)
+struct contig_page_info {
+	unsigned long free_pages;
+	unsigned long free_blocks_total;
+	unsigned long free_blocks_suitable;
+};
+
+/*
+ * Count the free pages of a zone, the free blocks they make up, and how
+ * many of those blocks are big enough for an allocation of
+ * @suitable_order.  Blocks that migrating movable pages could produce
+ * are not considered.
+ */
+static void fill_contig_page_info(struct zone *zone,
+				unsigned int suitable_order,
+				struct contig_page_info *info)
+{
+	unsigned int order;
+
+	info->free_pages = 0;
+	info->free_blocks_total = 0;
+	info->free_blocks_suitable = 0;
+
+	for (order = 0; order < MAX_ORDER; order++) {
+		unsigned long blocks;
+
+		blocks = zone->free_area[order].nr_free;
+		info->free_blocks_total += blocks;
+		info->free_pages += blocks << order;
+
+		if (order >= suitable_order)
+			info->free_blocks_suitable += blocks <<
+						(order - suitable_order);
+	}
+}
+
+/*
+ * A fragmentation index only makes sense if an allocation of a requested
+ * size would fail.  If that is true, it tells whether the failure is due
+ * to a lack of memory (towards 0) or to external fragmentation (towards
+ * 1000).  -1000 means an allocation of @order would succeed.
+ */
+static int __fragmentation_index(unsigned int order,
+				 struct contig_page_info *info)
+{
+	unsigned long requested = 1UL << order;
+
+	if (!info->free_blocks_total)
+		return 0;
+
+	if (info->free_blocks_suitable)
+		return -1000;
+
+	return 1000 - div_u64(1000 + div_u64(info->free_pages * 1000ULL,
+					     requested),
+			      info->free_blocks_total);
+}
+
+int fragmentation_index(struct zone *zone, unsigned int order)
+{
+	struct contig_page_info info;
+
+	fill_contig_page_info(zone, order, &info);
+	return __fragmentation_index(order, &info);
+}
+#endif
+
 #ifdef CONFIG_PROC_FS
 #include <linux/proc_fs.h>
 #include <linux/seq_file.h>
@@ -600,6 +669,122 @@ static const struct file_operations fragmentation_file_operations = {
 	.release	= seq_release,
 };
 
+/*
+ * The unusable free space index: the share of free memory, in thousandths,
+ * that cannot satisfy an allocation of @order.  0 means all of it can,
+ * 1000 means none of it can.
+ */
+static int unusable_free_index(unsigned int order,
+			       struct contig_page_info *info)
+{
+	if (!info->free_pages)
+		return 0;
+
+	return div_u64((info->free_pages -
+			(info->free_blocks_suitable << order)) * 1000ULL,
+		       info->free_pages);
+}
+
+static void unusable_show_print(struct seq_file *m, pg_data_t *pgdat,
+				struct zone *zone)
+{
+	struct contig_page_info info;
+	unsigned int order;
+	int index;
+
+	seq_printf(m, "Node %d, zone %8s ", pgdat->node_id, zone->name);
+	for (order = 0; order < MAX_ORDER; ++order) {
+		fill_contig_page_info(zone, order, &info);
+		index = unusable_free_index(order, &info);
+		seq_printf(m, "%d.%03d ", index / 1000, index % 1000);
+	}
+	seq_putc(m, '\n');
+}
+
+/*
+ * Display the unusable free space index for every order, per zone:
+ * how much of the free memory is too fragmented to be used.
+ */
+static int unusable_show(struct seq_file *m, void *arg)
+{
+	pg_data_t *pgdat = (pg_data_t *)arg;
+
+	/* check memoryless node */
+	if (!node_state(pgdat->node_id, N_HIGH_MEMORY))
+		return 0;
+
+	walk_zones_in_node(m, pgdat, unusable_show_print);
+	return 0;
+}
+
+static const struct seq_operations unusable_op = {
+	.start	= frag_start,
+	.next	= frag_next,
+	.stop	= frag_stop,
+	.show	= unusable_show,
+};
+
+static int unusable_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &unusable_op);
+}
+
+static const struct file_operations unusable_file_ops = {
+	.open		= unusable_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+
+static void extfrag_show_print(struct seq_file *m, pg_data_t *pgdat,
+			       struct zone *zone)
+{
+	struct contig_page_info info;
+	unsigned int order;
+	int index;
+
+	seq_printf(m, "Node %d, zone %8s ", pgdat->node_id, zone->name);
+	for (order = 0; order < MAX_ORDER; ++order) {
+		fill_contig_page_info(zone, order, &info);
+		index = __fragmentation_index(order, &info);
+		seq_printf(m, "%s%d.%03d ", index < 0 ? "-" : "",
+			   abs(index) / 1000, abs(index) % 1000);
+	}
+	seq_putc(m, '\n');
+}
+
+/*
+ * Display the fragmentation index for every order, per zone: whether an
+ * allocation of that order would fail for lack of memory or because of
+ * fragmentation.
+ */
+static int extfrag_show(struct seq_file *m, void *arg)
+{
+	pg_data_t *pgdat = (pg_data_t *)arg;
+
+	walk_zones_in_node(m, pgdat, extfrag_show_print);
+	return 0;
+}
+
+static const struct seq_operations extfrag_op = {
+	.start	= frag_start,
+	.next	= frag_next,
+	.stop	= frag_stop,
+	.show	= extfrag_show,
+};
+
+static int extfrag_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &extfrag_op);
+}
+
+static const struct file_operations extfrag_file_ops = {
+	.open		= extfrag_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= seq_release,
+};
+
 static const struct seq_operations pagetypeinfo_op = {
 	.start	= frag_start,
 	.next	= frag_next,
@@ -663,6 +848,8 @@ static const char * const vmstat_text[] = {
 	"nr_bounce",
 	"nr_vmscan_write",
 	"nr_writeback_temp",
+	"workingset_refault",
+	"workingset_activate",
 
 #ifdef CONFIG_NUMA
 	"numa_hit",
@@ -701,6 +888,14 @@ static const char * const vmstat_text[] = {
 	"allocstall",
 
 	"pgrotated",
+#ifdef CONFIG_COMPACTION
+	"compact_blocks_moved",
+	"compact_pages_moved",
+	"compact_pagemigrate_failed",
+	"compact_stall",
+	"compact_fail",
+	"compact_success",
+#endif
 #ifdef CONFIG_HUGETLB_PAGE
 	"htlb_buddy_alloc_success",
 	"htlb_buddy_alloc_fail",
@@ -715,6 +910,27 @@ static const char * const vmstat_text[] = {
 	"unevictable_pgs_stranded",
 	"unevictable_pgs_mlockfreed",
 #endif
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	"thp_fault_alloc",
+	"thp_fault_fallback",
+	"thp_collapse_alloc",
+	"thp_collapse_alloc_failed",
+	"thp_split",
+#endif
+#ifdef CONFIG_SPECULATIVE_PAGE_FAULT
+	"pgfault_speculative",
+#endif
+#ifdef CONFIG_NUMA_BALANCING
+	"numa_pte_updates",
+	"numa_hint_faults",
+	"numa_hint_faults_local",
+	"numa_pages_migrated",
+#endif
+#ifdef CONFIG_LRU_GEN
+	"lru_gen_aging",
+	"lru_gen_mm_walk",
+	"lru_gen_promoted",
+#endif
 #endif
 };
 
@@ -742,6 +958,13 @@ static void zoneinfo_show_print(struct seq_file *m, pg_data_t *pgdat,
 		   zone->lru[LRU_INACTIVE_FILE].nr_scan,
 		   zone->spanned_pages,
 		   zone->present_pages);
+#ifdef CONFIG_LRU_GEN
+	seq_printf(m,
+		   "\n        lru_gen  %lu (anon: %lu file: %lu)",
+		   zone->lrugen.max_seq,
+		   zone->lrugen.min_seq[0],
+		   zone->lrugen.min_seq[1]);
+#endif
 
 	for (i = 0; i < NR_VM_ZONE_STAT_ITEMS; i++)
 		seq_printf(m, "\n    %-12s %lu", vmstat_text[i],
@@ -961,6 +1184,8 @@ static int __init setup_vmstat(void)
 #ifdef CONFIG_PROC_FS
 	proc_create("buddyinfo", S_IRUGO, NULL, &fragmentation_file_operations);
 	proc_create("pagetypeinfo", S_IRUGO, NULL, &pagetypeinfo_file_ops);
+	proc_create("extfrag_index", S_IRUGO, NULL, &extfrag_file_ops);
+	proc_create("unusable_index", S_IRUGO, NULL, &unusable_file_ops);
 	proc_create("vmstat", S_IRUGO, NULL, &proc_vmstat_file_operations);
 	proc_create("zoneinfo", S_IRUGO, NULL, &proc_zoneinfo_file_operations);
 #endif
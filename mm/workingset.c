@@ -0,0 +1,279 @@
+/*
+ *  mm/workingset.c - detect refaults of the file working set
+ *
+ *  A file page that is read in goes on the inactive list and has to be
+ *  referenced there a second time before it is activated; a page that is
+ *  evicted from the inactive list meanwhile is simply forgotten.  So when
+ *  the working set is bigger than the inactive list but still fits into
+ *  memory, its pages keep being evicted and read back in, and never get
+ *  the chance to displace the stale pages on the active list.
+ *
+ *  To notice this, every zone keeps a clock, inactive_age, which ticks
+ *  for each file page evicted from or activated out of its inactive list.
+ *  When reclaim evicts a page cache page, it leaves a shadow entry in the
+ *  page's radix tree slot which records the zone and the clock at the
+ *  time of eviction.  When the page is read in again, the difference
+ *  between the clock then and now - the refault distance - is the number
+ *  of pages that left the inactive list while the page was out of memory:
+ *  the inactive list would have had to be that much bigger to keep it.
+ *
+ *  The active list is what the inactive list could grow into, so if the
+ *  refault distance is no more than the size of the active file list, the
+ *  page belongs to a working set that fits into memory, and it goes
+ *  straight onto the active list, where it competes with the established
+ *  pages; otherwise it starts over on the inactive list as usual.
+ *
+ *  Shadow entries live as long as the page's slot in the radix tree: they
+ *  are replaced when the page is read back in and dropped when the file
+ *  is truncated or its inode is freed.  Meanwhile they keep radix tree
+ *  nodes around, so a big file that is streamed through while its inode
+ *  stays cached would pin memory in proportion to its size.  But once
+ *  more pages have left a zone's inactive list since a shadow entry was
+ *  made than its active file list holds, the entry can never lead to an
+ *  activation again: a shrinker goes through the mappings that have
+ *  shadow entries and drops such stale ones, along with the nodes that
+ *  end up empty.  The entries that are left were all made by the most
+ *  recent evictions, at most an active list's worth per zone.
+ */
+
+#include <linux/mm.h>
+#include <linux/mmzone.h>
+#include <linux/pagemap.h>
+#include <linux/pagevec.h>
+#include <linux/radix-tree.h>
+#include <linux/swap.h>
+#include <linux/vmstat.h>
+#include <linux/writeback.h>
+#include <linux/init.h>
+
+/*
+ * A shadow entry holds the zone, and as much of the eviction clock as
+ * fits above it.  The refault distance is computed modulo that width.
+ */
+#define EVICTION_SHIFT	(RADIX_TREE_EXCEPTIONAL_SHIFT + \
+			 ZONES_SHIFT + NODES_SHIFT)
+#define EVICTION_MASK	(~0UL >> EVICTION_SHIFT)
+
+static void *pack_shadow(unsigned long eviction, struct zone *zone)
+{
+	eviction = (eviction << NODES_SHIFT) | zone_to_nid(zone);
+	eviction = (eviction << ZONES_SHIFT) | zone_idx(zone);
+	eviction = (eviction << RADIX_TREE_EXCEPTIONAL_SHIFT);
+
+	return (void *)(eviction | RADIX_TREE_EXCEPTIONAL_ENTRY);
+}
+
+static void unpack_shadow(void *shadow, struct zone **zone,
+			  unsigned long *distance)
+{
+	unsigned long entry = (unsigned long)shadow;
+	unsigned long eviction, refault;
+	int zid, nid;
+
+	entry >>= RADIX_TREE_EXCEPTIONAL_SHIFT;
+	zid = entry & ((1UL << ZONES_SHIFT) - 1);
+	entry >>= ZONES_SHIFT;
+	nid = entry & ((1UL << NODES_SHIFT) - 1);
+	entry >>= NODES_SHIFT;
+	eviction = entry;
+
+	*zone = NODE_DATA(nid)->node_zones + zid;
+
+	refault = atomic_long_read(&(*zone)->inactive_age);
+	*distance = (refault - eviction) & EVICTION_MASK;
+}
+
+/**
+ * workingset_eviction - note the eviction of a page from memory
+ * @mapping: address space the page was backing
+ * @page: the page being evicted
+ *
+ * Returns a shadow entry to be stored in place of the page in the
+ * page cache.  Called with the mapping's tree_lock held.
+ */
+void *workingset_eviction(struct address_space *mapping, struct page *page)
+{
+	struct zone *zone = page_zone(page);
+	unsigned long eviction;
+
+	eviction = atomic_long_inc_return(&zone->inactive_age);
+	return pack_shadow(eviction, zone);
+}
+
+/**
+ * workingset_refault - evaluate the refault of a previously evicted page
+ * @shadow: shadow entry of the evicted page
+ *
+ * Returns 1 if the page should be activated right away, because it was
+ * evicted from a working set that would fit into memory.
+ */
+int workingset_refault(void *shadow)
+{
+	unsigned long refault_distance;
+	struct zone *zone;
+
+	unpack_shadow(shadow, &zone, &refault_distance);
+	inc_zone_state(zone, WORKINGSET_REFAULT);
+
+	if (refault_distance <= zone_page_state(zone, NR_ACTIVE_FILE)) {
+		inc_zone_state(zone, WORKINGSET_ACTIVATE);
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * workingset_activation - note a page activation
+ * @page: page that is being activated
+ */
+void workingset_activation(struct page *page)
+{
+	atomic_long_inc(&page_zone(page)->inactive_age);
+}
+
+/*
+ * Mappings with shadow entries, for the shrinker.  A mapping is added
+ * under its tree_lock when it gets a shadow entry and is not on the list
+ * yet, and taken off either under its tree_lock by the shrinker, once it
+ * has no shadow entries left, or when its inode is cleared.  Lock order:
+ * inode_lock, then tree_lock, then shadow_mappings_lock, which is always
+ * taken with interrupts off.
+ */
+static LIST_HEAD(shadow_mappings);
+static DEFINE_SPINLOCK(shadow_mappings_lock);
+static atomic_long_t nr_shadow_entries;
+
+/* Called with the mapping's tree_lock held, after a shadow entry went in */
+void workingset_shadow_stored(struct address_space *mapping)
+{
+	atomic_long_inc(&nr_shadow_entries);
+	if (list_empty(&mapping->shadow_list)) {
+		spin_lock(&shadow_mappings_lock);
+		list_add_tail(&mapping->shadow_list, &shadow_mappings);
+		spin_unlock(&shadow_mappings_lock);
+	}
+}
+
+void workingset_shadows_dropped(unsigned long nr)
+{
+	atomic_long_sub(nr, &nr_shadow_entries);
+}
+
+/* The inode is going away: it has neither pages nor shadow entries left */
+void workingset_forget_mapping(struct address_space *mapping)
+{
+	if (list_empty(&mapping->shadow_list))
+		return;
+	spin_lock_irq(&shadow_mappings_lock);
+	list_del_init(&mapping->shadow_list);
+	spin_unlock_irq(&shadow_mappings_lock);
+}
+
+/* Could a refault of the page behind @shadow still be activated? */
+static int shadow_stale(void *shadow)
+{
+	unsigned long refault_distance;
+	struct zone *zone;
+
+	unpack_shadow(shadow, &zone, &refault_distance);
+	return refault_distance > zone_page_state(zone, NR_ACTIVE_FILE);
+}
+
+/*
+ * Drop the stale shadow entries of @mapping, looking at no more than
+ * about @nr_to_scan of them.  Returns the number looked at.
+ */
+static unsigned long prune_mapping_shadows(struct address_space *mapping,
+					   unsigned long nr_to_scan)
+{
+	void *entries[PAGEVEC_SIZE];
+	unsigned long indices[PAGEVEC_SIZE];
+	unsigned long scanned = 0;
+	pgoff_t next = 0;
+	unsigned int i, nr, dropped;
+
+	do {
+		spin_lock_irq(&mapping->tree_lock);
+		nr = radix_tree_gang_lookup_exceptional(&mapping->page_tree,
+					entries, indices, next, PAGEVEC_SIZE);
+		dropped = 0;
+		for (i = 0; i < nr; i++) {
+			if (!shadow_stale(entries[i]))
+				continue;
+			radix_tree_delete(&mapping->page_tree, indices[i]);
+			dropped++;
+		}
+		mapping->nrshadows -= dropped;
+		workingset_shadows_dropped(dropped);
+		if (!mapping->nrshadows) {
+			spin_lock(&shadow_mappings_lock);
+			list_del_init(&mapping->shadow_list);
+			spin_unlock(&shadow_mappings_lock);
+		}
+		spin_unlock_irq(&mapping->tree_lock);
+
+		scanned += nr + 1;
+		if (nr < PAGEVEC_SIZE)
+			break;
+		next = indices[nr - 1] + 1;
+		cond_resched();
+	} while (next && scanned < nr_to_scan);
+
+	return scanned;
+}
+
+static void prune_shadows(unsigned long nr_to_scan)
+{
+	struct address_space *mapping;
+	struct inode *inode;
+
+	while (nr_to_scan) {
+		inode = NULL;
+		spin_lock(&inode_lock);
+		spin_lock_irq(&shadow_mappings_lock);
+		if (!list_empty(&shadow_mappings)) {
+			mapping = list_entry(shadow_mappings.next,
+					     struct address_space, shadow_list);
+			list_move_tail(&mapping->shadow_list, &shadow_mappings);
+			inode = mapping->host;
+			if (inode->i_state & (I_FREEING|I_CLEAR|I_WILL_FREE))
+				inode = NULL;
+			else
+				__iget(inode);
+		}
+		spin_unlock_irq(&shadow_mappings_lock);
+		spin_unlock(&inode_lock);
+
+		if (inode) {
+			nr_to_scan -= min(nr_to_scan,
+				prune_mapping_shadows(mapping, nr_to_scan));
+			iput(inode);
+		} else if (list_empty(&shadow_mappings))
+			break;
+		else
+			nr_to_scan--;
+	}
+}
+
+static int shrink_shadows(int nr_to_scan, gfp_t gfp_mask)
+{
+	if (nr_to_scan) {
+		/* iput() may have to let the filesystem delete the inode */
+		if (!(gfp_mask & __GFP_FS))
+			return -1;
+		prune_shadows(nr_to_scan);
+	}
+	return min_t(long, atomic_long_read(&nr_shadow_entries), INT_MAX);
+}
+
+static struct shrinker shadow_shrinker = {
+	.shrink = shrink_shadows,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static int __init workingset_init(void)
+{
+	register_shrinker(&shadow_shrinker);
+	return 0;
+}
+module_init(workingset_init);
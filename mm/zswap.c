@@ -0,0 +1,608 @@
+/*
+ *  mm/zswap.c - compressed cache for swap pages
+ *
+ *  zswap sits between swap_writepage() and the swap device.  A page being
+ *  swapped out is compressed with LZO and kept in RAM, keyed by its swap
+ *  type and offset, instead of being written; swap_readpage() finds it
+ *  there and decompresses it without any I/O.  Only when the pool reaches
+ *  its size limit does zswap write its oldest pages back to the swap
+ *  device, to make room: a page that does not compress well, or for which
+ *  no pool memory can be had, simply goes to disk as before.
+ *
+ *  Compressed pages are kept in a "zbud" pool: each pool page holds at
+ *  most two of them, one packed against each end, in 64-byte chunks.
+ *  That wastes some of the ratio a denser allocator could get, but keeps
+ *  allocation and freeing trivial and never leaves a pool page pinned by
+ *  a single small object for long.
+ */
+
+#include <linux/mm.h>
+#include <linux/swap.h>
+#include <linux/swapops.h>
+#include <linux/pagemap.h>
+#include <linux/highmem.h>
+#include <linux/writeback.h>
+#include <linux/rbtree.h>
+#include <linux/spinlock.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/percpu.h>
+#include <linux/workqueue.h>
+#include <linux/lzo.h>
+#include <linux/debugfs.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/zswap.h>
+
+/* Tunables, in /sys/kernel/mm/zswap/ */
+static unsigned int zswap_enabled __read_mostly;
+static unsigned int zswap_max_pool_percent = 20;
+
+/* Statistics, in debugfs */
+static u64 zswap_pool_pages;
+static u64 zswap_stored_pages;
+static u64 zswap_stored_bytes;
+static u64 zswap_written_back_pages;
+static u64 zswap_pool_limit_hit;
+static u64 zswap_reject_alloc_fail;
+static u64 zswap_reject_compress_poor;
+static u64 zswap_duplicate_entry;
+
+/*
+ * zswap_lock protects the trees, the LRU, the pool and the statistics.
+ * It nests inside swap_lock: zswap_invalidate() is called with that held.
+ */
+static DEFINE_SPINLOCK(zswap_lock);
+
+/*
+ * One zswap_entry per compressed page, in the rbtree of its swap type and
+ * on the LRU.  The entry is freed when it has been taken out of the tree
+ * and the last zswap_load() using it has finished.
+ */
+struct zswap_entry {
+	struct rb_node rbnode;
+	struct list_head lru;
+	unsigned int type;
+	pgoff_t offset;
+	int refcount;
+	unsigned int length;
+	unsigned long handle;
+};
+
+static struct rb_root zswap_trees[MAX_SWAPFILES];
+static LIST_HEAD(zswap_lru);			/* oldest first */
+static struct kmem_cache *zswap_entry_cache;
+
+/*
+ * The zbud pool.
+ */
+#define ZBUD_CHUNK_SHIFT	6
+#define ZBUD_CHUNK_SIZE		(1 << ZBUD_CHUNK_SHIFT)
+#define ZBUD_NCHUNKS		(PAGE_SIZE >> ZBUD_CHUNK_SHIFT)
+#define ZBUD_LAST		1UL	/* handle bit: the buddy at the end */
+
+/*
+ * The header takes the first chunk of each pool page: the first buddy
+ * follows it, the last buddy ends at the end of the page.
+ */
+struct zbud_header {
+	struct list_head buddy;		/* on zbud_unbuddied, if one is free */
+	unsigned short first_chunks;
+	unsigned short last_chunks;
+};
+
+/* Pool pages with one buddy free, indexed by the number of free chunks */
+static struct list_head zbud_unbuddied[ZBUD_NCHUNKS];
+
+static inline int zbud_size_to_chunks(unsigned int size)
+{
+	return (size + ZBUD_CHUNK_SIZE - 1) >> ZBUD_CHUNK_SHIFT;
+}
+
+static inline int zbud_free_chunks(struct zbud_header *zhdr)
+{
+	return ZBUD_NCHUNKS - 1 - zhdr->first_chunks - zhdr->last_chunks;
+}
+
+static inline void *zbud_map(unsigned long handle)
+{
+	return (void *)(handle & ~ZBUD_LAST);
+}
+
+/*
+ * Find room for size bytes, returning a handle to it or 0.  Called with
+ * zswap_lock held, and may drop it to allocate a new pool page.
+ */
+static unsigned long zbud_alloc(unsigned int size)
+{
+	struct zbud_header *zhdr = NULL;
+	unsigned long handle;
+	struct page *page;
+	int chunks, i;
+
+	chunks = zbud_size_to_chunks(size);
+	for (i = chunks; i < ZBUD_NCHUNKS; i++) {
+		if (!list_empty(&zbud_unbuddied[i])) {
+			zhdr = list_first_entry(&zbud_unbuddied[i],
+						struct zbud_header, buddy);
+			list_del_init(&zhdr->buddy);
+			break;
+		}
+	}
+
+	if (!zhdr) {
+		spin_unlock(&zswap_lock);
+		page = alloc_page(GFP_NOWAIT | __GFP_NORETRY | __GFP_NOWARN);
+		spin_lock(&zswap_lock);
+		if (!page)
+			return 0;
+		zhdr = page_address(page);
+		INIT_LIST_HEAD(&zhdr->buddy);
+		zhdr->first_chunks = 0;
+		zhdr->last_chunks = 0;
+		zswap_pool_pages++;
+	}
+
+	if (!zhdr->first_chunks) {
+		zhdr->first_chunks = chunks;
+		handle = (unsigned long)zhdr + ZBUD_CHUNK_SIZE;
+	} else {
+		zhdr->last_chunks = chunks;
+		handle = (unsigned long)zhdr + PAGE_SIZE -
+				(chunks << ZBUD_CHUNK_SHIFT);
+		handle |= ZBUD_LAST;
+	}
+
+	i = zbud_free_chunks(zhdr);
+	if (i && (!zhdr->first_chunks || !zhdr->last_chunks))
+		list_add(&zhdr->buddy, &zbud_unbuddied[i]);
+	return handle;
+}
+
+/* Called with zswap_lock held */
+static void zbud_free(unsigned long handle)
+{
+	struct zbud_header *zhdr;
+
+	zhdr = (struct zbud_header *)(handle & PAGE_MASK);
+	if (handle & ZBUD_LAST)
+		zhdr->last_chunks = 0;
+	else
+		zhdr->first_chunks = 0;
+
+	list_del_init(&zhdr->buddy);
+	if (!zhdr->first_chunks && !zhdr->last_chunks) {
+		free_page((unsigned long)zhdr);
+		zswap_pool_pages--;
+		return;
+	}
+	list_add(&zhdr->buddy, &zbud_unbuddied[zbud_free_chunks(zhdr)]);
+}
+
+static int zswap_pool_full(void)
+{
+	return zswap_pool_pages >
+		totalram_pages * zswap_max_pool_percent / 100;
+}
+
+/*
+ * The trees.
+ */
+static struct zswap_entry *zswap_rb_search(struct rb_root *root,
+					   pgoff_t offset)
+{
+	struct rb_node *node = root->rb_node;
+	struct zswap_entry *entry;
+
+	while (node) {
+		entry = rb_entry(node, struct zswap_entry, rbnode);
+		if (offset < entry->offset)
+			node = node->rb_left;
+		else if (offset > entry->offset)
+			node = node->rb_right;
+		else
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+ * Insert entry into its tree, returning whatever entry it replaced there.
+ */
+static struct zswap_entry *zswap_rb_insert(struct zswap_entry *entry)
+{
+	struct rb_root *root = &zswap_trees[entry->type];
+	struct rb_node **link = &root->rb_node, *parent = NULL;
+	struct zswap_entry *old;
+
+	while (*link) {
+		parent = *link;
+		old = rb_entry(parent, struct zswap_entry, rbnode);
+		if (entry->offset < old->offset)
+			link = &parent->rb_left;
+		else if (entry->offset > old->offset)
+			link = &parent->rb_right;
+		else {
+			rb_replace_node(parent, &entry->rbnode, root);
+			return old;
+		}
+	}
+	rb_link_node(&entry->rbnode, parent, link);
+	rb_insert_color(&entry->rbnode, root);
+	return NULL;
+}
+
+/* Called with zswap_lock held, when the entry's last reference goes */
+static void zswap_free_entry(struct zswap_entry *entry)
+{
+	zbud_free(entry->handle);
+	zswap_stored_pages--;
+	zswap_stored_bytes -= entry->length;
+	kmem_cache_free(zswap_entry_cache, entry);
+}
+
+/*
+ * Take entry out of its tree and off the LRU: called with zswap_lock held.
+ */
+static void zswap_erase_entry(struct zswap_entry *entry)
+{
+	rb_erase(&entry->rbnode, &zswap_trees[entry->type]);
+	list_del(&entry->lru);
+	if (!--entry->refcount)
+		zswap_free_entry(entry);
+}
+
+/*
+ * Writeback of the oldest entries when the pool is full.
+ */
+static struct workqueue_struct *zswap_wq;
+
+static void zswap_writeback(struct work_struct *work)
+{
+	struct writeback_control wbc = {
+		.sync_mode = WB_SYNC_NONE,
+	};
+	struct zswap_entry *entry;
+	struct page *page;
+	swp_entry_t swp;
+	int nr = SWAP_CLUSTER_MAX * 4;
+
+	while (nr--) {
+		spin_lock(&zswap_lock);
+		if (list_empty(&zswap_lru) || zswap_pool_pages <=
+		    totalram_pages * zswap_max_pool_percent / 100 * 9 / 10) {
+			spin_unlock(&zswap_lock);
+			break;
+		}
+		entry = list_first_entry(&zswap_lru, struct zswap_entry, lru);
+		swp = swp_entry(entry->type, entry->offset);
+		spin_unlock(&zswap_lock);
+
+		/*
+		 * Bring the page back into the swap cache - most likely
+		 * decompressing it from this very entry - and write it out
+		 * from there, just as reclaim would have done.
+		 */
+		page = read_swap_cache_async(swp, GFP_KERNEL, NULL, 0);
+		if (!page)
+			break;
+
+		lock_page(page);
+		if (!PageSwapCache(page) || page_private(page) != swp.val ||
+		    !PageUptodate(page) || PageWriteback(page)) {
+			unlock_page(page);
+			page_cache_release(page);
+			continue;
+		}
+
+		/*
+		 * The page now holds the data: whatever is in the pool is
+		 * either the same or stale.  A dirty page will be written
+		 * (or stored again) by reclaim in the usual way.
+		 */
+		zswap_invalidate(swp_type(swp), swp_offset(swp));
+		if (PageDirty(page)) {
+			unlock_page(page);
+		} else {
+			SetPageReclaim(page);
+			__swap_writepage(page, &wbc);	/* unlocks */
+			spin_lock(&zswap_lock);
+			zswap_written_back_pages++;
+			spin_unlock(&zswap_lock);
+		}
+		page_cache_release(page);
+		cond_resched();
+	}
+}
+
+static DECLARE_WORK(zswap_writeback_work, zswap_writeback);
+
+/*
+ * Per-cpu buffers for compression.
+ */
+static DEFINE_PER_CPU(u8 *, zswap_dstmem);
+static DEFINE_PER_CPU(void *, zswap_wrkmem);
+
+/*
+ * Store the locked swap cache page, returning 0 if it is now in the pool
+ * and need not be written to the swap device.
+ */
+int zswap_store(struct page *page)
+{
+	swp_entry_t swp = { .val = page_private(page) };
+	struct zswap_entry *entry, *old;
+	size_t dlen;
+	unsigned long handle;
+	u8 *src, *dst;
+	int ret;
+
+	if (!zswap_enabled) {
+		ret = -ENODEV;
+		goto reject;
+	}
+
+	if (zswap_pool_full()) {
+		spin_lock(&zswap_lock);
+		zswap_pool_limit_hit++;
+		spin_unlock(&zswap_lock);
+		queue_work(zswap_wq, &zswap_writeback_work);
+		ret = -ENOMEM;
+		goto reject;
+	}
+
+	entry = kmem_cache_alloc(zswap_entry_cache, GFP_NOIO | __GFP_NOWARN);
+	if (!entry) {
+		ret = -ENOMEM;
+		goto reject_alloc;
+	}
+
+	dst = get_cpu_var(zswap_dstmem);
+	src = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_1_compress(src, PAGE_SIZE, dst, &dlen,
+			       __get_cpu_var(zswap_wrkmem));
+	kunmap_atomic(src, KM_USER0);
+	if (ret != LZO_E_OK || zbud_size_to_chunks(dlen) >= ZBUD_NCHUNKS) {
+		put_cpu_var(zswap_dstmem);
+		kmem_cache_free(zswap_entry_cache, entry);
+		spin_lock(&zswap_lock);
+		zswap_reject_compress_poor++;
+		spin_unlock(&zswap_lock);
+		ret = -EINVAL;
+		goto reject;
+	}
+
+	spin_lock(&zswap_lock);
+	handle = zbud_alloc(dlen);
+	if (!handle) {
+		spin_unlock(&zswap_lock);
+		put_cpu_var(zswap_dstmem);
+		kmem_cache_free(zswap_entry_cache, entry);
+		ret = -ENOMEM;
+		goto reject_alloc;
+	}
+	memcpy(zbud_map(handle), dst, dlen);
+	put_cpu_var(zswap_dstmem);
+
+	entry->type = swp_type(swp);
+	entry->offset = swp_offset(swp);
+	entry->refcount = 1;
+	entry->length = dlen;
+	entry->handle = handle;
+	zswap_stored_pages++;
+	zswap_stored_bytes += dlen;
+
+	old = zswap_rb_insert(entry);
+	if (old) {
+		/* The page was dirtied and swapped out again */
+		zswap_duplicate_entry++;
+		list_del(&old->lru);
+		if (!--old->refcount)
+			zswap_free_entry(old);
+	}
+	list_add_tail(&entry->lru, &zswap_lru);
+	spin_unlock(&zswap_lock);
+	return 0;
+
+reject_alloc:
+	spin_lock(&zswap_lock);
+	zswap_reject_alloc_fail++;
+	spin_unlock(&zswap_lock);
+reject:
+	/* The page goes to disk: drop any stale copy of an earlier version */
+	zswap_invalidate(swp_type(swp), swp_offset(swp));
+	return ret;
+}
+
+/*
+ * Fill the locked swap cache page from the pool, returning 0 if it was
+ * found there.  The entry stays: the page is clean and may be dropped
+ * from swap cache again without being written.
+ */
+int zswap_load(struct page *page)
+{
+	swp_entry_t swp = { .val = page_private(page) };
+	struct zswap_entry *entry;
+	size_t dlen = PAGE_SIZE;
+	u8 *dst;
+	int ret;
+
+	if (RB_EMPTY_ROOT(&zswap_trees[swp_type(swp)]))
+		return -ENOENT;
+
+	spin_lock(&zswap_lock);
+	entry = zswap_rb_search(&zswap_trees[swp_type(swp)], swp_offset(swp));
+	if (!entry) {
+		spin_unlock(&zswap_lock);
+		return -ENOENT;
+	}
+	entry->refcount++;
+	spin_unlock(&zswap_lock);
+
+	dst = kmap_atomic(page, KM_USER0);
+	ret = lzo1x_decompress_safe(zbud_map(entry->handle), entry->length,
+				    dst, &dlen);
+	kunmap_atomic(dst, KM_USER0);
+	BUG_ON(ret != LZO_E_OK || dlen != PAGE_SIZE);
+
+	spin_lock(&zswap_lock);
+	if (!--entry->refcount)
+		zswap_free_entry(entry);
+	spin_unlock(&zswap_lock);
+	return 0;
+}
+
+/*
+ * The swap entry has been freed, or is about to be written to the device:
+ * forget whatever the pool holds for it.
+ */
+void zswap_invalidate(unsigned type, pgoff_t offset)
+{
+	struct zswap_entry *entry;
+
+	/*
+	 * Nothing can be stored for this offset meanwhile: the caller holds
+	 * either the page lock of its swap cache page or the last reference.
+	 */
+	if (RB_EMPTY_ROOT(&zswap_trees[type]))
+		return;
+
+	spin_lock(&zswap_lock);
+	entry = zswap_rb_search(&zswap_trees[type], offset);
+	if (entry)
+		zswap_erase_entry(entry);
+	spin_unlock(&zswap_lock);
+}
+
+/*
+ * The swap device is gone.  try_to_unuse() will have freed every entry
+ * already, so this only mops up after anything that raced with it.
+ */
+void zswap_swapoff(unsigned type)
+{
+	struct rb_node *node;
+
+	spin_lock(&zswap_lock);
+	while ((node = rb_first(&zswap_trees[type])))
+		zswap_erase_entry(rb_entry(node, struct zswap_entry, rbnode));
+	spin_unlock(&zswap_lock);
+}
+
+#ifdef CONFIG_SYSFS
+#define ZSWAP_ATTR(_name) \
+	static struct kobj_attribute _name##_attr = \
+		__ATTR(_name, 0644, _name##_show, _name##_store)
+
+static ssize_t enabled_show(struct kobject *kobj,
+			    struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", zswap_enabled);
+}
+
+static ssize_t enabled_store(struct kobject *kobj,
+			     struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	unsigned long flag;
+
+	if (strict_strtoul(buf, 10, &flag) || flag > 1)
+		return -EINVAL;
+	zswap_enabled = flag;
+	return count;
+}
+ZSWAP_ATTR(enabled);
+
+static ssize_t max_pool_percent_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	return sprintf(buf, "%u\n", zswap_max_pool_percent);
+}
+
+static ssize_t max_pool_percent_store(struct kobject *kobj,
+				      struct kobj_attribute *attr,
+				      const char *buf, size_t count)
+{
+	unsigned long percent;
+
+	if (strict_strtoul(buf, 10, &percent) || percent > 100)
+		return -EINVAL;
+	zswap_max_pool_percent = percent;
+	return count;
+}
+ZSWAP_ATTR(max_pool_percent);
+
+static struct attribute *zswap_attrs[] = {
+	&enabled_attr.attr,
+	&max_pool_percent_attr.attr,
+	NULL,
+};
+
+static struct attribute_group zswap_attr_group = {
+	.attrs = zswap_attrs,
+	.name = "zswap",
+};
+#endif /* CONFIG_SYSFS */
+
+static void __init zswap_debugfs_init(void)
+{
+	struct dentry *dir;
+
+	dir = debugfs_create_dir("zswap", NULL);
+	if (!dir)
+		return;
+
+	debugfs_create_u64("pool_pages", S_IRUGO, dir, &zswap_pool_pages);
+	debugfs_create_u64("stored_pages", S_IRUGO, dir, &zswap_stored_pages);
+	debugfs_create_u64("stored_bytes", S_IRUGO, dir, &zswap_stored_bytes);
+	debugfs_create_u64("written_back_pages", S_IRUGO, dir,
+			   &zswap_written_back_pages);
+	debugfs_create_u64("pool_limit_hit", S_IRUGO, dir,
+			   &zswap_pool_limit_hit);
+	debugfs_create_u64("reject_alloc_fail", S_IRUGO, dir,
+			   &zswap_reject_alloc_fail);
+	debugfs_create_u64("reject_compress_poor", S_IRUGO, dir,
+			   &zswap_reject_compress_poor);
+	debugfs_create_u64("duplicate_entry", S_IRUGO, dir,
+			   &zswap_duplicate_entry);
+}
+
+static int __init zswap_init(void)
+{
+	int cpu, i;
+
+	for (i = 0; i < ZBUD_NCHUNKS; i++)
+		INIT_LIST_HEAD(&zbud_unbuddied[i]);
+
+	zswap_entry_cache = KMEM_CACHE(zswap_entry, 0);
+	if (!zswap_entry_cache)
+		goto nomem;
+
+	for_each_possible_cpu(cpu) {
+		/* lzo can overrun its output a little on incompressible data */
+		per_cpu(zswap_dstmem, cpu) = kmalloc(PAGE_SIZE * 2, GFP_KERNEL);
+		per_cpu(zswap_wrkmem, cpu) = vmalloc(LZO1X_MEM_COMPRESS);
+		if (!per_cpu(zswap_dstmem, cpu) || !per_cpu(zswap_wrkmem, cpu))
+			goto nomem;
+	}
+
+	zswap_wq = create_singlethread_workqueue("zswap");
+	if (!zswap_wq)
+		goto nomem;
+
+#ifdef CONFIG_SYSFS
+	if (sysfs_create_group(mm_kobj, &zswap_attr_group))
+		printk(KERN_ERR "zswap: register sysfs failed\n");
+#endif
+	zswap_debugfs_init();
+	return 0;
+
+nomem:
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(zswap_dstmem, cpu));
+		vfree(per_cpu(zswap_wrkmem, cpu));
+	}
+	if (zswap_entry_cache)
+		kmem_cache_destroy(zswap_entry_cache);
+	printk(KERN_ERR "zswap: cannot allocate its buffers, disabled\n");
+	return -ENOMEM;
+}
+module_init(zswap_init)
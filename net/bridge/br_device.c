@@ -160,6 +160,12 @@ static struct ethtool_ops br_ethtool_ops = {
 	.get_flags	= ethtool_op_get_flags,
 };
 
+static void br_dev_free(struct net_device *dev)
+{
+	br_fdb_table_free(netdev_priv(dev));
+	free_netdev(dev);
+}
+
 void br_dev_setup(struct net_device *dev)
 {
 	random_ether_addr(dev->dev_addr);
@@ -170,7 +176,7 @@ void br_dev_setup(struct net_device *dev)
 	dev->open = br_dev_open;
 	dev->set_multicast_list = br_dev_set_multicast_list;
 	dev->change_mtu = br_change_mtu;
-	dev->destructor = free_netdev;
+	dev->destructor = br_dev_free;
 	SET_ETHTOOL_OPS(dev, &br_ethtool_ops);
 	dev->stop = br_dev_stop;
 	dev->tx_queue_len = 0;
@@ -20,6 +20,8 @@
 #include <linux/etherdevice.h>
 #include <linux/jhash.h>
 #include <linux/random.h>
+#include <linux/workqueue.h>
+#include <linux/vmalloc.h>
 #include <asm/atomic.h>
 #include <asm/unaligned.h>
 #include "br_private.h"
@@ -27,6 +29,7 @@
 static struct kmem_cache *br_fdb_cache __read_mostly;
 static int fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 		      const unsigned char *addr);
+static void fdb_resize(struct work_struct *work);
 
 static u32 fdb_salt __read_mostly;
 
@@ -48,6 +51,57 @@ void br_fdb_fini(void)
 	kmem_cache_destroy(br_fdb_cache);
 }
 
+/* The largest tables are too big for kmalloc() to be reliable */
+static struct net_bridge_fdb_table *fdb_table_alloc(unsigned int size)
+{
+	struct net_bridge_fdb_table *tbl;
+	size_t bytes = sizeof(*tbl) + size * sizeof(struct hlist_head);
+	unsigned int i;
+
+	if (bytes > PAGE_SIZE)
+		tbl = vmalloc(bytes);
+	else
+		tbl = kmalloc(bytes, GFP_KERNEL);
+	if (tbl) {
+		tbl->size = size;
+		for (i = 0; i < size; i++)
+			INIT_HLIST_HEAD(&tbl->buckets[i]);
+	}
+	return tbl;
+}
+
+static void fdb_table_free(struct net_bridge_fdb_table *tbl)
+{
+	if (is_vmalloc_addr(tbl))
+		vfree(tbl);
+	else
+		kfree(tbl);
+}
+
+int br_fdb_table_init(struct net_bridge *br)
+{
+	int i;
+
+	spin_lock_init(&br->hash_lock);
+	for (i = 0; i < BR_HASH_LOCKS; i++)
+		spin_lock_init(&br->hash_locks[i]);
+	atomic_set(&br->fdb_count, 0);
+	seqcount_init(&br->fdb_resize_seq);
+	INIT_WORK(&br->fdb_resize_work, fdb_resize);
+
+	br->fdb_table = fdb_table_alloc(BR_HASH_SIZE);
+	if (!br->fdb_table)
+		return -ENOMEM;
+	return 0;
+}
+
+/* Called when the bridge device goes away, the table is empty by then */
+void br_fdb_table_free(struct net_bridge *br)
+{
+	fdb_table_free(br->fdb_table);
+	br->fdb_table = NULL;
+}
+
 
 /* if topology_changing then use forward_delay (default 15 sec)
  * otherwise keep longer (default 5 minutes)
@@ -64,30 +118,125 @@ static inline int has_expired(const struct net_bridge *br,
 		&& time_before_eq(fdb->ageing_timer + hold_time(br), jiffies);
 }
 
-static inline int br_mac_hash(const unsigned char *mac)
+static inline u32 br_mac_hash(const unsigned char *mac)
 {
 	/* use 1 byte of OUI cnd 3 bytes of NIC */
 	u32 key = get_unaligned((u32 *)(mac + 2));
-	return jhash_1word(key, fdb_salt) & (BR_HASH_SIZE - 1);
+	return jhash_1word(key, fdb_salt);
+}
+
+static inline struct hlist_head *fdb_bucket(struct net_bridge_fdb_table *tbl,
+					    u32 hash)
+{
+	return &tbl->buckets[hash & (tbl->size - 1)];
+}
+
+/*
+ * The table size is never below BR_HASH_LOCKS, so the lock of a bucket
+ * does not change when the table is resized: all the entries of a bucket
+ * share the low bits of their hash.
+ */
+static inline spinlock_t *fdb_bucket_lock(struct net_bridge *br, u32 hash)
+{
+	return &br->hash_locks[hash & (BR_HASH_LOCKS - 1)];
+}
+
+/* Take all bucket locks, the caller holds br->hash_lock */
+static void fdb_lock_buckets(struct net_bridge *br)
+{
+	int i;
+
+	for (i = 0; i < BR_HASH_LOCKS; i++)
+		spin_lock_nest_lock(&br->hash_locks[i], &br->hash_lock);
+}
+
+static void fdb_unlock_buckets(struct net_bridge *br)
+{
+	int i;
+
+	for (i = BR_HASH_LOCKS - 1; i >= 0; i--)
+		spin_unlock(&br->hash_locks[i]);
 }
 
-static inline void fdb_delete(struct net_bridge_fdb_entry *f)
+static inline void fdb_delete(struct net_bridge *br,
+			      struct net_bridge_fdb_entry *f)
 {
 	hlist_del_rcu(&f->hlist);
+	atomic_dec(&br->fdb_count);
 	br_fdb_put(f);
 }
 
+/*
+ * Double the size of the table when it gets too loaded.  Readers keep
+ * using the old table until every entry is linked into the new one, but
+ * an entry moved meanwhile takes a reader on an old chain along to its
+ * new one: __br_fdb_get() looks again when it missed while a resize was
+ * under way, see fdb_resize_seq.  Learners wait on their bucket lock and
+ * see the new table.
+ */
+static void fdb_resize(struct work_struct *work)
+{
+	struct net_bridge *br = container_of(work, struct net_bridge,
+					     fdb_resize_work);
+	struct net_bridge_fdb_table *old, *new;
+	unsigned int i, size;
+
+	size = br->fdb_table->size * 2;
+	if (size > BR_HASH_MAX_SIZE)
+		return;
+
+	new = fdb_table_alloc(size);
+	if (!new)
+		return;
+
+	spin_lock_bh(&br->hash_lock);
+	old = br->fdb_table;
+	if (old->size * 2 != size) {
+		/* somebody else resized it meanwhile */
+		spin_unlock_bh(&br->hash_lock);
+		fdb_table_free(new);
+		return;
+	}
+
+	fdb_lock_buckets(br);
+	write_seqcount_begin(&br->fdb_resize_seq);
+	for (i = 0; i < old->size; i++) {
+		struct net_bridge_fdb_entry *f;
+		struct hlist_node *h, *n;
+
+		hlist_for_each_entry_safe(f, h, n, &old->buckets[i], hlist) {
+			hlist_del_rcu(&f->hlist);
+			hlist_add_head_rcu(&f->hlist,
+					   fdb_bucket(new, br_mac_hash(f->addr.addr)));
+		}
+	}
+	rcu_assign_pointer(br->fdb_table, new);
+	write_seqcount_end(&br->fdb_resize_seq);
+	fdb_unlock_buckets(br);
+	spin_unlock_bh(&br->hash_lock);
+
+	/* vfree() cannot be called from an RCU callback */
+	synchronize_rcu();
+	fdb_table_free(old);
+}
+
 void br_fdb_changeaddr(struct net_bridge_port *p, const unsigned char *newaddr)
 {
 	struct net_bridge *br = p->br;
-	int i;
+	struct net_bridge_fdb_table *tbl;
+	spinlock_t *lock = NULL;
+	unsigned int i;
 
 	spin_lock_bh(&br->hash_lock);
+	tbl = br->fdb_table;
 
 	/* Search all chains since old address/hash is unknown */
-	for (i = 0; i < BR_HASH_SIZE; i++) {
+	for (i = 0; i < tbl->size; i++) {
 		struct hlist_node *h;
-		hlist_for_each(h, &br->hash[i]) {
+
+		lock = &br->hash_locks[i & (BR_HASH_LOCKS - 1)];
+		spin_lock(lock);
+		hlist_for_each(h, &tbl->buckets[i]) {
 			struct net_bridge_fdb_entry *f;
 
 			f = hlist_entry(h, struct net_bridge_fdb_entry, hlist);
@@ -104,12 +253,17 @@ void br_fdb_changeaddr(struct net_bridge_port *p, const unsigned char *newaddr)
 				}
 
 				/* delete old one */
-				fdb_delete(f);
+				fdb_delete(br, f);
 				goto insert;
 			}
 		}
+		spin_unlock(lock);
 	}
+	lock = NULL;
  insert:
+	if (lock)
+		spin_unlock(lock);
+
 	/* insert new address,  may fail if invalid address or dup. */
 	fdb_insert(br, p, newaddr);
 
@@ -121,23 +275,28 @@ void br_fdb_cleanup(unsigned long _data)
 	struct net_bridge *br = (struct net_bridge *)_data;
 	unsigned long delay = hold_time(br);
 	unsigned long next_timer = jiffies + br->forward_delay;
-	int i;
+	struct net_bridge_fdb_table *tbl;
+	unsigned int i;
 
 	spin_lock_bh(&br->hash_lock);
-	for (i = 0; i < BR_HASH_SIZE; i++) {
+	tbl = br->fdb_table;
+	for (i = 0; i < tbl->size; i++) {
+		spinlock_t *lock = &br->hash_locks[i & (BR_HASH_LOCKS - 1)];
 		struct net_bridge_fdb_entry *f;
 		struct hlist_node *h, *n;
 
-		hlist_for_each_entry_safe(f, h, n, &br->hash[i], hlist) {
+		spin_lock(lock);
+		hlist_for_each_entry_safe(f, h, n, &tbl->buckets[i], hlist) {
 			unsigned long this_timer;
 			if (f->is_static)
 				continue;
 			this_timer = f->ageing_timer + delay;
 			if (time_before_eq(this_timer, jiffies))
-				fdb_delete(f);
+				fdb_delete(br, f);
 			else if (time_before(this_timer, next_timer))
 				next_timer = this_timer;
 		}
+		spin_unlock(lock);
 	}
 	spin_unlock_bh(&br->hash_lock);
 
@@ -149,16 +308,22 @@ void br_fdb_cleanup(unsigned long _data)
 /* Completely flush all dynamic entries in forwarding database.*/
 void br_fdb_flush(struct net_bridge *br)
 {
-	int i;
+	struct net_bridge_fdb_table *tbl;
+	unsigned int i;
 
 	spin_lock_bh(&br->hash_lock);
-	for (i = 0; i < BR_HASH_SIZE; i++) {
+	tbl = br->fdb_table;
+	for (i = 0; i < tbl->size; i++) {
+		spinlock_t *lock = &br->hash_locks[i & (BR_HASH_LOCKS - 1)];
 		struct net_bridge_fdb_entry *f;
 		struct hlist_node *h, *n;
-		hlist_for_each_entry_safe(f, h, n, &br->hash[i], hlist) {
+
+		spin_lock(lock);
+		hlist_for_each_entry_safe(f, h, n, &tbl->buckets[i], hlist) {
 			if (!f->is_static)
-				fdb_delete(f);
+				fdb_delete(br, f);
 		}
+		spin_unlock(lock);
 	}
 	spin_unlock_bh(&br->hash_lock);
 }
@@ -170,13 +335,17 @@ void br_fdb_delete_by_port(struct net_bridge *br,
 			   const struct net_bridge_port *p,
 			   int do_all)
 {
-	int i;
+	struct net_bridge_fdb_table *tbl;
+	unsigned int i;
 
 	spin_lock_bh(&br->hash_lock);
-	for (i = 0; i < BR_HASH_SIZE; i++) {
+	tbl = br->fdb_table;
+	for (i = 0; i < tbl->size; i++) {
+		spinlock_t *lock = &br->hash_locks[i & (BR_HASH_LOCKS - 1)];
 		struct hlist_node *h, *g;
 
-		hlist_for_each_safe(h, g, &br->hash[i]) {
+		spin_lock(lock);
+		hlist_for_each_safe(h, g, &tbl->buckets[i]) {
 			struct net_bridge_fdb_entry *f
 				= hlist_entry(h, struct net_bridge_fdb_entry, hlist);
 			if (f->dst != p)
@@ -201,31 +370,50 @@ void br_fdb_delete_by_port(struct net_bridge *br,
 				}
 			}
 
-			fdb_delete(f);
+			fdb_delete(br, f);
 		skip_delete: ;
 		}
+		spin_unlock(lock);
 	}
 	spin_unlock_bh(&br->hash_lock);
 }
 
-/* No locking or refcounting, assumes caller has no preempt (rcu_read_lock) */
-struct net_bridge_fdb_entry *__br_fdb_get(struct net_bridge *br,
-					  const unsigned char *addr)
+static inline struct net_bridge_fdb_entry *fdb_find(struct hlist_head *head,
+						    const unsigned char *addr)
 {
 	struct hlist_node *h;
 	struct net_bridge_fdb_entry *fdb;
 
-	hlist_for_each_entry_rcu(fdb, h, &br->hash[br_mac_hash(addr)], hlist) {
-		if (!compare_ether_addr(fdb->addr.addr, addr)) {
-			if (unlikely(has_expired(br, fdb)))
-				break;
+	hlist_for_each_entry_rcu(fdb, h, head, hlist) {
+		if (!compare_ether_addr(fdb->addr.addr, addr))
 			return fdb;
-		}
 	}
-
 	return NULL;
 }
 
+/*
+ * No locking or refcounting, assumes caller has no preempt (rcu_read_lock).
+ * A miss is only trusted if no resize moved the entries meanwhile: a
+ * local address missed would send the frame out instead of up the stack.
+ */
+struct net_bridge_fdb_entry *__br_fdb_get(struct net_bridge *br,
+					  const unsigned char *addr)
+{
+	u32 hash = br_mac_hash(addr);
+	struct net_bridge_fdb_entry *fdb;
+	unsigned seq;
+
+	do {
+		seq = read_seqcount_begin(&br->fdb_resize_seq);
+		fdb = fdb_find(fdb_bucket(rcu_dereference(br->fdb_table),
+					  hash), addr);
+	} while (!fdb && read_seqcount_retry(&br->fdb_resize_seq, seq));
+
+	if (fdb && unlikely(has_expired(br, fdb)))
+		return NULL;
+	return fdb;
+}
+
 /* Interface used by ATM hook that keeps a ref count */
 struct net_bridge_fdb_entry *br_fdb_get(struct net_bridge *br,
 					unsigned char *addr)
@@ -262,15 +450,18 @@ int br_fdb_fillbuf(struct net_bridge *br, void *buf,
 		   unsigned long maxnum, unsigned long skip)
 {
 	struct __fdb_entry *fe = buf;
-	int i, num = 0;
+	struct net_bridge_fdb_table *tbl;
+	unsigned int i;
+	int num = 0;
 	struct hlist_node *h;
 	struct net_bridge_fdb_entry *f;
 
 	memset(buf, 0, maxnum*sizeof(struct __fdb_entry));
 
 	rcu_read_lock();
-	for (i = 0; i < BR_HASH_SIZE; i++) {
-		hlist_for_each_entry_rcu(f, h, &br->hash[i], hlist) {
+	tbl = rcu_dereference(br->fdb_table);
+	for (i = 0; i < tbl->size; i++) {
+		hlist_for_each_entry_rcu(f, h, &tbl->buckets[i], hlist) {
 			if (num >= maxnum)
 				goto out;
 
@@ -303,20 +494,9 @@ int br_fdb_fillbuf(struct net_bridge *br, void *buf,
 	return num;
 }
 
-static inline struct net_bridge_fdb_entry *fdb_find(struct hlist_head *head,
-						    const unsigned char *addr)
-{
-	struct hlist_node *h;
-	struct net_bridge_fdb_entry *fdb;
-
-	hlist_for_each_entry_rcu(fdb, h, head, hlist) {
-		if (!compare_ether_addr(fdb->addr.addr, addr))
-			return fdb;
-	}
-	return NULL;
-}
-
-static struct net_bridge_fdb_entry *fdb_create(struct hlist_head *head,
+/* Called with the bucket lock held */
+static struct net_bridge_fdb_entry *fdb_create(struct net_bridge *br,
+					       struct hlist_head *head,
 					       struct net_bridge_port *source,
 					       const unsigned char *addr,
 					       int is_local)
@@ -327,43 +507,54 @@ static struct net_bridge_fdb_entry *fdb_create(struct hlist_head *head,
 	if (fdb) {
 		memcpy(fdb->addr.addr, addr, ETH_ALEN);
 		atomic_set(&fdb->use_count, 1);
-		hlist_add_head_rcu(&fdb->hlist, head);
-
 		fdb->dst = source;
 		fdb->is_local = is_local;
 		fdb->is_static = is_local;
 		fdb->ageing_timer = jiffies;
+		hlist_add_head_rcu(&fdb->hlist, head);
+
+		if (atomic_inc_return(&br->fdb_count) >
+		    2 * br->fdb_table->size &&
+		    br->fdb_table->size < BR_HASH_MAX_SIZE)
+			schedule_work(&br->fdb_resize_work);
 	}
 	return fdb;
 }
 
+/* Called with br->hash_lock held */
 static int fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 		  const unsigned char *addr)
 {
-	struct hlist_head *head = &br->hash[br_mac_hash(addr)];
+	u32 hash = br_mac_hash(addr);
+	spinlock_t *lock = fdb_bucket_lock(br, hash);
+	struct hlist_head *head;
 	struct net_bridge_fdb_entry *fdb;
+	int ret = 0;
 
 	if (!is_valid_ether_addr(addr))
 		return -EINVAL;
 
+	spin_lock(lock);
+	head = fdb_bucket(br->fdb_table, hash);
 	fdb = fdb_find(head, addr);
 	if (fdb) {
 		/* it is okay to have multiple ports with same
 		 * address, just use the first one.
 		 */
 		if (fdb->is_local)
-			return 0;
+			goto out;
 
 		printk(KERN_WARNING "%s adding interface with same address "
 		       "as a received packet\n",
 		       source->dev->name);
-		fdb_delete(fdb);
+		fdb_delete(br, fdb);
 	}
 
-	if (!fdb_create(head, source, addr, 1))
-		return -ENOMEM;
-
-	return 0;
+	if (!fdb_create(br, head, source, addr, 1))
+		ret = -ENOMEM;
+out:
+	spin_unlock(lock);
+	return ret;
 }
 
 int br_fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
@@ -380,7 +571,8 @@ int br_fdb_insert(struct net_bridge *br, struct net_bridge_port *source,
 void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 		   const unsigned char *addr)
 {
-	struct hlist_head *head = &br->hash[br_mac_hash(addr)];
+	u32 hash = br_mac_hash(addr);
+	struct hlist_head *head;
 	struct net_bridge_fdb_entry *fdb;
 
 	/* some users want to always flood. */
@@ -392,7 +584,7 @@ void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 	      source->state == BR_STATE_FORWARDING))
 		return;
 
-	fdb = fdb_find(head, addr);
+	fdb = fdb_find(fdb_bucket(rcu_dereference(br->fdb_table), hash), addr);
 	if (likely(fdb)) {
 		/* attempt to update an entry for a local interface */
 		if (unlikely(fdb->is_local)) {
@@ -401,17 +593,26 @@ void br_fdb_update(struct net_bridge *br, struct net_bridge_port *source,
 				       " own address as source address\n",
 				       source->dev->name);
 		} else {
-			/* fastpath: update of existing entry */
-			fdb->dst = source;
-			fdb->ageing_timer = jiffies;
+			/*
+			 * fastpath: update of existing entry. Every CPU that
+			 * receives from this host gets here, so only write the
+			 * shared entry when something actually changed.
+			 */
+			if (unlikely(fdb->dst != source))
+				fdb->dst = source;
+			if (fdb->ageing_timer != jiffies)
+				fdb->ageing_timer = jiffies;
 		}
 	} else {
-		spin_lock(&br->hash_lock);
+		spinlock_t *lock = fdb_bucket_lock(br, hash);
+
+		spin_lock(lock);
+		head = fdb_bucket(br->fdb_table, hash);
 		if (!fdb_find(head, addr))
-			fdb_create(head, source, addr, 0);
+			fdb_create(br, head, source, addr, 0);
 		/* else  we lose race and someone else inserts
 		 * it first, don't bother updating
 		 */
-		spin_unlock(&br->hash_lock);
+		spin_unlock(lock);
 	}
 }
@@ -163,6 +163,7 @@ static void del_br(struct net_bridge *br)
 	}
 
 	del_timer_sync(&br->gc_timer);
+	cancel_work_sync(&br->fdb_resize_work);
 
 	br_sysfs_delbr(br->dev);
 	unregister_netdevice(br->dev);
@@ -185,7 +186,10 @@ static struct net_device *new_bridge_dev(struct net *net, const char *name)
 
 	spin_lock_init(&br->lock);
 	INIT_LIST_HEAD(&br->port_list);
-	spin_lock_init(&br->hash_lock);
+	if (br_fdb_table_init(br)) {
+		free_netdev(dev);
+		return NULL;
+	}
 
 	br->bridge_id.prio[0] = 0x80;
 	br->bridge_id.prio[1] = 0x00;
@@ -291,6 +295,7 @@ int br_add_bridge(struct net *net, const char *name)
 	return ret;
 
 out_free:
+	br_fdb_table_free(netdev_priv(dev));
 	free_netdev(dev);
 	goto out;
 }
@@ -19,6 +19,11 @@
 
 #define BR_HASH_BITS 8
 #define BR_HASH_SIZE (1 << BR_HASH_BITS)
+#define BR_HASH_MAX_BITS 14
+#define BR_HASH_MAX_SIZE (1 << BR_HASH_MAX_BITS)
+
+/* Number of bucket locks, must not be bigger than BR_HASH_SIZE */
+#define BR_HASH_LOCKS 32
 
 #define BR_HOLD_TIME (1*HZ)
 
@@ -58,6 +63,12 @@ struct net_bridge_fdb_entry
 	unsigned char			is_static;
 };
 
+struct net_bridge_fdb_table
+{
+	unsigned int			size;
+	struct hlist_head		buckets[0];
+};
+
 struct net_bridge_port
 {
 	struct net_bridge		*br;
@@ -89,8 +100,16 @@ struct net_bridge
 	spinlock_t			lock;
 	struct list_head		port_list;
 	struct net_device		*dev;
+	/*
+	 * hash_lock serializes the walks over the whole table and its
+	 * resizing, learning only takes the lock of the bucket.
+	 */
 	spinlock_t			hash_lock;
-	struct hlist_head		hash[BR_HASH_SIZE];
+	spinlock_t			hash_locks[BR_HASH_LOCKS];
+	struct net_bridge_fdb_table	*fdb_table;
+	seqcount_t			fdb_resize_seq;
+	atomic_t			fdb_count;
+	struct work_struct		fdb_resize_work;
 	struct list_head		age_list;
 	unsigned long			feature_mask;
 #ifdef CONFIG_BRIDGE_NETFILTER
@@ -146,6 +165,8 @@ extern int br_dev_xmit(struct sk_buff *skb, struct net_device *dev);
 /* br_fdb.c */
 extern int br_fdb_init(void);
 extern void br_fdb_fini(void);
+extern int br_fdb_table_init(struct net_bridge *br);
+extern void br_fdb_table_free(struct net_bridge *br);
 extern void br_fdb_flush(struct net_bridge *br);
 extern void br_fdb_changeaddr(struct net_bridge_port *p,
 			      const unsigned char *newaddr);
@@ -1452,9 +1452,10 @@ static int __skb_splice_bits(struct sk_buff *skb, unsigned int *offset,
  * Map data from the skb to a pipe. Should handle both the linear part,
  * the fragments, and the frag list. It does NOT handle frag lists within
  * the frag list, if such a thing exists. We'd probably need to recurse to
- * handle that cleanly.
+ * handle that cleanly. If @sk is not NULL, it is the socket whose lock is
+ * held by the caller, and it is dropped while the pipe is being filled.
  */
-int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
+int skb_splice_bits(struct sk_buff *skb, struct sock *sk, unsigned int offset,
 		    struct pipe_inode_info *pipe, unsigned int tlen,
 		    unsigned int flags)
 {
@@ -1491,9 +1492,11 @@ int skb_splice_bits(struct sk_buff *skb, unsigned int offset,
 
 done:
 	if (spd.nr_pages) {
-		struct sock *sk = skb->sk;
 		int ret;
 
+		if (!sk)
+			return splice_to_pipe(pipe, &spd);
+
 		/*
 		 * Drop the socket lock, otherwise we have reverse
 		 * locking dependencies between sk_lock and i_mutex
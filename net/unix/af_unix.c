@@ -114,6 +114,8 @@
 #include <linux/mount.h>
 #include <net/checksum.h>
 #include <linux/security.h>
+#include <linux/pipe_fs_i.h>
+#include <linux/splice.h>
 
 static struct hlist_head unix_socket_table[UNIX_HASH_SIZE + 1];
 static DEFINE_SPINLOCK(unix_table_lock);
@@ -172,6 +174,16 @@ static inline int unix_recvq_full(struct sock const *sk)
 	return skb_queue_len(&sk->sk_receive_queue) > sk->sk_max_ack_backlog;
 }
 
+/*
+ *	Stream sockets may read an skb in several steps: the bytes that were
+ *	already read are skipped rather than pulled, since the data can sit
+ *	in page fragments.
+ */
+static inline unsigned int unix_skb_len(const struct sk_buff *skb)
+{
+	return skb->len - UNIXCB(skb).consumed;
+}
+
 static struct sock *unix_peer_get(struct sock *s)
 {
 	struct sock *peer;
@@ -501,6 +513,11 @@ static int unix_dgram_connect(struct socket *, struct sockaddr *,
 			      int, int);
 static int unix_seqpacket_sendmsg(struct kiocb *, struct socket *,
 				  struct msghdr *, size_t);
+static ssize_t unix_stream_sendpage(struct socket *, struct page *,
+				    int, size_t, int);
+static ssize_t unix_stream_splice_read(struct socket *, loff_t *,
+				       struct pipe_inode_info *, size_t,
+				       unsigned int);
 
 static const struct proto_ops unix_stream_ops = {
 	.family =	PF_UNIX,
@@ -520,7 +537,8 @@ static const struct proto_ops unix_stream_ops = {
 	.sendmsg =	unix_stream_sendmsg,
 	.recvmsg =	unix_stream_recvmsg,
 	.mmap =		sock_no_mmap,
-	.sendpage =	sock_no_sendpage,
+	.sendpage =	unix_stream_sendpage,
+	.splice_read =	unix_stream_splice_read,
 };
 
 static const struct proto_ops unix_dgram_ops = {
@@ -1290,6 +1308,18 @@ static void unix_detach_fds(struct scm_cookie *scm, struct sk_buff *skb)
 		unix_notinflight(scm->fp->fp[i]);
 }
 
+static void unix_peek_fds(struct scm_cookie *scm, struct sk_buff *skb)
+{
+	int i;
+
+	scm->fp = scm_fp_dup(UNIXCB(skb).fp);
+	if (!scm->fp)
+		return;
+
+	for (i=scm->fp->count-1; i>=0; i--)
+		unix_peek_inflight(scm->fp->fp[i]);
+}
+
 static void unix_destruct_fds(struct sk_buff *skb)
 {
 	struct scm_cookie scm;
@@ -1480,6 +1510,11 @@ out:
 }
 
 
+/*
+ *	Largest amount of data put in the page fragments of a single skb.
+ */
+#define UNIX_SKB_FRAGS_SZ	(PAGE_SIZE << get_order(32768))
+
 static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 			       struct msghdr *msg, size_t len)
 {
@@ -1487,7 +1522,7 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 	struct sock *sk = sock->sk;
 	struct sock *other = NULL;
 	struct sockaddr_un *sunaddr=msg->msg_name;
-	int err,size;
+	int err,size,data_len;
 	struct sk_buff *skb;
 	int sent=0;
 	struct scm_cookie tmp_scm;
@@ -1530,27 +1565,26 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 		if (size > ((sk->sk_sndbuf >> 1) - 64))
 			size = (sk->sk_sndbuf >> 1) - 64;
 
-		if (size > SKB_MAX_ALLOC)
-			size = SKB_MAX_ALLOC;
+		/*
+		 *	Large writes go into order-0 page fragments, and only
+		 *	what fits in a single page stays in the linear part.
+		 *	This avoids high order allocations, and lets the
+		 *	receiver splice the fragments without copying them.
+		 */
+		size = min_t(int, size, SKB_MAX_HEAD(0) + UNIX_SKB_FRAGS_SZ);
+		data_len = max_t(int, 0, size - SKB_MAX_HEAD(0));
+		data_len = min_t(int, size, PAGE_ALIGN(data_len));
 
 		/*
 		 *	Grab a buffer
 		 */
 
-		skb=sock_alloc_send_skb(sk,size,msg->msg_flags&MSG_DONTWAIT, &err);
+		skb = sock_alloc_send_pskb(sk, size - data_len, data_len,
+					   msg->msg_flags & MSG_DONTWAIT, &err);
 
 		if (skb==NULL)
 			goto out_err;
 
-		/*
-		 *	If you pass two values to the sock_alloc_send_skb
-		 *	it tries to grab the large buffer with GFP_NOFS
-		 *	(which can fail easily), and if it fails grab the
-		 *	fallback size buffer which is under a page and will
-		 *	succeed. [Alan]
-		 */
-		size = min_t(int, size, skb_tailroom(skb));
-
 		memcpy(UNIXCREDS(skb), &siocb->scm->creds, sizeof(struct ucred));
 		if (siocb->scm->fp) {
 			err = unix_attach_fds(siocb->scm, skb);
@@ -1560,7 +1594,11 @@ static int unix_stream_sendmsg(struct kiocb *kiocb, struct socket *sock,
 			}
 		}
 
-		if ((err = memcpy_fromiovec(skb_put(skb,size), msg->msg_iov, size)) != 0) {
+		skb_put(skb, size - data_len);
+		skb->data_len = data_len;
+		skb->len = size;
+		err = skb_copy_datagram_from_iovec(skb, 0, msg->msg_iov, size);
+		if (err) {
 			kfree_skb(skb);
 			goto out_err;
 		}
@@ -1595,6 +1633,75 @@ out_err:
 	return sent ? : err;
 }
 
+/*
+ *	Queue a page to the peer by reference, without copying it. This is
+ *	what splice() and sendfile() use to move page cache or vmsplice()d
+ *	pages into a stream socket.
+ */
+static ssize_t unix_stream_sendpage(struct socket *sock, struct page *page,
+				    int offset, size_t size, int flags)
+{
+	struct sock *sk = sock->sk;
+	struct sock *other;
+	struct sk_buff *skb;
+	struct scm_cookie scm;
+	struct msghdr msg = { .msg_controllen = 0 };
+	int err;
+
+	if (flags & MSG_OOB)
+		return -EOPNOTSUPP;
+
+	other = unix_peer(sk);
+	if (!other || sk->sk_state != TCP_ESTABLISHED)
+		return -ENOTCONN;
+
+	err = -EPIPE;
+	if (sk->sk_shutdown & SEND_SHUTDOWN)
+		goto pipe_err;
+
+	/* Only fills in the credentials of the sender, there is no cmsg */
+	err = scm_send(sock, &msg, &scm);
+	if (err < 0)
+		return err;
+
+	skb = sock_alloc_send_skb(sk, 0, flags & MSG_DONTWAIT, &err);
+	if (skb == NULL)
+		goto out_err;
+
+	memcpy(UNIXCREDS(skb), &scm.creds, sizeof(struct ucred));
+
+	get_page(page);
+	skb_fill_page_desc(skb, 0, page, offset, size);
+	skb->len += size;
+	skb->data_len += size;
+	skb->truesize += size;
+	atomic_add(size, &sk->sk_wmem_alloc);
+
+	unix_state_lock(other);
+
+	if (sock_flag(other, SOCK_DEAD) ||
+	    (other->sk_shutdown & RCV_SHUTDOWN)) {
+		unix_state_unlock(other);
+		kfree_skb(skb);
+		err = -EPIPE;
+		goto pipe_err;
+	}
+
+	skb_queue_tail(&other->sk_receive_queue, skb);
+	unix_state_unlock(other);
+	other->sk_data_ready(other, size);
+	scm_destroy(&scm);
+
+	return size;
+
+pipe_err:
+	if (!(flags & MSG_NOSIGNAL))
+		send_sig(SIGPIPE, current, 0);
+out_err:
+	scm_destroy(&scm);
+	return err;
+}
+
 static int unix_seqpacket_sendmsg(struct kiocb *kiocb, struct socket *sock,
 				  struct msghdr *msg, size_t len)
 {
@@ -1697,7 +1804,7 @@ static int unix_dgram_recvmsg(struct kiocb *iocb, struct socket *sock,
 
 		*/
 		if (UNIXCB(skb).fp)
-			siocb->scm->fp = scm_fp_dup(UNIXCB(skb).fp);
+			unix_peek_fds(siocb->scm, skb);
 	}
 	err = size;
 
@@ -1844,8 +1951,9 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 			sunaddr = NULL;
 		}
 
-		chunk = min_t(unsigned int, skb->len, size);
-		if (memcpy_toiovec(msg->msg_iov, skb->data, chunk)) {
+		chunk = min_t(unsigned int, unix_skb_len(skb), size);
+		if (skb_copy_datagram_iovec(skb, UNIXCB(skb).consumed,
+					    msg->msg_iov, chunk)) {
 			skb_queue_head(&sk->sk_receive_queue, skb);
 			if (copied == 0)
 				copied = -EFAULT;
@@ -1857,13 +1965,13 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 		/* Mark read part of skb as used */
 		if (!(flags & MSG_PEEK))
 		{
-			skb_pull(skb, chunk);
+			UNIXCB(skb).consumed += chunk;
 
 			if (UNIXCB(skb).fp)
 				unix_detach_fds(siocb->scm, skb);
 
 			/* put the skb back if we didn't use it up.. */
-			if (skb->len)
+			if (unix_skb_len(skb))
 			{
 				skb_queue_head(&sk->sk_receive_queue, skb);
 				break;
@@ -1879,7 +1987,7 @@ static int unix_stream_recvmsg(struct kiocb *iocb, struct socket *sock,
 			/* It is questionable, see note in unix_dgram_recvmsg.
 			 */
 			if (UNIXCB(skb).fp)
-				siocb->scm->fp = scm_fp_dup(UNIXCB(skb).fp);
+				unix_peek_fds(siocb->scm, skb);
 
 			/* put message back and return */
 			skb_queue_head(&sk->sk_receive_queue, skb);
@@ -1893,6 +2001,106 @@ out:
 	return copied ? : err;
 }
 
+/*
+ *	Move data from the receive queue to a pipe. The page fragments are
+ *	passed by reference, only the linear part of each skb gets copied.
+ */
+static ssize_t unix_stream_splice_read(struct socket *sock, loff_t *ppos,
+				       struct pipe_inode_info *pipe,
+				       size_t len, unsigned int flags)
+{
+	struct sock *sk = sock->sk;
+	struct unix_sock *u = unix_sk(sk);
+	struct scm_cookie scm;
+	struct sk_buff *skb;
+	unsigned int chunk;
+	ssize_t spliced = 0;
+	long timeo;
+	int ret, err = 0;
+
+	if (unlikely(*ppos))
+		return -ESPIPE;
+
+	if (sk->sk_state != TCP_ESTABLISHED)
+		return -EINVAL;
+
+	timeo = sock_rcvtimeo(sk, (sock->file->f_flags & O_NONBLOCK) ||
+				  (flags & SPLICE_F_NONBLOCK));
+
+	memset(&scm, 0, sizeof(scm));
+
+	mutex_lock(&u->readlock);
+
+	while (len) {
+		unix_state_lock(sk);
+		skb = skb_dequeue(&sk->sk_receive_queue);
+		if (skb == NULL) {
+			if (spliced)
+				goto unlock;
+
+			err = sock_error(sk);
+			if (err)
+				goto unlock;
+			if (sk->sk_shutdown & RCV_SHUTDOWN)
+				goto unlock;
+
+			unix_state_unlock(sk);
+			err = -EAGAIN;
+			if (!timeo)
+				break;
+			mutex_unlock(&u->readlock);
+
+			timeo = unix_stream_data_wait(sk, timeo);
+
+			if (signal_pending(current)) {
+				err = sock_intr_errno(timeo);
+				goto out;
+			}
+			mutex_lock(&u->readlock);
+			continue;
+ unlock:
+			unix_state_unlock(sk);
+			break;
+		}
+		unix_state_unlock(sk);
+
+		/*
+		 * A pipe cannot carry file descriptors: they are dropped,
+		 * just like a read() that does not ask for SCM_RIGHTS.
+		 */
+		if (UNIXCB(skb).fp) {
+			unix_detach_fds(&scm, skb);
+			scm_destroy(&scm);
+		}
+
+		chunk = min_t(unsigned int, unix_skb_len(skb), len);
+		ret = skb_splice_bits(skb, NULL, UNIXCB(skb).consumed, pipe,
+				      chunk, flags);
+		if (ret <= 0) {
+			skb_queue_head(&sk->sk_receive_queue, skb);
+			if (!spliced)
+				err = ret;
+			break;
+		}
+
+		UNIXCB(skb).consumed += ret;
+		spliced += ret;
+		len -= ret;
+
+		/* put the skb back if we didn't use it up.. */
+		if (unix_skb_len(skb)) {
+			skb_queue_head(&sk->sk_receive_queue, skb);
+			break;
+		}
+
+		kfree_skb(skb);
+	}
+
+	mutex_unlock(&u->readlock);
+out:
+	return spliced ? : err;
+}
+
 static int unix_shutdown(struct socket *sock, int mode)
 {
 	struct sock *sk = sock->sk;
@@ -1960,7 +2168,7 @@ static int unix_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 			if (sk->sk_type == SOCK_STREAM ||
 			    sk->sk_type == SOCK_SEQPACKET) {
 				skb_queue_walk(&sk->sk_receive_queue, skb)
-					amount += skb->len;
+					amount += unix_skb_len(skb);
 			} else {
 				skb = skb_peek(&sk->sk_receive_queue);
 				if (skb)
@@ -2268,6 +2476,7 @@ out:
 
 static void __exit af_unix_exit(void)
 {
+	unix_gc_flush();
 	sock_unregister(PF_UNIX);
 	proto_unregister(&unix_proto);
 	unregister_pernet_subsys(&unix_net_ops);
@@ -66,6 +66,17 @@
  *		Reimplement with a cycle collecting algorithm. This should
  *		solve several problems with the previous code, like being racy
  *		wrt receive and holding up unrelated socket operations.
+ *
+ *		Run the collector from a work item, so that the releasing
+ *		task does not pay for it, and several triggers coalesce into
+ *		a single pass. Senders only wait for it when the number of
+ *		in-flight sockets gets insane.
+ *
+ *		The collector counts on a copy of the in-flight counts and
+ *		takes unix_gc_lock only in short stretches, so that passing
+ *		descriptors does not wait for a whole pass.  A pass whose
+ *		candidates were sent, received or peeked at meanwhile is
+ *		thrown away and rerun.
  */
 
 #include <linux/kernel.h>
@@ -81,6 +92,7 @@
 #include <linux/proc_fs.h>
 #include <linux/mutex.h>
 #include <linux/wait.h>
+#include <linux/workqueue.h>
 
 #include <net/sock.h>
 #include <net/af_unix.h>
@@ -92,10 +104,22 @@
 static LIST_HEAD(gc_inflight_list);
 static LIST_HEAD(gc_candidates);
 static DEFINE_SPINLOCK(unix_gc_lock);
-static DECLARE_WAIT_QUEUE_HEAD(unix_gc_wait);
 
 unsigned int unix_tot_inflight;
 
+/* A pass is running, and whether its candidates were touched since */
+static bool gc_in_progress = false;
+static bool gc_dirty;
+
+/* Sockets handled between two breaks of unix_gc_lock */
+#define UNIX_GC_BATCH 64
+
+/* Above this many in-flight sockets, senders wait for the collector */
+#define UNIX_INFLIGHT_TRIGGER_GC 16000
+
+static void __unix_gc(struct work_struct *work);
+static DECLARE_WORK(unix_gc_work, __unix_gc);
+
 
 static struct sock *unix_get_socket(struct file *filp)
 {
@@ -121,6 +145,10 @@ static struct sock *unix_get_socket(struct file *filp)
 /*
  *	Keep the number of times in flight count for the file
  *	descriptor if it is for an AF_UNIX socket.
+ *
+ *	The collector owns the list link of its candidates while it
+ *	runs, so those are left where they are, and it is told that its
+ *	counts for them are stale.
  */
 
 void unix_inflight(struct file *fp)
@@ -129,7 +157,10 @@ void unix_inflight(struct file *fp)
 	if(s) {
 		struct unix_sock *u = unix_sk(s);
 		spin_lock(&unix_gc_lock);
-		if (atomic_long_inc_return(&u->inflight) == 1) {
+		if (u->gc_candidate) {
+			gc_dirty = true;
+			atomic_long_inc(&u->inflight);
+		} else if (atomic_long_inc_return(&u->inflight) == 1) {
 			BUG_ON(!list_empty(&u->link));
 			list_add_tail(&u->link, &gc_inflight_list);
 		} else {
@@ -147,13 +178,35 @@ void unix_notinflight(struct file *fp)
 		struct unix_sock *u = unix_sk(s);
 		spin_lock(&unix_gc_lock);
 		BUG_ON(list_empty(&u->link));
-		if (atomic_long_dec_and_test(&u->inflight))
+		if (u->gc_candidate) {
+			gc_dirty = true;
+			atomic_long_dec(&u->inflight);
+		} else if (atomic_long_dec_and_test(&u->inflight))
 			list_del_init(&u->link);
 		unix_tot_inflight--;
 		spin_unlock(&unix_gc_lock);
 	}
 }
 
+/*
+ *	MSG_PEEK has duplicated a descriptor of a queued message.  That is
+ *	an external reference which did not go through unix_notinflight(),
+ *	so a running pass has to hear about it as well.
+ */
+void unix_peek_inflight(struct file *fp)
+{
+	struct sock *s = unix_get_socket(fp);
+
+	/* Pairs with the barrier in __unix_gc() */
+	smp_mb();
+	if (s && gc_in_progress) {
+		spin_lock(&unix_gc_lock);
+		if (unix_sk(s)->gc_candidate)
+			gc_dirty = true;
+		spin_unlock(&unix_gc_lock);
+	}
+}
+
 static inline struct sk_buff *sock_queue_head(struct sock *sk)
 {
 	return (struct sk_buff *) &sk->sk_receive_queue;
@@ -248,17 +301,17 @@ static void scan_children(struct sock *x, void (*func)(struct unix_sock *),
 
 static void dec_inflight(struct unix_sock *usk)
 {
-	atomic_long_dec(&usk->inflight);
+	usk->gc_refs--;
 }
 
 static void inc_inflight(struct unix_sock *usk)
 {
-	atomic_long_inc(&usk->inflight);
+	usk->gc_refs++;
 }
 
 static void inc_inflight_move_tail(struct unix_sock *u)
 {
-	atomic_long_inc(&u->inflight);
+	u->gc_refs++;
 	/*
 	 * If this still might be part of a cycle, move it to the end
 	 * of the list, so that it's checked even if it was already
@@ -268,49 +321,114 @@ static void inc_inflight_move_tail(struct unix_sock *u)
 		list_move_tail(&u->link, &gc_candidates);
 }
 
-static bool gc_in_progress = false;
-
+/*
+ *	Called by senders of file descriptors. Only when the number of
+ *	in-flight sockets is insane do we force a collection and wait for
+ *	it to complete, otherwise senders do not wait for it.
+ */
 void wait_for_unix_gc(void)
 {
-	wait_event(unix_gc_wait, gc_in_progress == false);
+	if (unix_tot_inflight > UNIX_INFLIGHT_TRIGGER_GC) {
+		unix_gc();
+		flush_work(&unix_gc_work);
+	}
 }
 
-/* The external entry point: unix_gc() */
+/*
+ *	The external entry point: unix_gc(). The collection runs from a work
+ *	item, and triggers that arrive while it is pending are merged.
+ */
 void unix_gc(void)
+{
+	schedule_work(&unix_gc_work);
+}
+
+/*
+ *	Flush a pending collection, before the module goes away.
+ */
+void unix_gc_flush(void)
+{
+	flush_work(&unix_gc_work);
+}
+
+/*
+ *	Hand candidates back to the inflight list, or take them off it if
+ *	they were received meanwhile.  Called with unix_gc_lock held, which
+ *	is dropped every UNIX_GC_BATCH sockets.
+ */
+static void release_candidates(struct list_head *list)
+{
+	struct unix_sock *u;
+	int batch = UNIX_GC_BATCH;
+
+	while (!list_empty(list)) {
+		u = list_entry(list->next, struct unix_sock, link);
+		u->gc_candidate = 0;
+		if (atomic_long_read(&u->inflight))
+			list_move_tail(&u->link, &gc_inflight_list);
+		else
+			list_del_init(&u->link);
+
+		if (!--batch) {
+			spin_unlock(&unix_gc_lock);
+			cond_resched();
+			spin_lock(&unix_gc_lock);
+			batch = UNIX_GC_BATCH;
+		}
+	}
+}
+
+static void __unix_gc(struct work_struct *work)
 {
 	struct unix_sock *u;
-	struct unix_sock *next;
 	struct sk_buff_head hitlist;
 	struct list_head cursor;
 	LIST_HEAD(not_cycle_list);
+	int batch = UNIX_GC_BATCH;
 
 	spin_lock(&unix_gc_lock);
 
-	/* Avoid a recursive GC. */
-	if (gc_in_progress)
-		goto out;
+	/*
+	 * Avoid concurrent passes: a work item that is requeued while
+	 * running may run on another CPU at the same time.
+	 */
+	if (gc_in_progress) {
+		spin_unlock(&unix_gc_lock);
+		return;
+	}
 
 	gc_in_progress = true;
+	gc_dirty = false;
+	/* Pairs with the barrier in unix_peek_inflight() */
+	smp_mb();
+
 	/*
 	 * First, select candidates for garbage collection.  Only
 	 * in-flight sockets are considered, and from those only ones
 	 * which don't have any external reference.
 	 *
-	 * Holding unix_gc_lock will protect these candidates from
-	 * being detached, and hence from gaining an external
-	 * reference.  Since there are no possible receivers, all
-	 * buffers currently on the candidates' queues stay there
-	 * during the garbage collection.
+	 * A candidate can only gain an external reference by a message
+	 * carrying it being received or peeked at, and we hear about
+	 * both through gc_dirty.  Until then no descriptor of it can be
+	 * sent either, so the references counted below stay as they
+	 * are, and they are counted in gc_refs without unix_gc_lock.
 	 *
-	 * We also know that no new candidate can be added onto the
-	 * receive queues.  Other, non candidate sockets _can_ be
-	 * added to queue, so we must make sure only to touch
-	 * candidates.
+	 * Other, non candidate sockets _can_ be added to the queues,
+	 * so we must make sure only to touch candidates.
+	 *
+	 * Closing the last external descriptor of an in-flight socket
+	 * never reaches us, so every in-flight socket has to be looked
+	 * at, not just those whose count changed.  Use a "cursor" link,
+	 * so that unix_gc_lock can be dropped every now and then.
 	 */
-	list_for_each_entry_safe(u, next, &gc_inflight_list, link) {
+	list_add(&cursor, &gc_inflight_list);
+	while (cursor.next != &gc_inflight_list) {
 		long total_refs;
 		long inflight_refs;
 
+		u = list_entry(cursor.next, struct unix_sock, link);
+		list_move(&cursor, &u->link);
+
 		total_refs = file_count(u->sk.sk_socket->file);
 		inflight_refs = atomic_long_read(&u->inflight);
 
@@ -320,8 +438,18 @@ void unix_gc(void)
 			list_move_tail(&u->link, &gc_candidates);
 			u->gc_candidate = 1;
 			u->gc_maybe_cycle = 1;
+			u->gc_refs = inflight_refs;
+		}
+
+		if (!--batch) {
+			spin_unlock(&unix_gc_lock);
+			cond_resched();
+			spin_lock(&unix_gc_lock);
+			batch = UNIX_GC_BATCH;
 		}
 	}
+	list_del(&cursor);
+	spin_unlock(&unix_gc_lock);
 
 	/*
 	 * Now remove all internal in-flight reference to children of
@@ -345,7 +473,7 @@ void unix_gc(void)
 		/* Move cursor to after the current position. */
 		list_move(&cursor, &u->link);
 
-		if (atomic_long_read(&u->inflight) > 0) {
+		if (u->gc_refs > 0) {
 			list_move_tail(&u->link, &not_cycle_list);
 			u->gc_maybe_cycle = 0;
 			scan_children(&u->sk, inc_inflight_move_tail, NULL);
@@ -357,33 +485,35 @@ void unix_gc(void)
 	 * not_cycle_list contains those sockets which do not make up a
 	 * cycle.  Restore these to the inflight list.
 	 */
-	while (!list_empty(&not_cycle_list)) {
-		u = list_entry(not_cycle_list.next, struct unix_sock, link);
-		u->gc_candidate = 0;
-		list_move_tail(&u->link, &gc_inflight_list);
+	spin_lock(&unix_gc_lock);
+	release_candidates(&not_cycle_list);
+
+	/*
+	 * If a candidate was touched, what is left may not be garbage.
+	 * Give up and have another go.
+	 */
+	if (gc_dirty) {
+		release_candidates(&gc_candidates);
+		gc_in_progress = false;
+		spin_unlock(&unix_gc_lock);
+		unix_gc();
+		return;
 	}
 
 	/*
-	 * Now gc_candidates contains only garbage.  Restore original
-	 * inflight counters for these as well, and remove the skbuffs
-	 * which are creating the cycle(s).
+	 * Now gc_candidates contains only garbage.  Remove the skbuffs
+	 * which are creating the cycle(s), still holding unix_gc_lock,
+	 * so that none of it can be touched before they are off the
+	 * queues.  Then the garbage is detached as any other socket.
 	 */
 	skb_queue_head_init(&hitlist);
 	list_for_each_entry(u, &gc_candidates, link)
 		scan_children(&u->sk, inc_inflight, &hitlist);
 
+	release_candidates(&gc_candidates);
+	gc_in_progress = false;
 	spin_unlock(&unix_gc_lock);
 
 	/* Here we are. Hitlist is filled. Die. */
 	__skb_queue_purge(&hitlist);
-
-	spin_lock(&unix_gc_lock);
-
-	/* All candidates should have been detached by now. */
-	BUG_ON(!list_empty(&gc_candidates));
-	gc_in_progress = false;
-	wake_up(&unix_gc_wait);
-
- out:
-	spin_unlock(&unix_gc_lock);
 }